@@ -0,0 +1,95 @@
+#include "BootSequencer.hpp"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include <cstdio>
+
+static const char* TAG = "BOOT_SEQ";
+
+BootSequencer::Record BootSequencer::_records[BootSequencer::MAX_STAGES] = {};
+size_t BootSequencer::_count = 0;
+int64_t BootSequencer::_total_us = 0;
+
+struct BootSequencer::StageCtx {
+    const BootStage* stage;
+    Record* record;
+    EventGroupHandle_t done;
+    uint32_t bit;
+};
+
+void BootSequencer::stage_task(void* pv) {
+    StageCtx* ctx = static_cast<StageCtx*>(pv);
+    if (ctx->stage->deps) {
+        xEventGroupWaitBits(ctx->done, ctx->stage->deps, pdFALSE, pdTRUE, portMAX_DELAY);
+    }
+
+    ctx->record->start_us = esp_timer_get_time();
+    ctx->stage->run();
+    ctx->record->end_us = esp_timer_get_time();
+
+    ESP_LOGI(TAG, "Etapa '%s': %lld ms (t=%lld ms)", ctx->stage->name,
+             (ctx->record->end_us - ctx->record->start_us) / 1000, ctx->record->end_us / 1000);
+
+    xEventGroupSetBits(ctx->done, ctx->bit);
+    vTaskDelete(NULL);
+}
+
+bool BootSequencer::run(const BootStage* stages, size_t count, TickType_t timeout) {
+    if (count == 0 || count > MAX_STAGES) return false;
+
+    EventGroupHandle_t done = xEventGroupCreate();
+    static StageCtx ctx[MAX_STAGES];
+    uint32_t all = 0;
+    _count = count;
+
+    for (size_t i = 0; i < count; i++) {
+        _records[i] = { stages[i].name, 0, 0 };
+        ctx[i] = { &stages[i], &_records[i], done, BOOT_STAGE(i) };
+        all |= BOOT_STAGE(i);
+    }
+    // Todas las tareas se crean de una vez; cada una espera sus dependencias
+    for (size_t i = 0; i < count; i++) {
+        if (xTaskCreate(stage_task, stages[i].name, 6144, &ctx[i], stages[i].priority, NULL) != pdPASS) {
+            ESP_LOGE(TAG, "No se pudo crear la etapa '%s'", stages[i].name);
+            return false;
+        }
+    }
+
+    EventBits_t bits = xEventGroupWaitBits(done, all, pdFALSE, pdTRUE, timeout);
+    _total_us = esp_timer_get_time();
+
+    if ((bits & all) != all) {
+        for (size_t i = 0; i < count; i++) {
+            if (!(bits & BOOT_STAGE(i))) ESP_LOGE(TAG, "Etapa '%s' no terminó a tiempo", stages[i].name);
+        }
+        return false;
+    }
+    // Las tareas ya terminaron: el grupo de eventos se puede liberar
+    vEventGroupDelete(done);
+    ESP_LOGI(TAG, "Arranque completo en %lld ms", _total_us / 1000);
+    return true;
+}
+
+uint32_t BootSequencer::total_ms() {
+    return (uint32_t)(_total_us / 1000);
+}
+
+std::string BootSequencer::summary() {
+    std::string out;
+    char buf[40];
+    for (size_t i = 0; i < _count; i++) {
+        snprintf(buf, sizeof(buf), "%s%s:%lld", i ? " " : "", _records[i].name,
+                 (_records[i].end_us - _records[i].start_us) / 1000);
+        out += buf;
+    }
+    return out;
+}
+
+void BootSequencer::metrics(TextBuffer& out) {
+    for (size_t i = 0; i < _count; i++) {
+        out.appendf("boot_stage_start_ms{stage=\"%s\"} %lld\n", _records[i].name, (long long)(_records[i].start_us / 1000));
+        out.appendf("boot_stage_end_ms{stage=\"%s\"} %lld\n", _records[i].name, (long long)(_records[i].end_us / 1000));
+    }
+    out.appendf("boot_total_ms %u\n", (unsigned)total_ms());
+}
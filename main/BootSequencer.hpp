@@ -0,0 +1,47 @@
+#pragma once
+#include <string>
+#include "TextBuffer.hpp"
+#include <stdint.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+
+#define BOOT_STAGE(i) (1u << (i))
+
+// Etapa de arranque: corre en su propia tarea cuando sus dependencias terminaron
+struct BootStage {
+    const char* name;
+    void (*run)();
+    uint32_t deps;          // Máscara BOOT_STAGE(n) de etapas previas
+    UBaseType_t priority;   // Las etapas críticas (relés) van con más prioridad
+};
+
+/**
+ * @brief Orquestador de arranque con grafo de dependencias.
+ *
+ * Las etapas independientes (p. ej. montar la SD y asociar el WiFi) corren en
+ * paralelo. Cada etapa registra su inicio/fin relativo al arranque para el log
+ * y para /metrics.
+ */
+class BootSequencer {
+public:
+    static constexpr size_t MAX_STAGES = 16;
+
+    static bool run(const BootStage* stages, size_t count, TickType_t timeout);
+    static uint32_t total_ms();
+    static std::string summary();   // "i2c:12 relays:3 ..." para el log
+    static void metrics(TextBuffer& out);   // Líneas "clave valor" para /metrics
+
+private:
+    struct Record {
+        const char* name;
+        int64_t start_us;
+        int64_t end_us;
+    };
+    struct StageCtx;
+
+    static Record _records[MAX_STAGES];
+    static size_t _count;
+    static int64_t _total_us;
+
+    static void stage_task(void* pv);
+};
@@ -0,0 +1,312 @@
+#include "ChargeControl.hpp"
+#include "SessionJournal.hpp"
+#include "Metering.hpp"
+#include "Protection.hpp"
+#include "LoggerFS.hpp"
+#include "mcp23017.hpp"
+#include "OtaPipeline.hpp"
+#include "HttpWorkers.hpp"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+#include <cstdio>
+#include <algorithm>
+#include <time.h>
+
+static const char* TAG = "CHARGE_CTL";
+
+extern MCP23017* g_mcp_1;
+extern LoggerFS g_logger;
+
+// Estado de los 4 puntos de carga para motos
+ChargePoint ChargeControl::_points[NUM_POINTS] = {
+    {0, 0, false, false, 0, 0, 0}, // Relay CH1
+    {1, 0, false, false, 0, 0, 0}, // Relay CH2
+    {2, 0, false, false, 0, 0, 0}, // Relay CH3
+    {3, 0, false, false, 0, 0, 0}  // Relay CH4
+};
+std::mutex ChargeControl::_mutex;
+uint8_t ChargeControl::_pending_resume_log = 0;
+PowerScheduler ChargeControl::_sched(ChargeControl::NUM_POINTS);
+uint32_t ChargeControl::_default_demand_ma = 10000;
+LatencyHistogram ChargeControl::_tick_jitter;
+LatencyHistogram ChargeControl::_tick_jitter_loaded;
+int64_t ChargeControl::_last_tick_us = 0;
+
+static uint32_t now_epoch() {
+    time_t now;
+    time(&now);
+    struct tm timeinfo;
+    localtime_r(&now, &timeinfo);
+    // Sin NTP el reloj arranca en 1970: no sirve como referencia absoluta
+    return (timeinfo.tm_year < (2024 - 1900)) ? 0 : (uint32_t)now;
+}
+
+const char* ChargeControl::point_tag(int point) {
+    static constexpr const char* TAGS[NUM_POINTS] = {"CH1", "CH2", "CH3", "CH4"};
+    return (point >= 0 && point < NUM_POINTS) ? TAGS[point] : "CH?";
+}
+
+void ChargeControl::set_relay(int point, bool on) {
+    if (!g_mcp_1 || !g_mcp_1->digital_write(_points[point].relay_pin, on)) {
+        ESP_LOGE(TAG, "Fallo I2C al conmutar relé CH%d", point + 1);
+        g_logger.diferirf(RectEvent::ERR_I2C, point_tag(point), "Fallo al conmutar relé");
+    }
+}
+
+void ChargeControl::journal(int point, uint8_t type) {
+    const ChargePoint& cp = _points[point];
+    SessionJournal::Entry e = {};
+    e.type = (SessionJournal::Type)type;
+    e.point = point;
+    e.start_time = cp.start_time;
+    // Con tope de sitio el fin depende de las esperas: no hay plazo absoluto
+    e.deadline = (cp.start_time && _sched.cap_ma() == 0) ? cp.start_time + cp.duration_s : 0;
+    e.duration_s = cp.duration_s;
+    e.seconds_left = cp.seconds_left;
+    e.energy_mwh = cp.energy_mwh;
+    SessionJournal::append(e);
+}
+
+void ChargeControl::load_scheduler() {
+    uint32_t cap = 0;
+    uint8_t policy = 0;
+    uint16_t slice = 60;
+    nvs_handle_t handle;
+    if (nvs_open("sched", NVS_READONLY, &handle) == ESP_OK) {
+        nvs_get_u32(handle, "cap_ma", &cap);
+        nvs_get_u8(handle, "policy", &policy);
+        nvs_get_u16(handle, "slice_s", &slice);
+        nvs_get_u32(handle, "def_ma", &_default_demand_ma);
+        nvs_close(handle);
+    }
+    // Franjas largas: los relés son mecánicos
+    _sched.configure(cap, (PowerScheduler::Policy)policy, slice);
+}
+
+// Lleva los relés al reparto vigente; solo conmuta los que cambian
+void ChargeControl::apply_allocation() {
+    for (int i = 0; i < NUM_POINTS; i++) {
+        ChargePoint& cp = _points[i];
+        bool want = cp.active && _sched.is_conducting(i);
+        if (want == cp.conducting) continue;
+        cp.conducting = want;
+        set_relay(i, want);
+        ESP_LOGI(TAG, "CH%d: %s", i + 1, want ? "conduce" : "en espera (tope de sitio)");
+    }
+}
+
+void ChargeControl::begin() {
+    SessionJournal::Entry latest[SessionJournal::MAX_POINTS];
+    SessionJournal::begin(latest);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    load_scheduler();
+    uint32_t now = now_epoch();
+
+    for (int i = 0; i < NUM_POINTS; i++) {
+        const SessionJournal::Entry& e = latest[i];
+        if (e.type == SessionJournal::Type::NONE || e.type == SessionJournal::Type::STOP) continue;
+
+        ChargePoint& cp = _points[i];
+        cp.duration_s = e.duration_s;
+        cp.start_time = e.start_time;
+        cp.energy_mwh = e.energy_mwh;
+        cp.seconds_left = e.seconds_left;
+
+        // Con reloj válido y plazo conocido, el tiempo del corte cuenta; si no, se devuelve
+        if (now && e.deadline) {
+            cp.seconds_left = (now >= e.deadline) ? 0 : std::min(e.seconds_left, e.deadline - now);
+        }
+
+        if (cp.seconds_left == 0) {
+            // Venció durante el corte: se cierra limpiamente
+            journal(i, (uint8_t)SessionJournal::Type::STOP);
+            ESP_LOGI(TAG, "CH%d: sesión vencida durante el corte, cerrada", i + 1);
+            continue;
+        }
+
+        cp.active = true;
+        Metering::session_begin(i, cp.energy_mwh); // Continúa sumando sobre lo ya entregado
+        _sched.request(i, _default_demand_ma, cp.seconds_left);
+        _pending_resume_log |= (1u << i);
+        ESP_LOGI(TAG, "CH%d: sesión reanudada, quedan %u s", i + 1, (unsigned)cp.seconds_left);
+    }
+    apply_allocation();
+}
+
+bool ChargeControl::start(int point, uint32_t minutes) {
+    if (point < 0 || point >= NUM_POINTS || minutes == 0) return false;
+    if (Protection::is_latched(point)) return false; // Falla enclavada: requiere fault.clear
+    std::lock_guard<std::mutex> lock(_mutex);
+    // Bajo _mutex: la subida marca su bandera antes de consultar any_active()
+    if (OtaPipeline::upload_running()) {
+        ESP_LOGW(TAG, "CH%d: subida de firmware en curso, sesión rechazada", point + 1);
+        return false;
+    }
+
+    ChargePoint& cp = _points[point];
+    cp.duration_s = minutes * 60;
+    cp.seconds_left = cp.duration_s;
+    cp.start_time = now_epoch();
+    cp.energy_mwh = 0;
+    cp.active = true;
+    Metering::session_begin(point, 0);
+
+    // Primero el diario: si se corta justo después de energizar, la sesión existe
+    journal(point, (uint8_t)SessionJournal::Type::START);
+    _sched.request(point, _default_demand_ma, cp.seconds_left);
+    apply_allocation();
+
+    g_logger.diferirf(RectEvent::PROCESS_START, point_tag(point), "Inicio de carga por %u min", (unsigned)minutes);
+    return true;
+}
+
+bool ChargeControl::stop(int point, const char* reason) {
+    if (point < 0 || point >= NUM_POINTS) return false;
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    ChargePoint& cp = _points[point];
+    if (!cp.active) return false;
+    cp.active = false;
+    _sched.release(point);
+    apply_allocation(); // Apaga este y admite a los que esperaban
+    cp.energy_mwh = Metering::session_end(point);
+    journal(point, (uint8_t)SessionJournal::Type::STOP);
+    g_logger.diferirf(RectEvent::PROCESS_STOP, point_tag(point), "%s | %u.%03u Wh", reason,
+                      (unsigned)(cp.energy_mwh / 1000), (unsigned)(cp.energy_mwh % 1000));
+    return true;
+}
+
+void ChargeControl::tick() {
+    int64_t now = esp_timer_get_time();
+    if (_last_tick_us) {
+        int64_t dev = now - _last_tick_us - 1000000;
+        uint32_t abs_dev = (uint32_t)(dev < 0 ? -dev : dev);
+        _tick_jitter.record(abs_dev);
+        if (OtaPipeline::is_running() || HttpWorkers::busy()) _tick_jitter_loaded.record(abs_dev);
+    }
+    _last_tick_us = now;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    // Los reanudados se registran cuando la SD ya está montada
+    if (_pending_resume_log && g_logger.is_ready()) {
+        for (int i = 0; i < NUM_POINTS; i++) {
+            if (!(_pending_resume_log & (1u << i))) continue;
+            g_logger.diferirf(RectEvent::PROCESS_START, point_tag(i), "Sesión reanudada tras reinicio: %u min",
+                              (unsigned)(_points[i].seconds_left / 60));
+        }
+        _pending_resume_log = 0;
+    }
+
+    MeterSnapshot meter;
+    Metering::snapshot(meter);
+
+    for (int i = 0; i < NUM_POINTS; i++) {
+        ChargePoint& cp = _points[i];
+        if (!cp.active) continue;
+        // En espera por el tope de sitio: el tiempo pagado no corre
+        if (!cp.conducting) continue;
+
+        if (cp.seconds_left > 0) {
+            _sched.update(i, meter.ma[i] > 0 ? (uint32_t)meter.ma[i] : 0, cp.seconds_left);
+
+            cp.seconds_left--;
+
+            // Cada 60 segundos registrar en el log
+            if (cp.seconds_left % 60 == 0) {
+                g_logger.diferirf(RectEvent::PROCESS_START, point_tag(i), "Tiempo restante: %u min",
+                                  (unsigned)(cp.seconds_left / 60));
+            }
+            if (cp.seconds_left % CHECKPOINT_S == 0) {
+                cp.energy_mwh = Metering::session_mwh(i);
+                journal(i, (uint8_t)SessionJournal::Type::CHECKPOINT);
+            }
+        } else {
+            // Tiempo agotado: Apagar relay
+            cp.active = false;
+            _sched.release(i);
+            cp.energy_mwh = Metering::session_end(i);
+            journal(i, (uint8_t)SessionJournal::Type::STOP);
+            g_logger.diferirf(RectEvent::PROCESS_STOP, point_tag(i), "Carga finalizada | %u.%03u Wh",
+                              (unsigned)(cp.energy_mwh / 1000), (unsigned)(cp.energy_mwh % 1000));
+        }
+    }
+
+    // Fin de franja, sesiones que terminaron o corriente medida sobre el tope
+    _sched.tick();
+    apply_allocation();
+
+    // Total histórico a NVS cada 5 min (solo si avanzó al menos 1 Wh)
+    static uint32_t persist_count = 0;
+    if (++persist_count >= 300) {
+        persist_count = 0;
+        Metering::persist();
+    }
+}
+
+ChargePoint ChargeControl::get(int point) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _points[point];
+}
+
+bool ChargeControl::any_active() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (int i = 0; i < NUM_POINTS; i++) {
+        if (_points[i].active) return true;
+    }
+    return false;
+}
+
+void ChargeControl::metrics(TextBuffer& out) {
+    _tick_jitter.metrics(out, "charge_tick_jitter_us");
+    _tick_jitter_loaded.metrics(out, "charge_tick_jitter_loaded_us");
+}
+
+std::string ChargeControl::status() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::string out;
+    char line[96];
+    for (int i = 0; i < NUM_POINTS; i++) {
+        const ChargePoint& cp = _points[i];
+        uint32_t mwh = cp.active ? Metering::session_mwh(i) : cp.energy_mwh;
+        snprintf(line, sizeof(line), "CH%d: %s | %u/%u min | %u.%03u Wh\n", i + 1,
+                 !cp.active ? "LIBRE" : (cp.conducting ? "CARGANDO" : "EN ESPERA"), (unsigned)(cp.seconds_left / 60), (unsigned)(cp.duration_s / 60),
+                 (unsigned)(mwh / 1000), (unsigned)(mwh % 1000));
+        out += line;
+    }
+    return out;
+}
+
+bool ChargeControl::configure_scheduler(uint32_t cap_ma, PowerScheduler::Policy policy) {
+    nvs_handle_t handle;
+    if (nvs_open("sched", NVS_READWRITE, &handle) != ESP_OK) return false;
+    nvs_set_u32(handle, "cap_ma", cap_ma);
+    nvs_set_u8(handle, "policy", (uint8_t)policy);
+    nvs_commit(handle);
+    nvs_close(handle);
+
+    if (cap_ma && cap_ma < _default_demand_ma) {
+        ESP_LOGW(TAG, "Tope %u mA menor que la demanda estimada (%u mA): los puntos conducirán de a uno",
+                 (unsigned)cap_ma, (unsigned)_default_demand_ma);
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    _sched.configure(cap_ma, policy, _sched.slice_s());
+    _sched.rebalance();
+    apply_allocation();
+    return true;
+}
+
+std::string ChargeControl::scheduler_status() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    char buf[160];
+    const PowerScheduler::Stats& st = _sched.stats();
+    snprintf(buf, sizeof(buf),
+             "Tope: %u mA%s | política %s | franja %u s\nAsignado: %u mA | repartos %u | incrementales %u | último %u us\n",
+             (unsigned)_sched.cap_ma(), _sched.cap_ma() ? "" : " (sin tope)",
+             _sched.policy() == PowerScheduler::Policy::ROUND_ROBIN ? "rotación" : "menor restante",
+             (unsigned)_sched.slice_s(), (unsigned)_sched.allocated_ma(), (unsigned)st.rebalances,
+             (unsigned)st.incremental, (unsigned)st.last_rebalance_us);
+    return buf;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <string>
+#include <stdint.h>
+#include <mutex>
+#include "PowerScheduler.hpp"
+#include "LatencyHistogram.hpp"
+#include "TextBuffer.hpp"
+
+struct ChargePoint {
+    int relay_pin;
+    uint32_t seconds_left;
+    bool active;            // Sesión abierta (pagada)
+    bool conducting;        // Relé cerrado: el reparto del sitio le dio potencia
+    uint32_t duration_s;    // Tiempo contratado de la sesión
+    uint32_t start_time;    // epoch (0 si el reloj no estaba sincronizado)
+    uint32_t energy_mwh;    // Energía entregada en la sesión
+};
+
+/**
+ * @brief Sesiones de carga de los 4 puntos (relés en g_mcp_1).
+ *
+ * Cada cambio de estado y un checkpoint periódico van a SessionJournal, de
+ * modo que tras un corte de energía o un reset por watchdog las sesiones
+ * pagadas se reanudan (o se cierran limpiamente) al arrancar.
+ *
+ * Con un tope de sitio (PowerScheduler) una sesión abierta puede quedar en
+ * espera; su tiempo solo corre mientras conduce.
+ */
+class ChargeControl {
+public:
+    static constexpr int NUM_POINTS = 4;
+
+    static void begin();                 // Relés ya en estado seguro; reanuda sesiones del diario
+    static void tick();                  // Llamar cada 1 s desde task_charging_control
+    static bool start(int point, uint32_t minutes);
+    static bool stop(int point, const char* reason);
+    static std::string status();
+    static ChargePoint get(int point);
+    static bool any_active();            // Alguna sesión abierta (conduciendo o en espera)
+    static const char* point_tag(int point);  // "CH1".."CH4" sin armar strings
+
+    // Tope del alimentador (0 = sin tope) y política de reparto; persisten en NVS "sched"
+    static bool configure_scheduler(uint32_t cap_ma, PowerScheduler::Policy policy);
+    static std::string scheduler_status();
+    static uint32_t scheduler_cap_ma() { return _sched.cap_ma(); }
+    static PowerScheduler::Policy scheduler_policy() { return _sched.policy(); }
+
+    // Desvío del tick respecto de 1 s: el indicador de que algo le roba el núcleo al control
+    static const LatencyHistogram& tick_jitter() { return _tick_jitter; }
+    // Mismo desvío, solo mientras corre una OTA o un handler lento del portal: prueba del aislamiento de núcleos
+    static const LatencyHistogram& tick_jitter_loaded() { return _tick_jitter_loaded; }
+    static void reset_tick_jitter() {
+        _tick_jitter.reset();
+        _tick_jitter_loaded.reset();
+    }
+    static void metrics(TextBuffer& out);
+
+private:
+    static constexpr uint32_t CHECKPOINT_S = 10; // Pérdida máxima tras un corte
+
+    static ChargePoint _points[NUM_POINTS];
+    static std::mutex _mutex;
+    static uint8_t _pending_resume_log;  // Bits de puntos reanudados aún no registrados en SD
+    static PowerScheduler _sched;
+    static uint32_t _default_demand_ma;  // Estimación hasta medir la corriente real
+    static LatencyHistogram _tick_jitter;
+    static LatencyHistogram _tick_jitter_loaded;
+    static int64_t _last_tick_us;
+
+    static void set_relay(int point, bool on);
+    static void journal(int point, uint8_t type);
+    static void load_scheduler();
+    static void apply_allocation();
+};
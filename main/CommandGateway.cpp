@@ -0,0 +1,277 @@
+#include "CommandGateway.hpp"
+#include "CommandManager.hpp"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "JsonWriter.hpp"
+#include "TaskConfig.hpp"
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+
+static const char* TAG = "CMD_GW";
+
+QueueHandle_t CommandGateway::_queue = nullptr;
+
+// Respuesta compartida entre el handler HTTP (que espera) y el ejecutor.
+// El último en soltarla la libera, así un timeout del lado HTTP no deja
+// al ejecutor escribiendo sobre memoria ya liberada. waiter y done se tocan
+// bajo s_reply_mutex: al expirar, el handler pone waiter en nullptr y el
+// ejecutor ya no notifica a un worker que volvió a otra cosa.
+struct CommandGateway::Reply {
+    std::string text;
+    TaskHandle_t waiter;
+    std::atomic<bool> done;
+    std::atomic<int> refs;
+};
+static std::mutex s_reply_mutex;
+
+// --- LIMITADOR POR TRANSPORTE (token bucket) ---
+struct RateBucket {
+    uint32_t per_sec;   // Tokens repuestos por segundo
+    uint32_t burst;     // Capacidad máxima
+    uint32_t milli;     // Tokens actuales x1000
+    int64_t last_us;
+};
+
+// UART: consola humana. WS: pensado para encadenar lotes. HTTP: una petición por comando.
+static RateBucket s_buckets[3] = {
+    {20, 20, 20000, 0},  // UART
+    {20, 40, 40000, 0},  // WS
+    {5,  10, 10000, 0},  // HTTP
+};
+static portMUX_TYPE s_rate_mux = portMUX_INITIALIZER_UNLOCKED;
+static std::atomic<uint32_t> s_next_id{1};
+
+static const char* source_name(CmdSource src) {
+    switch (src) {
+        case CmdSource::UART: return "UART";
+        case CmdSource::WS:   return "WS";
+        default:              return "HTTP";
+    }
+}
+
+bool CommandGateway::rate_allowed(CmdSource src) {
+    RateBucket& b = s_buckets[static_cast<uint8_t>(src)];
+    int64_t now = esp_timer_get_time();
+    bool ok = false;
+
+    portENTER_CRITICAL(&s_rate_mux);
+    if (b.last_us != 0) {
+        int64_t refill = (now - b.last_us) * b.per_sec / 1000; // µs * tok/s / 1000 = mili-tokens
+        b.milli = (uint32_t)std::min<int64_t>((int64_t)b.burst * 1000, b.milli + refill);
+    }
+    b.last_us = now;
+    if (b.milli >= 1000) {
+        b.milli -= 1000;
+        ok = true;
+    }
+    portEXIT_CRITICAL(&s_rate_mux);
+    return ok;
+}
+
+bool CommandGateway::start() {
+    if (_queue) return true;
+    _queue = xQueueCreate(QUEUE_LEN, sizeof(Request));
+    if (!_queue) {
+        ESP_LOGE(TAG, "Sin memoria para la cola de comandos");
+        return false;
+    }
+    // Ejecutor único: serializa el acceso a CommandManager y al hardware
+    TaskPlan::create(TaskPlan::CMD_EXEC, executor_task, NULL);
+    TaskPlan::create(TaskPlan::CMD_UART, uart_reader_task, NULL);
+    ESP_LOGI(TAG, "Pasarela de comandos lista (UART/WS/HTTP)");
+    return true;
+}
+
+CmdStatus CommandGateway::enqueue(CmdSource src, const char* frame, size_t len,
+                                  httpd_handle_t hd, int fd, Reply* reply, uint32_t& id,
+                                  bool overlong) {
+    if (!_queue || !frame) return CmdStatus::QUEUE_FULL;
+
+    Request rq = {};
+    rq.src = src;
+    rq.hd = hd;
+    rq.fd = fd;
+    rq.reply = reply;
+
+    // Formato de trama: "[id:]comando". Sin id, se asigna uno correlativo.
+    size_t pos = 0;
+    uint32_t parsed = 0;
+    while (pos < len && pos < 10 && frame[pos] >= '0' && frame[pos] <= '9') {
+        parsed = parsed * 10 + (frame[pos] - '0');
+        pos++;
+    }
+    if (pos > 0 && pos < len && frame[pos] == ':') {
+        rq.id = parsed;
+        frame += pos + 1;
+        len -= pos + 1;
+    } else {
+        rq.id = s_next_id.fetch_add(1);
+    }
+    id = rq.id;
+
+    // Sin truncar: un comando cortado podría ejecutar otra cosa.
+    // overlong: la trama es solo el comienzo de una línea que no cupo en el buffer.
+    size_t used = len;
+    while (used > 0 && isspace((unsigned char)frame[used - 1])) used--;
+    if (overlong) used = std::max(used, MAX_CMD_LEN);
+    if (used == 0 || used >= MAX_CMD_LEN) {
+        route(rq, used ? "ERROR: Comando demasiado largo." : "ERROR: Comando vacío.");
+        return CmdStatus::BAD_FRAME;
+    }
+    memcpy(rq.cmd, frame, used);
+    rq.cmd[used] = '\0';
+
+    if (!rate_allowed(src)) {
+        ESP_LOGW(TAG, "Límite de tasa excedido en %s (id=%u)", source_name(src), (unsigned)rq.id);
+        route(rq, "ERROR: Límite de comandos excedido, reintente.");
+        return CmdStatus::RATE_LIMITED;
+    }
+    if (xQueueSend(_queue, &rq, 0) != pdTRUE) {
+        route(rq, "ERROR: Cola de comandos llena.");
+        return CmdStatus::QUEUE_FULL;
+    }
+    return CmdStatus::OK;
+}
+
+CmdStatus CommandGateway::submit(CmdSource src, const char* frame, size_t len,
+                                 httpd_handle_t hd, int fd) {
+    uint32_t id = 0;
+    return enqueue(src, frame, len, hd, fd, nullptr, id);
+}
+
+CmdStatus CommandGateway::call(const char* frame, size_t len, uint32_t& id,
+                               std::string& response, TickType_t timeout) {
+    Reply* reply = new Reply();
+    reply->waiter = xTaskGetCurrentTaskHandle();
+    reply->done = false;
+    reply->refs = 2; // Handler + ejecutor
+
+    // Limpia notificaciones pendientes antes de esperar la nuestra
+    ulTaskNotifyTake(pdTRUE, 0);
+
+    CmdStatus st = enqueue(CmdSource::HTTP, frame, len, nullptr, -1, reply, id);
+    if (st != CmdStatus::OK) {
+        // route() ya dejó el texto del rechazo en reply y soltó la referencia del ejecutor
+        response = reply->text;
+        release(reply);
+        return st;
+    }
+
+    // Una notificación tardía de una llamada anterior que expiró no cuenta:
+    // solo salimos cuando el ejecutor marcó esta respuesta como lista.
+    TickType_t t0 = xTaskGetTickCount();
+    while (!reply->done) {
+        TickType_t waited = xTaskGetTickCount() - t0;
+        if (waited >= timeout) break;
+        ulTaskNotifyTake(pdTRUE, timeout - waited);
+    }
+    bool done;
+    {
+        std::lock_guard<std::mutex> lock(s_reply_mutex);
+        done = reply->done;
+        if (done) response = reply->text;
+        else reply->waiter = nullptr; // La respuesta tardía se descarta sin notificar
+    }
+    if (!done) response = "ERROR: Tiempo de espera agotado.";
+    release(reply);
+    return done ? CmdStatus::OK : CmdStatus::TIMEOUT;
+}
+
+void CommandGateway::release(Reply* reply) {
+    if (reply && reply->refs.fetch_sub(1) == 1) delete reply;
+}
+
+// Respuesta WS en fragmentos: una salida larga (log.show) no necesita una copia entera en RAM
+struct WsFragmentSink {
+    httpd_handle_t hd;
+    int fd;
+    bool started;
+
+    bool send(const char* data, size_t len, bool final) {
+        httpd_ws_frame_t ws_pkt = {};
+        ws_pkt.payload = (uint8_t*)data;
+        ws_pkt.len = len;
+        ws_pkt.type = started ? HTTPD_WS_TYPE_CONTINUE : HTTPD_WS_TYPE_TEXT;
+        ws_pkt.fragmented = true;
+        ws_pkt.final = final;
+        started = true;
+        return httpd_ws_send_frame_async(hd, fd, &ws_pkt) == ESP_OK;
+    }
+    static bool on_full(void* ctx, const char* data, size_t len) {
+        return ((WsFragmentSink*)ctx)->send(data, len, false);
+    }
+};
+
+void CommandGateway::route(const Request& rq, const std::string& response) {
+    switch (rq.src) {
+        case CmdSource::UART:
+            printf("Respuesta [%u]: %s\n", (unsigned)rq.id, response.c_str());
+            break;
+
+        case CmdSource::WS: {
+            if (!rq.hd || rq.fd < 0) break;
+            char buf[512];
+            WsFragmentSink ws = { rq.hd, rq.fd, false };
+            TextBuffer out(buf, sizeof(buf), WsFragmentSink::on_full, &ws);
+            JsonWriter(out).begin_object().field("type", "cmd").field("id", rq.id).field("resp", response).end_object();
+            // El último tramo cierra el mensaje (FIN); si todo entró en buf es una sola trama
+            bool sent = !out.overflow() && ws.send(out.c_str(), out.size(), true);
+            if (!sent) {
+                ESP_LOGW(TAG, "No se pudo responder id=%u al fd=%d", (unsigned)rq.id, rq.fd);
+            }
+            break;
+        }
+
+        case CmdSource::HTTP:
+            if (!rq.reply) break;
+            {
+                std::lock_guard<std::mutex> lock(s_reply_mutex);
+                rq.reply->text = response;
+                rq.reply->done = true;
+                if (rq.reply->waiter) xTaskNotifyGive(rq.reply->waiter);
+            }
+            release(rq.reply);
+            break;
+    }
+}
+
+void CommandGateway::executor_task(void* pv) {
+    Request rq;
+    while (1) {
+        if (xQueueReceive(_queue, &rq, portMAX_DELAY) != pdTRUE) continue;
+        ESP_LOGD(TAG, "[%s] id=%u cmd=%s", source_name(rq.src), (unsigned)rq.id, rq.cmd);
+        std::string response = CommandManager::execute(rq.cmd);
+        route(rq, response);
+    }
+}
+
+void CommandGateway::uart_reader_task(void* pv) {
+    char incoming_data[UART_LINE_LEN];
+    bool discarding = false; // Resto de una línea larga ya rechazada
+    while (1) {
+        // Leer desde el monitor serial (stdin), ej: "7:stats"
+        if (fgets(incoming_data, sizeof(incoming_data), stdin)) {
+            size_t n = strlen(incoming_data);
+            bool complete = n > 0 && incoming_data[n - 1] == '\n';
+            if (discarding) {
+                // Se tira hasta el salto de línea: el resto no es otro comando
+                discarding = !complete;
+                if (discarding) continue;
+            } else if (!complete && n == sizeof(incoming_data) - 1) {
+                // fgets cortó la línea: se rechaza entera como una sola trama
+                uint32_t id = 0;
+                enqueue(CmdSource::UART, incoming_data, n, nullptr, -1, nullptr, id, true);
+                discarding = true;
+                continue;
+            } else {
+                submit(CmdSource::UART, incoming_data, n);
+            }
+        }
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+}
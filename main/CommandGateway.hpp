@@ -0,0 +1,70 @@
+#pragma once
+
+#include <string>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_http_server.h"
+
+// Canal por el que llegó el comando (define a dónde vuelve la respuesta)
+enum class CmdSource : uint8_t { UART = 0, WS = 1, HTTP = 2 };
+
+// Resultado de encolar/esperar un comando (POST /api/cmd lo traduce a código HTTP)
+enum class CmdStatus : uint8_t {
+    OK = 0,
+    BAD_FRAME,      // Trama vacía o más larga que MAX_CMD_LEN
+    RATE_LIMITED,   // Límite de tasa del transporte
+    QUEUE_FULL,     // Ejecutor saturado
+    TIMEOUT,        // Encolado, pero sin respuesta a tiempo
+};
+
+/**
+ * @brief Pasarela única de comandos (UART, WebSocket y POST /api/cmd).
+ *
+ * Todos los transportes encolan tramas "[id:]comando" hacia una sola tarea
+ * ejecutora, de modo que CommandManager nunca corre en paralelo. La respuesta
+ * se enruta al canal de origen y lleva el mismo id para poder encadenar
+ * decenas de comandos por un solo WebSocket.
+ */
+class CommandGateway {
+public:
+    static bool start();
+
+    // Encola una trama de UART o WebSocket. La respuesta se envía sola.
+    static CmdStatus submit(CmdSource src, const char* frame, size_t len,
+                            httpd_handle_t hd = nullptr, int fd = -1);
+
+    // Variante síncrona para HTTP: espera la respuesta del ejecutor.
+    // Con TIMEOUT la respuesta tardía se descarta sin despertar a quien llamó.
+    static CmdStatus call(const char* frame, size_t len, uint32_t& id,
+                          std::string& response, TickType_t timeout);
+
+private:
+    static constexpr size_t MAX_CMD_LEN = 128;
+    static constexpr size_t QUEUE_LEN   = 32;
+    // Línea de UART: comando + "id:" de hasta 10 dígitos + fin de línea
+    static constexpr size_t UART_LINE_LEN = MAX_CMD_LEN + 16;
+
+    struct Reply;
+
+    struct Request {
+        CmdSource src;
+        uint32_t id;
+        httpd_handle_t hd;
+        int fd;
+        Reply* reply; // Solo HTTP
+        char cmd[MAX_CMD_LEN];
+    };
+
+    static QueueHandle_t _queue;
+
+    static CmdStatus enqueue(CmdSource src, const char* frame, size_t len,
+                             httpd_handle_t hd, int fd, Reply* reply, uint32_t& id,
+                             bool overlong = false);
+    static bool rate_allowed(CmdSource src);
+    static void route(const Request& rq, const std::string& response);
+    static void release(Reply* reply);
+    static void executor_task(void* pv);
+    static void uart_reader_task(void* pv);
+};
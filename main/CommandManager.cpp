@@ -1,6 +1,21 @@
 #include "CommandManager.hpp"
 #include <cstdio>
 #include "esp_log.h"
+#include "OtaPipeline.hpp"
+#include "ChargeControl.hpp"
+#include "Metering.hpp"
+#include "Protection.hpp"
+#include "TimeSeries.hpp"
+#include "JsonWriter.hpp"
+#include "HttpSessions.hpp"
+#include "Uplink.hpp"
+#include "Supervisor.hpp"
+#include "TaskConfig.hpp"
+#include "esp_app_format.h"
+#include "esp_ota_ops.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include <cstdlib>
 
 extern LoggerFS g_logger;
 
@@ -17,13 +32,140 @@ std::string CommandManager::execute(std::string cmd) {
     if (cmd.empty()) return "";
 
     ESP_LOGI(TAG, "Ejecutando: %s", cmd.c_str());
-    // Pseudocódigo para añadir en CommandManager.cpp
-    if (cmd.find("charge.ch") != std::string::npos) {
-        // Lógica para extraer el canal y los minutos del string
-        // Ejemplo: moto_points[0].seconds_left = 60 * 60;
-        // moto_points[0].active = true;
-        // g_mcp_1->digital_write(0, true);
-        return "SUCCESS: Iniciando carga CH1 por 60 min";
+    // charge.chN.M : inicia la carga del punto N (1-4) por M minutos
+    if (cmd.rfind("charge.ch", 0) == 0) {
+        int ch = 0, minutes = 0;
+        if (sscanf(cmd.c_str(), "charge.ch%d.%d", &ch, &minutes) != 2 || minutes <= 0 || minutes > 24 * 60) {
+            return "ERROR: Uso charge.chN.M (N=1-4, M=minutos)";
+        }
+        if (Protection::is_latched(ch - 1)) return "ERROR: CH" + std::to_string(ch) + " con falla enclavada (fault.clear." + std::to_string(ch) + ")";
+        if (!ChargeControl::start(ch - 1, minutes)) return "ERROR: Canal inválido";
+        return "SUCCESS: Iniciando carga CH" + std::to_string(ch) + " por " + std::to_string(minutes) + " min";
+    }
+    if (cmd.rfind("stop.ch", 0) == 0) {
+        int ch = atoi(cmd.c_str() + 7);
+        if (!ChargeControl::stop(ch - 1, "Detenido por comando")) return "ERROR: Canal inválido o sin carga activa";
+        return "SUCCESS: Carga CH" + std::to_string(ch) + " detenida";
+    }
+    if (cmd == "sessions") {
+        return ChargeControl::status();
+    }
+    if (cmd == "sched") {
+        return ChargeControl::scheduler_status();
+    }
+    if (cmd == "sched.bench") {
+        return PowerScheduler::bench();
+    }
+    // sched.cap.MA : tope de corriente del alimentador (0 = sin tope)
+    if (cmd.rfind("sched.cap.", 0) == 0 || cmd.rfind("sched.policy.", 0) == 0) {
+        uint32_t cap = ChargeControl::scheduler_cap_ma();
+        PowerScheduler::Policy pol = ChargeControl::scheduler_policy();
+        if (cmd.rfind("sched.cap.", 0) == 0) {
+            cap = strtoul(cmd.c_str() + 10, nullptr, 10);
+        } else if (cmd == "sched.policy.rr") {
+            pol = PowerScheduler::Policy::ROUND_ROBIN;
+        } else if (cmd == "sched.policy.srt") {
+            pol = PowerScheduler::Policy::SHORTEST_REMAINING;
+        } else {
+            return "ERROR: Uso sched.policy.rr | sched.policy.srt";
+        }
+        if (!ChargeControl::configure_scheduler(cap, pol)) return "ERROR: No se pudo guardar la configuración";
+        g_logger.registrarf(RectEvent::CONFIG_CHANGE, "SCHED", "%u mA, %s", (unsigned)cap,
+                            pol == PowerScheduler::Policy::ROUND_ROBIN ? "rr" : "srt");
+        return "SUCCESS: Reparto actualizado\n" + ChargeControl::scheduler_status();
+    }
+    if (cmd == "energy") {
+        return Metering::status();
+    }
+    if (cmd == "bench.json") {
+        return JsonWriter::bench();
+    }
+    if (cmd == "sd") {
+        return g_logger.io_status();
+    }
+    if (cmd == "http") {
+        return HttpSessions::status();
+    }
+    if (cmd == "tasks") {
+        return taskReport();
+    }
+    if (cmd == "health") {
+        return Supervisor::status();
+    }
+    if (cmd == "uplink") {
+        return Uplink::status();
+    }
+    // uplink.url.URL (uplink.url.off apaga) | uplink.period.TELE_S.LOTE_S | uplink.flush
+    if (cmd.rfind("uplink.url.", 0) == 0) {
+        std::string url = cmd.substr(11);
+        if (url == "off") url.clear();
+        if (!Uplink::set_url(url.c_str())) return "ERROR: Uso uplink.url.http(s)://host/ruta | uplink.url.off";
+        g_logger.registrarEstructurado(RectEvent::CONFIG_CHANGE, "UPLINK", url.empty() ? "apagado" : url);
+        return "SUCCESS: Uplink " + (url.empty() ? std::string("apagado") : "hacia " + url);
+    }
+    if (cmd.rfind("uplink.period.", 0) == 0) {
+        unsigned tele = 0, batch = 0;
+        if (sscanf(cmd.c_str(), "uplink.period.%u.%u", &tele, &batch) != 2 || tele > 65535 || batch > 65535 ||
+            !Uplink::set_periods((uint16_t)tele, (uint16_t)batch)) {
+            return "ERROR: Uso uplink.period.TELE_S.LOTE_S (TELE_S >= 5, LOTE_S >= TELE_S)";
+        }
+        return "SUCCESS: Telemetría cada " + std::to_string(tele) + " s, lote cada " + std::to_string(batch) + " s";
+    }
+    if (cmd == "uplink.flush") {
+        Uplink::flush_now();
+        return "SUCCESS: El lote actual sale en el próximo ciclo";
+    }
+    if (cmd == "load.report") {
+        return loadReport();
+    }
+    if (cmd == "load.reset") {
+        HttpSessions::reset_latency();
+        ChargeControl::reset_tick_jitter();
+        return "SUCCESS: Histogramas de latencia reiniciados";
+    }
+    if (cmd == "history") {
+        return TimeSeries::status();
+    }
+    if (cmd == "faults") {
+        return Protection::status();
+    }
+    if (cmd.rfind("fault.clear.", 0) == 0) {
+        int ch = atoi(cmd.c_str() + 12);
+        if (!Protection::clear(ch - 1)) return "ERROR: Canal inválido o sin falla";
+        g_logger.registrarEstructurado(RectEvent::CONFIG_CHANGE, ChargeControl::point_tag(ch - 1), "Falla rearmada");
+        return "SUCCESS: Falla CH" + std::to_string(ch) + " rearmada";
+    }
+    // fault.limit.N.MA : límite de sobrecorriente del punto N
+    if (cmd.rfind("fault.limit.", 0) == 0) {
+        int ch = 0, ma = 0;
+        if (sscanf(cmd.c_str(), "fault.limit.%d.%d", &ch, &ma) != 2 || ma <= 0 ||
+            !Protection::set_limit_ma(ch - 1, ma)) {
+            return "ERROR: Uso fault.limit.N.MA";
+        }
+        // Valor "LIM_CHn" y nota "N mA": el formato que leen las herramientas del log
+        char valor[12];
+        snprintf(valor, sizeof(valor), "LIM_CH%d", ch);
+        g_logger.registrarf(RectEvent::CONFIG_CHANGE, valor, "%d mA", ma);
+        return "SUCCESS: Límite CH" + std::to_string(ch) + " = " + std::to_string(ma) + " mA";
+    }
+    // meter.vnom.MV : tensión nominal usada para la energía
+    if (cmd.rfind("meter.vnom.", 0) == 0) {
+        uint32_t mv = strtoul(cmd.c_str() + 11, nullptr, 10);
+        if (!Metering::set_nominal_mv(mv)) return "ERROR: Uso meter.vnom.MV";
+        g_logger.registrarf(RectEvent::CONFIG_CHANGE, "V_NOM", "%u mV", (unsigned)mv);
+        return "SUCCESS: Tensión nominal " + std::to_string(mv) + " mV";
+    }
+    // meter.cal.N.UA.OFF : µA por LSB y cero (crudo) del canal N
+    if (cmd.rfind("meter.cal.", 0) == 0) {
+        int ch = 0, ua = 0, off = 0;
+        if (sscanf(cmd.c_str(), "meter.cal.%d.%d.%d", &ch, &ua, &off) != 3 ||
+            !Metering::set_calibration(ch - 1, ua, (int16_t)off)) {
+            return "ERROR: Uso meter.cal.N.UA.OFF";
+        }
+        char valor[12];
+        snprintf(valor, sizeof(valor), "CAL_CH%d", ch);
+        g_logger.registrarf(RectEvent::CONFIG_CHANGE, valor, "%d uA/LSB, off %d", ua, off);
+        return "SUCCESS: Calibración CH" + std::to_string(ch) + " guardada";
     }
     if (cmd == "log.show") {
         return dumpLogs();
@@ -36,11 +178,32 @@ std::string CommandManager::execute(std::string cmd) {
     else if (cmd == "stats") {
         return getSystemStats();
     }
+    else if (cmd == "ota.status") {
+        return OtaPipeline::status();
+    }
     else if (cmd == "help") {
         return "\n--- COMANDOS RECTIFICADOR ---\n"
                "log.show  : Muestra logs CSV\n"
                "log.clear : Borra logs\n"
                "stats     : Estado actual\n"
+               "ota.status: Avance de la descarga OTA\n"
+               "charge.chN.M: Carga punto N por M min\n"
+               "stop.chN  : Detiene la carga del punto N\n"
+               "sessions  : Estado de las sesiones\n"
+               "energy    : Corriente y energía por punto\n"
+               "meter.vnom.MV / meter.cal.N.UA.OFF: Calibración\n"
+               "sd        : Velocidad y buffers de la SD\n"
+               "bench.json: JsonWriter contra cJSON (100 objetos)\n"
+               "history   : Estado del historial en SD\n"
+               "http      : Conexiones abiertas del portal\n"
+               "health    : Pulso de las tareas vigiladas\n"
+               "tasks     : Núcleo, prioridad y pila de cada tarea\n"
+               "load.report / load.reset: Latencias por ruta y jitter del control\n"
+               "uplink    : Envío al colector (uplink.url.URL|off, uplink.period.T.L, uplink.flush)\n"
+               "sched     : Reparto bajo tope de sitio\n"
+               "sched.cap.MA / sched.policy.rr|srt / sched.bench\n"
+               "faults    : Estado de protecciones\n"
+               "fault.clear.N / fault.limit.N.MA: Rearme y límite\n"
                "-----------------------------\n";
     }
 
@@ -59,8 +222,52 @@ std::string CommandManager::getSystemStats() {
     return std::string(buf);
 }
 
+// Informe de capacidad: correr load.reset, aplicar la carga y leerlo al final
+std::string CommandManager::loadReport() {
+    char line[128];
+    snprintf(line, sizeof(line), "--- CAPACIDAD %s | uptime %lld s ---\n", esp_app_get_description()->version,
+             (long long)(esp_timer_get_time() / 1000000));
+    std::string res = line;
+    res += HttpSessions::latency_report();
+
+    const LatencyHistogram& j = ChargeControl::tick_jitter();
+    snprintf(line, sizeof(line), "Tick de carga: n=%u | desvío p50 %u | p99 %u | max %u us\n", (unsigned)j.count(),
+             (unsigned)j.percentile(500), (unsigned)j.percentile(990), (unsigned)j.max_us());
+    res += line;
+    const LatencyHistogram& jl = ChargeControl::tick_jitter_loaded();
+    snprintf(line, sizeof(line), "  con OTA/descarga: n=%u | desvío p50 %u | p99 %u | max %u us\n", (unsigned)jl.count(),
+             (unsigned)jl.percentile(500), (unsigned)jl.percentile(990), (unsigned)jl.max_us());
+    res += line;
+    snprintf(line, sizeof(line), "Heap libre %u | mínimo %u bytes\n", (unsigned)esp_get_free_heap_size(),
+             (unsigned)esp_get_minimum_free_heap_size());
+    res += line;
+    return res;
+}
+
+// Plan de TaskConfig.hpp contra lo que corre: núcleo, prioridad y pila mínima libre
+std::string CommandManager::taskReport() {
+    std::string res = "Tarea          plan      actual    pila libre\n";
+    char line[96];
+    for (const TaskConfig* cfg : TaskPlan::ALL) {
+        // Las tareas con índice (http_wk0, http_wk1) se reportan por la primera
+        char name[configMAX_TASK_NAME_LEN];
+        snprintf(name, sizeof(name), "%s%s", cfg->name, cfg == &TaskPlan::HTTP_WORKER ? "0" : "");
+        TaskHandle_t h = xTaskGetHandle(name);
+        if (!h) {
+            snprintf(line, sizeof(line), "%-14s c%d p%-2u   (no corre)\n", name, (int)cfg->core, (unsigned)cfg->priority);
+        } else {
+            snprintf(line, sizeof(line), "%-14s c%d p%-2u   c%d p%-2u   %u bytes\n", name, (int)cfg->core,
+                     (unsigned)cfg->priority, (int)xTaskGetCoreID(h), (unsigned)uxTaskPriorityGet(h),
+                     (unsigned)uxTaskGetStackHighWaterMark(h));
+        }
+        res += line;
+    }
+    return res;
+}
+
 std::string CommandManager::dumpLogs() {
     extern LoggerFS g_logger;
+    g_logger.flush();
     FILE* f = fopen(g_logger.getFilePath().c_str(), "r");
     if (f == NULL) return "ERROR: No se pudo leer el archivo de logs.";
 
@@ -10,7 +10,7 @@ class CommandManager {
 public:
     /**
      * @brief Procesa un comando de texto y retorna la respuesta.
-     * @param cmd Cadena de texto recibida (Serial, WiFi, BT)
+     * @param cmd Cadena de texto recibida (vía CommandGateway: UART, WS, HTTP)
      * @return std::string Respuesta para el canal emisor
      */
     static std::string execute(std::string cmd);
@@ -19,6 +19,8 @@ private:
     // Métodos internos de procesamiento
     static std::string dumpLogs();
     static std::string getSystemStats();
+    static std::string loadReport();
+    static std::string taskReport();
     static void sanitize(std::string &s);
 };
 
@@ -1,26 +1,50 @@
 #include "GitHubClient.hpp"
 #include "esp_http_client.h"
-#include "esp_https_ota.h"
 #include "esp_log.h"
 #include "cJSON.h"
-#include "esp_heap_caps.h"
 #include "esp_crt_bundle.h"
 #include "esp_ota_ops.h"
 #include <sstream>
 #include <vector>
 #include <cstdlib> // Necesario para atoi
+#include <mutex>
+#include <cstring>
+#include <strings.h>
+#include "nvs.h"
 #include "LoggerFS.hpp"
+#include "WifiManager.hpp"
+#include "ReleaseFeedParser.hpp"
+#include "OtaPipeline.hpp"
+#include "JsonWriter.hpp"
+#include "TaskConfig.hpp"
+
 static const char *TAG = "GH_CLIENT";
 
 // URL base de tu repositorio
 #define REPO_PATH "devSmartSolutionsLabs/DC-Rectifier-Controller"
 
+// Base de la API. Se puede apuntar a un servidor HTTP local de pruebas
+// compilando con -DGITHUB_API_BASE=\"http://192.168.1.10:8080\"
+#ifndef GITHUB_API_BASE
+#define GITHUB_API_BASE "https://api.github.com"
+#endif
+
+#define RELEASE_REFRESH_MS   (30 * 60 * 1000) // Refresco periódico: 30 min
+#define RELEASE_RETRY_MS     (60 * 1000)      // Reintento si no hay red o falló
+#define RELEASE_NVS_MAX_BODY 3000             // La partición NVS es de 16 KB
+
 extern "C" {
     extern volatile bool g_scr_enabled;
 }
 extern LoggerFS g_logger;
 
-static char* github_url_to_save = nullptr;
+// --- CACHÉ DE RELEASES ---
+static std::mutex s_cache_mutex;
+static std::vector<ReleaseInfo> s_cache;
+static std::string s_etag;
+static std::string s_last_modified;
+static bool s_cache_valid = false;
+static TaskHandle_t s_refresh_task = nullptr;
 
 
 std::string GitHubClient::get_current_version() {
@@ -62,162 +86,248 @@ bool GitHubClient::is_newer_version(std::string remote, std::string local) {
 }
 
 void GitHubClient::start_ota_from_url(const char* url) {
-    if (github_url_to_save != nullptr) free(github_url_to_save);
-    github_url_to_save = strdup(url);
-    
-    // Tarea en Core 1 para proteger el tiempo real del Core 0 (SCR)
-    xTaskCreatePinnedToCore(&GitHubClient::ota_task, "ota_task", 10240, NULL, 5, NULL, 1);
+    // Descarga reanudable (o delta si la URL termina en .vdelta)
+    if (!OtaPipeline::start(url)) {
+        ESP_LOGW(TAG, "OTA ya en curso o URL inválida: %s", url);
+    }
 }
 
-void GitHubClient::ota_task(void* pvParameter) {
-    ESP_LOGI(TAG, "Iniciando descarga OTA desde: %s", github_url_to_save);
+void GitHubClient::write_releases_json(TextBuffer& out) {
+    // Se escribe bajo el mutex directo desde la caché (sin copiar el vector)
+    bool valid;
+    JsonWriter j(out);
+    j.begin_array();
+    {
+        std::lock_guard<std::mutex> lock(s_cache_mutex);
+        valid = s_cache_valid;
+        for (const auto& rel : s_cache) {
+            j.begin_object().field("tag", rel.tag).field("bin_url", rel.bin_url).field("new", rel.is_new).end_object();
+        }
+    }
+    j.end_array();
+    if (!valid) request_refresh();
+}
 
-    esp_http_client_config_t config = {};
-    config.url = github_url_to_save;
-    config.crt_bundle_attach = esp_crt_bundle_attach; 
-    config.keep_alive_enable = true;
-    config.timeout_ms = 20000;
-    
-   // CORRECCIÓN AQUÍ: 
-    // En ESP-IDF v5.x, las redirecciones se manejan así:
-    // Por defecto vienen habilitadas, pero si quieres asegurar:
-    config.disable_auto_redirect = false; // Permitir que siga a Amazon S3
-    config.max_redirection_count = 5;      // Darle margen de saltos
+void GitHubClient::start_release_cache() {
+    if (s_refresh_task) return;
+    load_cache_from_nvs();
+    TaskPlan::create(TaskPlan::GH_REFRESH, &GitHubClient::release_refresh_task, NULL, &s_refresh_task);
+}
 
-    config.buffer_size_tx = 4096;
-    config.buffer_size = 10240; 
+void GitHubClient::request_refresh() {
+    if (s_refresh_task) xTaskNotifyGive(s_refresh_task);
+}
 
-    esp_https_ota_config_t ota_config = {};
-    ota_config.http_config = &config;
+void GitHubClient::release_refresh_task(void* pvParameter) {
+    while (1) {
+        uint32_t wait_ms = RELEASE_RETRY_MS;
 
-    g_logger.registrarEstructurado(RectEvent::OTA_START, "v3.0.2", "Descargando desde GitHub");
+        if (WifiManager::is_connected()) {
+            std::string etag, last_mod;
+            {
+                std::lock_guard<std::mutex> lock(s_cache_mutex);
+                // Sin caché válida no tiene sentido pedir un 304
+                if (s_cache_valid) {
+                    etag = s_etag;
+                    last_mod = s_last_modified;
+                }
+            }
 
-    esp_err_t ret = esp_https_ota(&ota_config);
+            std::vector<ReleaseInfo> fresh;
+            std::string new_etag, new_last_mod;
+            int status = fetch_releases(REPO_PATH, etag, last_mod, fresh, new_etag, new_last_mod);
 
-    if (ret == ESP_OK) {
-        ESP_LOGI(TAG, "Actualización completada con éxito. Reiniciando...");
-        vTaskDelay(pdMS_TO_TICKS(2000));
-        esp_restart();
-    } else {
-        char err_buf[32];
-        snprintf(err_buf, sizeof(err_buf), "Error:0x%X", ret);
-        g_logger.registrarEstructurado(RectEvent::ERR_SYSTEM, err_buf, "Fallo en descarga OTA");
-        ESP_LOGE(TAG, "Error durante el proceso OTA: %s", esp_err_to_name(ret));
+            if (status == 304) {
+                ESP_LOGI(TAG, "Releases sin cambios (304)");
+                wait_ms = RELEASE_REFRESH_MS;
+            } else if (status == 200) {
+                {
+                    std::lock_guard<std::mutex> lock(s_cache_mutex);
+                    s_cache.swap(fresh);
+                    s_etag = new_etag;
+                    s_last_modified = new_last_mod;
+                    s_cache_valid = true;
+                }
+                save_cache_to_nvs();
+                wait_ms = RELEASE_REFRESH_MS;
+            } else {
+                ESP_LOGW(TAG, "Refresco de releases fallido (HTTP %d)", status);
+            }
+        }
+
+        // Espera hasta el próximo ciclo o hasta que alguien pida refresco
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait_ms));
+    }
+}
+
+// Formato en NVS: "tag\x1fbin_url\x1fnew\x1e" por release (compacto, sin cJSON)
+void GitHubClient::load_cache_from_nvs() {
+    nvs_handle_t handle;
+    if (nvs_open("gh_cache", NVS_READONLY, &handle) != ESP_OK) return;
+
+    char etag[96] = {0}, last_mod[48] = {0};
+    size_t e_len = sizeof(etag), l_len = sizeof(last_mod), b_len = 0;
+    nvs_get_str(handle, "etag", etag, &e_len);
+    nvs_get_str(handle, "lastmod", last_mod, &l_len);
+
+    std::string body;
+    if (nvs_get_blob(handle, "body", NULL, &b_len) == ESP_OK && b_len > 0) {
+        body.resize(b_len);
+        if (nvs_get_blob(handle, "body", &body[0], &b_len) != ESP_OK) body.clear();
     }
+    nvs_close(handle);
+    if (body.empty()) return;
 
-    if (github_url_to_save) {
-        free(github_url_to_save);
-        github_url_to_save = nullptr;
+    std::vector<ReleaseInfo> list;
+    size_t pos = 0;
+    std::string current_version = get_current_version();
+    while (pos < body.size()) {
+        size_t end = body.find('\x1e', pos);
+        if (end == std::string::npos) break;
+        size_t f1 = body.find('\x1f', pos);
+        if (f1 != std::string::npos && f1 < end) {
+            std::string tag = body.substr(pos, f1 - pos);
+            size_t f2 = body.find('\x1f', f1 + 1);
+            std::string url = body.substr(f1 + 1, (f2 != std::string::npos && f2 < end ? f2 : end) - f1 - 1);
+            // La bandera "new" se recalcula: el firmware pudo cambiar tras un OTA
+            list.push_back({tag, url, is_newer_version(tag, current_version)});
+        }
+        pos = end + 1;
     }
-    vTaskDelete(NULL);
+
+    std::lock_guard<std::mutex> lock(s_cache_mutex);
+    s_cache.swap(list);
+    s_etag = etag;
+    s_last_modified = last_mod;
+    s_cache_valid = true;
+    ESP_LOGI(TAG, "Caché de releases restaurada de NVS (%d versiones)", (int)s_cache.size());
 }
 
-std::string GitHubClient::get_releases_json() {
-    // 1. Obtener el vector de versiones usando el método que ya tienes
-    std::vector<ReleaseInfo> releases = GitHubClient::get_releases(REPO_PATH);
-    
-    // 2. Crear objeto raíz JSON (un array)
-    cJSON *root = cJSON_CreateArray();
-    
-    for (const auto& rel : releases) {
-        cJSON *item = cJSON_CreateObject();
-        cJSON_AddStringToObject(item, "tag", rel.tag.c_str());
-        cJSON_AddStringToObject(item, "bin_url", rel.bin_url.c_str());
-        cJSON_AddBoolToObject(item, "new", rel.is_new);
-        cJSON_AddItemToArray(root, item);
+void GitHubClient::save_cache_to_nvs() {
+    std::string body, etag, last_mod;
+    {
+        std::lock_guard<std::mutex> lock(s_cache_mutex);
+        for (const auto& rel : s_cache) {
+            body += rel.tag + '\x1f' + rel.bin_url + '\x1f' + (rel.is_new ? '1' : '0') + '\x1e';
+        }
+        etag = s_etag;
+        last_mod = s_last_modified;
     }
-    
-    // 3. Convertir a string y liberar memoria de cJSON
-    char *rendered = cJSON_PrintUnformatted(root);
-    std::string out(rendered);
-    
-    cJSON_Delete(root);
-    free(rendered);
-    
-    return out;
+
+    nvs_handle_t handle;
+    if (nvs_open("gh_cache", NVS_READWRITE, &handle) != ESP_OK) return;
+    if (body.size() <= RELEASE_NVS_MAX_BODY) {
+        nvs_set_blob(handle, "body", body.data(), body.size());
+        nvs_set_str(handle, "etag", etag.c_str());
+        nvs_set_str(handle, "lastmod", last_mod.c_str());
+    } else {
+        // Sin cuerpo guardado, un ETag persistido daría 304 sobre una caché vacía
+        nvs_erase_key(handle, "body");
+        nvs_erase_key(handle, "etag");
+        nvs_erase_key(handle, "lastmod");
+    }
+    nvs_commit(handle);
+    nvs_close(handle);
 }
 
 std::vector<ReleaseInfo> GitHubClient::get_releases(const char* repo) {
     std::vector<ReleaseInfo> list;
-    
+    std::string etag, last_mod;
+    fetch_releases(repo, "", "", list, etag, last_mod);
+    return list;
+}
+
+// Captura de cabeceras de respuesta para la petición condicional
+struct CondHeaders {
+    std::string etag;
+    std::string last_modified;
+};
+
+static esp_err_t release_http_event(esp_http_client_event_t *evt) {
+    if (evt->event_id == HTTP_EVENT_ON_HEADER && evt->user_data) {
+        CondHeaders* h = static_cast<CondHeaders*>(evt->user_data);
+        if (strcasecmp(evt->header_key, "ETag") == 0) h->etag = evt->header_value;
+        else if (strcasecmp(evt->header_key, "Last-Modified") == 0) h->last_modified = evt->header_value;
+    }
+    return ESP_OK;
+}
+
+int GitHubClient::fetch_releases(const char* repo, const std::string& etag, const std::string& last_modified,
+                                 std::vector<ReleaseInfo>& list, std::string& new_etag, std::string& new_last_modified) {
     // 1. Obtener la versión que el ESP32 tiene grabada actualmente (vía CMake PROJECT_VER)
     const esp_app_desc_t *app_desc = esp_app_get_description();
     std::string current_version = app_desc->version;
     ESP_LOGI(TAG, "Versión local detectada: %s", current_version.c_str());
 
     const char* target_repo = (repo && strlen(repo) > 0) ? repo : REPO_PATH;
-    const size_t BUF_SIZE = 32768;
-    char* json_buf = (char*)heap_caps_malloc(BUF_SIZE, MALLOC_CAP_SPIRAM);
-    
-    if (!json_buf) {
-        ESP_LOGE(TAG, "Error: Memoria insuficiente en PSRAM");
-        return list;
-    }
 
+    CondHeaders resp_headers;
     esp_http_client_config_t config = {};
     char api_url[150];
-    snprintf(api_url, sizeof(api_url), "https://api.github.com/repos/%s/releases", target_repo);
+    snprintf(api_url, sizeof(api_url), GITHUB_API_BASE "/repos/%s/releases", target_repo);
     
     config.url = api_url;
     config.method = HTTP_METHOD_GET;
     config.user_agent = "ESP32-S3-Rectificador-v1";
-    config.crt_bundle_attach = esp_crt_bundle_attach;
+    if (strncmp(api_url, "https", 5) == 0) config.crt_bundle_attach = esp_crt_bundle_attach;
     config.timeout_ms = 15000;
     config.skip_cert_common_name_check = true; 
+    config.event_handler = release_http_event;
+    config.user_data = &resp_headers;
 
     esp_http_client_handle_t client = esp_http_client_init(&config);
     esp_http_client_set_header(client, "Accept", "application/vnd.github.v3+json");
+    // Petición condicional: GitHub no descuenta del rate limit las respuestas 304
+    if (!etag.empty()) esp_http_client_set_header(client, "If-None-Match", etag.c_str());
+    if (!last_modified.empty()) esp_http_client_set_header(client, "If-Modified-Since", last_modified.c_str());
 
+    int status = -1;
     esp_err_t err = esp_http_client_open(client, 0);
     if (err == ESP_OK) {
         esp_http_client_fetch_headers(client);
-        int total_read = 0;
-        int read_now = 0;
+        status = esp_http_client_get_status_code(client);
+    }
 
-        while (total_read < (BUF_SIZE - 1)) {
-            read_now = esp_http_client_read(client, json_buf + total_read, BUF_SIZE - total_read - 1);
-            if (read_now <= 0) break;
-            total_read += read_now;
-        }
-        json_buf[total_read] = '\0';
-
-        cJSON *root = cJSON_Parse(json_buf);
-        if (root) {
-            cJSON *release = NULL;
-            cJSON_ArrayForEach(release, root) {
-                cJSON *tag = cJSON_GetObjectItem(release, "tag_name");
-                cJSON *assets = cJSON_GetObjectItem(release, "assets");
-                
-                if (cJSON_IsString(tag) && cJSON_IsArray(assets)) {
-                    std::string remote_tag = tag->valuestring;
-                    
-                    cJSON *asset = NULL;
-                    cJSON_ArrayForEach(asset, assets) {
-                        cJSON *name = cJSON_GetObjectItem(asset, "name");
-                        cJSON *bin_url = cJSON_GetObjectItem(asset, "browser_download_url");
-                        
-                        if (cJSON_IsString(name) && strstr(name->valuestring, ".bin") && cJSON_IsString(bin_url)) {
-                            
-                            // 2. Lógica de comparación: ¿Es diferente a la actual?
-                            // Si el tag de GitHub no es igual al que tenemos grabado, es "new"
-                            bool is_new = is_newer_version(remote_tag, current_version);
-                            
-                            // Agregamos a la lista con la info completa
-                            list.push_back({remote_tag, bin_url->valuestring, is_new});
-                            break; 
-                        }
-                    }
-                }
+    if (status == 200) {
+        // Parser incremental: cada bloque se procesa y se descarta, sin límite de tamaño
+        struct Sink {
+            std::vector<ReleaseInfo>* list;
+            const std::string* local;
+        } sink = { &list, &current_version };
+
+        ReleaseFeedParser parser([](const char* tag, const char* bin_url, void* ctx) {
+            Sink* s = static_cast<Sink*>(ctx);
+            // Lógica de comparación: ¿Es más nueva que la grabada?
+            s->list->push_back({tag, bin_url, is_newer_version(tag, *s->local)});
+        }, &sink);
+
+        char chunk[512];
+        int read_now = 0;
+        bool complete = false;
+        while (!parser.failed()) {
+            read_now = esp_http_client_read(client, chunk, sizeof(chunk));
+            if (read_now < 0) break;
+            if (read_now == 0) {
+                complete = esp_http_client_is_complete_data_received(client);
+                break;
             }
-            cJSON_Delete(root);
+            parser.feed(chunk, read_now);
         }
-    } else {
+
+        if (parser.failed() || !complete) {
+            ESP_LOGE(TAG, "Feed de releases incompleto o inválido");
+            list.clear();
+            status = -1; // Cuerpo corrupto: no invalidar la caché buena
+        }
+        new_etag = resp_headers.etag;
+        new_last_modified = resp_headers.last_modified;
+    } else if (err != ESP_OK) {
         ESP_LOGE(TAG, "Error de red al consultar releases: %s", esp_err_to_name(err));
     }
 
+    esp_http_client_close(client);
     esp_http_client_cleanup(client);
-    heap_caps_free(json_buf);
     
-    ESP_LOGI(TAG, "Se encontraron %d versiones. Local: %s", (int)list.size(), current_version.c_str());
-    return list;
-}
\ No newline at end of file
+    ESP_LOGI(TAG, "HTTP %d, %d versiones. Local: %s", status, (int)list.size(), current_version.c_str());
+    return status;
+}
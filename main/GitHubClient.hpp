@@ -2,6 +2,7 @@
 #include <string>
 #include <vector>
 #include "esp_err.h"
+#include "TextBuffer.hpp"
 
 struct ReleaseInfo {
     std::string tag;
@@ -11,9 +12,14 @@ struct ReleaseInfo {
 
 class GitHubClient {
 public:
-    // Obtiene la lista de versiones y decide si son nuevas
+    // Obtiene la lista de versiones y decide si son nuevas (petición directa, bloqueante)
     static std::vector<ReleaseInfo> get_releases(const char* repo);
-    static std::string get_releases_json();
+    // Responde desde la caché en memoria; nunca toca la red ni el heap
+    static void write_releases_json(TextBuffer& out);
+
+    // Caché de releases: carga NVS y lanza el refresco condicional en segundo plano
+    static void start_release_cache();
+    static void request_refresh();
     // Inicia la tarea de actualización OTA
     static void start_ota_from_url(const char* url);
     
@@ -22,5 +28,11 @@ public:
     static bool is_newer_version(std::string remote, std::string local);
 
 private:
-    static void ota_task(void* pvParameter);
+    static void release_refresh_task(void* pvParameter);
+
+    // Devuelve el código HTTP (200, 304...) o -1 en error de red
+    static int fetch_releases(const char* repo, const std::string& etag, const std::string& last_modified,
+                              std::vector<ReleaseInfo>& out, std::string& new_etag, std::string& new_last_modified);
+    static void load_cache_from_nvs();
+    static void save_cache_to_nvs();
 };
\ No newline at end of file
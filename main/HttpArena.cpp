@@ -0,0 +1,135 @@
+#include "HttpArena.hpp"
+#include "esp_log.h"
+#include <cstring>
+#include <cstdlib>
+
+static const char* TAG = "HTTP_ARENA";
+
+HttpArena::HttpArena(void* mem, size_t size) : _mem((uint8_t*)mem), _size(size) {}
+
+static thread_local HttpArena* t_arena = nullptr;
+
+void HttpArena::bind(HttpArena* a) {
+    t_arena = a;
+}
+
+HttpArena& HttpArena::request() {
+    if (t_arena) return *t_arena;
+    alignas(max_align_t) static uint8_t s_mem[REQUEST_ARENA_SIZE];
+    static HttpArena s_arena(s_mem, sizeof(s_mem));
+    return s_arena;
+}
+
+void* HttpArena::alloc(size_t n, size_t align) {
+    size_t start = (_used + align - 1) & ~(align - 1);
+    if (start + n > _size) {
+        _failures++;
+        ESP_LOGW(TAG, "Arena llena: %u + %u > %u bytes", (unsigned)start, (unsigned)n, (unsigned)_size);
+        return nullptr;
+    }
+    _used = start + n;
+    if (_used > _high) _high = _used;
+    return _mem + start;
+}
+
+const char* HttpArena::copy(std::string_view s) {
+    char* p = (char*)alloc(s.size() + 1, 1);
+    if (!p) return nullptr;
+    memcpy(p, s.data(), s.size());
+    p[s.size()] = 0;
+    return p;
+}
+
+TextBuffer HttpArena::text(size_t cap, TextBuffer::Sink sink, void* ctx) {
+    size_t free_bytes = _size - _used;
+    if (cap == 0 || cap > free_bytes) cap = free_bytes;
+    char* p = cap ? (char*)alloc(cap, 1) : nullptr;
+    if (!p) {
+        // Sin lugar: un buffer de 1 byte que solo guarda el NUL y marca desborde
+        static char s_empty[1];
+        return TextBuffer(s_empty, sizeof(s_empty), sink, ctx);
+    }
+    return TextBuffer(p, cap, sink, ctx);
+}
+
+std::string_view HttpArena::query(httpd_req_t* req, HttpArena& a) {
+    size_t len = httpd_req_get_url_query_len(req);
+    if (len == 0) return {};
+    char* p = (char*)a.alloc(len + 1, 1);
+    if (!p || httpd_req_get_url_query_str(req, p, len + 1) != ESP_OK) return {};
+    return std::string_view(p, len);
+}
+
+std::string_view HttpArena::body(httpd_req_t* req, HttpArena& a, size_t max_len) {
+    size_t len = req->content_len;
+    if (len == 0 || len > max_len) return {};
+    char* p = (char*)a.alloc(len + 1, 1);
+    if (!p) return {};
+    size_t got = 0;
+    while (got < len) {
+        int r = httpd_req_recv(req, p + got, len - got);
+        if (r == HTTPD_SOCK_ERR_TIMEOUT) continue;
+        if (r <= 0) return {};
+        got += r;
+    }
+    p[got] = 0;
+    return std::string_view(p, got);
+}
+
+bool HttpArena::field(std::string_view kv, std::string_view key, std::string_view& raw) {
+    while (!kv.empty()) {
+        size_t amp = kv.find('&');
+        std::string_view pair = kv.substr(0, amp);
+        size_t eq = pair.find('=');
+        if (pair.substr(0, eq) == key) {
+            raw = (eq == std::string_view::npos) ? std::string_view() : pair.substr(eq + 1);
+            return true;
+        }
+        if (amp == std::string_view::npos) break;
+        kv.remove_prefix(amp + 1);
+    }
+    return false;
+}
+
+bool HttpArena::field_u32(std::string_view kv, std::string_view key, uint32_t& out) {
+    std::string_view raw;
+    if (!field(kv, key, raw) || raw.empty()) return false;
+    uint32_t v = 0;
+    for (char c : raw) {
+        if (c < '0' || c > '9') return false;
+        v = v * 10 + (uint32_t)(c - '0');
+    }
+    out = v;
+    return true;
+}
+
+static int hex_val(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+std::string_view HttpArena::decode(HttpArena& a, std::string_view raw) {
+    char* p = (char*)a.alloc(raw.size() + 1, 1);    // Decodificado nunca es más largo
+    if (!p) return {};
+    size_t n = 0;
+    for (size_t i = 0; i < raw.size(); i++) {
+        char c = raw[i];
+        int hi, lo;
+        if (c == '+') {
+            c = ' ';
+        } else if (c == '%' && i + 2 < raw.size() &&
+                   (hi = hex_val(raw[i + 1])) >= 0 && (lo = hex_val(raw[i + 2])) >= 0) {
+            c = (char)(hi * 16 + lo);
+            i += 2;
+        }
+        p[n++] = c;
+    }
+    p[n] = 0;
+    return std::string_view(p, n);
+}
+
+bool HttpArena::send_chunk(void* req, const char* data, size_t len) {
+    return httpd_resp_send_chunk((httpd_req_t*)req, data, len) == ESP_OK;
+}
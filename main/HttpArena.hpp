@@ -0,0 +1,72 @@
+#pragma once
+#include "TextBuffer.hpp"
+#include <esp_http_server.h>
+#include <string_view>
+#include <new>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Memoria de trabajo de una petición HTTP, sin heap.
+ *
+ * Asignación por avance de puntero sobre un bloque fijo; HttpArena::Scope
+ * vuelve la marca a donde estaba al terminar el handler, así la memoria se
+ * reutiliza entera en la próxima petición y el heap no se fragmenta por
+ * tráfico web. La arena del hilo del httpd es estática (request()); los
+ * workers de HttpWorkers enlazan la suya con bind().
+ *
+ * Incluye utilidades de formulario/consulta que devuelven string_view
+ * apuntando a la arena en lugar de std::string.
+ */
+class HttpArena {
+public:
+    static constexpr size_t REQUEST_ARENA_SIZE = 8 * 1024;
+
+    HttpArena(void* mem, size_t size);
+
+    void* alloc(size_t n, size_t align = alignof(max_align_t));
+    template <typename T> T* make() {
+        void* p = alloc(sizeof(T), alignof(T));
+        return p ? new (p) T() : nullptr;
+    }
+    const char* copy(std::string_view s);   // Copia terminada en NUL (nullptr si no entra)
+    // Texto sobre el resto libre de la arena (o cap bytes); con sink, envía por tramos
+    TextBuffer text(size_t cap = 0, TextBuffer::Sink sink = nullptr, void* ctx = nullptr);
+
+    size_t used() const { return _used; }
+    size_t high_water() const { return _high; }
+    uint32_t failures() const { return _failures; }
+
+    class Scope {
+    public:
+        explicit Scope(HttpArena& a) : _arena(a), _mark(a._used) {}
+        ~Scope() { _arena._used = _mark; }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    private:
+        HttpArena& _arena;
+        size_t _mark;
+    };
+
+    static HttpArena& request();        // Arena del hilo actual (la del httpd si no hay otra)
+    static void bind(HttpArena* a);     // Arena propia del hilo que llama
+
+    // --- Formularios y consultas ---
+    static std::string_view query(httpd_req_t* req, HttpArena& a);
+    static std::string_view body(httpd_req_t* req, HttpArena& a, size_t max_len);
+    // Valor crudo (sin decodificar) de key en "a=1&b=2"
+    static bool field(std::string_view kv, std::string_view key, std::string_view& raw);
+    static bool field_u32(std::string_view kv, std::string_view key, uint32_t& out);
+    // %XX y '+' decodificados en una copia terminada en NUL
+    static std::string_view decode(HttpArena& a, std::string_view raw);
+
+    // Sink de TextBuffer: ctx es el httpd_req_t*
+    static bool send_chunk(void* req, const char* data, size_t len);
+
+private:
+    uint8_t* _mem;
+    size_t _size;
+    size_t _used = 0;
+    size_t _high = 0;
+    uint32_t _failures = 0;
+};
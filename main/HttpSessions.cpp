@@ -0,0 +1,300 @@
+#include "HttpSessions.hpp"
+#include "esp_log.h"
+#include "lwip/sockets.h"
+#include "Supervisor.hpp"
+#include <cstdio>
+#include <cstring>
+
+static const char* TAG = "HTTP_SESS";
+
+HttpSessions::Slot HttpSessions::_slot[MAX_SESSIONS] = {};
+HttpSessions::Route HttpSessions::_routes[MAX_ROUTES];
+uint8_t HttpSessions::_route_count = 0;
+bool HttpSessions::_deferred = false;
+HttpSessions::Counters HttpSessions::_stats = {};
+portMUX_TYPE HttpSessions::_mux = portMUX_INITIALIZER_UNLOCKED;
+httpd_handle_t HttpSessions::_server = nullptr;
+esp_timer_handle_t HttpSessions::_reaper = nullptr;
+
+void HttpSessions::configure(httpd_config_t& config) {
+    config.max_open_sockets = MAX_SESSIONS;
+    config.backlog_conn = BACKLOG;
+    config.lru_purge_enable = true;     // Último recurso si la tabla se llena
+    // Detecta teléfonos que salieron del alcance del AP sin cerrar el WS
+    config.keep_alive_enable = true;
+    config.keep_alive_idle = 10;
+    config.keep_alive_interval = 5;
+    config.keep_alive_count = 3;
+    config.open_fn = on_open;
+    config.close_fn = on_close;
+}
+
+void HttpSessions::attach(httpd_handle_t server) {
+    _server = server;
+    if (!_reaper) {
+        esp_timer_create_args_t args = {};
+        args.callback = [](void*) {
+            // El barrido corre en el hilo del httpd, igual que open/close
+            if (_server) httpd_queue_work(_server, reap, nullptr);
+        };
+        args.name = "http_reaper";
+        if (esp_timer_create(&args, &_reaper) != ESP_OK) return;
+    }
+    esp_timer_start_periodic(_reaper, (uint64_t)REAP_PERIOD_MS * 1000);
+    // El barrido corre en el hilo del httpd: si no llega, el servidor está trabado
+    Supervisor::watch(Supervisor::Watch::HTTPD, 4 * REAP_PERIOD_MS, 120000);
+}
+
+void HttpSessions::detach() {
+    if (_reaper) esp_timer_stop(_reaper);
+    _server = nullptr;
+}
+
+esp_err_t HttpSessions::register_uri(httpd_handle_t server, httpd_uri_t* uri) {
+    // El handler real y su histograma viajan en user_ctx; dispatch() lo llama entre begin/end
+    if (uri->handler != dispatch) {
+        if (_route_count >= MAX_ROUTES) return httpd_register_uri_handler(server, uri); // Sin medición
+        Route& r = _routes[_route_count++];
+        r.handler = uri->handler;
+        r.uri = uri->uri;
+        r.method = uri->method;
+        uri->user_ctx = &r;
+        uri->handler = dispatch;
+    }
+    return httpd_register_uri_handler(server, uri);
+}
+
+HttpSessions::Slot* HttpSessions::find(int fd) {
+    for (auto& s : _slot) {
+        if (s.kind != Kind::FREE && s.fd == fd) return &s;
+    }
+    return nullptr;
+}
+
+uint32_t HttpSessions::peer_ip(int fd) {
+    struct sockaddr_storage addr = {};
+    socklen_t len = sizeof(addr);
+    if (getpeername(fd, (struct sockaddr*)&addr, &len) != 0) return 0;
+    if (addr.ss_family == AF_INET) return ((struct sockaddr_in*)&addr)->sin_addr.s_addr;
+    // Socket IPv6 del httpd: los clientes IPv4 llegan como ::ffff:a.b.c.d
+    uint32_t ip;
+    memcpy(&ip, &((struct sockaddr_in6*)&addr)->sin6_addr.s6_addr[12], sizeof(ip));
+    return ip;
+}
+
+esp_err_t HttpSessions::on_open(httpd_handle_t hd, int fd) {
+    uint32_t ip = peer_ip(fd);
+    int64_t now = esp_timer_get_time();
+    int recycle_fd = -1;
+    bool refused = false;
+
+    portENTER_CRITICAL(&_mux);
+    uint8_t mine = 0;
+    uint16_t open = 0;
+    Slot* free_slot = nullptr;
+    Slot* oldest_idle = nullptr;
+    for (auto& s : _slot) {
+        if (s.kind == Kind::FREE) {
+            if (!free_slot) free_slot = &s;
+            continue;
+        }
+        open++;
+        if (s.ip != ip || s.kind != Kind::HTTP) continue;
+        mine++;
+        if (!s.busy && (!oldest_idle || s.last_us < oldest_idle->last_us)) oldest_idle = &s;
+    }
+    if (mine >= MAX_HTTP_PER_CLIENT) {
+        if (oldest_idle) {
+            recycle_fd = oldest_idle->fd;
+            _stats.recycled++;
+        } else {
+            refused = true;
+        }
+    }
+    if (!free_slot) refused = true;
+    if (refused) {
+        _stats.refused++;
+    } else {
+        *free_slot = Slot{fd, ip, Kind::HTTP, 0, now, now, 0};
+        _stats.accepted++;
+        if (open + 1 > _stats.peak) _stats.peak = open + 1;
+    }
+    portEXIT_CRITICAL(&_mux);
+
+    if (refused) {
+        ESP_LOGW(TAG, "fd %d rechazado: cliente sin cupo (%u conexiones ocupadas)", fd, (unsigned)mine);
+        return ESP_FAIL; // El httpd cierra el socket vía on_close
+    }
+    if (recycle_fd >= 0) httpd_sess_trigger_close(hd, recycle_fd);
+    return ESP_OK;
+}
+
+void HttpSessions::on_close(httpd_handle_t hd, int fd) {
+    portENTER_CRITICAL(&_mux);
+    Slot* s = find(fd);
+    if (s) s->kind = Kind::FREE;
+    portEXIT_CRITICAL(&_mux);
+    close(fd); // Con close_fn propio el socket lo cierra la aplicación
+}
+
+esp_err_t HttpSessions::dispatch(httpd_req_t* req) {
+    Route* route = (Route*)req->user_ctx;
+    int fd = httpd_req_to_sockfd(req);
+    begin(fd);
+    _deferred = false;
+    int64_t t0 = esp_timer_get_time();
+    Supervisor::busy(Supervisor::Watch::HTTPD, route->uri);
+    esp_err_t ret = route->handler(req);
+    Supervisor::busy(Supervisor::Watch::HTTPD, nullptr);
+    if (!_deferred) route->latency.record((uint32_t)(esp_timer_get_time() - t0));
+    end(fd);
+    return ret;
+}
+
+void HttpSessions::defer(int fd) {
+    _deferred = true;
+    begin(fd);
+}
+
+void HttpSessions::record(httpd_req_t* req, uint32_t us) {
+    // La copia async conserva user_ctx: es la misma ruta
+    Route* route = (Route*)req->user_ctx;
+    if (route >= _routes && route < _routes + _route_count) route->latency.record(us);
+}
+
+void HttpSessions::begin(int fd) {
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&_mux);
+    Slot* s = find(fd);
+    if (s) {
+        s->busy++;
+        s->requests++;
+        s->last_us = now;
+    }
+    portEXIT_CRITICAL(&_mux);
+}
+
+void HttpSessions::end(int fd) {
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&_mux);
+    Slot* s = find(fd);
+    // busy puede ya estar en 0 si el fd se reutilizó mientras un worker terminaba
+    if (s && s->busy) s->busy--;
+    if (s) s->last_us = now;
+    portEXIT_CRITICAL(&_mux);
+}
+
+bool HttpSessions::promote_ws(int fd) {
+    bool ok = false;
+    portENTER_CRITICAL(&_mux);
+    Slot* me = find(fd);
+    if (me) {
+        uint8_t total = 0, mine = 0;
+        for (const auto& s : _slot) {
+            if (s.kind != Kind::WS) continue;
+            total++;
+            if (s.ip == me->ip) mine++;
+        }
+        ok = total < MAX_WS && mine < MAX_WS_PER_CLIENT;
+        if (ok) {
+            me->kind = Kind::WS;
+        } else {
+            _stats.ws_refused++;
+        }
+    }
+    portEXIT_CRITICAL(&_mux);
+    return ok;
+}
+
+size_t HttpSessions::ws_fds(int* fds, size_t max) {
+    size_t n = 0;
+    portENTER_CRITICAL(&_mux);
+    for (const auto& s : _slot) {
+        if (s.kind == Kind::WS && n < max) fds[n++] = s.fd;
+    }
+    portEXIT_CRITICAL(&_mux);
+    return n;
+}
+
+void HttpSessions::reap(void* arg) {
+    Supervisor::checkin(Supervisor::Watch::HTTPD);
+    int idle[MAX_SESSIONS];
+    size_t n = 0;
+    int64_t limit = esp_timer_get_time() - (int64_t)IDLE_TIMEOUT_MS * 1000;
+
+    portENTER_CRITICAL(&_mux);
+    for (const auto& s : _slot) {
+        if (s.kind == Kind::HTTP && !s.busy && s.last_us < limit) idle[n++] = s.fd;
+    }
+    _stats.reaped += n;
+    portEXIT_CRITICAL(&_mux);
+
+    for (size_t i = 0; i < n; i++) httpd_sess_trigger_close(_server, idle[i]);
+}
+
+void HttpSessions::metrics(TextBuffer& out) {
+    uint16_t http = 0, ws = 0;
+    portENTER_CRITICAL(&_mux);
+    for (const auto& s : _slot) {
+        if (s.kind == Kind::HTTP) http++;
+        if (s.kind == Kind::WS) ws++;
+    }
+    Counters c = _stats;
+    portEXIT_CRITICAL(&_mux);
+
+    out.appendf("http_sessions_open %u\nhttp_sessions_ws %u\nhttp_sessions_peak %u\nhttp_sessions_accepted %u\n",
+                (unsigned)http, (unsigned)ws, (unsigned)c.peak, (unsigned)c.accepted);
+    out.appendf("http_sessions_refused %u\nhttp_sessions_recycled %u\nhttp_sessions_reaped %u\nhttp_ws_refused %u\n",
+                (unsigned)c.refused, (unsigned)c.recycled, (unsigned)c.reaped, (unsigned)c.ws_refused);
+
+    char labels[48];
+    for (uint8_t i = 0; i < _route_count; i++) {
+        snprintf(labels, sizeof(labels), "route=\"%s\"", _routes[i].uri);
+        _routes[i].latency.metrics(out, "http_request_us", labels);
+    }
+}
+
+std::string HttpSessions::latency_report() {
+    std::string out;
+    char line[112];
+    for (uint8_t i = 0; i < _route_count; i++) {
+        const Route& r = _routes[i];
+        if (!r.latency.count()) continue;
+        snprintf(line, sizeof(line), "%-4s %-14s n=%-6u p50 %7u | p90 %7u | p99 %7u | max %7u us\n",
+                 r.method == HTTP_POST ? "POST" : "GET", r.uri, (unsigned)r.latency.count(),
+                 (unsigned)r.latency.percentile(500), (unsigned)r.latency.percentile(900),
+                 (unsigned)r.latency.percentile(990), (unsigned)r.latency.max_us());
+        out += line;
+    }
+    return out;
+}
+
+void HttpSessions::reset_latency() {
+    for (uint8_t i = 0; i < _route_count; i++) _routes[i].latency.reset();
+}
+
+std::string HttpSessions::status() {
+    Slot snap[MAX_SESSIONS];
+    portENTER_CRITICAL(&_mux);
+    memcpy(snap, _slot, sizeof(snap));
+    Counters c = _stats;
+    portEXIT_CRITICAL(&_mux);
+
+    std::string out;
+    char line[112];
+    int64_t now = esp_timer_get_time();
+    for (const auto& s : snap) {
+        if (s.kind == Kind::FREE) continue;
+        const uint8_t* ip = (const uint8_t*)&s.ip;
+        snprintf(line, sizeof(line), "fd %2d %-4s %u.%u.%u.%u | %u pet. | abierta %lld s | ociosa %lld s%s\n", s.fd,
+                 s.kind == Kind::WS ? "WS" : "HTTP", ip[0], ip[1], ip[2], ip[3], (unsigned)s.requests,
+                 (long long)((now - s.open_us) / 1000000), (long long)((now - s.last_us) / 1000000),
+                 s.busy ? " | ocupada" : "");
+        out += line;
+    }
+    snprintf(line, sizeof(line), "Aceptadas %u | rechazadas %u | recicladas %u | barridas %u | WS rechazados %u | pico %u/%u\n",
+             (unsigned)c.accepted, (unsigned)c.refused, (unsigned)c.recycled, (unsigned)c.reaped,
+             (unsigned)c.ws_refused, (unsigned)c.peak, (unsigned)MAX_SESSIONS);
+    out += line;
+    return out;
+}
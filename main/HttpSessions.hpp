@@ -0,0 +1,103 @@
+#pragma once
+#include "TextBuffer.hpp"
+#include "LatencyHistogram.hpp"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include <esp_http_server.h>
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Gestión de las conexiones del portal.
+ *
+ * Se engancha al httpd por open_fn/close_fn y lleva una tabla de sesiones
+ * con la IP del cliente, el tipo (HTTP o WebSocket) y la última actividad:
+ *   - Cupo por cliente: un teléfono que abre muchas conexiones recicla las
+ *     suyas (la más vieja ociosa) en lugar de desalojar a los demás por LRU.
+ *   - Los WebSocket tienen cupo propio y no cuentan contra el de HTTP.
+ *   - Un barrido periódico cierra las conexiones HTTP ociosas; los WS
+ *     muertos los detecta el keep-alive de TCP.
+ *
+ * La actividad se marca en register_uri(), que envuelve el handler; los
+ * handlers que pasan a HttpWorkers quedan ocupados hasta terminar. El mismo
+ * envoltorio mide la latencia de cada ruta (de punta a punta si la petición
+ * pasó por un worker) para /metrics y el comando load.report.
+ */
+class HttpSessions {
+public:
+    static constexpr uint16_t MAX_SESSIONS = 10;        // + 3 sockets internos del httpd <= LWIP_MAX_SOCKETS
+    static constexpr uint16_t BACKLOG = 8;
+    static constexpr uint8_t MAX_HTTP_PER_CLIENT = 4;
+    static constexpr uint8_t MAX_WS = 4;
+    static constexpr uint8_t MAX_WS_PER_CLIENT = 2;
+    static constexpr uint32_t IDLE_TIMEOUT_MS = 15000;
+    static constexpr uint32_t REAP_PERIOD_MS = 5000;
+    static constexpr uint8_t MAX_ROUTES = 16;            // = max_uri_handlers
+
+    static void configure(httpd_config_t& config);      // Límites, keep-alive y callbacks
+    static void attach(httpd_handle_t server);          // Tras httpd_start: arranca el barrido
+    static void detach();
+    // httpd_register_uri_handler con registro de actividad (usa user_ctx)
+    static esp_err_t register_uri(httpd_handle_t server, httpd_uri_t* uri);
+
+    // Petición en curso fuera del handler (HttpWorkers): no se barre
+    static void begin(int fd);
+    static void end(int fd);
+    // Desde el hilo del httpd: la respuesta sale después (worker); la latencia la registra record()
+    static void defer(int fd);
+    static void record(httpd_req_t* req, uint32_t us);
+    // Handshake de /ws: false si el cliente o el equipo superan el cupo de WS
+    static bool promote_ws(int fd);
+    static size_t ws_fds(int* fds, size_t max);
+
+    static void metrics(TextBuffer& out);               // Líneas "clave valor" para /metrics
+    static std::string status();                        // Comando "http"
+    static std::string latency_report();                // p50/p90/p99 por ruta
+    static void reset_latency();
+
+private:
+    enum class Kind : uint8_t { FREE = 0, HTTP, WS };
+
+    struct Slot {
+        int fd;
+        uint32_t ip;            // IPv4 en orden de red (0 si no se pudo leer)
+        Kind kind;
+        uint8_t busy;           // Peticiones en curso
+        int64_t open_us;
+        int64_t last_us;
+        uint32_t requests;
+    };
+
+    struct Counters {
+        uint32_t accepted;
+        uint32_t refused;       // Cliente sin cupo y sin conexiones ociosas propias
+        uint32_t recycled;      // Conexión ociosa propia cerrada para dar lugar
+        uint32_t reaped;        // Cerradas por inactividad
+        uint32_t ws_refused;
+        uint16_t peak;
+    };
+
+    struct Route {
+        httpd_handler_t handler;
+        const char* uri;
+        httpd_method_t method;
+        LatencyHistogram latency;
+    };
+
+    static Slot _slot[MAX_SESSIONS];
+    static Route _routes[MAX_ROUTES];
+    static uint8_t _route_count;
+    static bool _deferred;              // Solo lo tocan dispatch() y defer(), en el hilo del httpd
+    static Counters _stats;
+    static portMUX_TYPE _mux;
+    static httpd_handle_t _server;
+    static esp_timer_handle_t _reaper;
+
+    static Slot* find(int fd);          // Con _mux tomado
+    static uint32_t peer_ip(int fd);
+    static esp_err_t on_open(httpd_handle_t hd, int fd);
+    static void on_close(httpd_handle_t hd, int fd);
+    static esp_err_t dispatch(httpd_req_t* req);
+    static void reap(void* arg);
+};
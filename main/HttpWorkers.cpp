@@ -0,0 +1,107 @@
+#include "HttpWorkers.hpp"
+#include "HttpArena.hpp"
+#include "HttpSessions.hpp"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+#include "TaskConfig.hpp"
+#include <cstdio>
+#include <cstdint>
+
+static const char* TAG = "HTTP_WORKERS";
+
+QueueHandle_t HttpWorkers::_queue = nullptr;
+uint32_t HttpWorkers::_done = 0;
+uint32_t HttpWorkers::_rejected = 0;
+uint32_t HttpWorkers::_max_wait_us = 0;
+uint32_t HttpWorkers::_max_run_us = 0;
+std::atomic<int> HttpWorkers::_running{0};
+
+static thread_local bool t_worker = false;
+
+bool HttpWorkers::on_worker() { return t_worker; }
+
+bool HttpWorkers::start() {
+    if (_queue) return true;
+    _queue = xQueueCreate(QUEUE_LEN, sizeof(Job));
+    if (!_queue) {
+        ESP_LOGE(TAG, "Sin memoria para la cola de peticiones");
+        return false;
+    }
+    // Core 0 junto al httpd y al WiFi; misma prioridad que el httpd para no quitarle turno
+    for (int i = 0; i < WORKERS; i++) {
+        char name[12];
+        snprintf(name, sizeof(name), "%s%d", TaskPlan::HTTP_WORKER.name, i);
+        TaskPlan::create(TaskPlan::HTTP_WORKER, worker_task, (void*)(intptr_t)i, nullptr, name);
+    }
+    ESP_LOGI(TAG, "%d workers HTTP, cola de %u", WORKERS, (unsigned)QUEUE_LEN);
+    return true;
+}
+
+esp_err_t HttpWorkers::submit(httpd_req_t* req, Handler fn) {
+    if (!_queue) return fn(req);
+
+    if (uxQueueSpacesAvailable(_queue) == 0) {
+        _rejected++;
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+        return httpd_resp_sendstr(req, "Ocupado, reintente");
+    }
+
+    Job job = {};
+    if (httpd_req_async_handler_begin(req, &job.req) != ESP_OK) {
+        ESP_LOGW(TAG, "Sin memoria para la copia async; se atiende en línea");
+        return fn(req);
+    }
+    job.fn = fn;
+    job.fd = httpd_req_to_sockfd(req);
+    job.queued_us = esp_timer_get_time();
+
+    // La sesión queda ocupada (sin barrido) hasta que el worker termine
+    HttpSessions::defer(job.fd);
+    // Solo el hilo del httpd encola, así que el hueco visto arriba sigue libre
+    if (xQueueSend(_queue, &job, 0) != pdTRUE) {
+        _rejected++;
+        httpd_resp_set_status(job.req, "503 Service Unavailable");
+        httpd_resp_sendstr(job.req, "Ocupado, reintente");
+        HttpSessions::record(job.req, (uint32_t)(esp_timer_get_time() - job.queued_us));
+        httpd_req_async_handler_complete(job.req);
+        HttpSessions::end(job.fd);
+    }
+    return ESP_OK;
+}
+
+void HttpWorkers::worker_task(void* pv) {
+    alignas(max_align_t) static uint8_t s_mem[WORKERS][WORKER_ARENA_SIZE];
+    int index = (int)(intptr_t)pv;
+    HttpArena arena(s_mem[index], WORKER_ARENA_SIZE);
+    HttpArena::bind(&arena);
+    t_worker = true;
+
+    Job job;
+    while (1) {
+        if (xQueueReceive(_queue, &job, portMAX_DELAY) != pdTRUE) continue;
+        int64_t t0 = esp_timer_get_time();
+        uint32_t wait = (uint32_t)(t0 - job.queued_us);
+        if (wait > _max_wait_us) _max_wait_us = wait;
+
+        _running++;
+        if (job.fn(job.req) != ESP_OK) ESP_LOGW(TAG, "Handler async falló: %s", job.req->uri);
+        _running--;
+        // De punta a punta: espera en la cola + ejecución
+        HttpSessions::record(job.req, (uint32_t)(esp_timer_get_time() - job.queued_us));
+        httpd_req_async_handler_complete(job.req);
+        HttpSessions::end(job.fd);
+
+        uint32_t run = (uint32_t)(esp_timer_get_time() - t0);
+        if (run > _max_run_us) _max_run_us = run;
+        _done++;
+    }
+}
+
+void HttpWorkers::metrics(TextBuffer& out) {
+    out.appendf("http_workers_done %u\nhttp_workers_rejected %u\nhttp_workers_queued %u\n",
+                (unsigned)_done, (unsigned)_rejected, _queue ? (unsigned)uxQueueMessagesWaiting(_queue) : 0u);
+    out.appendf("http_workers_max_wait_us %u\nhttp_workers_max_run_us %u\n",
+                (unsigned)_max_wait_us, (unsigned)_max_run_us);
+}
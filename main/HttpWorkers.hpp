@@ -0,0 +1,53 @@
+#pragma once
+#include "TextBuffer.hpp"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include <esp_http_server.h>
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Pool de workers para los handlers HTTP lentos.
+ *
+ * El httpd tiene un solo hilo: un handler que espera la SD, un escaneo WiFi
+ * o al ejecutor de comandos congela la página entera. Estos handlers pasan
+ * la petición a este pool con httpd_req_async_handler_begin() y el hilo del
+ * httpd queda libre para los endpoints interactivos.
+ *
+ * La cola es acotada: si está llena se responde 503 con Retry-After en el
+ * acto en lugar de acumular sockets. Cada worker tiene su propia HttpArena,
+ * que HttpArena::request() devuelve mientras corre el handler.
+ */
+class HttpWorkers {
+public:
+    using Handler = esp_err_t (*)(httpd_req_t* req);
+
+    static constexpr int WORKERS = 2;
+    static constexpr size_t QUEUE_LEN = 4;
+    static constexpr size_t WORKER_ARENA_SIZE = 4 * 1024;
+
+    static bool start();
+    // Corre fn(req) en un worker; sin pool (o sin memoria) corre en el hilo del httpd
+    static esp_err_t submit(httpd_req_t* req, Handler fn);
+    static void metrics(TextBuffer& out);   // Líneas "clave valor" para /metrics
+    static bool busy() { return _running > 0; } // Algún handler lento en curso (descarga de logs, etc.)
+    static bool on_worker();                // El hilo que llama es un worker (no el httpd)
+
+private:
+    struct Job {
+        httpd_req_t* req;       // Copia de httpd_req_async_handler_begin()
+        Handler fn;
+        int fd;
+        int64_t queued_us;
+    };
+
+    static QueueHandle_t _queue;
+    static uint32_t _done;
+    static uint32_t _rejected;
+    static uint32_t _max_wait_us;
+    static uint32_t _max_run_us;
+    static std::atomic<int> _running;
+
+    static void worker_task(void* pv);
+};
@@ -0,0 +1,175 @@
+#include "JsonWriter.hpp"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "cJSON.h"
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+// Coma antes de cada elemento salvo el primero del nivel (o si viene después de una clave)
+void JsonWriter::separator() {
+    if (_after_key) {
+        _after_key = false;
+        return;
+    }
+    if (_depth == 0) return;
+    uint32_t bit = 1u << (_depth - 1);
+    if (_has_items & bit) _out.append(',');
+    _has_items |= bit;
+}
+
+JsonWriter& JsonWriter::open(char c) {
+    separator();
+    if (_depth >= MAX_DEPTH) {
+        _error = true;
+        return *this;
+    }
+    _out.append(c);
+    _depth++;
+    _has_items &= ~(1u << (_depth - 1));
+    return *this;
+}
+
+JsonWriter& JsonWriter::close(char c) {
+    if (_depth == 0 || _after_key) {
+        _error = true;
+        return *this;
+    }
+    _depth--;
+    _out.append(c);
+    return *this;
+}
+
+JsonWriter& JsonWriter::begin_object() { return open('{'); }
+JsonWriter& JsonWriter::end_object() { return close('}'); }
+JsonWriter& JsonWriter::begin_array() { return open('['); }
+JsonWriter& JsonWriter::end_array() { return close(']'); }
+
+JsonWriter& JsonWriter::key(std::string_view k) {
+    separator();
+    _out.append('"');
+    _out.append_json_escaped(k);
+    _out.append("\":");
+    _after_key = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(std::string_view s) {
+    separator();
+    _out.append('"');
+    _out.append_json_escaped(s);
+    _out.append('"');
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(bool b) {
+    separator();
+    _out.append(b ? std::string_view("true") : std::string_view("false"));
+    return *this;
+}
+
+JsonWriter& JsonWriter::null() {
+    separator();
+    _out.append("null");
+    return *this;
+}
+
+JsonWriter& JsonWriter::value_u64(uint64_t v) {
+    separator();
+    // Conversión directa: evita el costo de vsnprintf en los arreglos grandes
+    char tmp[20];
+    size_t n = 0;
+    do {
+        tmp[sizeof(tmp) - 1 - n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    _out.append(std::string_view(tmp + sizeof(tmp) - n, n));
+    return *this;
+}
+
+JsonWriter& JsonWriter::value_i64(int64_t v) {
+    if (v >= 0) return value_u64((uint64_t)v);
+    separator();
+    _out.append('-');
+    _after_key = true;  // El número sigue pegado al signo
+    return value_u64(0 - (uint64_t)v);
+}
+
+JsonWriter& JsonWriter::value(double v, int decimals) {
+    separator();
+    // JSON no admite NaN/Inf
+    if (v != v || v > 1e300 || v < -1e300) _out.append("null");
+    else _out.appendf("%.*f", decimals, v);
+    return *this;
+}
+
+std::string JsonWriter::bench() {
+    constexpr int N = 100;
+    constexpr int ROUNDS = 50;
+    constexpr size_t CAP = 8 * 1024;
+    std::unique_ptr<char[]> buf(new (std::nothrow) char[CAP]);
+    if (!buf) return "ERROR: Sin memoria";
+
+    char ssid[N][24];
+    for (int i = 0; i < N; i++) snprintf(ssid[i], sizeof(ssid[i]), "Red \"%d\" piso-%d", i, i % 7);
+
+    // 1. JsonWriter: directo al buffer
+    size_t len_w = 0;
+    bool ok_w = true;
+    uint32_t heap0 = esp_get_free_heap_size();
+    int64_t t0 = esp_timer_get_time();
+    for (int r = 0; r < ROUNDS; r++) {
+        TextBuffer out(buf.get(), CAP);
+        JsonWriter j(out);
+        j.begin_array();
+        for (int i = 0; i < N; i++) {
+            j.begin_object().field("s", ssid[i]).field("r", -30 - i % 60).field("new", (i & 1) != 0).end_object();
+        }
+        j.end_array();
+        ok_w = ok_w && j.ok();
+        len_w = out.size();
+    }
+    int64_t t_writer = esp_timer_get_time() - t0;
+    uint32_t heap_w = heap0 - esp_get_free_heap_size();
+    std::string ref(buf.get(), len_w);
+
+    // 2. cJSON: árbol + impresión + liberación
+    size_t len_c = 0;
+    bool same = true;
+    uint32_t min_heap = esp_get_free_heap_size();
+    t0 = esp_timer_get_time();
+    for (int r = 0; r < ROUNDS; r++) {
+        cJSON* root = cJSON_CreateArray();
+        for (int i = 0; i < N; i++) {
+            cJSON* item = cJSON_CreateObject();
+            cJSON_AddStringToObject(item, "s", ssid[i]);
+            cJSON_AddNumberToObject(item, "r", -30 - i % 60);
+            cJSON_AddBoolToObject(item, "new", (i & 1) != 0);
+            cJSON_AddItemToArray(root, item);
+        }
+        uint32_t h = esp_get_free_heap_size();
+        if (h < min_heap) min_heap = h;
+        char* printed = cJSON_PrintUnformatted(root);
+        cJSON_Delete(root);
+        if (printed) {
+            len_c = strlen(printed);
+            if (r == 0) same = (ref == printed);
+            free(printed);
+        }
+    }
+    int64_t t_cjson = esp_timer_get_time() - t0;
+    uint32_t heap_c = heap0 > min_heap ? heap0 - min_heap : 0;
+
+    char line[256];
+    snprintf(line, sizeof(line),
+             "Arreglo de %d objetos, %d rondas\n"
+             "JsonWriter: %lld us/doc | %u bytes | heap +%u | %s\n"
+             "cJSON     : %lld us/doc | %u bytes | heap pico %u\n"
+             "Salida idéntica: %s | %.1fx más rápido\n",
+             N, ROUNDS, (long long)(t_writer / ROUNDS), (unsigned)len_w, (unsigned)heap_w, ok_w ? "OK" : "DESBORDE",
+             (long long)(t_cjson / ROUNDS), (unsigned)len_c, (unsigned)heap_c, same ? "sí" : "NO",
+             t_writer ? (double)t_cjson / (double)t_writer : 0.0);
+    return line;
+}
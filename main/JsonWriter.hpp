@@ -0,0 +1,61 @@
+#pragma once
+#include "TextBuffer.hpp"
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <stdint.h>
+
+/**
+ * @brief JSON en flujo sobre un TextBuffer: sin árbol intermedio ni heap.
+ *
+ * Las comas y el anidamiento se llevan con una máscara de bits por nivel;
+ * las cadenas se escapan al escribir. Si el TextBuffer tiene sink (chunk
+ * HTTP, fragmento WS) el documento puede ser más grande que el buffer.
+ *
+ *   JsonWriter j(out);
+ *   j.begin_object().field("id", 7).field("resp", texto).end_object();
+ */
+class JsonWriter {
+public:
+    static constexpr int MAX_DEPTH = 32;
+
+    explicit JsonWriter(TextBuffer& out) : _out(out) {}
+
+    JsonWriter& begin_object();
+    JsonWriter& end_object();
+    JsonWriter& begin_array();
+    JsonWriter& end_array();
+    JsonWriter& key(std::string_view k);
+
+    JsonWriter& value(std::string_view s);
+    JsonWriter& value(const char* s) { return s ? value(std::string_view(s)) : null(); }
+    JsonWriter& value(bool b);
+    JsonWriter& value(double v, int decimals = 3);
+    template <typename T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>, int> = 0>
+    JsonWriter& value(T v) {
+        if constexpr (std::is_signed_v<T>) return value_i64((int64_t)v);
+        else return value_u64((uint64_t)v);
+    }
+    JsonWriter& null();
+
+    template <typename T> JsonWriter& field(std::string_view k, T v) { return key(k).value(v); }
+
+    // Documento completo, bien cerrado y sin desbordes
+    bool ok() const { return !_error && _depth == 0 && !_out.overflow(); }
+
+    // Comparación con cJSON para un arreglo de 100 objetos (comando bench.json)
+    static std::string bench();
+
+private:
+    TextBuffer& _out;
+    uint32_t _has_items = 0;    // Bit n: el nivel n ya tiene al menos un elemento
+    uint8_t _depth = 0;
+    bool _after_key = false;
+    bool _error = false;
+
+    void separator();
+    JsonWriter& open(char c);
+    JsonWriter& close(char c);
+    JsonWriter& value_i64(int64_t v);
+    JsonWriter& value_u64(uint64_t v);
+};
@@ -0,0 +1,88 @@
+#include "LatencyHistogram.hpp"
+#include <cstring>
+
+static int bucket_of(uint32_t us) {
+    int k = us ? 32 - __builtin_clz(us) : 0;
+    return k < LatencyHistogram::BUCKETS ? k : LatencyHistogram::BUCKETS - 1;
+}
+
+void LatencyHistogram::record(uint32_t us) {
+    int k = bucket_of(us);
+    portENTER_CRITICAL(&_mux);
+    _bucket[k]++;
+    _count++;
+    _sum += us;
+    if (us > _max) _max = us;
+    portEXIT_CRITICAL(&_mux);
+}
+
+void LatencyHistogram::reset() {
+    portENTER_CRITICAL(&_mux);
+    memset(_bucket, 0, sizeof(_bucket));
+    _count = 0;
+    _max = 0;
+    _sum = 0;
+    portEXIT_CRITICAL(&_mux);
+}
+
+void LatencyHistogram::snapshot(Snapshot& s) const {
+    portENTER_CRITICAL(&_mux);
+    memcpy(s.bucket, _bucket, sizeof(s.bucket));
+    s.count = _count;
+    s.max = _max;
+    s.sum = _sum;
+    portEXIT_CRITICAL(&_mux);
+}
+
+uint32_t LatencyHistogram::percentile(const Snapshot& s, uint32_t per_mille) {
+    if (s.count == 0) return 0;
+    uint64_t target = ((uint64_t)s.count * per_mille + 999) / 1000;
+    if (target == 0) target = 1;
+    uint64_t seen = 0;
+    for (int k = 0; k < BUCKETS; k++) {
+        if (seen + s.bucket[k] < target) {
+            seen += s.bucket[k];
+            continue;
+        }
+        if (k == 0) return 0;
+        if (k == BUCKETS - 1) return s.max;
+        // Interpolación lineal dentro de [2^(k-1), 2^k)
+        uint32_t lower = 1u << (k - 1);
+        uint32_t v = lower + (uint32_t)((uint64_t)(lower - 1) * (target - seen) / s.bucket[k]);
+        return v < s.max ? v : s.max;
+    }
+    return s.max;
+}
+
+uint32_t LatencyHistogram::count() const {
+    portENTER_CRITICAL(&_mux);
+    uint32_t c = _count;
+    portEXIT_CRITICAL(&_mux);
+    return c;
+}
+
+uint32_t LatencyHistogram::max_us() const {
+    portENTER_CRITICAL(&_mux);
+    uint32_t m = _max;
+    portEXIT_CRITICAL(&_mux);
+    return m;
+}
+
+uint32_t LatencyHistogram::percentile(uint32_t per_mille) const {
+    Snapshot s;
+    snapshot(s);
+    return percentile(s, per_mille);
+}
+
+void LatencyHistogram::metrics(TextBuffer& out, const char* name, const char* labels) const {
+    Snapshot s;
+    snapshot(s);
+    const char* sep = labels[0] ? "," : "";
+    out.appendf("%s_count{%s} %u\n%s_sum{%s} %llu\n", name, labels, (unsigned)s.count, name, labels,
+                (unsigned long long)s.sum);
+    static const struct { const char* q; uint32_t per_mille; } QS[] = { {"0.5", 500}, {"0.9", 900}, {"0.99", 990} };
+    for (const auto& q : QS) {
+        out.appendf("%s{%s%sq=\"%s\"} %u\n", name, labels, sep, q.q, (unsigned)percentile(s, q.per_mille));
+    }
+    out.appendf("%s_max{%s} %u\n", name, labels, (unsigned)s.max);
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "TextBuffer.hpp"
+#include "freertos/FreeRTOS.h"
+#include <stdint.h>
+
+/**
+ * @brief Histograma de latencias en cubetas log2 de microsegundos.
+ *
+ * La cubeta k cuenta los valores en [2^(k-1), 2^k) us; la última queda
+ * abierta. Registrar cuesta un clz y un incremento, así que se puede usar
+ * en el tick de control y en cada petición HTTP. Los percentiles se
+ * interpolan dentro de la cubeta: el error queda acotado por su ancho.
+ */
+class LatencyHistogram {
+public:
+    static constexpr int BUCKETS = 25;      // Hasta ~16 s
+
+    void record(uint32_t us);
+    void reset();
+
+    uint32_t count() const;
+    uint32_t max_us() const;
+    uint32_t percentile(uint32_t per_mille) const;
+
+    // name_count, name{q="0.5|0.9|0.99"} y name_max; labels sin llaves (puede ser "")
+    void metrics(TextBuffer& out, const char* name, const char* labels = "") const;
+
+private:
+    struct Snapshot {
+        uint32_t bucket[BUCKETS];
+        uint32_t count;
+        uint32_t max;
+        uint64_t sum;
+    };
+
+    mutable portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+    uint32_t _bucket[BUCKETS] = {};
+    uint32_t _count = 0;
+    uint32_t _max = 0;
+    uint64_t _sum = 0;
+
+    void snapshot(Snapshot& s) const;
+    static uint32_t percentile(const Snapshot& s, uint32_t per_mille);
+};
@@ -5,7 +5,18 @@
 #include "driver/spi_common.h"
 #include "sdmmc_cmd.h"
 #include "mcp23017.hpp"
+#include "Supervisor.hpp"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "nvs_flash.h"
+#include "TaskConfig.hpp"
 #include <cstdio>
+#include <cstring>
+#include <cstdarg>
+#include <cerrno>
 #include <sys/unistd.h>
 #include <sys/stat.h>
 
@@ -19,6 +30,19 @@ extern MCP23017* g_mcp_2;
 #define SD_SCK      GPIO_NUM_12
 #define SD_CS_INDEX 13 // GPB5
 #define SD_CD_INDEX 14 // GPB6
+// #define SD_CS_GPIO GPIO_NUM_x  -> CS cableado a un pin nativo (ver LoggerFS.hpp)
+
+static constexpr uint32_t SD_KHZ_NATIVE = 20000;    // SDMMC_FREQ_DEFAULT
+static constexpr uint32_t SD_KHZ_HELD = 10000;      // CS fijo por MCP: se verifica al montar
+static constexpr uint32_t SD_KHZ_SAFE = 1000;       // Valor histórico, siempre funcionó
+static constexpr size_t SELF_TEST_BYTES = 64 * 1024;
+static constexpr size_t LOG_LINE_MAX = 256;
+static constexpr uint32_t SEQ_RESERVE = 256;        // Secuencias reservadas por escritura en NVS
+static constexpr long SEQ_TAIL_BYTES = 512;         // Cola leída al arrancar (> 1 línea completa)
+static constexpr long SEQ_SCAN_BYTES = 1024;        // Debajo de esto la búsqueda pasa a lineal
+static constexpr uint32_t WATCH_DEADLINE_MS = 5000; // flush_task da pulso cada 500 ms
+
+static LoggerFS* s_supervised = nullptr;            // Para el hook del Supervisor (puntero a función)
 
 LoggerFS::LoggerFS(const char* base_path) : _base_path(base_path) {
     _full_path = std::string(base_path) + "/rect_log.csv";
@@ -35,25 +59,99 @@ bool LoggerFS::is_card_inserted() {
     return (level == false); 
 }
 
-bool LoggerFS::begin() {
-    if (!is_card_inserted()) {
-        ESP_LOGE(TAG, "No se detecta tarjeta SD en GPB6. Abortando montaje.");
-        return false;
-    }
-
-    ESP_LOGI(TAG, "Iniciando montaje de SD en %s...", _base_path.c_str());
-
+/**
+ * @brief Monta FatFS a khz. allow_format solo a la velocidad segura: una tarjeta que a
+ * velocidad alta devuelve sectores corruptos no debe perder el log por un formateo.
+ */
+bool LoggerFS::mount(uint32_t khz, bool allow_format) {
     esp_vfs_fat_sdmmc_mount_config_t mount_config = {
-        .format_if_mount_failed = true,
-        .max_files = 5,
-        .allocation_unit_size = 16 * 1024,
+        .format_if_mount_failed = allow_format,
+        .max_files = 12,            // Log + 3 niveles de historial + spool del uplink + lecturas del portal
+        .allocation_unit_size = IO_CHUNK,
         .disk_status_check_enable = false,
         .use_one_fat = false
     };
 
     sdmmc_host_t host = SDSPI_HOST_DEFAULT();
     host.slot = SPI2_HOST; // Bus SPI2 (Pines 11, 12, 13)
-    host.max_freq_khz = 1000; // REDUCIR A 5MHz para estabilidad con CS en MCP23017
+    host.max_freq_khz = khz;
+
+    sdspi_device_config_t slot_config = SDSPI_DEVICE_CONFIG_DEFAULT();
+#ifdef SD_CS_GPIO
+    slot_config.gpio_cs = (gpio_num_t)SD_CS_GPIO;
+#else
+    slot_config.gpio_cs = GPIO_NUM_NC; // CS no es un pin local del ESP32
+#endif
+    slot_config.host_id = (spi_host_device_t)host.slot;
+
+    // --- OPCIONAL: SOLO SI LA TARJETA ESTÁ CORRUPTA ---
+    // Si necesitas forzar un formateo manual porque nada funciona, descomenta la siguiente línea:
+    //esp_vfs_fat_sdcard_format(_base_path.c_str(), &host, &slot_config);
+
+    sdmmc_card_t* card = nullptr;
+    esp_err_t ret = esp_vfs_fat_sdspi_mount(_base_path.c_str(), &host, &slot_config, &mount_config, &card);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Fallo al montar FatFS a %u kHz: %s", (unsigned)khz, esp_err_to_name(ret));
+        return false;
+    }
+    _card = card;
+    _sd_khz = khz;
+    return true;
+}
+
+/**
+ * @brief Escribe y relee SELF_TEST_BYTES en trozos de IO_CHUNK; false si los datos no vuelven iguales.
+ */
+bool LoggerFS::self_test() {
+    // Nombre 8.3: con CONFIG_FATFS_LFN_NONE FatFs rechaza nombres largos o con punto inicial
+    std::string path = _base_path + "/IOTEST.TMP";
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) {
+        ESP_LOGE(TAG, "Prueba de E/S: no se pudo crear %s (errno %d)", path.c_str(), errno);
+        return false;
+    }
+    setvbuf(f, NULL, _IONBF, 0);
+
+    const size_t chunks = SELF_TEST_BYTES / IO_CHUNK;
+    bool ok = true;
+    int64_t t0 = esp_timer_get_time();
+    for (size_t i = 0; i < chunks && ok; i++) {
+        memset(_wbuf, (int)(0xA5 ^ i), IO_CHUNK);
+        ok = fwrite(_wbuf, IO_CHUNK, 1, f) == 1;
+    }
+    fsync(fileno(f));
+    int64_t t_write = esp_timer_get_time() - t0;
+    fclose(f);
+
+    f = ok ? fopen(path.c_str(), "r") : nullptr;
+    if (f) {
+        setvbuf(f, NULL, _IONBF, 0);
+        t0 = esp_timer_get_time();
+        for (size_t i = 0; i < chunks && ok; i++) {
+            ok = fread(_wbuf, IO_CHUNK, 1, f) == 1 &&
+                 (uint8_t)_wbuf[0] == (uint8_t)(0xA5 ^ i) && (uint8_t)_wbuf[IO_CHUNK - 1] == (uint8_t)(0xA5 ^ i);
+        }
+        int64_t t_read = esp_timer_get_time() - t0;
+        fclose(f);
+        if (ok) {
+            _bench_write_kbps = (uint32_t)((uint64_t)SELF_TEST_BYTES * 1000000 / 1024 / (t_write ? t_write : 1));
+            _bench_read_kbps = (uint32_t)((uint64_t)SELF_TEST_BYTES * 1000000 / 1024 / (t_read ? t_read : 1));
+        }
+    }
+    unlink(path.c_str());
+
+    ESP_LOGI(TAG, "Prueba de E/S a %u kHz: %s | escritura %u KB/s | lectura %u KB/s", (unsigned)_sd_khz,
+             ok ? "OK" : "FALLO", (unsigned)_bench_write_kbps, (unsigned)_bench_read_kbps);
+    return ok;
+}
+
+bool LoggerFS::begin() {
+    if (!is_card_inserted()) {
+        ESP_LOGE(TAG, "No se detecta tarjeta SD en GPB6. Abortando montaje.");
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Iniciando montaje de SD en %s...", _base_path.c_str());
 
     spi_bus_config_t bus_cfg = {
         .mosi_io_num = SD_MOSI,
@@ -64,108 +162,520 @@ bool LoggerFS::begin() {
         .max_transfer_sz = 4000,
     };
 
-    sdspi_device_config_t slot_config = SDSPI_DEVICE_CONFIG_DEFAULT();
-    slot_config.gpio_cs = GPIO_NUM_NC; // CS no es un pin local del ESP32
-    slot_config.host_id = (spi_host_device_t)host.slot;
-
     // 3. Inicializar el bus SPI
-    esp_err_t ret = spi_bus_initialize((spi_host_device_t)host.slot, &bus_cfg, SDSPI_DEFAULT_DMA);
+    esp_err_t ret = spi_bus_initialize(SPI2_HOST, &bus_cfg, SDSPI_DEFAULT_DMA);
     if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) return false;
 
-    // --- OPCIONAL: SOLO SI LA TARJETA ESTÁ CORRUPTA ---
-    // Si necesitas forzar un formateo manual porque nada funciona, descomenta la siguiente línea:
-    //esp_vfs_fat_sdcard_format(_base_path.c_str(), &host, &slot_config);
-
-    sdmmc_card_t* card;
-    ret = esp_vfs_fat_sdspi_mount(_base_path.c_str(), &host, &slot_config, &mount_config, &card);
+#ifdef SD_CS_GPIO
+    _cs_native = true;
+    uint32_t fast_khz = SD_KHZ_NATIVE;
+#else
+    // El bus es solo de la SD: se selecciona una vez y el CS queda fijo en 0,
+    // en vez de una transacción I2C por escritura.
+    g_mcp_2->pin_mode(SD_CS_INDEX, 0);
+    g_mcp_2->digital_write(SD_CS_INDEX, 0);
+    uint32_t fast_khz = SD_KHZ_HELD;
+#endif
 
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Fallo al montar FatFS: %s", esp_err_to_name(ret));
+    // Buffer de escritura: capacidad DMA para que FatFS transfiera sectores completos sin copia
+    if (!_wbuf) _wbuf = (char*)heap_caps_malloc(IO_CHUNK + LOG_LINE_MAX, MALLOC_CAP_DMA);
+    if (!_wbuf) {
+        ESP_LOGE(TAG, "Sin memoria para el buffer de la SD");
         return false;
     }
 
-    // ÉXITO: Dejamos el CS en 0 si es bus dedicado para evitar latencias de I2C
-    ESP_LOGI(TAG, "SD montada con éxito a 1MHz.");
-    sdmmc_card_print_info(stdout, card);
+    // Velocidad alta con verificación; si falla, el 1 MHz conocido
+    bool ok = mount(fast_khz, false);
+    _fast_ok = ok && self_test();
+    if (ok && !_fast_ok) {
+        esp_vfs_fat_sdcard_unmount(_base_path.c_str(), (sdmmc_card_t*)_card);
+        _card = nullptr;
+        ok = false;
+    }
+    if (!ok) {
+        ESP_LOGW(TAG, "Reintentando montaje a %u kHz", (unsigned)SD_KHZ_SAFE);
+        ok = mount(SD_KHZ_SAFE, true);
+        if (ok) self_test();
+    }
+    if (!ok) return false;
+
+    ESP_LOGI(TAG, "SD montada a %u kHz (CS %s, %s).", (unsigned)_sd_khz, _cs_native ? "nativo" : "fijo por MCP",
+             _fast_ok ? "velocidad alta verificada" : "respaldo seguro");
+    sdmmc_card_print_info(stdout, (sdmmc_card_t*)_card);
+
+    // 6. Abrir (o crear) el archivo de logs
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        recover_seq();
+        if (!open_log()) return false;
+    }
 
-    // 6. Verificar o crear el archivo de logs
+    TaskPlan::create(TaskPlan::SD_FLUSH, flush_task, this);
+    // Sin reinicio: una SD colgada no justifica cortar la carga; se deja de esperarla
+    s_supervised = this;
+    Supervisor::watch(Supervisor::Watch::LOGGER, WATCH_DEADLINE_MS, 0,
+                      [](bool stalled) { s_supervised->set_degraded(stalled); });
+    _ready = true;
+    return true;
+}
+
+bool LoggerFS::open_log() {
+    _file = fopen(_full_path.c_str(), "a");
+    if (!_file) {
+        ESP_LOGE(TAG, "No se pudo abrir %s", _full_path.c_str());
+        return false;
+    }
+    // Sin buffer de stdio: el alineado lo maneja _wbuf
+    setvbuf(_file, NULL, _IONBF, 0);
     struct stat st;
-    if (stat(_full_path.c_str(), &st) != 0) {
-        writeHeader();
+    _file_off = (stat(_full_path.c_str(), &st) == 0) ? st.st_size : 0;
+    if (_file_off == 0) writeHeader();
+    return true;
+}
+
+/**
+ * @brief Escribe todo lo pendiente (aunque no complete un trozo alineado). Requiere _mutex.
+ */
+void LoggerFS::write_out(bool sync) {
+    if (!_file && !open_log()) return;
+    if (_wlen) {
+        Supervisor::busy(Supervisor::Watch::LOGGER, "escritura SD");
+        size_t written = fwrite(_wbuf, 1, _wlen, _file);
+        Supervisor::busy(Supervisor::Watch::LOGGER, nullptr);
+        if (written != _wlen) {
+            _write_errors++;
+            fclose(_file);
+            _file = nullptr;    // Se reabre en la próxima escritura
+        } else {
+            _file_off += _wlen;
+        }
+        _wlen = 0;
     }
-    
+    if (sync && _file) {
+        Supervisor::busy(Supervisor::Watch::LOGGER, "fsync SD");
+        fsync(fileno(_file));
+        Supervisor::busy(Supervisor::Watch::LOGGER, nullptr);
+        _flushes++;
+    }
+}
+
+/**
+ * @brief Retoma la secuencia de la última línea en la tarjeta (actual o .old).
+ *
+ * El piso en NVS cubre el cambio de tarjeta o un historial borrado: nunca se
+ * reusa un número que un colector pudo haber visto.
+ */
+void LoggerFS::recover_seq() {
+    uint32_t floor_seq = 0;
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open("storage", NVS_READONLY, &handle);
+    if (err == ESP_OK) {
+        nvs_get_u32(handle, "log_seq", &floor_seq);
+        nvs_close(handle);
+    } else if (err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGW(TAG, "Sin piso de secuencia en NVS: %s", esp_err_to_name(err));
+    }
+    uint32_t last = tail_seq(_full_path);
+    if (!last) last = tail_seq(_old_path);
+    // El piso manda aunque la tarjeta tenga datos: una tarjeta más vieja no hace reusar números.
+    // Tras un reinicio normal la secuencia salta hasta SEQ_RESERVE; los colectores solo piden "> N"
+    _seq = std::max(last, floor_seq ? floor_seq - 1 : 0u);
+    _seq_reserved = floor_seq;
+    ESP_LOGI(TAG, "Secuencia del log: %u (última en tarjeta %u, piso NVS %u)", (unsigned)_seq, (unsigned)last,
+             (unsigned)floor_seq);
+}
+
+uint32_t LoggerFS::next_seq() {
+    if (++_seq >= _seq_reserved) {
+        _seq_reserved = _seq + SEQ_RESERVE;
+        nvs_handle_t handle;
+        if (nvs_open("storage", NVS_READWRITE, &handle) == ESP_OK) {
+            nvs_set_u32(handle, "log_seq", _seq_reserved);
+            nvs_commit(handle);
+            nvs_close(handle);
+        }
+    }
+    return _seq;
+}
+
+/**
+ * @brief Secuencia de la última línea completa de path (0 si no hay).
+ */
+uint32_t LoggerFS::tail_seq(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f) return 0;
+    char buf[SEQ_TAIL_BYTES + 1];
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    long off = size > SEQ_TAIL_BYTES ? size - SEQ_TAIL_BYTES : 0;
+    fseek(f, off, SEEK_SET);
+    size_t n = fread(buf, 1, SEQ_TAIL_BYTES, f);
+    fclose(f);
+
+    uint32_t last = 0;
+    std::string_view tail(buf, n);
+    size_t pos = off ? tail.find('\n') : 0;   // La primera línea puede estar cortada
+    while (pos != std::string_view::npos && pos < tail.size()) {
+        if (tail[pos] == '\n') pos++;
+        size_t eol = tail.find('\n', pos);
+        if (eol == std::string_view::npos) break;      // Línea sin terminar: se descarta
+        LogRecord rec;
+        if (parse_line(tail.substr(pos, eol - pos), rec)) last = rec.seq;
+        pos = eol;
+    }
+    return last;
+}
+
+/**
+ * @brief Separa "seq,fecha,0xCODE,valor,nota" (nota puede tener comas). false en cabecera o formato viejo.
+ */
+bool LoggerFS::parse_line(std::string_view line, LogRecord& rec) {
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    size_t c1 = line.find(',');
+    if (c1 == 0 || c1 == std::string_view::npos || c1 > 10) return false;
+    uint32_t seq = 0;
+    for (size_t i = 0; i < c1; i++) {
+        if (line[i] < '0' || line[i] > '9') return false;
+        seq = seq * 10 + (uint32_t)(line[i] - '0');
+    }
+    size_t c2 = line.find(',', c1 + 1);
+    if (c2 == std::string_view::npos) return false;
+    size_t c3 = line.find(',', c2 + 1);
+    if (c3 == std::string_view::npos) return false;
+    size_t c4 = line.find(',', c3 + 1);
+    if (c4 == std::string_view::npos) return false;
+    rec.seq = seq;
+    rec.fecha = line.substr(c1 + 1, c2 - c1 - 1);
+    rec.codigo = line.substr(c2 + 1, c3 - c2 - 1);
+    rec.valor = line.substr(c3 + 1, c4 - c3 - 1);
+    rec.nota = line.substr(c4 + 1);
     return true;
 }
 
-void LoggerFS::registrarEstructurado(RectEvent evento, std::string valor, std::string nota) {
-    if (!is_card_inserted()) return;
+/**
+ * @brief Primera secuencia del archivo; data_off queda en el inicio de esa línea.
+ */
+uint32_t LoggerFS::first_seq(FILE* f, long& data_off) {
+    char line[LOG_LINE_MAX + 8];
+    fseek(f, 0, SEEK_SET);
+    for (int i = 0; i < 4; i++) {       // Cabecera y, en tarjetas viejas, líneas sin secuencia
+        long off = ftell(f);
+        if (!fgets(line, sizeof(line), f)) break;
+        LogRecord rec;
+        if (parse_line(std::string_view(line, strcspn(line, "\n")), rec)) {
+            data_off = off;
+            return rec.seq;
+        }
+    }
+    return 0;
+}
 
-    std::lock_guard<std::mutex> lock(_mutex);
-    checkRotation();
+/**
+ * @brief Offset de una línea con seq <= after (o el inicio) desde donde el recorrido lineal es corto.
+ *
+ * Bisección por offset: las líneas están ordenadas por secuencia dentro de cada archivo.
+ */
+long LoggerFS::seek_after(FILE* f, long size, uint32_t after) {
+    char line[LOG_LINE_MAX + 8];
+    long lo = 0, hi = size;
+    while (hi - lo > SEQ_SCAN_BYTES) {
+        long mid = lo + (hi - lo) / 2;
+        fseek(f, mid, SEEK_SET);
+        if (!fgets(line, sizeof(line), f)) break;       // Resto de la línea cortada
+        long start = ftell(f);
+        LogRecord rec;
+        if (start >= hi || !fgets(line, sizeof(line), f) ||
+            !parse_line(std::string_view(line, strcspn(line, "\n")), rec)) {
+            hi = mid;
+            continue;
+        }
+        if (rec.seq <= after) lo = start;
+        else hi = mid;
+    }
+    return lo;
+}
 
-    // ACTIVAR CS (LOW)
-    g_mcp_2->digital_write(SD_CS_INDEX, 0);
+LoggerFS::SinceResult LoggerFS::read_since(uint32_t after, size_t max, RecordCallback cb, void* ctx) {
+    SinceResult res = {after, 0, 0, false, false};
+    if (!_ready) return res;
+    flush();
+    // La rotación espera mientras haya lectores: el .old no cambia bajo los pies.
+    // Se anota bajo _mutex (el mismo de checkRotation): una rotación ya empezada
+    // termina antes, y ninguna empieza entre este punto y el fopen del .old.
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _readers++;
+    }
+
+    char line[LOG_LINE_MAX + 8];
+    const std::string* paths[2] = {&_old_path, &_full_path};
+    for (const std::string* path : paths) {
+        if (res.more) break;
+        FILE* f = fopen(path->c_str(), "r");
+        if (!f) continue;
+        long data_off = 0;
+        uint32_t first = first_seq(f, data_off);
+        if (!first) {
+            fclose(f);
+            continue;
+        }
+        if (!res.first) res.first = first;
 
-    FILE* f = fopen(_full_path.c_str(), "a");
-    if (f != NULL) {
-        fprintf(f, "%s,0x%04X,%s,%s\n", 
-                getLimaTimestamp().c_str(),
-                static_cast<uint16_t>(evento),
-                valor.empty() ? "-" : valor.c_str(),
-                nota.empty() ? "-" : nota.c_str());
+        long off = data_off;
+        if (first <= after) {
+            fseek(f, 0, SEEK_END);
+            long found = seek_after(f, ftell(f), after);
+            if (found > off) off = found;
+        }
+        fseek(f, off, SEEK_SET);
+        while (fgets(line, sizeof(line), f)) {
+            size_t len = strlen(line);
+            if (line[len - 1] != '\n') break;   // Línea a medio escribir: entra en la próxima consulta
+            LogRecord rec;
+            if (!parse_line(std::string_view(line, len - 1), rec) || rec.seq <= res.next) continue;
+            if (res.count >= max) {
+                res.more = true;
+                break;
+            }
+            if (!cb(rec, ctx)) {
+                res.more = true;
+                break;
+            }
+            res.next = rec.seq;
+            res.count++;
+        }
         fclose(f);
     }
+    _readers--;
+    res.gap = res.first && after + 1 < res.first;
+    return res;
+}
+
+void LoggerFS::flush() {
+    if (!_ready) return;
+    std::unique_lock<std::mutex> lock(_mutex, std::defer_lock);
+    if (!lock_or_drop(lock)) return;
+    write_out(true);
+}
+
+/**
+ * @brief Toma _mutex; en modo degradado solo si está libre (false = no esperar a la SD).
+ */
+bool LoggerFS::lock_or_drop(std::unique_lock<std::mutex>& lock) {
+    if (!_degraded) {
+        lock.lock();
+        return true;
+    }
+    return lock.try_lock();
+}
+
+void LoggerFS::flush_task(void* pv) {
+    LoggerFS* self = (LoggerFS*)pv;
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(500));
+        std::lock_guard<std::mutex> lock(self->_mutex);
+        Supervisor::checkin(Supervisor::Watch::LOGGER); // Sin pulso = algo retiene la SD
+        if (self->_wlen && esp_timer_get_time() - self->_pending_since_us >= (int64_t)FLUSH_MS * 1000) {
+            self->write_out(true);
+        }
+    }
+}
+
+void LoggerFS::registrarEstructurado(RectEvent evento, std::string_view valor, std::string_view nota) {
+    if (_tap) _tap(evento, valor, nota); // También sin tarjeta: el colector no depende de la SD
+    if (!_ready || !is_card_inserted()) return;
+    if (valor.empty()) valor = "-";
+    if (nota.empty()) nota = "-";
+
+    std::unique_lock<std::mutex> lock(_mutex, std::defer_lock);
+    if (!lock_or_drop(lock)) {
+        _dropped++;
+        return;
+    }
+    checkRotation();
+    if (!_file && !open_log()) return;
+
+    // La línea se arma en su lugar dentro de _wbuf (siempre queda LOG_LINE_MAX libre)
+    if (_wlen == 0) _pending_since_us = esp_timer_get_time();
+    char* line = _wbuf + _wlen;
+    size_t n = (size_t)snprintf(line, LOG_LINE_MAX, "%u,", (unsigned)next_seq());
+    n += format_timestamp(line + n, LOG_LINE_MAX - n);
+    int m = snprintf(line + n, LOG_LINE_MAX - n, ",0x%04X,%.*s,%.*s\n", static_cast<uint16_t>(evento),
+                     (int)valor.size(), valor.data(), (int)nota.size(), nota.data());
+    if (m <= 0) return;
+    n += (size_t)m;
+    if (n >= LOG_LINE_MAX) {
+        n = LOG_LINE_MAX - 1;
+        line[n - 1] = '\n';
+    }
+    _wlen += n;
+
+    // Solo trozos completos y alineados al cluster; el resto espera en RAM
+    size_t room = IO_CHUNK - (size_t)(_file_off % IO_CHUNK);
+    if (_wlen >= room) {
+        Supervisor::busy(Supervisor::Watch::LOGGER, "escritura SD");
+        size_t written = fwrite(_wbuf, 1, room, _file);
+        Supervisor::busy(Supervisor::Watch::LOGGER, nullptr);
+        if (written == room) {
+            _file_off += room;
+            _chunks_written++;
+        } else {
+            _write_errors++;
+        }
+        memmove(_wbuf, _wbuf + room, _wlen - room);
+        _wlen -= room;
+        _pending_since_us = esp_timer_get_time();
+    }
+
+    // Los eventos críticos no esperan al vaciado periódico
+    const RectEventInfo* info = rect_event_info(evento);
+    if (info && info->critico) write_out(true);
+}
+
+void LoggerFS::registrarf(RectEvent evento, std::string_view valor, const char* fmt, ...) {
+    if (!_ready && !_tap) return; // Sin SD el colector igual recibe el evento
+    char nota[160];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(nota, sizeof(nota), fmt, args);
+    va_end(args);
+    if (n < 0) n = 0;
+    registrarEstructurado(evento, valor, std::string_view(nota, std::min((size_t)n, sizeof(nota) - 1)));
+}
+
+void LoggerFS::diferirf(RectEvent evento, std::string_view valor, const char* fmt, ...) {
+    if (!_defer_q) {
+        _defer_dropped++;
+        return;
+    }
+    Deferred d;
+    d.evento = evento;
+    size_t vn = std::min(valor.size(), sizeof(d.valor) - 1);
+    memcpy(d.valor, valor.data(), vn);
+    d.valor[vn] = 0;
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(d.nota, sizeof(d.nota), fmt, args);
+    va_end(args);
+    if (xQueueSend((QueueHandle_t)_defer_q, &d, 0) != pdTRUE) _defer_dropped++;
+}
+
+bool LoggerFS::start_deferred() {
+    if (_defer_q) return true;
+    _defer_q = xQueueCreate(DEFER_DEPTH, sizeof(Deferred));
+    if (!_defer_q || TaskPlan::create(TaskPlan::LOG_DEFER, defer_task, this) != pdPASS) {
+        ESP_LOGE(TAG, "No se pudo crear la cola de eventos diferidos");
+        return false;
+    }
+    return true;
+}
+
+// Core 0: el fsync de los eventos críticos y el colector corren aquí, no en quien los generó
+void LoggerFS::defer_task(void* pv) {
+    LoggerFS* self = (LoggerFS*)pv;
+    Deferred d;
+    while (1) {
+        if (xQueueReceive((QueueHandle_t)self->_defer_q, &d, portMAX_DELAY) != pdTRUE) continue;
+        self->registrarEstructurado(d.evento, d.valor, d.nota);
+    }
 }
 
 void LoggerFS::limpiarLog() {
-    if (!is_card_inserted()) return;
+    if (!_ready || !is_card_inserted()) return;
     
     std::lock_guard<std::mutex> lock(_mutex);
-    
-    writeHeader(); 
+    // Un read_since en curso tiene el archivo abierto: se le da un momento para terminar
+    for (int i = 0; i < 200 && _readers > 0; i++) vTaskDelay(pdMS_TO_TICKS(10));
+
+    _wlen = 0;
+    if (_file) fclose(_file);
+    _file = nullptr;
+    unlink(_full_path.c_str());
+    if (!open_log()) return;
 
     // Registrar el rastro del borrado
-    FILE* f = fopen(_full_path.c_str(), "a");
-    if (f) {
-        fprintf(f, "%s,0x0601,USER,Historial reiniciado por el usuario\n", getLimaTimestamp().c_str());
-        fclose(f);
-    }
+    size_t n = (size_t)snprintf(_wbuf + _wlen, LOG_LINE_MAX, "%u,", (unsigned)next_seq());
+    n += format_timestamp(_wbuf + _wlen + n, LOG_LINE_MAX - n);
+    int m = snprintf(_wbuf + _wlen + n, LOG_LINE_MAX - n, ",0x0601,USER,Historial reiniciado por el usuario\n");
+    if (m > 0) _wlen += std::min(n + (size_t)m, LOG_LINE_MAX - 1);
+    write_out(true);
     ESP_LOGW(TAG, "Log en SD reiniciado.");
 }
 
 void LoggerFS::writeHeader() {
-    FILE* f = fopen(_full_path.c_str(), "w");
-    if (f) {
-        fprintf(f, "Fecha_Hora,EventID,Valor,Nota\n");
-        fclose(f);
-    }
+    static const char header[] = "Seq,Fecha_Hora,EventID,Valor,Nota\n";
+    memcpy(_wbuf + _wlen, header, sizeof(header) - 1);
+    _wlen += sizeof(header) - 1;
+    if (_wlen == sizeof(header) - 1) _pending_since_us = esp_timer_get_time();
 }
 
-std::string LoggerFS::getLimaTimestamp() {
-    time_t now;
-    struct tm timeinfo;
-    time(&now);
-    localtime_r(&now, &timeinfo);
-    
-    char buf[64];
-    // [L] Local (sin sincronizar), [S] Sincronizado por NTP
-    const char* tag = (timeinfo.tm_year < (2024 - 1900)) ? "[L]" : "[S]";
-    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &timeinfo);
-    return std::string(tag) + " " + std::string(buf);
+std::string LoggerFS::io_status() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    char buf[320];
+    snprintf(buf, sizeof(buf),
+             "SD: %s a %u kHz (%s), CS %s\n"
+             "Prueba al montar: escritura %u KB/s | lectura %u KB/s\n"
+             "Log: %ld bytes en tarjeta, %u en RAM | trozos de %u KB %u | vaciados %u | errores %u | descartadas %u%s\n",
+             _ready ? "montada" : "sin montar", (unsigned)_sd_khz, _fast_ok ? "verificada" : "respaldo", _cs_native ? "nativo" : "fijo por MCP",
+             (unsigned)_bench_write_kbps, (unsigned)_bench_read_kbps, _file_off, (unsigned)_wlen,
+             (unsigned)(IO_CHUNK / 1024), (unsigned)_chunks_written, (unsigned)_flushes, (unsigned)_write_errors,
+             (unsigned)_dropped, _degraded ? " (DEGRADADO)" : "");
+    return buf;
 }
 
-void LoggerFS::checkRotation() {
-    struct stat st;
-    if (stat(_full_path.c_str(), &st) == 0 && st.st_size >= MAX_LOG_SIZE) {
-        ESP_LOGW(TAG, "Rotando archivo de log en SD...");
-        unlink(_old_path.c_str());
-        rename(_full_path.c_str(), _old_path.c_str());
-        writeHeader();
+void LoggerFS::metrics(TextBuffer& out) {
+    out.appendf("log_seq %u\nsd_log_dropped %u\nlog_deferred_dropped %u\n", (unsigned)_seq, (unsigned)_dropped,
+                (unsigned)_defer_dropped.load());
+    out.appendf("sd_fast_ok %u\n", _fast_ok ? 1u : 0u);
+    out.appendf("sd_khz %u\nsd_bench_write_kbps %u\nsd_bench_read_kbps %u\nsd_log_chunks %u\nsd_log_flushes %u\nsd_write_errors %u\n",
+                (unsigned)_sd_khz, (unsigned)_bench_write_kbps, (unsigned)_bench_read_kbps,
+                (unsigned)_chunks_written, (unsigned)_flushes, (unsigned)_write_errors);
+}
+
+/**
+ * @brief Escribe "[S] AAAA-MM-DD HH:MM:SS" en out; devuelve los caracteres escritos.
+ *
+ * localtime_r solo corre al cambiar de minuto (o si el reloj salta, p. ej. al
+ * sincronizar NTP); el resto de las llamadas copia el prefijo y pone los segundos.
+ */
+size_t LoggerFS::format_timestamp(char* out, size_t cap) {
+    time_t now = time(NULL);
+    if (_ts_minute < 0 || now < _ts_minute || now - _ts_minute >= 60) {
+        struct tm timeinfo;
+        localtime_r(&now, &timeinfo);
+        _ts_minute = now - timeinfo.tm_sec;
+        // [L] Local (sin sincronizar), [S] Sincronizado por NTP
+        const char* tag = (timeinfo.tm_year < (2024 - 1900)) ? "[L]" : "[S]";
+        int n = snprintf(_ts_prefix, sizeof(_ts_prefix), "%s %04d-%02d-%02d %02d:%02d:", tag,
+                         timeinfo.tm_year + 1900, timeinfo.tm_mon + 1, timeinfo.tm_mday,
+                         timeinfo.tm_hour, timeinfo.tm_min);
+        _ts_len = (n > 0) ? std::min((size_t)n, sizeof(_ts_prefix) - 1) : 0;
     }
+    if (cap < _ts_len + 3) return 0;
+    unsigned sec = (unsigned)(now - _ts_minute);
+    memcpy(out, _ts_prefix, _ts_len);
+    out[_ts_len] = (char)('0' + sec / 10);
+    out[_ts_len + 1] = (char)('0' + sec % 10);
+    out[_ts_len + 2] = 0;
+    return _ts_len + 2;
+}
+
+void LoggerFS::checkRotation() {
+    if (_file_off + (long)_wlen < (long)MAX_LOG_SIZE) return;
+    if (_readers > 0) return; // Se rota en la próxima línea; el archivo crece unos bytes de más
+    ESP_LOGW(TAG, "Rotando archivo de log en SD...");
+    write_out(false);
+    Supervisor::busy(Supervisor::Watch::LOGGER, "rotación");
+    if (_file) fclose(_file);
+    _file = nullptr;
+    unlink(_old_path.c_str());
+    rename(_full_path.c_str(), _old_path.c_str());
+    Supervisor::busy(Supervisor::Watch::LOGGER, nullptr);
+    open_log();
 }
 
 // Método compatible con el formato antiguo (si aún se usa en alguna parte)
-void LoggerFS::registrar(RectEvent evento, const RectStatus& status, const std::string& nota) {
+void LoggerFS::registrar(RectEvent evento, const RectStatus& status, std::string_view nota) {
     char buf[64];
     snprintf(buf, sizeof(buf), "D:%d|A:%.1f|V:%.1f", 
              static_cast<int>(status.direction), status.current, status.voltage);
@@ -2,7 +2,12 @@
 #define LOGGER_FS_HPP
 
 #include <string>
+#include <string_view>
 #include <mutex>
+#include <atomic>
+#include <cstdio>
+#include <stdint.h>
+#include "TextBuffer.hpp"
 #include <time.h>
 #include <algorithm>
 
@@ -26,6 +31,7 @@ enum class RectEvent : uint16_t {
     ERR_I2C         = 0x0501,
     ERR_WDT         = 0x0502,
     ERR_SYSTEM      = 0x0503,
+    ERR_OVERCURRENT = 0x0504,  // Disparo de protección en un punto de carga
 
     // CATEGORIA 06: CONFIG/USUARIO
     CONFIG_CHANGE  = 0x0600,  // Evento genérico de configuración
@@ -39,6 +45,74 @@ enum class RectEvent : uint16_t {
     NET_RSSI        = 0x0703
 };
 
+/**
+ * @brief Tabla de eventos: nombre y si debe llegar a la tarjeta de inmediato.
+ *
+ * Ordenada por código; los static_assert de abajo fallan en compilación si
+ * se repite un código, se rompe el orden o un error queda sin marcar como crítico.
+ */
+struct RectEventInfo {
+    RectEvent evento;
+    const char* nombre;
+    bool critico;
+};
+
+inline constexpr RectEventInfo RECT_EVENTS[] = {
+    { RectEvent::BOOT,              "BOOT",              false },
+    { RectEvent::BOOT_WDT,          "BOOT_WDT",          true  },
+    { RectEvent::BOOT_SOFT,         "BOOT_SOFT",         false },
+    { RectEvent::HEARTBEAT,         "HEARTBEAT",         false },
+    { RectEvent::PROCESS_START,     "PROCESS_START",     false },
+    { RectEvent::PROCESS_STOP,      "PROCESS_STOP",      false },
+    { RectEvent::POT_CHANGE,        "POT_CHANGE",        false },
+    { RectEvent::BTN_START_PRESS,   "BTN_START_PRESS",   false },
+    { RectEvent::BTN_START_RELEASE, "BTN_START_RELEASE", false },
+    { RectEvent::ERR_I2C,           "ERR_I2C",           true  },
+    { RectEvent::ERR_WDT,           "ERR_WDT",           true  },
+    { RectEvent::ERR_SYSTEM,        "ERR_SYSTEM",        true  },
+    { RectEvent::ERR_OVERCURRENT,   "ERR_OVERCURRENT",   true  },
+    { RectEvent::CONFIG_CHANGE,     "CONFIG_CHANGE",     false },
+    { RectEvent::LOG_CLEARED,       "LOG_CLEARED",       false },
+    { RectEvent::OTA_START,         "OTA_START",         false },
+    { RectEvent::NET_AP_START,      "NET_AP_START",      false },
+    { RectEvent::NET_IP,            "NET_IP",            false },
+    { RectEvent::NET_SSID,          "NET_SSID",          false },
+    { RectEvent::NET_RSSI,          "NET_RSSI",          false },
+};
+inline constexpr size_t RECT_EVENT_COUNT = sizeof(RECT_EVENTS) / sizeof(RECT_EVENTS[0]);
+
+constexpr bool rect_events_valid() {
+    for (size_t i = 0; i < RECT_EVENT_COUNT; i++) {
+        uint16_t code = static_cast<uint16_t>(RECT_EVENTS[i].evento);
+        if (i > 0 && code <= static_cast<uint16_t>(RECT_EVENTS[i - 1].evento)) return false;
+        if ((code >> 8) == 0x05 && !RECT_EVENTS[i].critico) return false;
+    }
+    return true;
+}
+static_assert(rect_events_valid(), "RECT_EVENTS: códigos repetidos, fuera de orden o error no crítico");
+
+// Búsqueda binaria (la tabla está ordenada); nullptr si el código no está
+constexpr const RectEventInfo* rect_event_info(RectEvent ev) {
+    size_t lo = 0, hi = RECT_EVENT_COUNT;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (RECT_EVENTS[mid].evento == ev) return &RECT_EVENTS[mid];
+        if (static_cast<uint16_t>(RECT_EVENTS[mid].evento) < static_cast<uint16_t>(ev)) lo = mid + 1;
+        else hi = mid;
+    }
+    return nullptr;
+}
+static_assert(rect_event_info(RectEvent::ERR_OVERCURRENT)->critico, "La sobrecorriente debe escribirse al instante");
+
+// Una línea del log separada en campos (vistas sobre el buffer de lectura)
+struct LogRecord {
+    uint32_t seq;
+    std::string_view fecha;
+    std::string_view codigo;    // "0x0504"
+    std::string_view valor;
+    std::string_view nota;
+};
+
 struct RectStatus {
     RectDirection direction;
     float current;
@@ -46,26 +120,127 @@ struct RectStatus {
     uint32_t temp;
 };
 
+/**
+ * @brief Log CSV de eventos en la SD.
+ *
+ * E/S pensada para el CS por el MCP23017: el CS se selecciona una vez al
+ * montar y queda fijo (bus SPI dedicado a la SD), así ninguna escritura
+ * depende del I2C. Las líneas se acumulan en un buffer DMA y se escriben en
+ * trozos alineados a la unidad de asignación (16 KB); lo pendiente baja a la
+ * tarjeta cada FLUSH_MS o de inmediato en eventos de error (categoría 05).
+ *
+ * Si la placa cablea el CS a un GPIO nativo, definir SD_CS_GPIO y el bus
+ * sube a 20 MHz.
+ *
+ * Cada línea lleva un número de secuencia monótono (primera columna) que
+ * sigue entre reinicios y rotaciones: al arrancar se retoma de la última
+ * línea en la tarjeta, con un piso reservado en NVS por si la tarjeta se
+ * cambia. read_since() lo usa para la sincronización incremental.
+ */
 class LoggerFS {
 public:
+    static constexpr size_t IO_CHUNK = 16 * 1024;   // = allocation_unit_size
+    static constexpr uint32_t FLUSH_MS = 2000;
+
     explicit LoggerFS(const char* base_path);
     bool begin(); 
     bool is_card_inserted(); // <--- AÑADIR ESTA LÍNEA
-    void registrar(RectEvent evento, const RectStatus& status, const std::string& nota = "");
-    void registrarEstructurado(RectEvent evento, std::string valor, std::string nota);
+    void registrar(RectEvent evento, const RectStatus& status, std::string_view nota = {});
+    // Sin heap: la línea se arma directamente en el buffer de escritura
+    void registrarEstructurado(RectEvent evento, std::string_view valor, std::string_view nota);
+    // Nota con formato printf (verificado por el compilador) en un buffer de pila
+    void registrarf(RectEvent evento, std::string_view valor, const char* fmt, ...)
+        __attribute__((format(printf, 4, 5)));
+    // Para las tareas del core 1: copia el evento a una cola sin esperar y vuelve;
+    // log_defer (core 0) lo registra. Con la cola llena se descarta y se cuenta.
+    void diferirf(RectEvent evento, std::string_view valor, const char* fmt, ...)
+        __attribute__((format(printf, 4, 5)));
+    bool start_deferred();   // app_main, antes de las etapas de arranque
     void limpiarLog();
+    void flush();            // Baja lo pendiente y sincroniza (antes de leer el archivo)
     std::string getFilePath() const { return _full_path; }
+    // Copia de cada evento (antes de la SD, fuera del mutex): la usa Uplink
+    using Tap = void (*)(RectEvent evento, std::string_view valor, std::string_view nota);
+    void set_tap(Tap tap) { _tap = tap; }
+    // SD colgada (Supervisor): las líneas que encuentran el mutex tomado se descartan en vez de esperar
+    void set_degraded(bool on) { _degraded = on; }
+    bool is_ready() const { return _ready; }
+
+    std::string io_status();
+    void metrics(TextBuffer& out);
+
+    // Sincronización incremental: registros con seq > after, en orden (.old y luego el actual)
+    struct SinceResult {
+        uint32_t next;          // Cursor para la próxima consulta
+        uint32_t first;         // Secuencia más antigua aún en la tarjeta (0 si no hay)
+        size_t count;
+        bool more;              // Quedaron registros por max
+        bool gap;               // after + 1 ya se perdió por rotación o borrado
+    };
+    using RecordCallback = bool (*)(const LogRecord& rec, void* ctx);
+    SinceResult read_since(uint32_t after, size_t max, RecordCallback cb, void* ctx);
+    uint32_t last_seq() const { return _seq; }
+    static bool parse_line(std::string_view line, LogRecord& rec);
 
 private:
     std::string _base_path;
     std::string _full_path;
     std::string _old_path;
     std::mutex _mutex;
+    volatile bool _ready = false; // El montaje corre en paralelo con otras etapas de arranque
+    Tap _tap = nullptr;
+    uint32_t _seq = 0;               // Última secuencia escrita
+    uint32_t _seq_reserved = 0;      // Piso en NVS: ninguna secuencia por debajo se reutiliza
+    std::atomic<int> _readers{0};    // read_since en curso: la rotación espera
     const size_t MAX_LOG_SIZE = 500 * 1024; // 500 KB
 
-    std::string getLimaTimestamp();
+    // E/S con buffer
+    void* _card = nullptr;           // sdmmc_card_t*
+    FILE* _file = nullptr;
+    char* _wbuf = nullptr;           // IO_CHUNK + una línea, con capacidad DMA
+    size_t _wlen = 0;
+    long _file_off = 0;              // Tamaño del archivo en la tarjeta
+    int64_t _pending_since_us = 0;
+    uint32_t _sd_khz = 0;
+    bool _fast_ok = false;           // La prueba de E/S pasó a la velocidad alta
+    bool _cs_native = false;
+    uint32_t _bench_write_kbps = 0;
+    uint32_t _bench_read_kbps = 0;
+    uint32_t _chunks_written = 0;
+    uint32_t _flushes = 0;
+    uint32_t _write_errors = 0;
+    uint32_t _dropped = 0;           // Líneas descartadas en modo degradado
+    void* _defer_q = nullptr;        // QueueHandle_t de Deferred
+    std::atomic<uint32_t> _defer_dropped{0};
+
+    struct Deferred {
+        RectEvent evento;
+        char valor[16];
+        char nota[112];
+    };
+    static constexpr size_t DEFER_DEPTH = 16;
+    std::atomic<bool> _degraded{false};
+
+    // Fecha/hora en caché: solo se recalcula al cambiar de minuto
+    time_t _ts_minute = -1;
+    char _ts_prefix[32] = {};
+    size_t _ts_len = 0;
+
+    size_t format_timestamp(char* out, size_t cap);
     void checkRotation();
     void writeHeader();
+    bool lock_or_drop(std::unique_lock<std::mutex>& lock);
+    bool mount(uint32_t khz, bool allow_format);
+    bool self_test();
+    bool open_log();
+    uint32_t next_seq();
+    void recover_seq();
+    static uint32_t tail_seq(const std::string& path);
+    static uint32_t first_seq(FILE* f, long& data_off);
+    static long seek_after(FILE* f, long size, uint32_t after);
+    void write_out(bool sync);
+    static void flush_task(void* pv);
+    static void defer_task(void* pv);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,355 @@
+#include "Metering.hpp"
+#include "ads1115.hpp"
+#include "Protection.hpp"
+#include "Supervisor.hpp"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "esp_rom_sys.h"
+#include "TaskConfig.hpp"
+#include <cstdio>
+
+static const char* TAG = "METERING";
+
+extern ADS1115* g_ads;
+extern float g_corriente_actual;
+
+// Escalas por defecto: ±2.048 V, 62.5 µV/LSB; con el shunt+amplificador del
+// rectificador 1 LSB ≈ 1 mA. Se ajusta por canal con meter.cal
+static constexpr ADS1115::PGA METER_PGA = ADS1115::PGA::FS_2V048;
+static constexpr ADS1115::DataRate METER_DR = ADS1115::DataRate::SPS_860;
+static constexpr int32_t DEFAULT_UA_PER_LSB = 1000;
+static constexpr uint32_t DEFAULT_NOMINAL_MV = 48000;
+static constexpr int16_t FILTER_IIR_ALPHA = 8192;   // 0.25 => ~20 ms a 200 SPS por canal
+static constexpr uint8_t FILTER_MA_LOG2 = 3;         // Media de 8 muestras
+static constexpr uint64_t LIFETIME_SAVE_STEP_UWH = 1000000; // Persistir cada 1 Wh como mínimo
+static constexpr int READY_POLLS = 4;                // Hasta ~0.4 ms extra: cubre el -10% del reloj del ADS
+static constexpr uint32_t READY_POLL_US = 100;
+
+// Recorte del dt: exacto dentro del tope, saturado fuera, y sin desborde a fondo de escala
+static_assert(Metering::clamp_dt(Metering::CHANNELS * Metering::PERIOD_US) == Metering::CHANNELS * Metering::PERIOD_US,
+              "Una vuelta normal no se recorta");
+static_assert(Metering::clamp_dt(12000000) == Metering::MAX_DT_US, "Un hueco de 12 s se recorta al tope");
+static_assert(Metering::clamp_dt(0) == 0, "dt nulo intacto");
+static_assert((int64_t)32768 * Metering::MAX_UA_PER_LSB * Metering::MAX_NOMINAL_MV * Metering::MAX_DT_US <
+                  INT64_MAX / 2,
+              "µA·mV·µs de una muestra a fondo de escala entra en acc_nw_us");
+
+static const ADS1115::Mux s_mux[Metering::CHANNELS] = {
+    ADS1115::Mux::AIN0_GND, ADS1115::Mux::AIN1_GND, ADS1115::Mux::AIN2_GND, ADS1115::Mux::AIN3_GND
+};
+
+// Protege los acumuladores que se leen desde otras tareas (el otro core)
+static portMUX_TYPE s_meter_mux = portMUX_INITIALIZER_UNLOCKED;
+
+Metering::Channel Metering::_ch[CHANNELS] = {};
+uint64_t Metering::_lifetime_uwh = 0;
+uint64_t Metering::_lifetime_saved_uwh = 0;
+uint32_t Metering::_nominal_mv = DEFAULT_NOMINAL_MV;
+uint32_t Metering::_samples = 0;
+uint32_t Metering::_missed = 0;
+uint32_t Metering::_i2c_errors = 0;
+uint32_t Metering::_not_ready = 0;
+uint32_t Metering::_gaps = 0;
+uint32_t Metering::_rate_sps = 0;
+uint32_t Metering::_dsp_us_per_s = 0;
+static int64_t s_dsp_us_acc = 0;
+TaskHandle_t Metering::_task = nullptr;
+esp_timer_handle_t Metering::_timer = nullptr;
+
+void Metering::load_config() {
+    for (int i = 0; i < CHANNELS; i++) {
+        _ch[i].ua_per_lsb = DEFAULT_UA_PER_LSB;
+        _ch[i].offset = 0;
+    }
+
+    nvs_handle_t handle;
+    if (nvs_open("meter", NVS_READONLY, &handle) != ESP_OK) return;
+    char key[8];
+    for (int i = 0; i < CHANNELS; i++) {
+        snprintf(key, sizeof(key), "cal%d", i);
+        nvs_get_i32(handle, key, &_ch[i].ua_per_lsb);
+        snprintf(key, sizeof(key), "off%d", i);
+        nvs_get_i16(handle, key, &_ch[i].offset);
+        if (_ch[i].ua_per_lsb <= 0 || _ch[i].ua_per_lsb > MAX_UA_PER_LSB) _ch[i].ua_per_lsb = DEFAULT_UA_PER_LSB;
+    }
+    nvs_get_u32(handle, "v_nom", &_nominal_mv);
+    if (_nominal_mv == 0 || _nominal_mv > MAX_NOMINAL_MV) _nominal_mv = DEFAULT_NOMINAL_MV;
+    nvs_get_u64(handle, "life_uwh", &_lifetime_uwh);
+    nvs_close(handle);
+    _lifetime_saved_uwh = _lifetime_uwh;
+}
+
+static void configure_chain(SignalChain& chain, int16_t offset) {
+    SignalChain::Config cfg = { offset, FILTER_IIR_ALPHA, FILTER_MA_LOG2, true };
+    chain.configure(cfg);
+}
+
+void Metering::save_lifetime() {
+    portENTER_CRITICAL(&s_meter_mux);
+    uint64_t life = _lifetime_uwh;
+    portEXIT_CRITICAL(&s_meter_mux);
+    if (life - _lifetime_saved_uwh < LIFETIME_SAVE_STEP_UWH) return; // No desgastar NVS
+
+    nvs_handle_t handle;
+    if (nvs_open("meter", NVS_READWRITE, &handle) != ESP_OK) return;
+    nvs_set_u64(handle, "life_uwh", life);
+    nvs_commit(handle);
+    nvs_close(handle);
+    _lifetime_saved_uwh = life;
+}
+
+bool Metering::start() {
+    if (_task) return true;
+    if (!g_ads) return false;
+    load_config();
+    for (int i = 0; i < CHANNELS; i++) configure_chain(_ch[i].chain, _ch[i].offset);
+
+    TaskPlan::create(TaskPlan::METER, meter_task, NULL, &_task);
+
+    // El timer solo despierta a la tarea: el I2C no corre en el contexto de esp_timer
+    esp_timer_create_args_t args = {};
+    args.callback = [](void*) { if (_task) xTaskNotifyGive(_task); };
+    args.name = "meter";
+    if (esp_timer_create(&args, &_timer) != ESP_OK || esp_timer_start_periodic(_timer, PERIOD_US) != ESP_OK) {
+        ESP_LOGE(TAG, "No se pudo crear el timer de muestreo");
+        return false;
+    }
+    ESP_LOGI(TAG, "Medición iniciada: %u µs/muestra, %d canales, V nominal %u mV",
+             (unsigned)PERIOD_US, CHANNELS, (unsigned)_nominal_mv);
+    return true;
+}
+
+void Metering::integrate(int ch, int16_t raw, int64_t now_us) {
+    Channel& c = _ch[ch];
+    int64_t ua = (int64_t)(raw - c.offset) * c.ua_per_lsb;
+    Protection::on_sample(ch, (int32_t)ua); // Primero la protección: no espera al bloque filtrado
+    if (ua < 0) ua = 0; // Ruido alrededor de cero: no descuenta energía
+
+    c.block[c.block_n++] = raw;
+    if (c.block_n == BLOCK) condition_block(ch);
+
+    int64_t dt = c.last_us ? (now_us - c.last_us) : 0;
+    c.last_us = now_us;
+    if (dt > MAX_DT_US) {
+        _gaps++;    // Falla de medición: el hueco no se factura
+        dt = clamp_dt(dt);
+    }
+    if (!c.in_session || dt <= 0) return;
+
+    // µA · mV = nW ; nW · µs acumulados sin pérdida, acarreo entero a µWh
+    c.acc_nw_us += ua * (int64_t)_nominal_mv * dt;
+    if (c.acc_nw_us >= NW_US_PER_UWH) {
+        uint64_t uwh = c.acc_nw_us / NW_US_PER_UWH;
+        c.acc_nw_us -= (int64_t)uwh * NW_US_PER_UWH;
+        portENTER_CRITICAL(&s_meter_mux);
+        c.session_uwh += uwh;
+        _lifetime_uwh += uwh;
+        portEXIT_CRITICAL(&s_meter_mux);
+    }
+}
+
+void Metering::condition_block(int ch) {
+    Channel& c = _ch[ch];
+    int64_t t0 = esp_timer_get_time();
+
+    if (c.chain_dirty) {
+        c.chain_dirty = false;
+        configure_chain(c.chain, c.offset);
+    }
+    SignalChain::BlockStats st;
+    c.chain.process(c.block, c.block, BLOCK, st);
+    c.block_n = 0;
+
+    int32_t mean = st.mean < 0 ? 0 : st.mean;
+    c.avg_ma = (int32_t)((int64_t)mean * c.ua_per_lsb / 1000);
+    c.rms_ma = (int32_t)((int64_t)st.rms * c.ua_per_lsb / 1000);
+
+    s_dsp_us_acc += esp_timer_get_time() - t0;
+}
+
+void Metering::publish_window(int64_t now_us) {
+    static int64_t win_start = 0;
+    static uint32_t win_samples = 0;
+    if (win_start == 0) { win_start = now_us; win_samples = _samples; }
+    if (now_us - win_start < 1000000) return;
+
+    int32_t total_ma = 0;
+    for (int i = 0; i < CHANNELS; i++) total_ma += _ch[i].avg_ma;
+
+    _rate_sps = (uint32_t)((uint64_t)(_samples - win_samples) * 1000000 / (now_us - win_start));
+    _dsp_us_per_s = (uint32_t)(s_dsp_us_acc * 1000000 / (now_us - win_start));
+    s_dsp_us_acc = 0;
+    win_start = now_us;
+    win_samples = _samples;
+
+    g_corriente_actual = total_ma / 1000.0f; // Amperes, suma de los 4 puntos (filtrada)
+}
+
+/**
+ * @brief Espera corta al bit OS: sin él la lectura sería la conversión del canal anterior.
+ */
+bool Metering::conversion_done() {
+    bool ready = false;
+    for (int i = 0; i < READY_POLLS; i++) {
+        if (!g_ads->conversionReady(ready)) return false;
+        if (ready) return true;
+        esp_rom_delay_us(READY_POLL_US);
+    }
+    return false;
+}
+
+void Metering::meter_task(void* pv) {
+    int cur = 0;
+    int16_t raw;
+
+    // Primera conversión: dispara AIN0 y descarta lo que hubiera en el registro
+    g_ads->readAndStart(s_mux[cur], METER_PGA, METER_DR, raw);
+    // Pulso = lectura I2C válida: un bus colgado o un ADS que no responde dejan de darlo
+    Supervisor::watch(Supervisor::Watch::I2C, 2000, 30000);
+
+    while (1) {
+        uint32_t ticks = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+        if (ticks == 0) continue;
+        if (ticks > 1) _missed += ticks - 1; // El timer se adelantó: hubo periodos sin leer
+
+        if (!conversion_done()) {
+            _not_ready++; // Se lee en el próximo periodo; el canal no cambia
+            continue;
+        }
+
+        int next = (cur + 1) % CHANNELS;
+        if (!g_ads->readAndStart(s_mux[next], METER_PGA, METER_DR, raw)) {
+            _i2c_errors++;
+            // Reintentar el mismo canal en el próximo periodo
+            g_ads->readAndStart(s_mux[cur], METER_PGA, METER_DR, raw);
+            continue;
+        }
+        Supervisor::checkin(Supervisor::Watch::I2C);
+        int64_t now = esp_timer_get_time();
+        _samples++;
+        integrate(cur, raw, now);
+        publish_window(now);
+        cur = next;
+    }
+}
+
+void Metering::session_begin(int point, uint32_t base_mwh) {
+    if (point < 0 || point >= CHANNELS) return;
+    portENTER_CRITICAL(&s_meter_mux);
+    _ch[point].session_uwh = (uint64_t)base_mwh * 1000;
+    _ch[point].acc_nw_us = 0;
+    _ch[point].in_session = true;
+    portEXIT_CRITICAL(&s_meter_mux);
+}
+
+uint32_t Metering::session_end(int point) {
+    if (point < 0 || point >= CHANNELS) return 0;
+    portENTER_CRITICAL(&s_meter_mux);
+    _ch[point].in_session = false;
+    uint32_t mwh = (uint32_t)(_ch[point].session_uwh / 1000);
+    portEXIT_CRITICAL(&s_meter_mux);
+    save_lifetime();
+    return mwh;
+}
+
+uint32_t Metering::session_mwh(int point) {
+    if (point < 0 || point >= CHANNELS) return 0;
+    portENTER_CRITICAL(&s_meter_mux);
+    uint32_t mwh = (uint32_t)(_ch[point].session_uwh / 1000);
+    portEXIT_CRITICAL(&s_meter_mux);
+    return mwh;
+}
+
+void Metering::persist() {
+    save_lifetime();
+}
+
+void Metering::snapshot(MeterSnapshot& out) {
+    portENTER_CRITICAL(&s_meter_mux);
+    for (int i = 0; i < CHANNELS; i++) {
+        out.ma[i] = _ch[i].avg_ma;
+        out.rms_ma[i] = _ch[i].rms_ma;
+        out.session_mwh[i] = (uint32_t)(_ch[i].session_uwh / 1000);
+    }
+    out.lifetime_mwh = _lifetime_uwh / 1000;
+    portEXIT_CRITICAL(&s_meter_mux);
+    out.nominal_mv = _nominal_mv;
+    out.samples = _samples;
+    out.missed = _missed;
+    out.i2c_errors = _i2c_errors;
+    out.not_ready = _not_ready;
+    out.gaps = _gaps;
+    out.rate_sps = _rate_sps;
+    out.dsp_us_per_s = _dsp_us_per_s;
+}
+
+bool Metering::set_nominal_mv(uint32_t mv) {
+    if (mv == 0 || mv > MAX_NOMINAL_MV) return false;
+    nvs_handle_t handle;
+    if (nvs_open("meter", NVS_READWRITE, &handle) != ESP_OK) return false;
+    nvs_set_u32(handle, "v_nom", mv);
+    nvs_commit(handle);
+    nvs_close(handle);
+    _nominal_mv = mv;
+    return true;
+}
+
+bool Metering::set_calibration(int point, int32_t ua_per_lsb, int16_t offset) {
+    if (point < 0 || point >= CHANNELS || ua_per_lsb <= 0 || ua_per_lsb > MAX_UA_PER_LSB) return false;
+    nvs_handle_t handle;
+    if (nvs_open("meter", NVS_READWRITE, &handle) != ESP_OK) return false;
+    char key[8];
+    snprintf(key, sizeof(key), "cal%d", point);
+    nvs_set_i32(handle, key, ua_per_lsb);
+    snprintf(key, sizeof(key), "off%d", point);
+    nvs_set_i16(handle, key, offset);
+    nvs_commit(handle);
+    nvs_close(handle);
+
+    portENTER_CRITICAL(&s_meter_mux);
+    _ch[point].ua_per_lsb = ua_per_lsb;
+    _ch[point].offset = offset;
+    portEXIT_CRITICAL(&s_meter_mux);
+    // La cadena es de la tarea de muestreo: el cambio entra en el próximo bloque
+    _ch[point].chain_dirty = true;
+    return true;
+}
+
+std::string Metering::status() {
+    MeterSnapshot s;
+    snapshot(s);
+    std::string out;
+    char line[96];
+    for (int i = 0; i < CHANNELS; i++) {
+        snprintf(line, sizeof(line), "CH%d: %d mA (rms %d) | sesión %u.%03u Wh\n", i + 1, (int)s.ma[i], (int)s.rms_ma[i],
+                 (unsigned)(s.session_mwh[i] / 1000), (unsigned)(s.session_mwh[i] % 1000));
+        out += line;
+    }
+    snprintf(line, sizeof(line), "Total: %llu.%03llu kWh | V nom %u mV\n",
+             (unsigned long long)(s.lifetime_mwh / 1000000), (unsigned long long)((s.lifetime_mwh / 1000) % 1000),
+             (unsigned)s.nominal_mv);
+    out += line;
+    snprintf(line, sizeof(line), "ADC: %u SPS | muestras %u | perdidas %u | err I2C %u | DSP %u us/s\n",
+             (unsigned)s.rate_sps, (unsigned)s.samples, (unsigned)s.missed, (unsigned)s.i2c_errors,
+             (unsigned)s.dsp_us_per_s);
+    out += line;
+    snprintf(line, sizeof(line), "Conversión sin terminar %u | huecos recortados %u\n", (unsigned)s.not_ready,
+             (unsigned)s.gaps);
+    out += line;
+    return out;
+}
+
+void Metering::metrics(TextBuffer& out) {
+    MeterSnapshot s;
+    snapshot(s);
+    for (int i = 0; i < CHANNELS; i++) {
+        out.appendf("meter_current_ma{point=\"%d\"} %d\n", i + 1, (int)s.ma[i]);
+        out.appendf("meter_rms_ma{point=\"%d\"} %d\n", i + 1, (int)s.rms_ma[i]);
+        out.appendf("meter_session_mwh{point=\"%d\"} %u\n", i + 1, (unsigned)s.session_mwh[i]);
+    }
+    out.appendf("meter_lifetime_mwh %llu\nmeter_rate_sps %u\n", (unsigned long long)s.lifetime_mwh, (unsigned)s.rate_sps);
+    out.appendf("meter_dsp_us_per_s %u\n", (unsigned)s.dsp_us_per_s);
+    out.appendf("meter_samples %u\nmeter_missed %u\nmeter_i2c_errors %u\n",
+                (unsigned)s.samples, (unsigned)s.missed, (unsigned)s.i2c_errors);
+    out.appendf("meter_not_ready %u\nmeter_gaps %u\n", (unsigned)s.not_ready, (unsigned)s.gaps);
+}
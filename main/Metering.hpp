@@ -0,0 +1,104 @@
+#pragma once
+#include <string>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "SignalChain.hpp"
+#include "TextBuffer.hpp"
+
+struct MeterSnapshot {
+    int32_t ma[4];              // Corriente filtrada (media del último bloque) por punto
+    int32_t rms_ma[4];          // RMS del último bloque, sin filtrar (rizado incluido)
+    uint32_t session_mwh[4];    // Energía de la sesión en curso
+    uint64_t lifetime_mwh;      // Acumulado histórico (persistente en NVS)
+    uint32_t nominal_mv;
+    uint32_t samples;           // Muestras totales del ADC
+    uint32_t missed;            // Periodos del timer sin atender
+    uint32_t i2c_errors;
+    uint32_t not_ready;         // Conversión sin terminar al llegar el periodo: se espera al siguiente
+    uint32_t gaps;              // dt entre muestras de un canal recortado (bus trabado o recuperado)
+    uint32_t rate_sps;          // Muestras/s medidas en el último segundo (todos los canales)
+    uint32_t dsp_us_per_s;      // Tiempo de CPU del acondicionamiento en el último segundo
+};
+
+/**
+ * @brief Medición de energía por punto de carga.
+ *
+ * Un esp_timer marca el ritmo (periodo > conversión a 860 SPS) y una tarea en
+ * el core 1 hace, en una sola transacción I2C, la lectura del canal anterior
+ * y el disparo del siguiente (round-robin AIN0..AIN3). Antes de leer se
+ * confirma el bit OS: el reloj del ADS tiene ±10% y una conversión lenta
+ * cargaría la muestra al canal equivocado. La energía se integra
+ * en enteros: µA · mV = nW, por el dt real entre muestras del mismo canal
+ * (reloj monotónico, no el periodo nominal), con acarreo exacto a µWh.
+ *
+ * Para la corriente mostrada las muestras pasan por bloques de SignalChain
+ * (mediana, IIR, media móvil); la energía usa la muestra cruda calibrada
+ * para no sumar el retardo de los filtros.
+ *
+ * La tensión no se mide (los 4 canales del ADS son corriente): se usa una
+ * tensión nominal configurable en NVS.
+ */
+class Metering {
+public:
+    static constexpr int CHANNELS = 4;
+    static constexpr uint32_t PERIOD_US = 1250;            // 860 SPS => 1.16 ms de conversión (±10%); se verifica OS
+    // Tope del dt de integración: dos vueltas del round-robin. Tras un cuelgue del I2C la
+    // muestra siguiente no se lleva todo el hueco (energía inflada y desborde de acc_nw_us)
+    static constexpr int64_t MAX_DT_US = 2LL * CHANNELS * PERIOD_US;
+    static constexpr int64_t clamp_dt(int64_t dt) { return dt > MAX_DT_US ? MAX_DT_US : dt; }
+    static constexpr int32_t MAX_UA_PER_LSB = 10000;       // 327 A a fondo de escala
+    static constexpr uint32_t MAX_NOMINAL_MV = 1000000;
+
+    static bool start();
+    static void snapshot(MeterSnapshot& out);
+
+    // Integración por sesión: solo acumula mientras la sesión está abierta
+    static void session_begin(int point, uint32_t base_mwh);  // base > 0 al reanudar tras un corte
+    static uint32_t session_end(int point);                   // Devuelve mWh totales de la sesión
+    static uint32_t session_mwh(int point);
+    static void persist();   // Guarda el total histórico si avanzó; fuera de la tarea de muestreo
+
+    // Calibración (NVS "meter")
+    static bool set_nominal_mv(uint32_t mv);
+    static bool set_calibration(int point, int32_t ua_per_lsb, int16_t offset);
+
+    static std::string status();   // Texto para el comando "energy"
+    static void metrics(TextBuffer& out);  // Líneas para /metrics
+
+private:
+    static constexpr size_t BLOCK = 20;                   // 100 ms por canal a ~200 SPS
+    static constexpr int64_t NW_US_PER_UWH = 3600000000000LL; // 1 µWh = 3.6e12 nW·µs
+
+    struct Channel {
+        int32_t ua_per_lsb;     // Escala del shunt/amplificador
+        int16_t offset;         // Cero en crudo
+        int64_t last_us;        // Marca de la muestra anterior de este canal
+        int64_t acc_nw_us;      // Resto por debajo de 1 µWh
+        uint64_t session_uwh;
+        bool in_session;
+        SignalChain chain;
+        volatile bool chain_dirty;  // Calibración nueva: la tarea de muestreo reconfigura
+        int16_t block[BLOCK];
+        uint8_t block_n;
+        int32_t avg_ma;
+        int32_t rms_ma;
+    };
+
+    static Channel _ch[CHANNELS];
+    static uint64_t _lifetime_uwh;
+    static uint64_t _lifetime_saved_uwh;
+    static uint32_t _nominal_mv;
+    static uint32_t _samples, _missed, _i2c_errors, _not_ready, _gaps, _rate_sps, _dsp_us_per_s;
+    static TaskHandle_t _task;
+    static esp_timer_handle_t _timer;
+
+    static void load_config();
+    static void save_lifetime();
+    static void integrate(int ch, int16_t raw, int64_t now_us);
+    static void condition_block(int ch);
+    static void publish_window(int64_t now_us);
+    static bool conversion_done();
+    static void meter_task(void* pv);
+};
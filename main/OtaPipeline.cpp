@@ -0,0 +1,697 @@
+#include "OtaPipeline.hpp"
+#include "esp_http_client.h"
+#include "esp_https_ota.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "spi_flash_mmap.h"
+#include "esp_crt_bundle.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_image_format.h"
+#include "mbedtls/sha256.h"
+#include "LoggerFS.hpp"
+#include "WifiManager.hpp"
+#include "ChargeControl.hpp"
+#include "TaskConfig.hpp"
+#include "HttpWorkers.hpp"
+#include "Supervisor.hpp"
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <atomic>
+
+static const char* TAG = "OTA_PIPE";
+
+extern LoggerFS g_logger;
+extern volatile bool g_scr_enabled;
+
+#define OTA_RANGE_SIZE    (64 * 1024)  // Tamaño de cada petición Range
+#define OTA_SAVE_EVERY    (64 * 1024)  // Cada cuánto se persiste el avance en NVS
+#define OTA_MAX_ATTEMPTS  10
+#define OTA_BACKOFF_MAX_MS 60000
+#define OTA_URL_MAX       256
+#define OTA_IDLE_POLL_MS  10000        // Espera de fin de sesiones antes de descargar o reiniciar
+
+#define UPLOAD_BLOCK_SIZE (16 * 1024)  // Dos bloques: uno recibe mientras el otro se graba
+#define UPLOAD_ERASE_STEP (64 * 1024)  // Borrado anticipado por pasos mientras no hay datos
+#define UPLOAD_RECV_RETRIES 5
+
+static char s_url[OTA_URL_MAX] = {0};
+static std::atomic<bool> s_running{false};   // Descarga o subida: se toma con compare_exchange
+static std::atomic<bool> s_uploading{false}; // Subida local: ChargeControl::start no abre sesiones
+static volatile int s_total = 0;
+static volatile int s_done = 0;
+static volatile bool s_is_delta = false;
+static const char* volatile s_waiting = nullptr; // Etapa en espera de que terminen las cargas
+
+static bool url_is_delta(const char* url) {
+    const char* end = strchr(url, '?');
+    size_t len = end ? (size_t)(end - url) : strlen(url);
+    static const char ext[] = ".vdelta";
+    return len >= sizeof(ext) - 1 && strncmp(url + len - (sizeof(ext) - 1), ext, sizeof(ext) - 1) == 0;
+}
+
+static void fill_http_config(esp_http_client_config_t& config, const char* url) {
+    config.url = url;
+    if (strncmp(url, "https", 5) == 0) config.crt_bundle_attach = esp_crt_bundle_attach;
+    config.keep_alive_enable = true;
+    config.timeout_ms = 20000;
+    config.disable_auto_redirect = false; // Permitir que siga a Amazon S3
+    config.max_redirection_count = 5;
+    config.buffer_size_tx = 4096;
+    config.buffer_size = 10240;
+}
+
+// --- PERSISTENCIA DEL AVANCE ---
+
+uint32_t OtaPipeline::load_resume_offset(const char* url) {
+    nvs_handle_t handle;
+    if (nvs_open("ota_prog", NVS_READONLY, &handle) != ESP_OK) return 0;
+
+    char saved_url[OTA_URL_MAX] = {0}, saved_part[17] = {0};
+    size_t u_len = sizeof(saved_url), p_len = sizeof(saved_part);
+    uint32_t written = 0;
+    esp_err_t res = nvs_get_str(handle, "url", saved_url, &u_len);
+    res |= nvs_get_str(handle, "part", saved_part, &p_len);
+    res |= nvs_get_u32(handle, "written", &written);
+    nvs_close(handle);
+    if (res != ESP_OK) return 0;
+
+    // Solo vale si es la misma imagen y la misma partición destino
+    const esp_partition_t* target = esp_ota_get_next_update_partition(NULL);
+    if (!target || strcmp(saved_url, url) != 0 || strcmp(saved_part, target->label) != 0) return 0;
+    return written;
+}
+
+void OtaPipeline::save_resume_offset(const char* url, uint32_t written) {
+    const esp_partition_t* target = esp_ota_get_next_update_partition(NULL);
+    nvs_handle_t handle;
+    if (!target || nvs_open("ota_prog", NVS_READWRITE, &handle) != ESP_OK) return;
+    nvs_set_str(handle, "url", url);
+    nvs_set_str(handle, "part", target->label);
+    nvs_set_u32(handle, "written", written);
+    nvs_commit(handle);
+    nvs_close(handle);
+}
+
+void OtaPipeline::clear_resume() {
+    nvs_handle_t handle;
+    if (nvs_open("ota_prog", NVS_READWRITE, &handle) != ESP_OK) return;
+    nvs_erase_all(handle);
+    nvs_commit(handle);
+    nvs_close(handle);
+}
+
+// --- IMAGEN COMPLETA (REANUDABLE) ---
+
+esp_err_t OtaPipeline::run_full_image(const char* url) {
+    esp_http_client_config_t config = {};
+    fill_http_config(config, url);
+
+    uint32_t resume_at = load_resume_offset(url);
+
+    esp_https_ota_config_t ota_config = {};
+    ota_config.http_config = &config;
+    ota_config.partial_http_download = true;        // Bloques Range: un corte solo pierde el bloque en curso
+    ota_config.max_http_request_size = OTA_RANGE_SIZE;
+    ota_config.ota_resumption = resume_at > 0;
+    ota_config.ota_image_bytes_written = resume_at;
+
+    if (resume_at > 0) ESP_LOGI(TAG, "Reanudando OTA desde el byte %u", (unsigned)resume_at);
+
+    esp_https_ota_handle_t handle = NULL;
+    esp_err_t err = esp_https_ota_begin(&ota_config, &handle);
+    if (err != ESP_OK) {
+        // Un offset guardado que el servidor ya no acepta no debe bloquear para siempre
+        if (resume_at > 0) clear_resume();
+        return err;
+    }
+
+    s_total = esp_https_ota_get_image_size(handle);
+    uint32_t last_saved = resume_at;
+
+    while ((err = esp_https_ota_perform(handle)) == ESP_ERR_HTTPS_OTA_IN_PROGRESS) {
+        int read = esp_https_ota_get_image_len_read(handle);
+        s_done = read;
+        if (read > 0 && (uint32_t)read - last_saved >= OTA_SAVE_EVERY) {
+            save_resume_offset(url, read);
+            last_saved = read;
+        }
+    }
+
+    if (err == ESP_OK && !esp_https_ota_is_complete_data_received(handle)) err = ESP_ERR_INVALID_SIZE;
+
+    if (err != ESP_OK) {
+        // Guardar lo alcanzado antes de abortar: el próximo intento sigue desde aquí
+        int read = esp_https_ota_get_image_len_read(handle);
+        if (read > 0) save_resume_offset(url, read);
+        esp_https_ota_abort(handle);
+        return err;
+    }
+
+    // Valida la imagen y fija la partición de arranque
+    err = esp_https_ota_finish(handle);
+    clear_resume();
+    return err;
+}
+
+// --- PARCHE DELTA ---
+
+namespace {
+
+class DeltaApplier {
+public:
+    DeltaApplier(const esp_partition_t* base, const esp_partition_t* target)
+        : _base(base), _target(target) {}
+
+    ~DeltaApplier() {
+        if (_ota) esp_ota_abort(_ota);
+    }
+
+    esp_err_t feed(const uint8_t* data, size_t len) {
+        size_t i = 0;
+        while (i < len) {
+            switch (_state) {
+                case State::HEADER:
+                case State::ARGS: {
+                    size_t n = std::min(len - i, _need - _have);
+                    memcpy(_buf + _have, data + i, n);
+                    _have += n;
+                    i += n;
+                    if (_have == _need) {
+                        esp_err_t err = (_state == State::HEADER) ? on_header() : on_args();
+                        if (err != ESP_OK) return err;
+                    }
+                    break;
+                }
+                case State::OP:
+                    _op = data[i++];
+                    if (_op == OP_END) {
+                        _state = State::DONE;
+                    } else if (_op == OP_COPY) {
+                        expect(State::ARGS, 8);
+                    } else if (_op == OP_INSERT) {
+                        expect(State::ARGS, 4);
+                    } else {
+                        ESP_LOGE(TAG, "Delta: operación desconocida 0x%02X", _op);
+                        return ESP_ERR_INVALID_ARG;
+                    }
+                    break;
+                case State::INSERT_DATA: {
+                    size_t n = std::min<size_t>(len - i, _insert_left);
+                    esp_err_t err = write(data + i, n);
+                    if (err != ESP_OK) return err;
+                    _insert_left -= n;
+                    i += n;
+                    if (_insert_left == 0) _state = State::OP;
+                    break;
+                }
+                case State::DONE:
+                    return ESP_OK; // Bytes tras END se ignoran
+            }
+        }
+        return ESP_OK;
+    }
+
+    esp_err_t finish() {
+        if (_state != State::DONE || _written != _target_size) {
+            ESP_LOGE(TAG, "Delta incompleto: %u/%u bytes", (unsigned)_written, (unsigned)_target_size);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        esp_err_t err = esp_ota_end(_ota); // Verifica la imagen reconstruida
+        _ota = 0;
+        if (err != ESP_OK) return err;
+        return esp_ota_set_boot_partition(_target);
+    }
+
+private:
+    static constexpr uint8_t OP_END = 0x00, OP_COPY = 0x01, OP_INSERT = 0x02;
+    static constexpr size_t HEADER_LEN = 4 + 4 + 32 + 4;
+
+    enum class State : uint8_t { HEADER, OP, ARGS, INSERT_DATA, DONE };
+
+    const esp_partition_t* _base;
+    const esp_partition_t* _target;
+    esp_ota_handle_t _ota = 0;
+
+    State _state = State::HEADER;
+    uint8_t _buf[HEADER_LEN];
+    size_t _need = HEADER_LEN;
+    size_t _have = 0;
+    uint8_t _op = 0;
+    uint32_t _insert_left = 0;
+    uint32_t _target_size = 0;
+    uint32_t _written = 0;
+
+    static uint32_t rd32(const uint8_t* p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    void expect(State st, size_t n) {
+        _state = st;
+        _need = n;
+        _have = 0;
+    }
+
+    esp_err_t write(const uint8_t* data, size_t n) {
+        if (_written + n > _target_size) return ESP_ERR_INVALID_SIZE;
+        esp_err_t err = esp_ota_write(_ota, data, n);
+        if (err == ESP_OK) {
+            _written += n;
+            s_done = _written;
+        }
+        return err;
+    }
+
+    esp_err_t on_header() {
+        if (memcmp(_buf, "VDLT", 4) != 0 || _buf[4] != 1) {
+            ESP_LOGE(TAG, "Delta: cabecera inválida");
+            return ESP_ERR_INVALID_ARG;
+        }
+        uint8_t running_sha[32];
+        if (esp_partition_get_sha256(_base, running_sha) != ESP_OK || memcmp(running_sha, _buf + 8, 32) != 0) {
+            ESP_LOGE(TAG, "Delta: la app en ejecución no es la base del parche");
+            return ESP_ERR_INVALID_VERSION;
+        }
+        _target_size = rd32(_buf + 40);
+        if (_target_size == 0 || _target_size > _target->size) return ESP_ERR_INVALID_SIZE;
+        s_total = _target_size;
+
+        esp_err_t err = esp_ota_begin(_target, OTA_WITH_SEQUENTIAL_WRITES, &_ota);
+        if (err != ESP_OK) return err;
+        expect(State::OP, 0);
+        return ESP_OK;
+    }
+
+    esp_err_t on_args() {
+        if (_op == OP_INSERT) {
+            _insert_left = rd32(_buf);
+            _state = _insert_left ? State::INSERT_DATA : State::OP;
+            return ESP_OK;
+        }
+
+        // COPY: bloques de la partición en ejecución hacia la nueva
+        uint32_t offset = rd32(_buf), len = rd32(_buf + 4);
+        if ((uint64_t)offset + len > _base->size) return ESP_ERR_INVALID_ARG;
+
+        uint8_t chunk[1024];
+        while (len > 0) {
+            uint32_t n = std::min<uint32_t>(len, sizeof(chunk));
+            esp_err_t err = esp_partition_read(_base, offset, chunk, n);
+            if (err == ESP_OK) err = write(chunk, n);
+            if (err != ESP_OK) return err;
+            offset += n;
+            len -= n;
+        }
+        _state = State::OP;
+        return ESP_OK;
+    }
+};
+
+} // namespace
+
+esp_err_t OtaPipeline::run_delta(const char* url) {
+    const esp_partition_t* running = esp_ota_get_running_partition();
+    const esp_partition_t* target = esp_ota_get_next_update_partition(NULL);
+    if (!running || !target) return ESP_ERR_NOT_FOUND;
+
+    esp_http_client_config_t config = {};
+    fill_http_config(config, url);
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (!client) return ESP_ERR_NO_MEM;
+
+    esp_err_t err = esp_http_client_open(client, 0);
+    if (err == ESP_OK) {
+        esp_http_client_fetch_headers(client);
+        int status = esp_http_client_get_status_code(client);
+        if (status != 200) {
+            ESP_LOGE(TAG, "Delta: HTTP %d", status);
+            err = ESP_FAIL;
+        }
+    }
+
+    if (err == ESP_OK) {
+        DeltaApplier applier(running, target);
+        uint8_t chunk[1024];
+        while (err == ESP_OK) {
+            int n = esp_http_client_read(client, (char*)chunk, sizeof(chunk));
+            if (n < 0) { err = ESP_FAIL; break; }
+            if (n == 0) {
+                if (!esp_http_client_is_complete_data_received(client)) err = ESP_ERR_INVALID_SIZE;
+                break;
+            }
+            err = applier.feed(chunk, n);
+        }
+        if (err == ESP_OK) err = applier.finish();
+    }
+
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+    return err;
+}
+
+// --- TAREA ---
+
+const char* OtaPipeline::blocked_by() {
+    if (g_scr_enabled) return "SCR activos";
+    if (ChargeControl::any_active()) return "sesión de carga activa";
+    return nullptr;
+}
+
+// Una OTA retomada al arrancar, o lista para reiniciar, no corta una carga pagada
+void OtaPipeline::wait_idle(const char* stage) {
+    const char* why = blocked_by();
+    if (!why) return;
+    ESP_LOGW(TAG, "OTA en espera antes de %s: %s", stage, why);
+    s_waiting = stage;
+    while (blocked_by()) vTaskDelay(pdMS_TO_TICKS(OTA_IDLE_POLL_MS));
+    s_waiting = nullptr;
+    ESP_LOGI(TAG, "Sin cargas activas: OTA continúa (%s)", stage);
+}
+
+bool OtaPipeline::start(const char* url) {
+    if (const char* why = blocked_by()) {
+        ESP_LOGW(TAG, "OTA rechazada: %s", why);
+        return false;
+    }
+    return launch(url);
+}
+
+bool OtaPipeline::launch(const char* url) {
+    if (!url || strlen(url) >= OTA_URL_MAX) return false;
+    bool idle = false;
+    if (!s_running.compare_exchange_strong(idle, true)) return false; // Otra descarga o una subida
+    strncpy(s_url, url, OTA_URL_MAX - 1);
+    s_is_delta = url_is_delta(url);
+    s_total = 0;
+    s_done = 0;
+
+    // Core 0 con el WiFi y el TLS: el core 1 queda para el control (ver TaskConfig.hpp)
+    if (TaskPlan::create(TaskPlan::OTA, &OtaPipeline::ota_task, NULL) != pdPASS) {
+        s_running = false;
+        return false;
+    }
+    return true;
+}
+
+bool OtaPipeline::resume_pending() {
+    nvs_handle_t handle;
+    char url[OTA_URL_MAX] = {0};
+    size_t len = sizeof(url);
+    if (nvs_open("ota_prog", NVS_READONLY, &handle) != ESP_OK) return false;
+    esp_err_t res = nvs_get_str(handle, "url", url, &len);
+    nvs_close(handle);
+    if (res != ESP_OK || url[0] == 0) return false;
+
+    ESP_LOGI(TAG, "OTA interrumpida encontrada en NVS, se retomará: %s", url);
+    return launch(url); // ota_task espera a que no haya sesiones reanudadas en curso
+}
+
+void OtaPipeline::ota_task(void* pv) {
+    wait_idle("descargar");
+    ESP_LOGI(TAG, "Iniciando OTA (%s) desde: %s", s_is_delta ? "delta" : "completa", s_url);
+    g_logger.registrarEstructurado(RectEvent::OTA_START, s_is_delta ? "delta" : "full", "Descargando firmware");
+
+    esp_err_t err = ESP_FAIL;
+    uint32_t backoff_ms = 2000;
+
+    for (int attempt = 1; attempt <= OTA_MAX_ATTEMPTS; attempt++) {
+        // Sin red no gastamos intentos
+        while (!WifiManager::is_connected()) vTaskDelay(pdMS_TO_TICKS(1000));
+
+        err = s_is_delta ? run_delta(s_url) : run_full_image(s_url);
+        if (err == ESP_OK) break;
+
+        ESP_LOGW(TAG, "Intento %d/%d fallido: %s (%d/%d bytes)", attempt, OTA_MAX_ATTEMPTS,
+                 esp_err_to_name(err), s_done, s_total);
+        // Un parche contra otra base o una imagen inválida no se arreglan reintentando
+        if (err == ESP_ERR_INVALID_VERSION || err == ESP_ERR_OTA_VALIDATE_FAILED) break;
+
+        vTaskDelay(pdMS_TO_TICKS(backoff_ms));
+        backoff_ms = std::min<uint32_t>(backoff_ms * 2, OTA_BACKOFF_MAX_MS);
+    }
+
+    if (err == ESP_OK) {
+        wait_idle("reiniciar"); // Una sesión iniciada durante la descarga termina primero
+        ESP_LOGI(TAG, "Actualización completada con éxito. Reiniciando...");
+        vTaskDelay(pdMS_TO_TICKS(2000));
+        esp_restart();
+    }
+
+    char err_buf[32];
+    snprintf(err_buf, sizeof(err_buf), "Error:0x%X", err);
+    g_logger.registrarEstructurado(RectEvent::ERR_SYSTEM, err_buf, "Fallo en descarga OTA");
+    ESP_LOGE(TAG, "Error durante el proceso OTA: %s", esp_err_to_name(err));
+
+    s_running = false;
+    vTaskDelete(NULL);
+}
+
+bool OtaPipeline::is_running() { return s_running; }
+bool OtaPipeline::upload_running() { return s_uploading; }
+
+static void upload_release() {
+    s_uploading = false;
+    s_running = false;
+}
+
+int OtaPipeline::progress_pct() {
+    if (!s_running) return -1;
+    if (s_total <= 0) return 0;
+    return (int)((int64_t)s_done * 100 / s_total);
+}
+
+std::string OtaPipeline::status() {
+    if (!s_running) return "OTA: inactiva";
+    char buf[96];
+    if (const char* stage = s_waiting) {
+        const char* why = blocked_by();
+        snprintf(buf, sizeof(buf), "OTA: en espera antes de %s (%s)", stage, why ? why : "-");
+        return std::string(buf);
+    }
+    snprintf(buf, sizeof(buf), "OTA: %s %d%% (%d/%d bytes)", s_is_delta ? "delta" : "completa",
+             progress_pct(), s_done, s_total);
+    return std::string(buf);
+}
+
+// --- SUBIDA LOCAL CON DOBLE BUFFER ---
+
+namespace {
+
+struct UploadBlock {
+    uint8_t* data;
+    int len;        // 0 = fin de imagen, <0 = abortar
+};
+
+struct UploadCtx {
+    const esp_partition_t* part;
+    uint32_t image_size;
+    QueueHandle_t free_q;
+    QueueHandle_t full_q;
+    TaskHandle_t waiter;
+    esp_err_t result;
+    uint8_t sha[32];
+};
+
+bool parse_sha_hex(const char* hex, uint8_t out[32]) {
+    if (strlen(hex) != 64) return false;
+    for (int i = 0; i < 32; i++) {
+        unsigned v;
+        if (sscanf(hex + 2 * i, "%2x", &v) != 1) return false;
+        out[i] = (uint8_t)v;
+    }
+    return true;
+}
+
+} // namespace
+
+void OtaPipeline::upload_writer_task(void* pv) {
+    UploadCtx* ctx = static_cast<UploadCtx*>(pv);
+    // Se borra solo lo que ocupa la imagen, redondeado a sectores
+    const uint32_t erase_limit = (ctx->image_size + SPI_FLASH_SEC_SIZE - 1) & ~(SPI_FLASH_SEC_SIZE - 1);
+    uint32_t erased = 0, written = 0;
+    esp_err_t err = ESP_OK;
+
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+
+    while (1) {
+        UploadBlock blk;
+        // Mientras no llegan datos, adelantamos el borrado de la partición
+        TickType_t wait = (erased < erase_limit && err == ESP_OK) ? 0 : portMAX_DELAY;
+        if (xQueueReceive(ctx->full_q, &blk, wait) != pdTRUE) {
+            uint32_t n = std::min<uint32_t>(UPLOAD_ERASE_STEP, erase_limit - erased);
+            err = esp_partition_erase_range(ctx->part, erased, n);
+            erased += n;
+            continue;
+        }
+        if (blk.len <= 0) {
+            if (blk.len < 0 && err == ESP_OK) err = ESP_ERR_INVALID_STATE;
+            break;
+        }
+
+        if (err == ESP_OK) {
+            // El receptor fue más rápido que el borrado: completar lo que falta ahora
+            uint32_t need = written + blk.len;
+            if (need > erased) {
+                uint32_t upto = std::min(erase_limit, (need + SPI_FLASH_SEC_SIZE - 1) & ~(SPI_FLASH_SEC_SIZE - 1));
+                err = esp_partition_erase_range(ctx->part, erased, upto - erased);
+                erased = upto;
+            }
+        }
+        if (err == ESP_OK && written + blk.len > ctx->image_size) err = ESP_ERR_INVALID_SIZE;
+        if (err == ESP_OK) err = esp_partition_write(ctx->part, written, blk.data, blk.len);
+        if (err == ESP_OK) {
+            mbedtls_sha256_update(&sha, blk.data, blk.len);
+            written += blk.len;
+            s_done = written;
+        }
+        // El buffer vuelve al receptor aunque haya error, para que no se bloquee
+        xQueueSend(ctx->free_q, &blk.data, portMAX_DELAY);
+    }
+
+    mbedtls_sha256_finish(&sha, ctx->sha);
+    mbedtls_sha256_free(&sha);
+    if (err == ESP_OK && written != ctx->image_size) err = ESP_ERR_INVALID_SIZE;
+
+    ctx->result = err;
+    xTaskNotifyGive(ctx->waiter);
+    vTaskDelete(NULL);
+}
+
+esp_err_t OtaPipeline::receive_upload(httpd_req_t* req) {
+    // La subida dura minutos: en el hilo del httpd dejaría sin pulso al supervisor
+    // (HttpSessions::reap) y sin servicio al resto de la página
+    return HttpWorkers::submit(req, &OtaPipeline::upload_job);
+}
+
+esp_err_t OtaPipeline::upload_job(httpd_req_t* req) {
+    // Reserva atómica: una subida y una descarga (launch) no pueden pasar las dos
+    bool idle = false;
+    if (!s_running.compare_exchange_strong(idle, true)) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "OTA ya en curso");
+    }
+    // Primero se cierran las sesiones nuevas y después se mira si hay alguna: así
+    // ninguna arranca entre la comprobación y el reinicio del final
+    s_uploading = true;
+    if (const char* why = blocked_by()) {
+        upload_release();
+        ESP_LOGW(TAG, "Subida rechazada: %s", why);
+        httpd_resp_set_status(req, "409 Conflict");
+        return httpd_resp_sendstr(req, "ERROR: Carga en curso - Detenga el equipo.");
+    }
+
+    const esp_partition_t* part = esp_ota_get_next_update_partition(NULL);
+    if (!part || req->content_len == 0 || req->content_len > part->size) {
+        upload_release();
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Tamaño de imagen inválido");
+    }
+
+    uint8_t expected_sha[32];
+    bool check_sha = false;
+    char hex[65];
+    if (httpd_req_get_hdr_value_str(req, "X-Firmware-SHA256", hex, sizeof(hex)) == ESP_OK) {
+        check_sha = parse_sha_hex(hex, expected_sha);
+        if (!check_sha) {
+            upload_release();
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "SHA-256 inválido");
+        }
+    }
+
+    uint8_t* bufs[2] = { (uint8_t*)malloc(UPLOAD_BLOCK_SIZE), (uint8_t*)malloc(UPLOAD_BLOCK_SIZE) };
+    UploadCtx ctx = {};
+    ctx.part = part;
+    ctx.image_size = req->content_len;
+    ctx.free_q = xQueueCreate(2, sizeof(uint8_t*));
+    ctx.full_q = xQueueCreate(2, sizeof(UploadBlock));
+    ctx.waiter = xTaskGetCurrentTaskHandle();
+    ctx.result = ESP_FAIL;
+
+    if (!bufs[0] || !bufs[1] || !ctx.free_q || !ctx.full_q) {
+        free(bufs[0]);
+        free(bufs[1]);
+        if (ctx.free_q) vQueueDelete(ctx.free_q);
+        if (ctx.full_q) vQueueDelete(ctx.full_q);
+        upload_release();
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Sin memoria para la OTA");
+    }
+    xQueueSend(ctx.free_q, &bufs[0], 0);
+    xQueueSend(ctx.free_q, &bufs[1], 0);
+
+    s_is_delta = false;
+    s_total = req->content_len;
+    s_done = 0;
+    ESP_LOGI(TAG, "Subida OTA de %d bytes hacia %s", req->content_len, part->label);
+
+    ulTaskNotifyTake(pdTRUE, 0);
+    TaskPlan::create(TaskPlan::OTA_WRITER, &OtaPipeline::upload_writer_task, &ctx);
+
+    // Receptor: llena un buffer mientras el escritor graba el otro
+    int remaining = req->content_len;
+    bool rx_ok = true;
+    // Sin pool (o sin memoria para la copia async) se corre en el hilo del httpd:
+    // el pulso por bloque evita que el supervisor lo dé por colgado
+    bool inline_rx = !HttpWorkers::on_worker();
+    while (remaining > 0 && rx_ok) {
+        uint8_t* buf;
+        xQueueReceive(ctx.free_q, &buf, portMAX_DELAY);
+        if (inline_rx) Supervisor::checkin(Supervisor::Watch::HTTPD);
+
+        int fill = 0, want = std::min(remaining, UPLOAD_BLOCK_SIZE), retries = 0;
+        while (fill < want) {
+            int r = httpd_req_recv(req, (char*)buf + fill, want - fill);
+            if (r == HTTPD_SOCK_ERR_TIMEOUT && ++retries <= UPLOAD_RECV_RETRIES) continue;
+            if (r <= 0) { rx_ok = false; break; }
+            fill += r;
+            retries = 0;
+        }
+
+        UploadBlock blk = { buf, rx_ok ? fill : -1 };
+        xQueueSend(ctx.full_q, &blk, portMAX_DELAY);
+        remaining -= fill;
+    }
+    if (rx_ok) {
+        UploadBlock end = { nullptr, 0 };
+        xQueueSend(ctx.full_q, &end, portMAX_DELAY);
+    }
+
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    esp_err_t err = ctx.result;
+
+    free(bufs[0]);
+    free(bufs[1]);
+    vQueueDelete(ctx.free_q);
+    vQueueDelete(ctx.full_q);
+
+    if (err == ESP_OK && check_sha && memcmp(ctx.sha, expected_sha, 32) != 0) {
+        ESP_LOGE(TAG, "SHA-256 de la imagen no coincide");
+        err = ESP_ERR_INVALID_CRC;
+    }
+    if (err == ESP_OK) {
+        // Verificación completa de la imagen (cabeceras, segmentos y hash embebido)
+        esp_partition_pos_t pos = { .offset = part->address, .size = part->size };
+        esp_image_metadata_t meta = {};
+        err = esp_image_verify(ESP_IMAGE_VERIFY, &pos, &meta);
+    }
+    if (err == ESP_OK) err = esp_ota_set_boot_partition(part);
+
+    if (err != ESP_OK) {
+        upload_release();
+        char err_buf[32];
+        snprintf(err_buf, sizeof(err_buf), "Error:0x%X", err);
+        g_logger.registrarEstructurado(RectEvent::ERR_SYSTEM, err_buf, "Fallo en subida OTA");
+        ESP_LOGE(TAG, "Subida OTA fallida: %s", esp_err_to_name(err));
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Imagen rechazada");
+    }
+
+    // s_uploading sigue en alto: ninguna sesión pudo abrirse durante la subida ni hasta el reinicio
+    ESP_LOGI(TAG, "OTA Completo. Reiniciando...");
+    httpd_resp_sendstr(req, "<html><body><h1>Exito. Reiniciando equipo...</h1></body></html>");
+    vTaskDelay(pdMS_TO_TICKS(2000));
+    esp_restart();
+    return ESP_OK;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <string>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+/**
+ * @brief Descarga OTA reanudable sobre esp_https_ota_begin/perform.
+ *
+ * - Imagen completa (.bin): peticiones Range de 64 KB; el avance se guarda en
+ *   NVS y tras un corte (o un reinicio) se continúa desde el último offset.
+ * - Parche delta (.vdelta): se aplica en streaming contra la partición en
+ *   ejecución, así solo viajan los bytes que cambiaron.
+ *
+ * Formato .vdelta (little endian):
+ *   "VDLT" | u8 versión(1) | u8[3] reservado | u8[32] SHA-256 de la app base | u32 tamaño final
+ *   y luego operaciones hasta END:
+ *     0x00 END
+ *     0x01 COPY   u32 offset_base, u32 len   -> copia desde la partición en ejecución
+ *     0x02 INSERT u32 len, len bytes         -> bytes nuevos literales
+ *
+ * Subida local (POST /update, cuerpo binario crudo): un worker de HttpWorkers
+ * recibe en un buffer (el hilo del httpd queda libre) mientras una tarea escritora graba el otro, calcula SHA-256 al vuelo
+ * y borra por adelantado la partición destino mientras espera datos.
+ *
+ * Nunca se actualiza con una carga en curso: start() y la subida se rechazan
+ * mientras blocked_by() dé un motivo; la descarga retomada al arrancar espera
+ * a que terminen las sesiones y vuelve a esperar antes del reinicio. Durante
+ * una subida local ChargeControl::start rechaza sesiones nuevas, así el
+ * reinicio del final no corta ninguna.
+ */
+class OtaPipeline {
+public:
+    static bool start(const char* url);
+    static bool resume_pending();  // Retoma al arrancar una descarga cortada por un reinicio
+    static bool is_running();
+    static const char* blocked_by();  // Motivo para no actualizar ahora; nullptr si se puede
+    static bool upload_running();     // Subida local en curso: no se abren sesiones hasta el reinicio
+    static int progress_pct();     // -1 si no hay descarga en curso
+    static std::string status();   // Resumen legible para comandos
+
+    // Handler de subida local; opcional "X-Firmware-SHA256: <hex>" para verificar
+    static esp_err_t receive_upload(httpd_req_t* req);
+
+private:
+    static bool launch(const char* url);
+    static esp_err_t upload_job(httpd_req_t* req);
+    static void wait_idle(const char* stage);
+    static void ota_task(void* pv);
+    static void upload_writer_task(void* pv);
+    static esp_err_t run_full_image(const char* url);
+    static esp_err_t run_delta(const char* url);
+
+    static uint32_t load_resume_offset(const char* url);
+    static void save_resume_offset(const char* url, uint32_t written);
+    static void clear_resume();
+};
@@ -2,13 +2,32 @@
 #include "WifiManager.hpp"
 #include "GitHubClient.hpp"
 #include "LoggerFS.hpp"
+#include "CommandGateway.hpp"
+#include "OtaPipeline.hpp"
+#include "BootSequencer.hpp"
+#include "Metering.hpp"
+#include "TimeSeries.hpp"
+#include "ChargeControl.hpp"
+#include "SessionJournal.hpp"
+#include "Uplink.hpp"
+#include "Supervisor.hpp"
+#include "HttpArena.hpp"
+#include "HttpWorkers.hpp"
+#include "HttpSessions.hpp"
+#include "JsonWriter.hpp"
+#include "TaskConfig.hpp"
+#include "esp_timer.h"
+#include "esp_system.h"
 #include "esp_log.h"
 #include "esp_http_server.h"
 #include <string>
+#include <cstring>
+#include <cstdlib>
 #include <algorithm>
+#include <time.h>
 #include "esp_app_format.h"
 #include "esp_ota_ops.h"
-#include "cJSON.h"
+#include "esp_heap_caps.h"
 
 static const char *TAG = "PORTAL_WEB";
 
@@ -21,207 +40,500 @@ extern float g_corriente_actual;
 extern int g_potenciometro_mv;   
 
 int g_debug_adc_val = 0;  // Variable global que compartiremos con PortalWeb
-int ws_fd = -1; 
+static httpd_handle_t s_server = nullptr;
 
 extern "C" { extern volatile bool g_scr_enabled; }
 extern LoggerFS g_logger; 
 
 
-// Utilidad para decodificar caracteres especiales del WiFi (espacios, @, etc)
-std::string urlDecode(std::string str) {
-    std::string res;
-    for (size_t i = 0; i < str.length(); ++i) {
-        if (str[i] == '+') res += ' ';        
-        else if (str[i] == '%' && i + 2 < str.length()) {
-            char hex[3] = { str[i+1], str[i+2], 0 };
-            res += (char)strtol(hex, nullptr, 16);
-            i += 2;
-        } 
-        else res += str[i];
+PortalWeb::PortalWeb() {}
+
+// Aviso corto a todos los WebSocket (fin de trabajos largos, reinicio, ...)
+void PortalWeb::notify(const char* json, size_t len) {
+    if (s_server == NULL) return;
+    int fds[HttpSessions::MAX_WS];
+    size_t n = HttpSessions::ws_fds(fds, HttpSessions::MAX_WS);
+
+    httpd_ws_frame_t ws_pkt = {};
+    ws_pkt.payload = (uint8_t*)json;
+    ws_pkt.len = len;
+    ws_pkt.type = HTTPD_WS_TYPE_TEXT;
+    for (size_t i = 0; i < n; i++) {
+        // Envío asíncrono: no espera a que el cliente reciba para seguir procesando
+        if (httpd_ws_get_fd_info(s_server, fds[i]) == HTTPD_WS_CLIENT_WEBSOCKET) {
+            httpd_ws_send_frame_async(s_server, fds[i], &ws_pkt);
+        }
     }
-    return res;
 }
 
+// Función para enviar datos en tiempo real sin bloquear el servidor
+void broadcast_debug_data(httpd_handle_t server) {
+    char json[64];
+    TextBuffer out(json, sizeof(json));
+    // Enviamos un tipo "debug" para procesarlo independientemente en JS
+    JsonWriter(out).begin_object().field("type", "debug").field("adc", g_debug_adc_val).end_object();
+    PortalWeb::notify(out.c_str(), out.size());
+}
 
+static void notify_scan(uint32_t scan_id, bool ok) {
+    char json[64];
+    TextBuffer out(json, sizeof(json));
+    JsonWriter(out).begin_object().field("type", "scan").field("id", scan_id).field("ok", ok).end_object();
+    PortalWeb::notify(out.c_str(), out.size());
+}
 
-PortalWeb::PortalWeb() {}
+// Resultado de /scan, por tramos
+static esp_err_t send_scan(httpd_req_t* req, HttpArena& arena) {
+    httpd_resp_set_type(req, "application/json");
+    TextBuffer out = arena.text(0, HttpArena::send_chunk, req);
+    WifiManager::scan_to_json(out);
+    out.flush();
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
 
-// Función para enviar datos en tiempo real sin bloquear el servidor
-void broadcast_debug_data(httpd_handle_t server) {
-    if (ws_fd == -1 || server == NULL) return;
+// Salida de /api/series: agrupa filas en cubetas de bucket_s y las escribe como arreglos JSON
+struct SeriesSink {
+    JsonWriter* json;
+    uint32_t bucket_s;
+    uint32_t bucket_t;
+    uint32_t count;
+    int64_t sum[TimeSeries::COLS];
+    int32_t last[TimeSeries::COLS];
+};
 
-    char json[128];
-    // Enviamos un tipo "debug" para procesarlo independientemente en JS
-    snprintf(json, sizeof(json), "{\"type\":\"debug\",\"adc\":%d}", g_debug_adc_val);
+static void series_emit(SeriesSink& s) {
+    if (!s.count) return;
+    s.json->begin_array().value(s.bucket_t);
+    for (int c = 0; c < TimeSeries::COLS; c++) {
+        // mA: media de la cubeta; mWh: último valor
+        s.json->value((c < 4) ? (int32_t)(s.sum[c] / (int64_t)s.count) : s.last[c]);
+    }
+    s.json->end_array();
+    s.count = 0;
+    memset(s.sum, 0, sizeof(s.sum));
+}
 
-    httpd_ws_frame_t ws_pkt = {};
-    ws_pkt.payload = (uint8_t*)json;
-    ws_pkt.len = strlen(json);
-    ws_pkt.type = HTTPD_WS_TYPE_TEXT;
+static bool series_row(const TimeSeries::Row& row, void* ctx) {
+    SeriesSink& s = *(SeriesSink*)ctx;
+    uint32_t bucket = row.t - (row.t % s.bucket_s);
+    if (s.count && bucket != s.bucket_t) series_emit(s);
+    s.bucket_t = bucket;
+    s.count++;
+    for (int c = 0; c < TimeSeries::COLS; c++) {
+        s.sum[c] += row.v[c];
+        s.last[c] = row.v[c];
+    }
+    return true;
+}
 
-    // Envío asíncrono: no espera a que el cliente reciba para seguir procesando
-    httpd_ws_send_frame_async(server, ws_fd, &ws_pkt);
+// Salida de /api/log/since: una línea JSON por registro (NDJSON)
+static bool log_record_ndjson(const LogRecord& rec, void* ctx) {
+    TextBuffer& out = *(TextBuffer*)ctx;
+    uint16_t code = (uint16_t)strtoul(rec.codigo.data(), nullptr, 16); // Termina en la coma siguiente
+    const RectEventInfo* info = rect_event_info((RectEvent)code);
+    JsonWriter json(out);
+    json.begin_object().field("seq", rec.seq).field("t", rec.fecha).field("ev", code);
+    if (info) json.field("name", info->nombre);
+    json.field("v", rec.valor).field("n", rec.nota).end_object();
+    out.append('\n');
+    return !out.overflow(); // El cliente se fue: se corta la lectura
 }
 
 esp_err_t PortalWeb::start() {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-    config.core_id = 0; // El servidor web se queda en el Core 0 con el WiFi
-    config.lru_purge_enable = true;
-    config.max_uri_handlers = 15; // Suficientes para todos los endpoints
+    config.core_id = TaskPlan::HTTPD.core; // El servidor web se queda en el Core 0 con el WiFi
+    HttpSessions::configure(config); // Cupos de sockets, keep-alive y barrido de ociosas
+    config.max_uri_handlers = 16; // Suficientes para todos los endpoints
     config.send_wait_timeout = 15;
     config.recv_wait_timeout = 15; // Añadido para estabilidad
-    config.stack_size = 10240;
-    config.task_priority = 2;      // Mayor prioridad para fluidez del portal
+    config.stack_size = TaskPlan::HTTPD.stack;
+    config.task_priority = TaskPlan::HTTPD.priority;
 
     ESP_LOGI(TAG, "Iniciando Servidor Web...");
+    HttpWorkers::start(); // Handlers lentos (SD, escaneo, comandos) fuera del hilo del httpd
 
     if (httpd_start(&_server, &config) == ESP_OK) {
+        s_server = _server;
+        HttpSessions::attach(_server);
+        WifiManager::set_scan_listener(notify_scan);
         
         // --- 1. RUTA RAÍZ (index.html embebido) ---
         static httpd_uri_t uri_root = {
             .uri       = "/",
             .method    = HTTP_GET,
             .handler   = [](httpd_req_t *req) {
-                const size_t size = (index_html_end - index_html_start);
-                std::string s((const char*)index_html_start, size);
-                
+                // La página embebida se envía por tramos y los marcadores se sustituyen al vuelo
+                std::string_view page((const char*)index_html_start, index_html_end - index_html_start);
+                if (!page.empty() && page.back() == 0) page.remove_suffix(1); // NUL de EMBED_TXTFILES
+
                 const esp_app_desc_t *app_desc = esp_app_get_description();
-                
-                auto replace = [&](std::string& target, const std::string& placeholder, const std::string& value) {
-                    size_t pos = 0;
-                    while((pos = target.find(placeholder, pos)) != std::string::npos) {
-                        target.replace(pos, placeholder.length(), value);
-                        pos += value.length();
-                    }
+                const struct { std::string_view key; const char* value; } vars[] = {
+                    { "{{VERSION}}", app_desc->version },
+                    { "{{TITULO_EQUIPO}}", app_desc->project_name },
                 };
 
-                replace(s, "{{VERSION}}", app_desc->version);
-                replace(s, "{{TITULO_EQUIPO}}", app_desc->project_name);
-
                 httpd_resp_set_type(req, "text/html; charset=utf-8");
-                return httpd_resp_send(req, s.c_str(), s.length());
+                size_t pos = 0;
+                while (pos < page.size()) {
+                    size_t mark = page.find("{{", pos);
+                    size_t stop = (mark == std::string_view::npos) ? page.size() : mark;
+                    if (stop > pos && httpd_resp_send_chunk(req, page.data() + pos, stop - pos) != ESP_OK) return ESP_FAIL;
+                    if (mark == std::string_view::npos) break;
+
+                    pos = mark + 2;
+                    const char* value = "{{";
+                    for (const auto& v : vars) {
+                        if (page.substr(mark, v.key.size()) == v.key) {
+                            value = v.value;
+                            pos = mark + v.key.size();
+                            break;
+                        }
+                    }
+                    if (httpd_resp_sendstr_chunk(req, value) != ESP_OK) return ESP_FAIL;
+                }
+                return httpd_resp_send_chunk(req, NULL, 0);
             }
         };
-        httpd_register_uri_handler(_server, &uri_root);
+        HttpSessions::register_uri(_server, &uri_root);
 
         // --- HANDLER WEBSOCKET ---
         static httpd_uri_t uri_ws = {
             .uri = "/ws",
             .method = HTTP_GET,
             .handler = [](httpd_req_t *req) {
-                if (req->sess_ctx) return ESP_OK; 
-                ws_fd = httpd_req_to_sockfd(req);
-                ESP_LOGI("WS", "Cliente conectado: fd=%d", ws_fd);
+                if (req->method == HTTP_GET) {
+                    int fd = httpd_req_to_sockfd(req);
+                    if (!HttpSessions::promote_ws(fd)) {
+                        ESP_LOGW("WS", "Cliente rechazado: fd=%d (cupo de WebSocket lleno)", fd);
+                        return ESP_FAIL; // El httpd cierra la sesión
+                    }
+                    ESP_LOGI("WS", "Cliente conectado: fd=%d", fd);
+                    return ESP_OK;
+                }
+
+                // Trama entrante: solo texto, se encola como comando "[id:]cmd"
+                httpd_ws_frame_t frame = {};
+                frame.type = HTTPD_WS_TYPE_TEXT;
+                esp_err_t ret = httpd_ws_recv_frame(req, &frame, 0);
+                if (ret != ESP_OK) return ret;
+                if (frame.type != HTTPD_WS_TYPE_TEXT || frame.len == 0) return ESP_OK;
+
+                char buf[128];
+                if (frame.len >= sizeof(buf)) {
+                    ESP_LOGW("WS", "Trama de %d bytes descartada", (int)frame.len);
+                    return ESP_OK;
+                }
+                frame.payload = (uint8_t*)buf;
+                ret = httpd_ws_recv_frame(req, &frame, frame.len);
+                if (ret != ESP_OK) return ret;
+                buf[frame.len] = 0;
+
+                CommandGateway::submit(CmdSource::WS, buf, frame.len, req->handle, httpd_req_to_sockfd(req));
                 return ESP_OK;
             },
             .is_websocket = true,
             .handle_ws_control_frames = false // Silencia warning
         };
-        httpd_register_uri_handler(_server, &uri_ws);
+        HttpSessions::register_uri(_server, &uri_ws);
 
         // --- 3. AUDITORÍA: Obtener Logs ---
         static httpd_uri_t uri_get_logs = {
             .uri = "/get-logs",
             .method = HTTP_GET,
             .handler = [](httpd_req_t *req) {
-                // Dentro del handler de "/get-logs"
-                FILE* f = fopen("/sd/rect_log.csv", "r"); // Debe coincidir con el prefijo /sd
-                if (!f) return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No hay logs");
-                
-                httpd_resp_set_type(req, "text/plain");
-                char line[512];
-                while (fgets(line, sizeof(line), f)) {
-                    httpd_resp_sendstr_chunk(req, line);
-                    vTaskDelay(pdMS_TO_TICKS(2));
-                }
-                fclose(f);
-                return httpd_resp_sendstr_chunk(req, NULL);
+                // Lectura larga de la SD: en un worker
+                return HttpWorkers::submit(req, [](httpd_req_t *req) {
+                    g_logger.flush(); // Lo pendiente en RAM también se muestra
+                    FILE* f = fopen("/sd/rect_log.csv", "r"); // Debe coincidir con el prefijo /sd
+                    if (!f) return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No hay logs");
+
+                    httpd_resp_set_type(req, "text/plain");
+                    char line[512];
+                    while (fgets(line, sizeof(line), f)) {
+                        if (httpd_resp_sendstr_chunk(req, line) != ESP_OK) break; // Cliente se fue
+                        vTaskDelay(pdMS_TO_TICKS(2));
+                    }
+                    fclose(f);
+                    return httpd_resp_sendstr_chunk(req, NULL);
+                });
             }
         };
-        httpd_register_uri_handler(_server, &uri_get_logs);
+        HttpSessions::register_uri(_server, &uri_get_logs);
 
         // --- 4. AUDITORÍA: Borrar Logs ---
         static httpd_uri_t uri_clear_logs = {
             .uri = "/clear-logs",
             .method = HTTP_POST,
             .handler = [](httpd_req_t *req) {
-                g_logger.limpiarLog();
-                return httpd_resp_sendstr(req, "Historial borrado");
+                // Borrado y recreación en la SD (y espera a lectores): en un worker
+                return HttpWorkers::submit(req, [](httpd_req_t *req) {
+                    g_logger.limpiarLog();
+                    return httpd_resp_sendstr(req, "Historial borrado");
+                });
             }
         };
-        httpd_register_uri_handler(_server, &uri_clear_logs);
+        HttpSessions::register_uri(_server, &uri_clear_logs);
 
         // --- 5. WIFI: Escanear Redes ---
         static httpd_uri_t uri_scan = {
             .uri = "/scan",
             .method = HTTP_GET,
             .handler = [](httpd_req_t *req) {
-                std::string json = WifiManager::scan_to_json();
-                httpd_resp_set_type(req, "application/json");
-                return httpd_resp_sendstr(req, json.c_str());
+                // ?async=1 -> 202 con id y aviso {"type":"scan"} por WS; ?id=N -> ese escaneo;
+                // sin query -> caché o espera corta
+                HttpArena& arena = HttpArena::request();
+                HttpArena::Scope scope(arena);
+                std::string_view query = HttpArena::query(req, arena), val;
+                bool async = HttpArena::field(query, "async", val) && val == "1";
+                bool force = HttpArena::field(query, "force", val) && val == "1";
+                uint32_t scan_id = 0;
+                HttpArena::field_u32(query, "id", scan_id);
+
+                if (scan_id == 0) scan_id = WifiManager::start_scan(force);
+                bool ready = WifiManager::scan_result_id() >= scan_id;
+
+                if (async) {
+                    char buf[64];
+                    TextBuffer out(buf, sizeof(buf));
+                    JsonWriter(out).begin_object().field("scan", scan_id).field("ready", ready).end_object();
+                    httpd_resp_set_type(req, "application/json");
+                    if (!ready) httpd_resp_set_status(req, "202 Accepted");
+                    return httpd_resp_send(req, out.c_str(), out.size());
+                }
+                if (ready) return send_scan(req, arena);
+
+                // Long-poll acotado (el escaneo activo tarda ~2-3 s): la espera va en un worker
+                return HttpWorkers::submit(req, [](httpd_req_t *req) {
+                    HttpArena& arena = HttpArena::request();
+                    HttpArena::Scope scope(arena);
+                    uint32_t scan_id = 0;
+                    HttpArena::field_u32(HttpArena::query(req, arena), "id", scan_id);
+                    if (scan_id == 0) scan_id = WifiManager::start_scan(false); // El que está en curso
+                    WifiManager::wait_scan(scan_id, pdMS_TO_TICKS(5000));
+                    return send_scan(req, arena);
+                });
             }
         };
-        httpd_register_uri_handler(_server, &uri_scan);
+        HttpSessions::register_uri(_server, &uri_scan);
 
         // --- 6. WIFI: Guardar Configuración ---
         static httpd_uri_t uri_setwifi = {
             .uri = "/setwifi",
             .method = HTTP_POST,
             .handler = [](httpd_req_t *req) {
-                char buf[256];
-                int ret = httpd_req_recv(req, buf, std::min((size_t)req->content_len, sizeof(buf)-1));
-                if (ret <= 0) return ESP_FAIL;
-                buf[ret] = 0;
-
-                std::string data(buf);
-                size_t s_pos = data.find("ssid="), p_pos = data.find("&pass=");
-                if (s_pos != std::string::npos && p_pos != std::string::npos) {
-                    std::string ssid = urlDecode(data.substr(s_pos + 5, p_pos - (s_pos + 5)));
-                    std::string pass = urlDecode(data.substr(p_pos + 6));
-                    WifiManager::save_and_reconnect(ssid, pass);
+                HttpArena& arena = HttpArena::request();
+                HttpArena::Scope scope(arena);
+                std::string_view form = HttpArena::body(req, arena, 255);
+                if (form.empty()) return ESP_FAIL;
+
+                std::string_view ssid, pass;
+                if (HttpArena::field(form, "ssid", ssid) && HttpArena::field(form, "pass", pass)) {
+                    ssid = HttpArena::decode(arena, ssid);
+                    pass = HttpArena::decode(arena, pass);
+                    if (ssid.data() && pass.data()) {
+                        WifiManager::save_and_reconnect(ssid.data(), pass.data()); // Reinicio en 3 s
+                        static const char restart[] = "{\"type\":\"restart\",\"in_ms\":3000}";
+                        PortalWeb::notify(restart, sizeof(restart) - 1);
+                        httpd_resp_set_status(req, "202 Accepted");
+                        return httpd_resp_sendstr(req, "Configuración recibida, reiniciando");
+                    }
                 }
-                return httpd_resp_sendstr(req, "Configuración recibida");
+                return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Faltan ssid/pass");
             }
         };
-        httpd_register_uri_handler(_server, &uri_setwifi);
+        HttpSessions::register_uri(_server, &uri_setwifi);
 
         // --- 7. OTA: Listar Versiones ---
         static httpd_uri_t uri_list_ota = {
             .uri = "/list-releases",
             .method = HTTP_GET,
             .handler = [](httpd_req_t *req) {
-                std::string json = GitHubClient::get_releases_json();
+                // Respuesta inmediata desde caché; "?refresh=1" despierta el refresco en segundo plano
+                HttpArena& arena = HttpArena::request();
+                HttpArena::Scope scope(arena);
+                std::string_view val;
+                if (HttpArena::field(HttpArena::query(req, arena), "refresh", val) && val == "1") {
+                    GitHubClient::request_refresh();
+                }
                 httpd_resp_set_type(req, "application/json");
-                return httpd_resp_sendstr(req, json.c_str());
+                TextBuffer out = arena.text(0, HttpArena::send_chunk, req);
+                GitHubClient::write_releases_json(out);
+                out.flush();
+                return httpd_resp_send_chunk(req, NULL, 0);
             }
         };
-        httpd_register_uri_handler(_server, &uri_list_ota);
+        HttpSessions::register_uri(_server, &uri_list_ota);
 
         // --- 8. OTA: Ejecutar Actualización ---
         static httpd_uri_t uri_do_ota = {
             .uri = "/do-update",
             .method = HTTP_GET,
             .handler = [](httpd_req_t *req) {
-                char* query = nullptr;
-                size_t q_len = httpd_req_get_url_query_len(req) + 1;
-                if (q_len > 1) {
-                    query = (char*)malloc(q_len);
-                    if (httpd_req_get_url_query_str(req, query, q_len) == ESP_OK) {
-                        char url[256];
-                        if (httpd_query_key_value(query, "url", url, sizeof(url)) == ESP_OK) {
-                            std::string dec_url = urlDecode(std::string(url));
-                            g_logger.registrarEstructurado(RectEvent::OTA_START, dec_url, "Inicio OTA desde Web");
-                            GitHubClient::start_ota_from_url(dec_url.c_str());
-                            free(query);
-                            return httpd_resp_sendstr(req, "Actualización iniciada");
-                        }
+                if (const char* why = OtaPipeline::blocked_by()) {
+                    httpd_resp_set_status(req, "409 Conflict");
+                    char msg[64];
+                    snprintf(msg, sizeof(msg), "OTA bloqueada: %s", why);
+                    return httpd_resp_sendstr(req, msg);
+                }
+                HttpArena& arena = HttpArena::request();
+                HttpArena::Scope scope(arena);
+                std::string_view url;
+                if (HttpArena::field(HttpArena::query(req, arena), "url", url) && !url.empty()) {
+                    url = HttpArena::decode(arena, url);
+                    if (url.data()) {
+                        g_logger.registrarEstructurado(RectEvent::OTA_START, url, "Inicio OTA desde Web");
+                        GitHubClient::start_ota_from_url(url.data());
+                        return httpd_resp_sendstr(req, "Actualización iniciada");
                     }
-                    free(query);
                 }
                 return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "URL inválida");
             }
         };
-        httpd_register_uri_handler(_server, &uri_do_ota);
+        HttpSessions::register_uri(_server, &uri_do_ota);
+
+        // --- 8b. OTA: Subida local (binario crudo, doble buffer) ---
+        static httpd_uri_t uri_upload = {
+            .uri = "/update",
+            .method = HTTP_POST,
+            .handler = OtaPipeline::receive_upload
+        };
+        HttpSessions::register_uri(_server, &uri_upload);
+
+        // --- 9. COMANDOS: Pasarela HTTP ---
+        static httpd_uri_t uri_cmd = {
+            .uri = "/api/cmd",
+            .method = HTTP_POST,
+            .handler = [](httpd_req_t *req) {
+                // Espera al ejecutor hasta 5 s: en un worker
+                return HttpWorkers::submit(req, [](httpd_req_t *req) {
+                    HttpArena& arena = HttpArena::request();
+                    HttpArena::Scope scope(arena);
+                    std::string_view cmd = HttpArena::body(req, arena, 127);
+                    if (cmd.empty()) return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Comando inválido");
+
+                    uint32_t id = 0;
+                    std::string resp;
+                    CmdStatus st = CommandGateway::call(cmd.data(), cmd.size(), id, resp, pdMS_TO_TICKS(5000));
+
+                    switch (st) {
+                        case CmdStatus::OK: break;
+                        case CmdStatus::BAD_FRAME:    httpd_resp_set_status(req, "400 Bad Request"); break;
+                        case CmdStatus::RATE_LIMITED: httpd_resp_set_status(req, "429 Too Many Requests"); break;
+                        case CmdStatus::QUEUE_FULL:   httpd_resp_set_status(req, "503 Service Unavailable"); break;
+                        case CmdStatus::TIMEOUT:      httpd_resp_set_status(req, "504 Gateway Timeout"); break;
+                    }
+                    httpd_resp_set_type(req, "application/json");
+                    // Respuestas largas (log.show) salen por tramos sin otra copia en el heap
+                    TextBuffer out = arena.text(0, HttpArena::send_chunk, req);
+                    JsonWriter(out).begin_object().field("id", id).field("resp", resp).end_object();
+                    out.flush();
+                    return httpd_resp_send_chunk(req, NULL, 0);
+                });
+            }
+        };
+        HttpSessions::register_uri(_server, &uri_cmd);
+
+        // --- 10. MÉTRICAS (texto "clave valor") ---
+        static httpd_uri_t uri_metrics = {
+            .uri = "/metrics",
+            .method = HTTP_GET,
+            .handler = [](httpd_req_t *req) {
+                HttpArena& arena = HttpArena::request();
+                HttpArena::Scope scope(arena);
+                httpd_resp_set_type(req, "text/plain");
+                TextBuffer out = arena.text(0, HttpArena::send_chunk, req);
+                BootSequencer::metrics(out);
+                Metering::metrics(out);
+                ChargeControl::metrics(out);
+                SessionJournal::metrics(out);
+                g_logger.metrics(out);
+                HttpWorkers::metrics(out);
+                HttpSessions::metrics(out);
+                Uplink::metrics(out);
+                Supervisor::metrics(out);
+                out.appendf("uptime_s %lld\nheap_free %u\nheap_min_free %u\nheap_largest_free_block %u\n",
+                            (long long)(esp_timer_get_time() / 1000000), (unsigned)esp_get_free_heap_size(),
+                            (unsigned)esp_get_minimum_free_heap_size(),
+                            (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+                out.appendf("http_arena_high_water %u\nhttp_arena_failures %u\n",
+                            (unsigned)arena.high_water(), (unsigned)arena.failures());
+                out.flush();
+                return httpd_resp_send_chunk(req, NULL, 0);
+            }
+        };
+        HttpSessions::register_uri(_server, &uri_metrics);
+
+        // --- 11. HISTORIAL: /api/series?from=&to=&max= (epoch s, por defecto la última hora) ---
+        static httpd_uri_t uri_series = {
+            .uri = "/api/series",
+            .method = HTTP_GET,
+            .handler = [](httpd_req_t *req) {
+                // Lectura de bloques en la SD: en un worker
+                return HttpWorkers::submit(req, [](httpd_req_t *req) {
+                    HttpArena& arena = HttpArena::request();
+                    HttpArena::Scope scope(arena);
+                    std::string_view query = HttpArena::query(req, arena);
+                    uint32_t to = (uint32_t)time(NULL), from = 0, max_rows = 300;
+                    HttpArena::field_u32(query, "from", from);
+                    HttpArena::field_u32(query, "to", to);
+                    HttpArena::field_u32(query, "max", max_rows);
+                    if (from == 0 || from >= to) from = to > 3600 ? to - 3600 : 0;
+                    if (max_rows == 0 || max_rows > 2000) max_rows = 300;
+
+                    // Nivel más fino que alcanza y, si aún sobran filas, cubetas más anchas
+                    int level = TimeSeries::pick_level(from, to, max_rows);
+                    uint32_t step = TimeSeries::step_s(level);
+                    uint32_t span = to - from;
+                    uint32_t bucket = (span + max_rows - 1) / max_rows;
+                    bucket = (bucket <= step) ? step : ((bucket + step - 1) / step) * step;
+
+                    SeriesSink* sink = arena.make<SeriesSink>();
+                    if (!sink) return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Sin memoria");
+                    sink->bucket_s = bucket;
+
+                    httpd_resp_set_type(req, "application/json");
+                    TextBuffer out = arena.text(2048, HttpArena::send_chunk, req);
+                    JsonWriter json(out);
+                    sink->json = &json;
+                    json.begin_object().field("level", level).field("step", bucket).key("rows").begin_array();
+                    TimeSeries::query(level, from, to, series_row, sink);
+                    series_emit(*sink);
+                    json.end_array().end_object();
+                    out.flush();
+                    return httpd_resp_send_chunk(req, NULL, 0);
+                });
+            }
+        };
+        HttpSessions::register_uri(_server, &uri_series);
+
+        // --- 12. AUDITORÍA: /api/log/since?seq=N&max= (réplica incremental del log, NDJSON) ---
+        static httpd_uri_t uri_log_since = {
+            .uri = "/api/log/since",
+            .method = HTTP_GET,
+            .handler = [](httpd_req_t *req) {
+                // Búsqueda y lectura en la SD: en un worker
+                return HttpWorkers::submit(req, [](httpd_req_t *req) {
+                    HttpArena& arena = HttpArena::request();
+                    HttpArena::Scope scope(arena);
+                    std::string_view query = HttpArena::query(req, arena);
+                    uint32_t after = 0, max_rows = 200;
+                    HttpArena::field_u32(query, "seq", after);
+                    HttpArena::field_u32(query, "max", max_rows);
+                    if (max_rows == 0 || max_rows > 1000) max_rows = 200;
+
+                    httpd_resp_set_type(req, "application/x-ndjson");
+                    TextBuffer out = arena.text(2048, HttpArena::send_chunk, req);
+                    LoggerFS::SinceResult res = g_logger.read_since(after, max_rows, log_record_ndjson, &out);
+                    // Última línea: cursor para la próxima consulta; gap = hubo registros perdidos por rotación
+                    JsonWriter(out).begin_object().field("next", res.next).field("first", res.first)
+                        .field("count", (uint32_t)res.count).field("more", res.more).field("gap", res.gap).end_object();
+                    out.append('\n');
+                    out.flush();
+                    return httpd_resp_send_chunk(req, NULL, 0);
+                });
+            }
+        };
+        HttpSessions::register_uri(_server, &uri_log_since);
 
         return ESP_OK;
     }
@@ -230,7 +542,9 @@ esp_err_t PortalWeb::start() {
 
 void PortalWeb::stop() {
     if (_server) {
+        HttpSessions::detach();
         httpd_stop(_server);
         _server = nullptr;
+        s_server = nullptr;
     }
 }
\ No newline at end of file
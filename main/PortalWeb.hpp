@@ -8,6 +8,8 @@ public:
     PortalWeb();
     esp_err_t start();
     void stop();
+    // Texto JSON al cliente WebSocket conectado (no bloquea; sin cliente no hace nada)
+    static void notify(const char* json, size_t len);
 
 private:
     httpd_handle_t _server = nullptr;
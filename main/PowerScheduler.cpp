@@ -0,0 +1,202 @@
+#include "PowerScheduler.hpp"
+#include "esp_timer.h"
+#include <cstdio>
+#include <memory>
+#include <new>
+
+PowerScheduler::PowerScheduler(size_t points) : _n(points > MAX_POINTS ? MAX_POINTS : points) {}
+
+void PowerScheduler::configure(uint32_t cap_ma, Policy policy, uint32_t slice_s) {
+    _cap_ma = cap_ma;
+    _policy = policy;
+    _slice_s = slice_s ? slice_s : 1;
+    _slice_left = _slice_s;
+    // Las demandas anotadas con el tope anterior se recortan al nuevo
+    for (size_t p = 0; p < _n; p++) {
+        if (!((_requesting >> p) & 1)) continue;
+        uint32_t d = clamp(_slot[p].demand_ma);
+        if ((_conducting >> p) & 1) _allocated_ma -= _slot[p].demand_ma - d;
+        _slot[p].demand_ma = d;
+    }
+    _dirty = true;
+}
+
+bool PowerScheduler::fits(uint32_t demand_ma) const {
+    return _cap_ma == 0 || _allocated_ma + demand_ma <= _cap_ma;
+}
+
+uint32_t PowerScheduler::clamp(uint32_t demand_ma) const {
+    return (_cap_ma && demand_ma > _cap_ma) ? _cap_ma : demand_ma;
+}
+
+// Llena idx con los puntos que piden potencia, en el orden de la política
+size_t PowerScheduler::order(size_t* idx, size_t from) const {
+    size_t count = 0;
+    for (size_t k = 0; k < _n; k++) {
+        size_t p = (from + k) % _n;
+        if ((_requesting >> p) & 1) idx[count++] = p;
+    }
+    if (_policy == Policy::SHORTEST_REMAINING) {
+        // Inserción: estable y sin memoria extra, n <= 64
+        for (size_t i = 1; i < count; i++) {
+            size_t v = idx[i];
+            size_t j = i;
+            while (j > 0 && _slot[idx[j - 1]].remaining_s > _slot[v].remaining_s) {
+                idx[j] = idx[j - 1];
+                j--;
+            }
+            idx[j] = v;
+        }
+    }
+    return count;
+}
+
+void PowerScheduler::admit_waiting() {
+    uint64_t waiting = _requesting & ~_conducting;
+    if (!waiting) return;
+
+    size_t idx[MAX_POINTS];
+    size_t count = order(idx, _rr_next);
+    for (size_t i = 0; i < count; i++) {
+        size_t p = idx[i];
+        if ((_conducting >> p) & 1) continue;
+        if (fits(_slot[p].demand_ma)) {
+            _conducting |= (1ULL << p);
+            _allocated_ma += _slot[p].demand_ma;
+        }
+    }
+    _stats.incremental++;
+}
+
+void PowerScheduler::request(size_t p, uint32_t demand_ma, uint32_t remaining_s) {
+    if (p >= _n) return;
+    if ((_requesting >> p) & 1) release(p);
+    demand_ma = clamp(demand_ma);
+    _slot[p].demand_ma = demand_ma;
+    _slot[p].remaining_s = remaining_s;
+    _requesting |= (1ULL << p);
+    // Entra ya si cabe; si no, espera su turno sin cortar a nadie
+    if (fits(demand_ma)) {
+        _conducting |= (1ULL << p);
+        _allocated_ma += demand_ma;
+    }
+    _stats.incremental++;
+}
+
+void PowerScheduler::release(size_t p) {
+    if (p >= _n || !((_requesting >> p) & 1)) return;
+    if ((_conducting >> p) & 1) _allocated_ma -= _slot[p].demand_ma;
+    _requesting &= ~(1ULL << p);
+    _conducting &= ~(1ULL << p);
+    admit_waiting();
+}
+
+void PowerScheduler::update(size_t p, uint32_t measured_ma, uint32_t remaining_s) {
+    if (p >= _n || !((_requesting >> p) & 1)) return;
+    _slot[p].remaining_s = remaining_s;
+    if (!((_conducting >> p) & 1) || measured_ma == 0) return;
+
+    // La medición manda: sube de inmediato, baja de a 1/8 (rampa al conectar)
+    uint32_t old = _slot[p].demand_ma;
+    uint32_t learned = clamp(measured_ma >= old ? measured_ma : old - (old - measured_ma) / 8);
+    _allocated_ma = _allocated_ma - old + learned;
+    _slot[p].demand_ma = learned;
+    if (_cap_ma && _allocated_ma > _cap_ma) _dirty = true;
+}
+
+void PowerScheduler::rebalance() {
+    int64_t t0 = esp_timer_get_time();
+    size_t idx[MAX_POINTS];
+    size_t count = order(idx, _rr_next);
+
+    _conducting = 0;
+    _allocated_ma = 0;
+    bool first_out = true;
+    for (size_t i = 0; i < count; i++) {
+        size_t p = idx[i];
+        if (fits(_slot[p].demand_ma)) {
+            _conducting |= (1ULL << p);
+            _allocated_ma += _slot[p].demand_ma;
+        } else if (first_out && _policy == Policy::ROUND_ROBIN) {
+            // El primero que no entró encabeza la próxima franja
+            _rr_next = p;
+            first_out = false;
+        }
+    }
+    // Si todos entraron, igual se rota para repartir el orden
+    if (first_out && count) _rr_next = (idx[0] + 1) % _n;
+
+    _dirty = false;
+    _slice_left = _slice_s;
+    _stats.rebalances++;
+    _stats.last_rebalance_us = (uint32_t)(esp_timer_get_time() - t0);
+}
+
+bool PowerScheduler::tick() {
+    uint64_t before = _conducting;
+    // Sin tope o sin nadie esperando no hace falta rotar
+    bool contended = _cap_ma && (_requesting & ~_conducting);
+    if (_slice_left) _slice_left--;
+    if (_dirty || (contended && _slice_left == 0)) {
+        rebalance();
+    } else if (_slice_left == 0) {
+        _slice_left = _slice_s;
+    }
+    return before != _conducting;
+}
+
+std::string PowerScheduler::bench() {
+    constexpr size_t N = MAX_POINTS;
+    std::unique_ptr<PowerScheduler> s(new (std::nothrow) PowerScheduler(N));
+    if (!s) return "ERROR: Sin memoria";
+
+    // 64 puntos de 4..16 A con un alimentador de 200 A
+    uint32_t seed = 12345;
+    auto rnd = [&seed]() { seed = seed * 1103515245u + 12345u; return (seed >> 16) & 0x7FFF; };
+
+    std::string out;
+    char line[128];
+    for (int pol = 0; pol < 2; pol++) {
+        s->configure(200000, (Policy)pol, 30);
+
+        int64_t t0 = esp_timer_get_time();
+        for (size_t p = 0; p < N; p++) s->request(p, 4000 + rnd() % 12000, 600 + rnd() % 3600);
+        int64_t t_req = esp_timer_get_time() - t0;
+
+        uint32_t slices[N] = {};
+        int64_t t_reb = 0, t_inc = 0;
+        uint64_t util = 0;
+        const int ROUNDS = 200;
+        for (int r = 0; r < ROUNDS; r++) {
+            t0 = esp_timer_get_time();
+            s->rebalance();
+            t_reb += esp_timer_get_time() - t0;
+            util += s->allocated_ma();
+            for (size_t p = 0; p < N; p++) {
+                if (s->is_conducting(p)) {
+                    slices[p]++;
+                    s->update(p, s->_slot[p].demand_ma, s->_slot[p].remaining_s > 30 ? s->_slot[p].remaining_s - 30 : 1);
+                }
+            }
+            // Una sesión termina y otra nueva llega: camino incremental
+            size_t p = rnd() % N;
+            t0 = esp_timer_get_time();
+            s->release(p);
+            s->request(p, 4000 + rnd() % 12000, 600 + rnd() % 3600);
+            t_inc += esp_timer_get_time() - t0;
+        }
+
+        uint32_t mn = UINT32_MAX, mx = 0;
+        for (size_t p = 0; p < N; p++) {
+            if (slices[p] < mn) mn = slices[p];
+            if (slices[p] > mx) mx = slices[p];
+        }
+        snprintf(line, sizeof(line),
+                 "%s: alta 64 pts %lld us | reparto %lld us | alta/baja %lld us | uso %u%% | franjas min/max %u/%u\n",
+                 pol ? "SRT" : "RR", (long long)t_req, (long long)(t_reb / ROUNDS), (long long)(t_inc / ROUNDS),
+                 (unsigned)(util * 100 / ((uint64_t)ROUNDS * 200000)), (unsigned)mn, (unsigned)mx);
+        out += line;
+        for (size_t p = 0; p < N; p++) s->release(p);
+    }
+    return out;
+}
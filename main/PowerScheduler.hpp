@@ -0,0 +1,87 @@
+#pragma once
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Reparto de la potencia del sitio entre puntos de carga.
+ *
+ * Con un tope de corriente del alimentador (cap_ma, 0 = sin tope) decide qué
+ * puntos conducen en cada franja de tiempo:
+ *   - ROUND_ROBIN: rotación; el primero que quedó afuera arranca la próxima franja.
+ *   - SHORTEST_REMAINING: primero las sesiones a las que les queda menos.
+ *
+ * El cálculo es incremental: una sesión nueva entra de inmediato si cabe en
+ * el margen libre, y al terminar una se admiten las que esperan sin mover a
+ * las que ya conducen. El reparto completo solo se rehace al cerrar la franja
+ * o si la corriente medida excede el tope.
+ *
+ * Ninguna demanda se anota por encima del tope: con un tope menor que lo que
+ * pide un punto, ese punto conduce solo (al tope) en lugar de esperar para
+ * siempre un margen que nunca se libera.
+ *
+ * Es una instancia (no estática) para poder simular 64 puntos en sched.bench.
+ */
+class PowerScheduler {
+public:
+    static constexpr size_t MAX_POINTS = 64;
+
+    enum class Policy : uint8_t { ROUND_ROBIN = 0, SHORTEST_REMAINING = 1 };
+
+    struct Stats {
+        uint32_t rebalances;
+        uint32_t incremental;
+        uint32_t last_rebalance_us;
+    };
+
+    explicit PowerScheduler(size_t points = MAX_POINTS);
+
+    void configure(uint32_t cap_ma, Policy policy, uint32_t slice_s);
+    uint32_t cap_ma() const { return _cap_ma; }
+    Policy policy() const { return _policy; }
+    uint32_t slice_s() const { return _slice_s; }
+
+    // Ciclo de vida de una sesión
+    void request(size_t p, uint32_t demand_ma, uint32_t remaining_s);
+    void release(size_t p);
+    // Corriente medida (si conduce) y tiempo restante; puede pedir un reparto nuevo
+    void update(size_t p, uint32_t measured_ma, uint32_t remaining_s);
+
+    // Avanza 1 s; true si cambió el conjunto de puntos que conducen
+    bool tick();
+    void rebalance();
+
+    bool is_conducting(size_t p) const { return p < _n && (_conducting >> p) & 1; }
+    bool is_waiting(size_t p) const { return p < _n && ((_requesting & ~_conducting) >> p) & 1; }
+    uint64_t conducting_mask() const { return _conducting; }
+    uint32_t allocated_ma() const { return _allocated_ma; }
+    const Stats& stats() const { return _stats; }
+
+    // Bench con 64 puntos simulados (comando sched.bench)
+    static std::string bench();
+
+private:
+    struct Slot {
+        uint32_t demand_ma;     // Estimada al pedir; se corrige con lo medido
+        uint32_t remaining_s;
+    };
+
+    size_t _n;
+    uint32_t _cap_ma = 0;
+    Policy _policy = Policy::ROUND_ROBIN;
+    uint32_t _slice_s = 30;
+
+    Slot _slot[MAX_POINTS] = {};
+    uint64_t _requesting = 0;
+    uint64_t _conducting = 0;
+    uint32_t _allocated_ma = 0;
+    size_t _rr_next = 0;            // Primer punto a considerar en la próxima franja
+    uint32_t _slice_left = 0;
+    bool _dirty = false;            // Pedir reparto completo en el próximo tick
+    Stats _stats = {};
+
+    bool fits(uint32_t demand_ma) const;
+    uint32_t clamp(uint32_t demand_ma) const; // Demanda recortada al tope
+    void admit_waiting();           // Incremental: no desaloja a nadie
+    size_t order(size_t* idx, size_t from) const; // Candidatos según la política
+};
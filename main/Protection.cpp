@@ -0,0 +1,200 @@
+#include "Protection.hpp"
+#include "ChargeControl.hpp"
+#include "LoggerFS.hpp"
+#include "mcp23017.hpp"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+#include "TaskConfig.hpp"
+#include <cstdio>
+#include <algorithm>
+
+static const char* TAG = "PROTECTION";
+
+extern MCP23017* g_mcp_1;
+extern LoggerFS g_logger;
+
+Protection::PointState Protection::_pt[POINTS] = {};
+uint8_t Protection::_confirm = DEFAULT_CONFIRM;
+TaskHandle_t Protection::_task = nullptr;
+QueueHandle_t Protection::_reports = nullptr;
+uint32_t Protection::_trips = 0;
+uint32_t Protection::_last_latency_us = 0;
+uint32_t Protection::_retries = 0;
+uint32_t Protection::_unconfirmed = 0;
+uint32_t Protection::_reports_lost = 0;
+
+void Protection::load_config() {
+    for (int i = 0; i < POINTS; i++) _pt[i].limit_ma = DEFAULT_LIMIT_MA;
+
+    nvs_handle_t handle;
+    if (nvs_open("protect", NVS_READONLY, &handle) != ESP_OK) return;
+    char key[8];
+    for (int i = 0; i < POINTS; i++) {
+        uint32_t ma = 0;
+        snprintf(key, sizeof(key), "lim%d", i);
+        if (nvs_get_u32(handle, key, &ma) == ESP_OK && ma > 0) _pt[i].limit_ma = ma;
+    }
+    nvs_get_u8(handle, "confirm", &_confirm);
+    if (_confirm == 0) _confirm = 1;
+    nvs_close(handle);
+}
+
+bool Protection::start() {
+    if (_task) return true;
+    load_config();
+    _reports = xQueueCreate(8, sizeof(TripReport));
+    if (!_reports || TaskPlan::create(TaskPlan::PROTECT_LOG, report_task, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "No se pudo crear la cola de disparos");
+    }
+    // Por encima de la tarea de muestreo (6) y del control de carga (5)
+    TaskPlan::create(TaskPlan::PROTECTION, protection_task, NULL, &_task);
+    return _task != nullptr;
+}
+
+void Protection::on_sample(int point, int32_t ua) {
+    PointState& p = _pt[point];
+    if (p.latched || !_task) return;
+
+    int64_t limit_ua = (int64_t)p.limit_ma * 1000; // Una sola lectura del límite
+    if (ua > limit_ua * 2) {
+        p.over_count = _confirm; // Cortocircuito franco: no esperar confirmación
+    } else if (ua > limit_ua) {
+        p.over_count++;
+    } else {
+        p.over_count = 0;
+        return;
+    }
+
+    if (p.over_count >= _confirm) {
+        p.latched = true;
+        p.trip_ua = ua;
+        p.trip_us = esp_timer_get_time();
+        xTaskNotify(_task, 1u << point, eSetBits);
+    }
+}
+
+// Escritura pre-armada y lectura de OLATA: solo cuenta si el chip tiene los bits en 0
+bool Protection::trip(uint8_t mask) {
+    return g_mcp_1 && g_mcp_1->trip_port_a(mask) && g_mcp_1->port_a_low(mask);
+}
+
+void Protection::report(uint8_t mask, bool confirmed, bool followup, uint32_t attempts) {
+    TripReport r = {mask, confirmed, followup, (uint16_t)std::min<uint32_t>(attempts, UINT16_MAX), esp_timer_get_time()};
+    if (!_reports || xQueueSend(_reports, &r, 0) != pdTRUE) _reports_lost++;
+}
+
+void Protection::protection_task(void* pv) {
+    uint32_t bits;
+    while (1) {
+        if (xTaskNotifyWait(0, 0xFFFFFFFF, &bits, portMAX_DELAY) != pdTRUE) continue;
+        uint8_t mask = 0;
+        for (int i = 0; i < POINTS; i++) {
+            if (bits & (1u << i)) mask |= (uint8_t)(1u << i); // Relé CHn = GPA(n-1)
+        }
+        if (!mask) continue;
+
+        // 1. Abrir relés: nada antes de esto; se repite hasta que OLATA lo confirme
+        uint32_t attempts = 1;
+        bool ok = trip(mask);
+        while (!ok && attempts < TRIP_FAST_ATTEMPTS) {
+            ok = trip(mask);
+            attempts++;
+        }
+        _retries += attempts - 1;
+        report(mask, ok, false, attempts);
+        if (ok) continue;
+
+        // 2. I2C sin respuesta: el aviso ya salió; se insiste sin acaparar el core
+        _unconfirmed++;
+        ESP_LOGE(TAG, "Disparo 0x%02X sin confirmar tras %u intentos", mask, (unsigned)attempts);
+        while (!ok) {
+            vTaskDelay(pdMS_TO_TICKS(TRIP_RETRY_MS));
+            ok = trip(mask);
+            attempts++;
+            _retries++;
+        }
+        report(mask, true, true, attempts);
+    }
+}
+
+/**
+ * @brief Core 0: registro de cada disparo y cierre de su sesión (SD y diario fuera del core 1).
+ */
+void Protection::report_task(void* pv) {
+    TripReport r;
+    while (1) {
+        if (xQueueReceive(_reports, &r, portMAX_DELAY) != pdTRUE) continue;
+        for (int i = 0; i < POINTS; i++) {
+            if (!(r.mask & (1u << i))) continue;
+            uint32_t latency_us = (uint32_t)(r.done_us - _pt[i].trip_us);
+            if (r.followup) {
+                // El disparo ya se registró y contó al salir sin confirmar: solo se anota el cierre
+                _last_latency_us = latency_us;
+                ESP_LOGW(TAG, "CH%d: relé confirmado abierto en %u us (%u intentos)", i + 1,
+                         (unsigned)latency_us, (unsigned)r.attempts);
+                continue;
+            }
+            _trips++;
+            if (!r.confirmed) {
+                g_logger.registrarf(RectEvent::ERR_OVERCURRENT, ChargeControl::point_tag(i),
+                                    "%d mA > %d mA, relé SIN CONFIRMAR tras %u intentos (fallo I2C)",
+                                    (int)(_pt[i].trip_ua / 1000), (int)_pt[i].limit_ma, (unsigned)r.attempts);
+                ChargeControl::stop(i, "Falla por sobrecorriente");
+                continue;
+            }
+            _last_latency_us = latency_us;
+            ESP_LOGE(TAG, "CH%d: sobrecorriente %d mA (límite %d mA), relé abierto en %u us (%u intentos)", i + 1,
+                     (int)(_pt[i].trip_ua / 1000), (int)_pt[i].limit_ma, (unsigned)latency_us,
+                     (unsigned)r.attempts);
+            g_logger.registrarf(RectEvent::ERR_OVERCURRENT, ChargeControl::point_tag(i),
+                                "%d mA > %d mA, disparo en %u us%s", (int)(_pt[i].trip_ua / 1000),
+                                (int)_pt[i].limit_ma, (unsigned)latency_us,
+                                r.attempts > 1 ? ", con reintentos" : "");
+            ChargeControl::stop(i, "Falla por sobrecorriente");
+        }
+    }
+}
+
+bool Protection::is_latched(int point) {
+    return point >= 0 && point < POINTS && _pt[point].latched;
+}
+
+bool Protection::clear(int point) {
+    if (point < 0 || point >= POINTS || !_pt[point].latched) return false;
+    if (g_mcp_1) g_mcp_1->release_port_a((uint8_t)(1u << point));
+    _pt[point].over_count = 0;
+    _pt[point].latched = false;
+    ESP_LOGI(TAG, "CH%d: falla rearmada", point + 1);
+    return true;
+}
+
+bool Protection::set_limit_ma(int point, uint32_t ma) {
+    if (point < 0 || point >= POINTS || ma == 0) return false;
+    nvs_handle_t handle;
+    if (nvs_open("protect", NVS_READWRITE, &handle) != ESP_OK) return false;
+    char key[8];
+    snprintf(key, sizeof(key), "lim%d", point);
+    nvs_set_u32(handle, key, ma);
+    nvs_commit(handle);
+    nvs_close(handle);
+    _pt[point].limit_ma = ma;
+    return true;
+}
+
+std::string Protection::status() {
+    std::string out;
+    char line[96];
+    for (int i = 0; i < POINTS; i++) {
+        snprintf(line, sizeof(line), "CH%d: límite %d mA | %s\n", i + 1, (int)_pt[i].limit_ma,
+                 _pt[i].latched ? "FALLA ENCLAVADA" : "OK");
+        out += line;
+    }
+    snprintf(line, sizeof(line), "Disparos: %u | última latencia %u us | confirmación %u muestras\n",
+             (unsigned)_trips, (unsigned)_last_latency_us, (unsigned)_confirm);
+    out += line;
+    snprintf(line, sizeof(line), "Reintentos I2C %u | sin confirmar %u | avisos perdidos %u\n",
+             (unsigned)_retries, (unsigned)_unconfirmed, (unsigned)_reports_lost);
+    out += line;
+    return out;
+}
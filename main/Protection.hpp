@@ -0,0 +1,74 @@
+#pragma once
+#include <string>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+/**
+ * @brief Protección por sobrecorriente, independiente del lazo de 1 s.
+ *
+ * Metering entrega cada muestra cruda a on_sample() (tarea de muestreo, core 1).
+ * Si un punto supera su límite N muestras seguidas (o el doble del límite en
+ * una sola), se avisa a la tarea de protección, la de mayor prioridad del
+ * core 1, que abre el relé con la escritura de OLATA pre-armada en MCP23017
+ * y la repite hasta leer OLATA con el bit en 0. Nada más corre en el core 1:
+ * el registro (fsync en la SD) y el cierre de la sesión (diario en flash) los
+ * hace protect_log en el core 0, a menor prioridad, a partir de una cola.
+ * El fallo queda enclavado: el relé no vuelve a energizarse hasta fault.clear.
+ *
+ * Latencia: una muestra por canal cada ~5 ms + escritura y lectura I2C (~200 µs).
+ */
+class Protection {
+public:
+    static constexpr int POINTS = 4;
+
+    static bool start();
+
+    // Camino rápido, sin bloqueo: llamado por Metering por cada muestra
+    static void on_sample(int point, int32_t ua);
+
+    static bool is_latched(int point);
+    static bool clear(int point);
+    static bool set_limit_ma(int point, uint32_t ma);
+    static std::string status();
+
+private:
+    static constexpr uint32_t DEFAULT_LIMIT_MA = 16000;
+    static constexpr uint8_t DEFAULT_CONFIRM = 2;   // Muestras seguidas sobre el límite
+    static constexpr uint32_t TRIP_FAST_ATTEMPTS = 3; // Reintentos seguidos antes de avisar
+    static constexpr uint32_t TRIP_RETRY_MS = 10;     // Luego, uno cada 10 ms hasta confirmar
+
+    // Disparo ya ejecutado, para registrar y cerrar en el core 0
+    struct TripReport {
+        uint8_t mask;
+        bool confirmed;         // OLATA leída con los bits en 0
+        bool followup;          // Confirmación tardía de un disparo ya registrado
+        uint16_t attempts;
+        int64_t done_us;
+    };
+
+    struct PointState {
+        volatile uint32_t limit_ma; // 32 bits: se escribe en el core 0 y se lee en el 1 sin cortes
+        uint8_t over_count;
+        volatile bool latched;
+        int32_t trip_ua;        // Valor que disparó
+        int64_t trip_us;        // Momento de la muestra que disparó
+    };
+
+    static PointState _pt[POINTS];
+    static uint8_t _confirm;
+    static TaskHandle_t _task;
+    static QueueHandle_t _reports;
+    static uint32_t _trips;
+    static uint32_t _last_latency_us;
+    static uint32_t _retries;           // Escrituras de disparo repetidas
+    static uint32_t _unconfirmed;       // Disparos sin confirmar tras los reintentos rápidos
+    static uint32_t _reports_lost;      // Cola llena: el disparo se hizo, el registro no
+
+    static void load_config();
+    static bool trip(uint8_t mask);
+    static void report(uint8_t mask, bool confirmed, bool followup, uint32_t attempts);
+    static void protection_task(void* pv);
+    static void report_task(void* pv);
+};
@@ -0,0 +1,196 @@
+#include "ReleaseFeedParser.hpp"
+#include <string.h>
+
+// Profundidades en el feed de GitHub:
+//   1 = array raíz, 2 = objeto release, 3 = array "assets", 4 = objeto asset
+static constexpr int DEPTH_RELEASE = 2;
+static constexpr int DEPTH_ASSET   = 4;
+
+ReleaseFeedParser::ReleaseFeedParser(Callback cb, void* ctx) : _cb(cb), _ctx(ctx) {
+    _key[0] = 0;
+    reset_release();
+}
+
+void ReleaseFeedParser::reset_release() {
+    _tag[0] = 0;
+    _asset_url[0] = 0;
+    _rel_url[0] = 0;
+    _asset_is_bin = false;
+    _bin_match = 0;
+}
+
+bool ReleaseFeedParser::key_is(const char* k) const {
+    return _key_valid && strcmp(_key, k) == 0;
+}
+
+void ReleaseFeedParser::begin_string() {
+    _in_string = true;
+    _escape = false;
+    _hex_left = 0;
+    _cap_len = 0;
+    _cap_overflow = false;
+    _cap_buf = nullptr;
+    _cap_size = 0;
+
+    bool in_object = !(_array_mask & (1u << _depth));
+    if (in_object && _expect_key) {
+        _capture = Capture::KEY;
+        _cap_buf = _key;
+        _cap_size = KEY_LEN;
+        return;
+    }
+
+    _capture = Capture::NONE;
+    if (!in_object) return;
+
+    if (_depth == DEPTH_RELEASE && key_is("tag_name")) {
+        _capture = Capture::TAG;
+        _cap_buf = _tag;
+        _cap_size = TAG_LEN;
+    } else if (_depth == DEPTH_ASSET && _in_assets) {
+        if (key_is("name")) {
+            _capture = Capture::NAME; // Solo se busca ".bin", no se guarda
+            _bin_match = 0;
+            _asset_is_bin = false;
+        } else if (key_is("browser_download_url")) {
+            _capture = Capture::URL;
+            _cap_buf = _asset_url;
+            _cap_size = URL_LEN;
+        }
+    }
+}
+
+void ReleaseFeedParser::put_char(char c) {
+    if (_capture == Capture::NONE) return;
+
+    if (_capture == Capture::NAME) {
+        static const char pat[] = ".bin";
+        if (c == pat[_bin_match]) {
+            if (++_bin_match == 4) { _asset_is_bin = true; _bin_match = 0; }
+        } else {
+            _bin_match = (c == '.') ? 1 : 0;
+        }
+        return;
+    }
+
+    if (_cap_len + 1 < _cap_size) {
+        _cap_buf[_cap_len++] = c;
+    } else {
+        _cap_overflow = true;
+    }
+}
+
+void ReleaseFeedParser::end_string() {
+    _in_string = false;
+    if (_cap_buf) {
+        _cap_buf[_cap_len] = 0;
+        // Un valor truncado no sirve (URL cortada); una clave truncada no debe coincidir
+        if (_cap_overflow) _cap_buf[0] = 0;
+    }
+    if (_capture == Capture::KEY) _key_valid = !_cap_overflow;
+    _capture = Capture::NONE;
+    _cap_buf = nullptr;
+}
+
+void ReleaseFeedParser::open_container(bool is_array) {
+    if (_depth + 1 >= MAX_DEPTH) { _failed = true; return; }
+
+    // Entrar a "assets" dentro de una release
+    if (is_array && _depth == DEPTH_RELEASE && key_is("assets")) _in_assets = true;
+
+    _depth++;
+    if (is_array) _array_mask |= (1u << _depth);
+    else          _array_mask &= ~(1u << _depth);
+
+    if (!is_array) {
+        _expect_key = true;
+        _key_valid = false;
+        if (_depth == DEPTH_RELEASE) reset_release();
+        if (_depth == DEPTH_ASSET) { _asset_url[0] = 0; _asset_is_bin = false; }
+    }
+}
+
+void ReleaseFeedParser::close_container(bool is_array) {
+    if (_depth <= 0) { _failed = true; return; }
+    bool was_array = _array_mask & (1u << _depth);
+    if (was_array != is_array) { _failed = true; return; }
+
+    if (!is_array && _depth == DEPTH_ASSET && _in_assets) {
+        // Nos quedamos con el primer .bin de la release (mismo criterio que antes)
+        if (_asset_is_bin && _asset_url[0] && !_rel_url[0]) {
+            strcpy(_rel_url, _asset_url);
+        }
+    } else if (!is_array && _depth == DEPTH_RELEASE) {
+        _releases++;
+        if (_tag[0] && _rel_url[0] && _cb) _cb(_tag, _rel_url, _ctx);
+        reset_release();
+    } else if (is_array && _depth == DEPTH_RELEASE + 1) {
+        _in_assets = false;
+    }
+
+    _depth--;
+    // Tras cerrar un valor dentro de un objeto, lo siguiente es ',' o '}'
+    _expect_key = false;
+}
+
+void ReleaseFeedParser::feed(const char* data, size_t len) {
+    for (size_t i = 0; i < len && !_failed; i++) {
+        char c = data[i];
+
+        if (_in_string) {
+            if (_hex_left) {
+                uint8_t v;
+                if (c >= '0' && c <= '9') v = c - '0';
+                else if (c >= 'a' && c <= 'f') v = c - 'a' + 10;
+                else if (c >= 'A' && c <= 'F') v = c - 'A' + 10;
+                else { _failed = true; break; }
+                _hex_val = (_hex_val << 4) | v;
+                if (--_hex_left == 0) {
+                    // \uXXXX -> UTF-8 (los sustitutos no aparecen en tags/URLs)
+                    uint16_t u = _hex_val;
+                    if (u < 0x80) {
+                        put_char((char)u);
+                    } else if (u < 0x800) {
+                        put_char((char)(0xC0 | (u >> 6)));
+                        put_char((char)(0x80 | (u & 0x3F)));
+                    } else if (u >= 0xD800 && u <= 0xDFFF) {
+                        put_char('?');
+                    } else {
+                        put_char((char)(0xE0 | (u >> 12)));
+                        put_char((char)(0x80 | ((u >> 6) & 0x3F)));
+                        put_char((char)(0x80 | (u & 0x3F)));
+                    }
+                }
+            } else if (_escape) {
+                _escape = false;
+                switch (c) {
+                    case 'n': put_char('\n'); break;
+                    case 't': put_char('\t'); break;
+                    case 'r': put_char('\r'); break;
+                    case 'b': put_char('\b'); break;
+                    case 'f': put_char('\f'); break;
+                    case 'u': _hex_left = 4; _hex_val = 0; break;
+                    default:  put_char(c); break; // '"', '\\', '/'
+                }
+            } else if (c == '\\') {
+                _escape = true;
+            } else if (c == '"') {
+                end_string();
+            } else {
+                put_char(c);
+            }
+            continue;
+        }
+
+        switch (c) {
+            case '"': begin_string(); break;
+            case '{': open_container(false); break;
+            case '[': open_container(true); break;
+            case '}': close_container(false); break;
+            case ']': close_container(true); break;
+            case ':': _expect_key = false; break;
+            case ',': _expect_key = !(_array_mask & (1u << _depth)); break;
+            default:  break; // Números, true/false/null y espacios: se ignoran
+        }
+    }
+}
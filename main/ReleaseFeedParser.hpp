@@ -0,0 +1,71 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Parser JSON incremental (estilo SAX) para /repos/{repo}/releases.
+ *
+ * Consume los bloques tal como llegan de esp_http_client_read y solo extrae
+ * `tag_name` y el primer `browser_download_url` cuyo asset contiene ".bin".
+ * El estado completo cabe en el objeto (~600 bytes), así que el tamaño de la
+ * respuesta no importa: no hay buffer del cuerpo ni árbol cJSON.
+ */
+class ReleaseFeedParser {
+public:
+    // Se invoca una vez por release con asset .bin, en orden de aparición
+    using Callback = void (*)(const char* tag, const char* bin_url, void* ctx);
+
+    ReleaseFeedParser(Callback cb, void* ctx);
+
+    void feed(const char* data, size_t len);
+    bool failed() const { return _failed; }
+    int releases_seen() const { return _releases; }
+
+private:
+    static constexpr int MAX_DEPTH = 32;
+    static constexpr size_t KEY_LEN = 24;
+    static constexpr size_t TAG_LEN = 48;
+    static constexpr size_t URL_LEN = 256;
+
+    enum class Capture : uint8_t { NONE, KEY, TAG, NAME, URL };
+
+    Callback _cb;
+    void* _ctx;
+
+    // Tokenizador
+    int _depth = 0;
+    uint32_t _array_mask = 0;   // bit n = el contenedor de profundidad n es array
+    bool _expect_key = false;
+    bool _in_string = false;
+    bool _escape = false;
+    uint8_t _hex_left = 0;
+    uint16_t _hex_val = 0;
+    bool _failed = false;
+    int _releases = 0;
+
+    // Captura del string actual
+    Capture _capture = Capture::NONE;
+    char* _cap_buf = nullptr;
+    size_t _cap_size = 0;
+    size_t _cap_len = 0;
+    bool _cap_overflow = false;
+
+    // Contexto de ruta
+    char _key[KEY_LEN];
+    bool _key_valid = false;
+    bool _in_assets = false;
+    uint8_t _bin_match = 0;     // Progreso buscando ".bin" en el nombre del asset
+    bool _asset_is_bin = false;
+
+    char _tag[TAG_LEN];
+    char _asset_url[URL_LEN];
+    char _rel_url[URL_LEN];
+
+    bool key_is(const char* k) const;
+    void begin_string();
+    void put_char(char c);
+    void end_string();
+    void open_container(bool is_array);
+    void close_container(bool is_array);
+    void reset_release();
+};
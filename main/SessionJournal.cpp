@@ -0,0 +1,197 @@
+#include "SessionJournal.hpp"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+#include <cstring>
+#include <cstdio>
+
+static const char* TAG = "JOURNAL";
+
+SessionJournal::Backend SessionJournal::_backend = SessionJournal::Backend::NONE;
+uint32_t SessionJournal::_write_errors = 0;
+int64_t SessionJournal::_nvs_saved_us[SessionJournal::MAX_POINTS] = {};
+const esp_partition_t* SessionJournal::_part = nullptr;
+uint32_t SessionJournal::_sectors = 0;
+uint32_t SessionJournal::_head = 0;
+uint32_t SessionJournal::_seq = 0;
+SessionJournal::Entry SessionJournal::_latest[SessionJournal::MAX_POINTS] = {};
+
+uint32_t SessionJournal::record_crc(const Record& r) {
+    return esp_rom_crc32_le(0, (const uint8_t*)&r, offsetof(Record, crc));
+}
+
+static bool is_blank(const void* p, size_t n) {
+    const uint8_t* b = (const uint8_t*)p;
+    for (size_t i = 0; i < n; i++) if (b[i] != 0xFF) return false;
+    return true;
+}
+
+bool SessionJournal::begin(Entry latest[MAX_POINTS]) {
+    memset(_latest, 0, sizeof(_latest));
+    _part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "journal");
+    if (!_part) {
+        ESP_LOGW(TAG, "Partición 'journal' no encontrada (tabla previa a la OTA): diario en NVS");
+        nvs_load();
+        _backend = Backend::NVS;
+        memcpy(latest, _latest, sizeof(_latest));
+        return true;
+    }
+    _backend = Backend::PARTITION;
+    _sectors = _part->size / SECTOR;
+
+    // 1. Recorrer el anillo: el último registro válido de cada punto gana (mayor seq)
+    uint32_t best_seq[MAX_POINTS] = {0};
+    uint32_t max_seq = 0, max_off = 0;
+    bool any = false;
+    Record page[PER_SECTOR / 4]; // 1 KB por lectura
+
+    for (uint32_t off = 0; off < _part->size; off += sizeof(page)) {
+        if (esp_partition_read(_part, off, page, sizeof(page)) != ESP_OK) continue;
+        for (size_t i = 0; i < sizeof(page) / sizeof(Record); i++) {
+            const Record& r = page[i];
+            if (is_blank(&r, sizeof(r))) continue;
+            // Un registro a medio escribir (corte durante el write) se descarta
+            if (record_crc(r) != r.crc) continue;
+            if (!any || r.seq > max_seq) {
+                max_seq = r.seq;
+                max_off = off + i * sizeof(Record);
+                any = true;
+            }
+            if (r.point < MAX_POINTS && r.seq >= best_seq[r.point]) {
+                best_seq[r.point] = r.seq;
+                Entry& e = _latest[r.point];
+                e.type = (Type)r.type;
+                e.point = r.point;
+                e.start_time = r.start_time;
+                e.deadline = r.deadline;
+                e.duration_s = r.duration_s;
+                e.seconds_left = r.seconds_left;
+                e.energy_mwh = r.energy_mwh;
+            }
+        }
+    }
+
+    // 2. Cabeza de escritura: primer slot libre tras el último registro
+    if (!any) {
+        // Anillo vacío: el primer append borra el sector 0
+        _seq = 0;
+        _head = 0;
+    } else {
+        _seq = max_seq;
+        _head = max_off + sizeof(Record);
+        // Saltar slots no vacíos (escrituras cortadas) dentro del sector actual
+        Record r;
+        while (_head % SECTOR != 0) {
+            if (esp_partition_read(_part, _head, &r, sizeof(r)) == ESP_OK && is_blank(&r, sizeof(r))) break;
+            _head += sizeof(Record);
+        }
+    }
+
+    ESP_LOGI(TAG, "Diario montado: %u sectores, seq=%u, cabeza=0x%X",
+             (unsigned)_sectors, (unsigned)_seq, (unsigned)_head);
+    memcpy(latest, _latest, sizeof(_latest));
+    return true;
+}
+
+// Borra el sector y escribe primero el estado vigente de las sesiones activas
+bool SessionJournal::open_sector(uint32_t sector) {
+    _head = sector * SECTOR;
+    if (esp_partition_erase_range(_part, _head, SECTOR) != ESP_OK) {
+        ESP_LOGE(TAG, "No se pudo borrar el sector %u", (unsigned)sector);
+        return false;
+    }
+    for (size_t p = 0; p < MAX_POINTS; p++) {
+        const Entry& e = _latest[p];
+        if (e.type == Type::NONE || e.type == Type::STOP) continue;
+        Entry snap = e;
+        snap.type = Type::SNAPSHOT;
+        if (!write_record(snap)) return false;
+    }
+    return true;
+}
+
+bool SessionJournal::write_record(const Entry& e) {
+    Record r = {};
+    r.seq = ++_seq;
+    r.type = (uint8_t)e.type;
+    r.point = e.point;
+    r.reserved = 0xFFFF;
+    r.start_time = e.start_time;
+    r.deadline = e.deadline;
+    r.duration_s = e.duration_s;
+    r.seconds_left = e.seconds_left;
+    r.energy_mwh = e.energy_mwh;
+    r.crc = record_crc(r);
+
+    if (esp_partition_write(_part, _head, &r, sizeof(r)) != ESP_OK) return false;
+    _head += sizeof(Record);
+    return true;
+}
+
+// --- Respaldo en NVS (sin partición "journal") ---
+
+void SessionJournal::nvs_load() {
+    nvs_handle_t handle;
+    if (nvs_open("journal", NVS_READONLY, &handle) != ESP_OK) return; // Nunca escrito
+    char key[8];
+    for (size_t p = 0; p < MAX_POINTS; p++) {
+        Entry e;
+        size_t len = sizeof(e);
+        snprintf(key, sizeof(key), "pt%u", (unsigned)p);
+        if (nvs_get_blob(handle, key, &e, &len) == ESP_OK && len == sizeof(e) && e.point == p) _latest[p] = e;
+    }
+    nvs_close(handle);
+}
+
+bool SessionJournal::nvs_append(const Entry& e) {
+    // Un CHECKPOINT cada NVS_CHECKPOINT_S por punto; START y STOP siempre
+    int64_t now = esp_timer_get_time();
+    if (e.type == Type::CHECKPOINT && _nvs_saved_us[e.point] &&
+        now - _nvs_saved_us[e.point] < (int64_t)NVS_CHECKPOINT_S * 1000000) {
+        return true;
+    }
+    nvs_handle_t handle;
+    if (nvs_open("journal", NVS_READWRITE, &handle) != ESP_OK) return false;
+    char key[8];
+    snprintf(key, sizeof(key), "pt%u", (unsigned)e.point);
+    bool ok = nvs_set_blob(handle, key, &e, sizeof(e)) == ESP_OK && nvs_commit(handle) == ESP_OK;
+    nvs_close(handle);
+    if (ok) _nvs_saved_us[e.point] = now;
+    return ok;
+}
+
+bool SessionJournal::append(const Entry& e) {
+    if (e.point >= MAX_POINTS || _backend == Backend::NONE) return false;
+    if (_backend == Backend::NVS) {
+        if (!nvs_append(e)) {
+            _write_errors++;
+            return false;
+        }
+        _latest[e.point] = e;
+        return true;
+    }
+
+    // Sector lleno: pasar al siguiente del anillo (el más viejo) y compactar
+    if (_head % SECTOR == 0) {
+        uint32_t next = (_head / SECTOR) % _sectors;
+        if (!open_sector(next)) {
+            _write_errors++;
+            return false;
+        }
+    }
+
+    if (!write_record(e)) {
+        ESP_LOGE(TAG, "Fallo de escritura en 0x%X", (unsigned)_head);
+        _write_errors++;
+        return false;
+    }
+    _latest[e.point] = e;
+    return true;
+}
+
+void SessionJournal::metrics(TextBuffer& out) {
+    // journal_backend: 0 = sin diario, 1 = partición, 2 = NVS (equipo actualizado por OTA)
+    out.appendf("journal_backend %u\njournal_partition %u\njournal_write_errors %u\n", (unsigned)_backend,
+                _part ? 1u : 0u, (unsigned)_write_errors);
+}
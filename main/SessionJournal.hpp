@@ -0,0 +1,79 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_partition.h"
+#include "TextBuffer.hpp"
+
+/**
+ * @brief Diario de sesiones de carga en un anillo de flash (partición "journal").
+ *
+ * Registros de 32 bytes, solo se agregan (append-only) con CRC32 y número de
+ * secuencia. Al entrar a un sector nuevo se borra y se escribe primero una
+ * instantánea de las sesiones activas (compactación), así el sector más viejo
+ * siempre se puede reciclar. Tras un corte, el último registro válido de cada
+ * punto define si la sesión se reanuda o se cierra.
+ *
+ * Los equipos actualizados por OTA conservan la tabla de particiones vieja,
+ * sin "journal" (la tabla solo cambia por cable). Ahí el diario pasa a NVS:
+ * un blob por punto con el último estado, y los CHECKPOINT se espacian a
+ * NVS_CHECKPOINT_S para no gastar la partición nvs (16 KB); tras un corte se
+ * pierden como mucho esos segundos en vez de 10. /metrics informa el modo.
+ */
+class SessionJournal {
+public:
+    static constexpr size_t MAX_POINTS = 8;
+
+    enum class Type : uint8_t { NONE = 0, START = 1, CHECKPOINT = 2, STOP = 3, SNAPSHOT = 4 };
+
+    struct Entry {
+        Type type;
+        uint8_t point;
+        uint32_t start_time;    // epoch (0 si el reloj no estaba sincronizado)
+        uint32_t deadline;      // epoch de fin (0 si desconocido)
+        uint32_t duration_s;    // Tiempo contratado
+        uint32_t seconds_left;
+        uint32_t energy_mwh;    // Energía entregada hasta el momento
+    };
+
+    // Monta el anillo y devuelve el último estado conocido de cada punto
+    static bool begin(Entry latest[MAX_POINTS]);
+    static bool append(const Entry& e);
+    static bool is_ready() { return _backend != Backend::NONE; }
+    static void metrics(TextBuffer& out);
+
+private:
+    struct __attribute__((packed)) Record {
+        uint32_t seq;
+        uint8_t type;
+        uint8_t point;
+        uint16_t reserved;
+        uint32_t start_time;
+        uint32_t deadline;
+        uint32_t duration_s;
+        uint32_t seconds_left;
+        uint32_t energy_mwh;
+        uint32_t crc;
+    };
+    static_assert(sizeof(Record) == 32, "Registro de diario debe medir 32 bytes");
+
+    static constexpr uint32_t SECTOR = 4096;
+    static constexpr uint32_t PER_SECTOR = SECTOR / sizeof(Record);
+    static constexpr uint32_t NVS_CHECKPOINT_S = 300;
+
+    enum class Backend : uint8_t { NONE = 0, PARTITION, NVS };
+
+    static Backend _backend;
+    static uint32_t _write_errors;
+    static int64_t _nvs_saved_us[MAX_POINTS];  // Última escritura en NVS por punto
+    static const esp_partition_t* _part;
+    static uint32_t _sectors;
+    static uint32_t _head;          // Offset del próximo registro libre
+    static uint32_t _seq;
+    static Entry _latest[MAX_POINTS];
+
+    static uint32_t record_crc(const Record& r);
+    static bool write_record(const Entry& e);
+    static bool open_sector(uint32_t sector);
+    static void nvs_load();
+    static bool nvs_append(const Entry& e);
+};
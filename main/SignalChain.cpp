@@ -0,0 +1,136 @@
+#include "SignalChain.hpp"
+#include <string.h>
+
+// Corriente inversa = muestras negativas: el paso a Q31 debe conservar signo y escala
+static_assert(SignalChain::to_q31(-1) == -65536, "to_q31 con entrada negativa");
+static_assert(SignalChain::to_q31(INT16_MIN) == INT16_MIN * 65536, "to_q31 en el extremo negativo");
+static_assert(SignalChain::to_q31(INT16_MAX) == INT16_MAX * 65536, "to_q31 en el extremo positivo");
+
+static inline int16_t sat16(int32_t v) {
+    if (v > INT16_MAX) return INT16_MAX;
+    if (v < INT16_MIN) return INT16_MIN;
+    return (int16_t)v;
+}
+
+static inline int16_t med3(int16_t a, int16_t b, int16_t c) {
+    if (a > b) { int16_t t = a; a = b; b = t; }
+    if (b > c) b = c;
+    return (a > b) ? a : b;
+}
+
+// Raíz cuadrada entera (bit a bit), suficiente para RMS de 16 bits
+static uint32_t isqrt64(uint64_t v) {
+    uint64_t res = 0;
+    uint64_t bit = 1ULL << 62;
+    while (bit > v) bit >>= 2;
+    while (bit) {
+        if (v >= res + bit) {
+            v -= res + bit;
+            res = (res >> 1) + bit;
+        } else {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)res;
+}
+
+SignalChain::SignalChain() {
+    Config cfg = { 0, 0, 0, false };
+    configure(cfg);
+}
+
+void SignalChain::configure(const Config& cfg) {
+    _cfg = cfg;
+    if (_cfg.ma_log2 > MA_MAX_LOG2) _cfg.ma_log2 = MA_MAX_LOG2;
+    reset();
+}
+
+void SignalChain::reset() {
+    _med_hist[0] = _med_hist[1] = 0;
+    _primed = false;
+    _iir_q31 = 0;
+    memset(_ma_ring, 0, sizeof(_ma_ring));
+    _ma_pos = 0;
+    _ma_sum = 0;
+}
+
+void SignalChain::calibrate(const int16_t* in, int16_t* out, size_t n, int16_t offset) {
+    for (size_t i = 0; i < n; i++) out[i] = sat16((int32_t)in[i] - offset);
+}
+
+void SignalChain::median3(int16_t* buf, size_t n, int16_t hist[2]) {
+    int16_t a = hist[0], b = hist[1];
+    for (size_t i = 0; i < n; i++) {
+        int16_t c = buf[i];
+        buf[i] = med3(a, b, c);
+        a = b;
+        b = c;
+    }
+    hist[0] = a;
+    hist[1] = b;
+}
+
+void SignalChain::iir1(int16_t* buf, size_t n, int16_t alpha_q15, int32_t& state_q31) {
+    // y += alpha * (x - y), con y en Q31 (x * 2^16); el error no cabe en 32 bits
+    int32_t y = state_q31;
+    for (size_t i = 0; i < n; i++) {
+        int64_t err = (int64_t)to_q31(buf[i]) - y;
+        y += (int32_t)((err * alpha_q15) >> 15);
+        buf[i] = (int16_t)(y >> 16);
+    }
+    state_q31 = y;
+}
+
+void SignalChain::moving_avg(int16_t* buf, size_t n, int16_t* ring, uint8_t log2, uint8_t& pos, int32_t& sum) {
+    const uint8_t mask = (uint8_t)((1u << log2) - 1);
+    for (size_t i = 0; i < n; i++) {
+        sum += buf[i] - ring[pos];
+        ring[pos] = buf[i];
+        pos = (pos + 1) & mask;
+        buf[i] = (int16_t)(sum >> log2);
+    }
+}
+
+void SignalChain::stats(const int16_t* buf, size_t n, BlockStats& out) {
+    if (n == 0) { out = {0, 0, 0, 0}; return; }
+    int32_t sum = 0;
+    uint64_t sq = 0;
+    int16_t mn = buf[0], mx = buf[0];
+    for (size_t i = 0; i < n; i++) {
+        int32_t v = buf[i];
+        sum += v;
+        sq += (uint64_t)(v * v);
+        if (buf[i] < mn) mn = buf[i];
+        if (buf[i] > mx) mx = buf[i];
+    }
+    out.mean = (int16_t)(sum / (int32_t)n);
+    out.rms = sat16((int32_t)isqrt64(sq / n));
+    out.min = mn;
+    out.max = mx;
+}
+
+void SignalChain::process(const int16_t* in, int16_t* out, size_t n, BlockStats& st) {
+    if (n == 0) { st = {0, 0, 0, 0}; return; }
+    calibrate(in, out, n, _cfg.offset);
+
+    if (!_primed) {
+        // Arranque sin transitorio: los estados parten del primer valor
+        _med_hist[0] = _med_hist[1] = out[0];
+        _iir_q31 = to_q31(out[0]);
+        for (size_t i = 0; i < (1u << _cfg.ma_log2); i++) _ma_ring[i] = out[0];
+        _ma_sum = (int32_t)out[0] * (int32_t)(1u << _cfg.ma_log2);
+        _primed = true;
+    }
+
+    // RMS/mín/máx sobre la señal calibrada: el filtrado borraría el rizado
+    stats(out, n, st);
+
+    if (_cfg.median) median3(out, n, _med_hist);
+    if (_cfg.iir_alpha_q15) iir1(out, n, _cfg.iir_alpha_q15, _iir_q31);
+    if (_cfg.ma_log2) moving_avg(out, n, _ma_ring, _cfg.ma_log2, _ma_pos, _ma_sum);
+
+    int32_t sum = 0;
+    for (size_t i = 0; i < n; i++) sum += out[i];
+    st.mean = (int16_t)(sum / (int32_t)n);
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Acondicionamiento de muestras del ADC por bloques, en punto fijo.
+ *
+ * Etapas (cada una es un kernel sobre un bloque int16):
+ *   1. Cero: x - offset (la escala uA/LSB la aplica Metering por canal)
+ *   2. Mediana de 3: elimina los picos de conmutación de relés
+ *   3. IIR de un polo (alpha Q15, estado Q31 para no perder resolución)
+ *   4. Media móvil de 2^n muestras (suma corrida, sin divisiones)
+ * Por bloque se entregan la media filtrada y RMS/mínimo/máximo de la señal
+ * calibrada (antes de filtrar, para no ocultar el rizado).
+ *
+ * Las muestras son negativas con corriente inversa: los pasos a Q31 y a la
+ * suma de la media móvil multiplican en vez de desplazar a la izquierda
+ * (desplazar un negativo es comportamiento indefinido antes de C++20).
+ */
+class SignalChain {
+public:
+    static constexpr size_t MA_MAX_LOG2 = 4;    // Ventana máxima de la media móvil: 16
+
+    // Muestra a Q31 (x * 2^16) sin desplazar un valor con signo
+    static constexpr int32_t to_q31(int16_t x) { return (int32_t)x * 65536; }
+
+    struct Config {
+        int16_t offset;         // Cero en cuentas crudas
+        int16_t iir_alpha_q15;  // 0 = IIR desactivado
+        uint8_t ma_log2;        // 0 = media móvil desactivada
+        bool median;
+    };
+
+    struct BlockStats {
+        int16_t mean;
+        int16_t rms;
+        int16_t min;
+        int16_t max;
+    };
+
+    SignalChain();
+    void configure(const Config& cfg);
+    void reset();
+
+    // in y out pueden ser el mismo buffer
+    void process(const int16_t* in, int16_t* out, size_t n, BlockStats& stats);
+
+    // ----- Kernels de bloque (sin estado salvo el que se pasa) -----
+    static void calibrate(const int16_t* in, int16_t* out, size_t n, int16_t offset);
+    static void median3(int16_t* buf, size_t n, int16_t hist[2]);
+    static void iir1(int16_t* buf, size_t n, int16_t alpha_q15, int32_t& state_q31);
+    static void moving_avg(int16_t* buf, size_t n, int16_t* ring, uint8_t log2, uint8_t& pos, int32_t& sum);
+    static void stats(const int16_t* buf, size_t n, BlockStats& out);
+
+private:
+    Config _cfg;
+
+    // Estado entre bloques
+    int16_t _med_hist[2];
+    bool _primed;
+    int32_t _iir_q31;
+    int16_t _ma_ring[1 << MA_MAX_LOG2];
+    uint8_t _ma_pos;
+    int32_t _ma_sum;
+};
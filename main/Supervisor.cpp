@@ -0,0 +1,218 @@
+#include "Supervisor.hpp"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_attr.h"
+#include "esp_task_wdt.h"
+#include "TaskConfig.hpp"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <cstdio>
+
+static const char* TAG = "SUPERVISOR";
+
+extern LoggerFS g_logger;
+
+// Sobrevive a esp_restart (no al corte de energía): qué tarea provocó el reinicio
+static constexpr uint32_t RESTART_MAGIC = 0x53555056; // "VPUS"
+RTC_NOINIT_ATTR static uint32_t s_restart_magic;
+RTC_NOINIT_ATTR static uint32_t s_restart_watch;
+RTC_NOINIT_ATTR static uint32_t s_restart_gap_ms;
+
+Supervisor::Slot Supervisor::_slot[COUNT] = {};
+const char* const Supervisor::NAMES[COUNT] = {"sd_log", "i2c", "carga", "httpd"};
+
+uint32_t Supervisor::now_ms() {
+    uint32_t ms = (uint32_t)(esp_timer_get_time() / 1000);
+    return ms ? ms : 1; // 0 significa "libre" en busy_ms
+}
+
+void Supervisor::watch(Watch w, uint32_t deadline_ms, uint32_t restart_ms, Hook hook) {
+    Slot& s = _slot[(int)w];
+    s.hook = hook;
+    s.restart_ms = restart_ms;
+    s.last_ms = now_ms();   // Una tarea que nunca da pulso también se detecta
+    s.deadline_ms = deadline_ms;
+}
+
+void Supervisor::checkin(Watch w) {
+    _slot[(int)w].last_ms = now_ms();
+}
+
+void Supervisor::busy(Watch w, const char* what) {
+    Slot& s = _slot[(int)w];
+    if (what) {
+        s.busy_what = what;
+        s.busy_ms = now_ms();
+    } else {
+        s.busy_ms = 0;
+    }
+}
+
+bool Supervisor::start() {
+    if (TaskPlan::create(TaskPlan::SUPERVISOR, supervisor_task, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "No se pudo crear la tarea del supervisor");
+        return false;
+    }
+    return true;
+}
+
+RectEvent Supervisor::boot_event(char* detail, size_t cap) {
+    esp_reset_reason_t reason = esp_reset_reason();
+    bool marked = s_restart_magic == RESTART_MAGIC && s_restart_watch < (uint32_t)COUNT;
+    s_restart_magic = 0;
+
+    RectEvent ev = RectEvent::BOOT;
+    switch (reason) {
+        case ESP_RST_TASK_WDT:
+        case ESP_RST_INT_WDT:
+        case ESP_RST_WDT:
+            snprintf(detail, cap, "watchdog de hardware (%d)", (int)reason);
+            ev = RectEvent::BOOT_WDT;
+            break;
+        case ESP_RST_PANIC:
+            snprintf(detail, cap, "excepción/panic");
+            ev = RectEvent::BOOT_WDT;
+            break;
+        case ESP_RST_SW:
+            if (marked) {
+                snprintf(detail, cap, "supervisor: %s sin pulso %u ms", NAMES[s_restart_watch],
+                         (unsigned)s_restart_gap_ms);
+                ev = RectEvent::BOOT_WDT;
+            } else {
+                snprintf(detail, cap, "reinicio por software");
+                ev = RectEvent::BOOT_SOFT;
+            }
+            break;
+        case ESP_RST_BROWNOUT:
+            snprintf(detail, cap, "caída de tensión");
+            break;
+        case ESP_RST_POWERON:
+            snprintf(detail, cap, "encendido");
+            break;
+        default:
+            snprintf(detail, cap, "reset %d", (int)reason);
+            break;
+    }
+    return ev;
+}
+
+/**
+ * @brief Evalúa una tarea: alarma y hook al pasar el plazo, reinicio marcado al pasar restart_ms.
+ */
+void Supervisor::check(int i, uint32_t now) {
+    Slot& s = _slot[i];
+    if (!s.deadline_ms) return;
+    uint32_t gap = now - s.last_ms;
+    if ((int32_t)gap < 0) gap = 0;      // checkin entre la lectura del reloj y esta resta
+    if (gap > s.max_gap_ms) s.max_gap_ms = gap;
+
+    if (gap <= s.deadline_ms) {
+        if (s.stalled) {
+            s.stalled = false;
+            if (s.hook) s.hook(false);
+            ESP_LOGW(TAG, "%s: recuperada", NAMES[i]);
+        }
+        return;
+    }
+
+    uint32_t busy_ms = s.busy_ms;
+    const char* what = s.busy_what;
+    if (!s.stalled) {
+        s.stalled = true;
+        s.stalls++;
+        if (s.hook) s.hook(true); // Antes de registrar: el hook del logger evita que esto bloquee
+        if (busy_ms) {
+            ESP_LOGE(TAG, "%s: sin pulso %u ms, ocupada %u ms en %s", NAMES[i], (unsigned)gap,
+                     (unsigned)(now - busy_ms), what ? what : "?");
+            g_logger.registrarf(RectEvent::ERR_WDT, NAMES[i], "Sin pulso %u ms, ocupada %u ms en %s", (unsigned)gap,
+                                (unsigned)(now - busy_ms), what ? what : "?");
+        } else {
+            ESP_LOGE(TAG, "%s: sin pulso %u ms", NAMES[i], (unsigned)gap);
+            g_logger.registrarf(RectEvent::ERR_WDT, NAMES[i], "Sin pulso %u ms", (unsigned)gap);
+        }
+    }
+
+    if (s.restart_ms && gap > s.restart_ms) {
+        ESP_LOGE(TAG, "%s: sin pulso %u ms, reiniciando", NAMES[i], (unsigned)gap);
+        s_restart_magic = RESTART_MAGIC;
+        s_restart_watch = (uint32_t)i;
+        s_restart_gap_ms = gap;
+        g_logger.flush();
+        esp_restart();
+    }
+}
+
+/**
+ * @brief Latido compacto: tiempo encendido, heap y el mayor hueco de pulso por tarea desde el anterior.
+ */
+void Supervisor::heartbeat(uint32_t now) {
+    char gaps[80];
+    size_t n = 0;
+    uint32_t stalls = 0;
+    bool alert = false;
+    for (int i = 0; i < COUNT; i++) {
+        Slot& s = _slot[i];
+        stalls += s.stalls;
+        alert |= s.stalled;
+        if (!s.deadline_ms) continue;
+        int m = snprintf(gaps + n, sizeof(gaps) - n, "%s%s %u", n ? " " : "", NAMES[i], (unsigned)s.max_gap_ms);
+        if (m > 0 && (size_t)m < sizeof(gaps) - n) n += (size_t)m;
+        s.max_gap_ms = 0;
+    }
+    gaps[n] = 0;
+    g_logger.registrarf(RectEvent::HEARTBEAT, alert ? "ALERTA" : "OK", "up %u s | heap %uK min %uK | pulso ms %s | fallas %u",
+                        (unsigned)(now / 1000), (unsigned)(esp_get_free_heap_size() / 1024),
+                        (unsigned)(esp_get_minimum_free_heap_size() / 1024), gaps, (unsigned)stalls);
+}
+
+void Supervisor::supervisor_task(void* pv) {
+    esp_task_wdt_add(NULL);
+    uint32_t last_beat = now_ms();
+    TickType_t last_wake = xTaskGetTickCount();
+    while (1) {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(PERIOD_MS));
+        esp_task_wdt_reset();
+        uint32_t now = now_ms();
+        for (int i = 0; i < COUNT; i++) check(i, now);
+        if (now - last_beat >= HEARTBEAT_S * 1000) {
+            last_beat = now;
+            heartbeat(now);
+        }
+    }
+}
+
+std::string Supervisor::status() {
+    std::string out;
+    char line[128];
+    uint32_t now = now_ms();
+    for (int i = 0; i < COUNT; i++) {
+        const Slot& s = _slot[i];
+        if (!s.deadline_ms) {
+            snprintf(line, sizeof(line), "%-7s sin vigilar\n", NAMES[i]);
+        } else {
+            uint32_t busy_ms = s.busy_ms;
+            const char* what = s.busy_what;
+            int n = snprintf(line, sizeof(line), "%-7s %s | pulso hace %u ms (plazo %u) | máx %u ms | fallas %u",
+                             NAMES[i], s.stalled ? "COLGADA" : "ok", (unsigned)(now - s.last_ms),
+                             (unsigned)s.deadline_ms, (unsigned)s.max_gap_ms, (unsigned)s.stalls);
+            if (busy_ms && n > 0 && (size_t)n < sizeof(line)) {
+                snprintf(line + n, sizeof(line) - n, " | en %s %u ms", what ? what : "?", (unsigned)(now - busy_ms));
+            }
+            out += line;
+            out += '\n';
+            continue;
+        }
+        out += line;
+    }
+    return out;
+}
+
+void Supervisor::metrics(TextBuffer& out) {
+    for (int i = 0; i < COUNT; i++) {
+        const Slot& s = _slot[i];
+        if (!s.deadline_ms) continue;
+        out.appendf("supervisor_stalls{task=\"%s\"} %u\nsupervisor_gap_max_ms{task=\"%s\"} %u\n", NAMES[i],
+                    (unsigned)s.stalls, NAMES[i], (unsigned)s.max_gap_ms);
+    }
+}
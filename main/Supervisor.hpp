@@ -0,0 +1,68 @@
+#pragma once
+#include "LoggerFS.hpp"
+#include "TextBuffer.hpp"
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Supervisor de salud: pulso por tarea, latidos y recuperación escalonada.
+ *
+ * Cada tarea crítica se registra con watch() y da señales de vida con
+ * checkin() (un store; sin colas ni mutex). Las secciones que pueden
+ * bloquearse (escritura en SD, handler del httpd, tick de carga) se marcan
+ * con busy(), así una alarma dice dónde quedó colgada la tarea: un cuelgue
+ * del I2C, una SD que no responde y un servidor web trabado se ven distintos.
+ *
+ * Escalado ante una tarea sin pulso:
+ *   1. Evento ERR_WDT con la tarea, el tiempo sin pulso y la sección en curso;
+ *      el hook de la tarea (si tiene) mitiga (p. ej. el logger deja de esperar la SD).
+ *   2. Si sigue colgada pasado restart_ms, reinicio marcado: el próximo
+ *      arranque se registra como BOOT_WDT con el nombre de la tarea.
+ *
+ * La tarea del supervisor y la de carga están suscritas al task watchdog de
+ * IDF, que cubre el caso de que el propio supervisor quede sin CPU.
+ */
+class Supervisor {
+public:
+    // El orden importa: el logger se evalúa primero para que sus eventos no bloqueen al resto
+    enum class Watch : uint8_t { LOGGER = 0, I2C, CHARGE, HTTPD, COUNT };
+    using Hook = void (*)(bool stalled);     // true al detectar el cuelgue, false al recuperarse
+
+    static constexpr uint32_t PERIOD_MS = 500;
+    static constexpr uint32_t HEARTBEAT_S = 300;
+
+    static void watch(Watch w, uint32_t deadline_ms, uint32_t restart_ms, Hook hook = nullptr);
+    static void checkin(Watch w);
+    static void busy(Watch w, const char* what);  // nullptr = terminó la sección
+
+    static bool start();
+    // Evento de arranque según esp_reset_reason y la marca del último reinicio supervisado
+    static RectEvent boot_event(char* detail, size_t cap);
+
+    static std::string status();                // Comando "health"
+    static void metrics(TextBuffer& out);
+
+private:
+    static constexpr int COUNT = (int)Watch::COUNT;
+
+    struct Slot {
+        uint32_t deadline_ms;   // 0 = sin vigilar
+        uint32_t restart_ms;    // 0 = nunca reinicia
+        Hook hook;
+        volatile uint32_t last_ms;
+        volatile uint32_t busy_ms;      // Inicio de la sección en curso (0 = libre)
+        const char* volatile busy_what;
+        uint32_t max_gap_ms;    // Desde el último latido
+        uint32_t stalls;
+        bool stalled;
+    };
+
+    static Slot _slot[COUNT];
+    static const char* const NAMES[COUNT];
+
+    static uint32_t now_ms();
+    static void check(int i, uint32_t now);
+    static void heartbeat(uint32_t now);
+    static void supervisor_task(void* pv);
+};
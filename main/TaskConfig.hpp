@@ -0,0 +1,63 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdint.h>
+
+/**
+ * @brief Plan de núcleos, prioridades y pilas de todas las tareas del equipo.
+ *
+ * Core 1: solo tiempo real (muestreo, protección, control de carga); nada
+ * de red ni SD, así una descarga OTA o un log largo no le quitan turno. Sus
+ * eventos van por LoggerFS::diferirf (cola hacia log_defer) y los disparos
+ * por la cola de protect_log. El diario de sesiones y el total en NVS sí se
+ * escriben desde charge_task: una escritura en flash detiene la caché de
+ * ambos núcleos igual, la pida quien la pida.
+ * Core 0: WiFi, lwIP, TLS, httpd, SD y logging, junto a las tareas del
+ * sistema que IDF ya fija ahí (WiFi, esp_timer). lwIP también se fija al
+ * core 0 en sdkconfig (CONFIG_LWIP_TCPIP_TASK_AFFINITY_CPU0).
+ *
+ * Cada xTaskCreatePinnedToCore toma su fila de aquí; el comando "tasks"
+ * compara el plan con lo que corre (núcleo y pila libre).
+ */
+struct TaskConfig {
+    const char* name;
+    uint32_t stack;
+    UBaseType_t priority;
+    BaseType_t core;
+};
+
+namespace TaskPlan {
+inline constexpr BaseType_t CORE_RT = 1;
+inline constexpr BaseType_t CORE_NET = 0;
+
+// --- Core 1: tiempo real ---
+inline constexpr TaskConfig PROTECTION   = { "protect_task", 3072,  configMAX_PRIORITIES - 2, CORE_RT };
+inline constexpr TaskConfig METER        = { "meter_task",   3072,  6,                        CORE_RT };
+inline constexpr TaskConfig CHARGE       = { "charge_task",  4096,  5,                        CORE_RT };
+
+// --- Core 0: red, TLS, SD y logging ---
+inline constexpr TaskConfig SUPERVISOR   = { "supervisor",   3072,  configMAX_PRIORITIES - 3, CORE_NET };
+inline constexpr TaskConfig PROTECT_LOG  = { "protect_log",  4096,  4,                        CORE_NET }; // Registro y cierre tras un disparo
+inline constexpr TaskConfig LOG_DEFER    = { "log_defer",    4096,  3,                        CORE_NET }; // Eventos del core 1
+inline constexpr TaskConfig OTA_WRITER   = { "ota_writer",   4096,  4,                        CORE_NET }; // Libera el buffer del receptor (httpd)
+inline constexpr TaskConfig OTA          = { "ota_task",     10240, 3,                        CORE_NET };
+inline constexpr TaskConfig CMD_EXEC     = { "cmd_exec",     6144,  3,                        CORE_NET };
+inline constexpr TaskConfig HTTPD        = { "httpd",        10240, 2,                        CORE_NET };
+inline constexpr TaskConfig HTTP_WORKER  = { "http_wk",      6144,  2,                        CORE_NET }; // + índice
+inline constexpr TaskConfig CMD_UART     = { "cmd_uart",     3072,  2,                        CORE_NET };
+inline constexpr TaskConfig GH_REFRESH   = { "gh_refresh",   8192,  2,                        CORE_NET };
+inline constexpr TaskConfig TIME_SERIES  = { "ts_task",      4096,  2,                        CORE_NET };
+inline constexpr TaskConfig SD_FLUSH     = { "sd_flush",     3072,  1,                        CORE_NET };
+inline constexpr TaskConfig UPLINK       = { "uplink",       8192,  1,                        CORE_NET };
+
+inline constexpr const TaskConfig* ALL[] = {
+    &PROTECTION, &METER, &CHARGE, &SUPERVISOR, &PROTECT_LOG, &LOG_DEFER, &OTA_WRITER, &OTA, &CMD_EXEC,
+    &HTTPD, &HTTP_WORKER, &CMD_UART, &GH_REFRESH, &TIME_SERIES, &SD_FLUSH, &UPLINK,
+};
+
+// xTaskCreatePinnedToCore con la fila del plan; name sobrescribe el nombre (tareas con índice)
+inline BaseType_t create(const TaskConfig& cfg, TaskFunction_t fn, void* arg, TaskHandle_t* handle = nullptr,
+                         const char* name = nullptr) {
+    return xTaskCreatePinnedToCore(fn, name ? name : cfg.name, cfg.stack, arg, cfg.priority, handle, cfg.core);
+}
+} // namespace TaskPlan
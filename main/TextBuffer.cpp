@@ -0,0 +1,101 @@
+#include "TextBuffer.hpp"
+#include <cstdio>
+#include <cstring>
+#include <cstdarg>
+
+TextBuffer::TextBuffer(char* buf, size_t cap, Sink sink, void* ctx)
+    : _buf(buf), _cap(cap), _sink(sink), _ctx(ctx) {
+    if (_cap) _buf[0] = 0;
+}
+
+bool TextBuffer::flush() {
+    if (!_sink) return !_overflow;
+    if (_len && !_sink(_ctx, _buf, _len)) _overflow = true;
+    _sent += _len;
+    _len = 0;
+    if (_cap) _buf[0] = 0;
+    return !_overflow;
+}
+
+// Deja lugar para n bytes + NUL vaciando hacia el sink si hace falta
+bool TextBuffer::reserve(size_t n) {
+    if (_len + n < _cap) return true;
+    if (_sink) {
+        flush();
+        if (n < _cap) return true;
+    }
+    _overflow = true;
+    return false;
+}
+
+bool TextBuffer::append(std::string_view s) {
+    if (_overflow && !_sink) return false;  // Truncado: nada más puede quedar detrás del corte
+    while (!s.empty()) {
+        if (_cap <= 1) {
+            _overflow = true;
+            return false;
+        }
+        // Cadenas más largas que el buffer pasan en tramos
+        size_t n = s.size() < _cap - 1 ? s.size() : _cap - 1;
+        if (!reserve(n)) {
+            n = _cap - 1 - _len;
+            memcpy(_buf + _len, s.data(), n);
+            _len += n;
+            _buf[_len] = 0;
+            return false;
+        }
+        memcpy(_buf + _len, s.data(), n);
+        _len += n;
+        _buf[_len] = 0;
+        s.remove_prefix(n);
+    }
+    return true;
+}
+
+bool TextBuffer::append(char c) {
+    if (_overflow && !_sink) return false;
+    if (!reserve(1)) return false;
+    _buf[_len++] = c;
+    _buf[_len] = 0;
+    return true;
+}
+
+bool TextBuffer::appendf(const char* fmt, ...) {
+    if (_overflow && !_sink) return false;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(_buf + _len, _cap - _len, fmt, args);
+        va_end(args);
+        if (n < 0) return false;
+        if (_len + (size_t)n < _cap) {
+            _len += n;
+            return true;
+        }
+        _buf[_len] = 0;     // Descarta el intento truncado
+        if (attempt == 0 && !reserve((size_t)n)) break;
+    }
+    _overflow = true;
+    return false;
+}
+
+bool TextBuffer::append_json_escaped(std::string_view s) {
+    size_t start = 0;
+    for (size_t i = 0; i < s.size(); i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+        if (i > start && !append(s.substr(start, i - start))) return false;
+        start = i + 1;
+        bool ok;
+        switch (c) {
+            case '"':  ok = append("\\\""); break;
+            case '\\': ok = append("\\\\"); break;
+            case '\n': ok = append("\\n"); break;
+            case '\r': ok = append("\\r"); break;
+            case '\t': ok = append("\\t"); break;
+            default:   ok = appendf("\\u%04x", c); break;
+        }
+        if (!ok) return false;
+    }
+    return start >= s.size() || append(s.substr(start));
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <string_view>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Texto armado sobre memoria ajena (pila o arena), sin heap.
+ *
+ * Si se le da un sink, al llenarse le entrega lo acumulado y sigue desde
+ * cero (p. ej. httpd_resp_send_chunk); sin sink, lo que no entra se marca
+ * como desborde, la salida queda truncada y se rechaza todo lo que venga
+ * después (un texto corto posterior no aparece pegado al corte).
+ */
+class TextBuffer {
+public:
+    using Sink = bool (*)(void* ctx, const char* data, size_t len);
+
+    TextBuffer(char* buf, size_t cap, Sink sink = nullptr, void* ctx = nullptr);
+
+    bool append(std::string_view s);
+    bool append(char c);
+    bool appendf(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+    bool append_json_escaped(std::string_view s);   // Sin comillas alrededor
+
+    bool flush();                   // Entrega al sink lo pendiente (true si no hay sink)
+
+    std::string_view view() const { return std::string_view(_buf, _len); }
+    const char* c_str() const { return _buf; }      // Siempre terminado en NUL
+    size_t size() const { return _len; }
+    size_t total() const { return _sent + _len; }   // Incluye lo ya entregado al sink
+    bool overflow() const { return _overflow; }
+
+private:
+    char* _buf;
+    size_t _cap;
+    size_t _len = 0;
+    size_t _sent = 0;
+    Sink _sink;
+    void* _ctx;
+    bool _overflow = false;
+
+    bool reserve(size_t n);
+};
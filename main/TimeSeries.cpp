@@ -0,0 +1,380 @@
+#include "TimeSeries.hpp"
+#include "Metering.hpp"
+#include "LoggerFS.hpp"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "TaskConfig.hpp"
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/unistd.h>
+
+static const char* TAG = "TIMESERIES";
+
+extern LoggerFS g_logger;
+
+static constexpr uint16_t BLOCK_MAGIC = 0x5354; // "TS"
+static constexpr uint32_t LEVEL_STEP_S[TimeSeries::LEVELS] = {1, 60, 3600};
+static constexpr long LEVEL_MAX_BYTES[TimeSeries::LEVELS] = {32L << 20, 4L << 20, 1L << 20};
+static constexpr int MEAN_COLS = 4;   // Columnas 0..3 (mA) se promedian; 4..7 (mWh) toman el último
+static constexpr size_t READ_BATCH = 8; // Bloques por lectura (4 KB)
+
+std::string TimeSeries::_base;
+std::mutex TimeSeries::_mutex;
+TimeSeries::Encoder TimeSeries::_enc[LEVELS];
+TimeSeries::Rollup TimeSeries::_roll[LEVELS - 1];
+uint32_t TimeSeries::_blocks_written[LEVELS] = {};
+uint32_t TimeSeries::_write_errors = 0;
+uint32_t TimeSeries::_last_t[LEVELS] = {};
+uint32_t TimeSeries::_waiting_clock = 0;
+uint32_t TimeSeries::_backwards = 0;
+bool TimeSeries::_started = false;
+FILE* TimeSeries::_file[LEVELS] = {};
+long TimeSeries::_file_size[LEVELS] = {};
+
+// --- Varints zigzag ---
+static inline uint32_t zz_enc(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+static inline int32_t zz_dec(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+static inline size_t put_varint(uint8_t* p, uint32_t v) {
+    size_t n = 0;
+    while (v >= 0x80) { p[n++] = (uint8_t)(v | 0x80); v >>= 7; }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+static inline bool get_varint(const uint8_t* p, size_t len, size_t& pos, uint32_t& out) {
+    uint32_t v = 0;
+    for (int shift = 0; shift < 35 && pos < len; shift += 7) {
+        uint8_t b = p[pos++];
+        v |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) { out = v; return true; }
+    }
+    return false;
+}
+
+static uint32_t block_crc(const void* blk) {
+    // Cabecera hasta el campo crc (16 bytes) + payload completo (desde el byte 20)
+    const uint8_t* b = (const uint8_t*)blk;
+    uint32_t crc = esp_rom_crc32_le(0, b, 16);
+    return esp_rom_crc32_le(crc, b + 20, TimeSeries::BLOCK_SIZE - 20);
+}
+
+uint32_t TimeSeries::step_s(int level) {
+    return (level >= 0 && level < LEVELS) ? LEVEL_STEP_S[level] : 1;
+}
+
+std::string TimeSeries::path(int level, bool old) {
+    char name[24];
+    snprintf(name, sizeof(name), "/ts_l%d.%s", level, old ? "old" : "dat");
+    return _base + name;
+}
+
+void TimeSeries::encoder_reset(Encoder& e, int level) {
+    memset(&e, 0, sizeof(e));
+    e.blk.hdr.magic = BLOCK_MAGIC;
+    e.blk.hdr.level = (uint8_t)level;
+    e.blk.hdr.cols = COLS;
+}
+
+bool TimeSeries::encoder_push(Encoder& e, const Row& row) {
+    BlockHeader& h = e.blk.hdr;
+    if (h.bytes + MAX_ROW_BYTES > PAYLOAD) return false;
+
+    uint8_t* p = e.blk.payload + h.bytes;
+    size_t n = 0;
+    if (h.rows == 0) {
+        h.t_first = row.t;
+        for (int c = 0; c < COLS; c++) n += put_varint(p + n, zz_enc(row.v[c]));
+        e.prev_dt = 0;
+    } else {
+        int32_t dt = (int32_t)(row.t - e.prev_t);
+        n += put_varint(p + n, zz_enc(dt - e.prev_dt));
+        e.prev_dt = dt;
+        for (int c = 0; c < COLS; c++) n += put_varint(p + n, zz_enc(row.v[c] - e.prev_v[c]));
+    }
+    e.prev_t = row.t;
+    memcpy(e.prev_v, row.v, sizeof(e.prev_v));
+    h.t_last = row.t;
+    h.rows++;
+    h.bytes += n;
+    return true;
+}
+
+bool TimeSeries::flush(int level) {
+    Encoder& e = _enc[level];
+    if (e.blk.hdr.rows == 0) return true;
+    e.blk.hdr.crc = block_crc(&e.blk);
+
+    std::string file = path(level, false);
+    if (_file[level] && _file_size[level] >= LEVEL_MAX_BYTES[level]) {
+        fclose(_file[level]);
+        _file[level] = nullptr;
+        std::string old = path(level, true);
+        unlink(old.c_str());
+        rename(file.c_str(), old.c_str());
+        ESP_LOGI(TAG, "Nivel %d rotado", level);
+    }
+
+    // Archivo abierto de forma persistente: sin búsqueda de directorio por bloque
+    if (!_file[level]) {
+        _file[level] = fopen(file.c_str(), "ab");
+        if (_file[level]) {
+            setvbuf(_file[level], NULL, _IONBF, 0);
+            struct stat st;
+            _file_size[level] = (stat(file.c_str(), &st) == 0) ? st.st_size : 0;
+        }
+    }
+
+    FILE* f = _file[level];
+    bool ok = f && fwrite(&e.blk, BLOCK_SIZE, 1, f) == 1;
+    if (ok) fsync(fileno(f));   // Las consultas abren el archivo aparte y leen el tamaño del directorio
+    if (!ok) {
+        _write_errors++;
+        if (f) fclose(f);
+        _file[level] = nullptr;
+        ESP_LOGW(TAG, "No se pudo escribir bloque del nivel %d", level);
+        return false;
+    }
+    _file_size[level] += BLOCK_SIZE;
+    _blocks_written[level]++;
+    encoder_reset(e, level);
+    return true;
+}
+
+void TimeSeries::append_level(int level, const Row& row) {
+    // dt negativo rompería la bisección y el delta de delta
+    if (row.t <= _last_t[level]) {
+        _backwards++;
+        return;
+    }
+    _last_t[level] = row.t;
+
+    Encoder& e = _enc[level];
+    if (!encoder_push(e, row)) {
+        if (!flush(level)) {
+            // Sin SD: el bloque lleno se descarta para no frenar el muestreo
+            if (e.blk.hdr.bytes + MAX_ROW_BYTES > PAYLOAD) encoder_reset(e, level);
+        }
+        encoder_push(e, row);
+    }
+
+    if (level + 1 >= LEVELS) return;
+
+    // Reducción: al cambiar de cubeta se emite la fila agregada al nivel siguiente
+    Rollup& r = _roll[level];
+    uint32_t step = LEVEL_STEP_S[level + 1];
+    uint32_t bucket = row.t - (row.t % step);
+    if (r.count && bucket != r.bucket) {
+        Row agg;
+        agg.t = r.bucket;
+        for (int c = 0; c < COLS; c++) {
+            agg.v[c] = (c < MEAN_COLS) ? (int32_t)(r.sum[c] / (int64_t)r.count) : r.last[c];
+        }
+        memset(&r, 0, sizeof(r));
+        append_level(level + 1, agg);
+    }
+    r.bucket = bucket;
+    r.count++;
+    for (int c = 0; c < COLS; c++) {
+        r.sum[c] += row.v[c];
+        r.last[c] = row.v[c];
+    }
+}
+
+void TimeSeries::append(const Row& row) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_started) return;
+    append_level(0, row);
+}
+
+/**
+ * @brief t_last del último bloque válido del nivel (.dat, o .old si aún no hay .dat); 0 si no hay.
+ */
+uint32_t TimeSeries::last_time_on_disk(int level) {
+    Block* b = new (std::nothrow) Block;
+    if (!b) return 0;
+    uint32_t t = 0;
+    for (int old = 0; old < 2 && !t; old++) {
+        FILE* f = fopen(path(level, old).c_str(), "rb");
+        if (!f) continue;
+        fseek(f, 0, SEEK_END);
+        long blocks = ftell(f) / (long)BLOCK_SIZE;
+        // Un bloque corrupto al final (corte de energía) no debe ocultar los anteriores
+        for (long i = blocks - 1; i >= 0 && i >= blocks - 4 && !t; i--) {
+            fseek(f, i * (long)BLOCK_SIZE, SEEK_SET);
+            if (fread(b, BLOCK_SIZE, 1, f) == 1 && b->hdr.magic == BLOCK_MAGIC && b->hdr.crc == block_crc(b)) {
+                t = b->hdr.t_last;
+            }
+        }
+        fclose(f);
+    }
+    delete b;
+    return t;
+}
+
+bool TimeSeries::start(const char* base_path) {
+    if (_started) return true;
+    _base = base_path;
+    for (int l = 0; l < LEVELS; l++) {
+        encoder_reset(_enc[l], l);
+        _last_t[l] = last_time_on_disk(l);
+    }
+    memset(_roll, 0, sizeof(_roll));
+    _started = true;
+    TaskPlan::create(TaskPlan::TIME_SERIES, writer_task, NULL);
+    ESP_LOGI(TAG, "Historial en %s (1 s / 1 min / 1 h), retoma desde t=%u", base_path, (unsigned)_last_t[0]);
+    return true;
+}
+
+void TimeSeries::writer_task(void* pv) {
+    TickType_t last = xTaskGetTickCount();
+    while (1) {
+        vTaskDelayUntil(&last, pdMS_TO_TICKS(1000));
+        if (!g_logger.is_ready()) continue;
+
+        // Sin NTP el reloj arranca cerca de 0: esas filas quedarían antes que las de ayer
+        uint32_t now = (uint32_t)time(NULL);
+        if (now < MIN_VALID_EPOCH) {
+            if (_waiting_clock++ == 0) ESP_LOGW(TAG, "Reloj sin sincronizar: historial en espera");
+            continue;
+        }
+
+        MeterSnapshot m;
+        Metering::snapshot(m);
+        Row row;
+        row.t = now;
+        for (int i = 0; i < 4; i++) {
+            row.v[i] = m.ma[i];
+            row.v[4 + i] = (int32_t)m.session_mwh[i];
+        }
+        append(row);
+    }
+}
+
+int TimeSeries::pick_level(uint32_t from, uint32_t to, uint32_t max_rows) {
+    uint32_t span = (to > from) ? (to - from) : 0;
+    if (max_rows == 0) max_rows = 1;
+    for (int l = 0; l < LEVELS; l++) {
+        if (span / LEVEL_STEP_S[l] <= max_rows) return l;
+    }
+    return LEVELS - 1;
+}
+
+bool TimeSeries::decode_block(const Block& b, uint32_t from, uint32_t to, RowCallback cb, void* ctx, size_t& emitted) {
+    const BlockHeader& h = b.hdr;
+    if (h.bytes > PAYLOAD) return true;
+
+    Row row;
+    int32_t prev_dt = 0;
+    size_t pos = 0;
+    uint32_t u;
+    for (uint16_t r = 0; r < h.rows; r++) {
+        if (r == 0) {
+            row.t = h.t_first;
+            for (int c = 0; c < COLS; c++) {
+                if (!get_varint(b.payload, h.bytes, pos, u)) return true;
+                row.v[c] = zz_dec(u);
+            }
+        } else {
+            if (!get_varint(b.payload, h.bytes, pos, u)) return true;
+            prev_dt += zz_dec(u);
+            row.t += prev_dt;
+            for (int c = 0; c < COLS; c++) {
+                if (!get_varint(b.payload, h.bytes, pos, u)) return true;
+                row.v[c] += zz_dec(u);
+            }
+        }
+        if (row.t < from) continue;
+        if (row.t > to) return false;
+        emitted++;
+        if (!cb(row, ctx)) return false;
+    }
+    return true;
+}
+
+size_t TimeSeries::query_file(const std::string& file, uint32_t from, uint32_t to, RowCallback cb, void* ctx, bool& stop) {
+    size_t emitted = 0;
+    size_t lo = 0, hi = 0;
+
+    // 1. Bisección sobre las cabeceras: primer bloque con t_last >= from
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        FILE* f = fopen(file.c_str(), "rb");
+        if (!f) return 0;
+        fseek(f, 0, SEEK_END);
+        hi = (size_t)ftell(f) / BLOCK_SIZE;
+        BlockHeader h;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            fseek(f, (long)(mid * BLOCK_SIZE), SEEK_SET);
+            if (fread(&h, sizeof(h), 1, f) != 1) break;
+            if (h.t_last < from) lo = mid + 1;
+            else hi = mid;
+        }
+        fseek(f, 0, SEEK_END);
+        hi = (size_t)ftell(f) / BLOCK_SIZE;
+        fclose(f);
+    }
+
+    // 2. Lectura por lotes: el mutex no se retiene mientras se envía al cliente
+    Block* batch = new (std::nothrow) Block[READ_BATCH];
+    if (!batch) return 0;
+    size_t idx = lo;
+    while (idx < hi && !stop) {
+        size_t got = 0;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            FILE* f = fopen(file.c_str(), "rb");
+            if (!f) break;
+            fseek(f, (long)(idx * BLOCK_SIZE), SEEK_SET);
+            got = fread(batch, BLOCK_SIZE, READ_BATCH, f);
+            fclose(f);
+        }
+        if (got == 0) break;
+        for (size_t i = 0; i < got && !stop; i++) {
+            const Block& b = batch[i];
+            if (b.hdr.magic != BLOCK_MAGIC || b.hdr.crc != block_crc(&b)) continue;
+            if (b.hdr.t_first > to) { stop = true; break; }
+            if (!decode_block(b, from, to, cb, ctx, emitted)) stop = true;
+        }
+        idx += got;
+    }
+    delete[] batch;
+    return emitted;
+}
+
+size_t TimeSeries::query(int level, uint32_t from, uint32_t to, RowCallback cb, void* ctx) {
+    if (!_started || level < 0 || level >= LEVELS) return 0;
+    bool stop = false;
+    size_t n = query_file(path(level, true), from, to, cb, ctx, stop);
+    if (!stop) n += query_file(path(level, false), from, to, cb, ctx, stop);
+    if (stop) return n;
+
+    // Filas aún en RAM (bloque sin completar): el gráfico llega hasta ahora
+    Block* tail = new (std::nothrow) Block;
+    if (!tail) return n;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        *tail = _enc[level].blk;
+    }
+    decode_block(*tail, from, to, cb, ctx, n);
+    delete tail;
+    return n;
+}
+
+std::string TimeSeries::status() {
+    char buf[224];
+    std::lock_guard<std::mutex> lock(_mutex);
+    snprintf(buf, sizeof(buf),
+             "Historial: bloques 1s/1m/1h %u/%u/%u | filas en RAM %u/%u/%u | errores %u\n"
+             "  espera de reloj %u s | filas fuera de orden %u | última t %u\n",
+             (unsigned)_blocks_written[0], (unsigned)_blocks_written[1], (unsigned)_blocks_written[2],
+             (unsigned)_enc[0].blk.hdr.rows, (unsigned)_enc[1].blk.hdr.rows, (unsigned)_enc[2].blk.hdr.rows,
+             (unsigned)_write_errors, (unsigned)_waiting_clock, (unsigned)_backwards, (unsigned)_last_t[0]);
+    return buf;
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include <string>
+#include <mutex>
+#include <cstdio>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Historial de corriente y energía por punto en la SD.
+ *
+ * Tres niveles con reducción automática: 1 s -> 1 min -> 1 h (media para la
+ * corriente, último valor para la energía). Cada nivel es un archivo de
+ * bloques fijos de 512 bytes; dentro del bloque las filas van una tras otra
+ * (t, v0..v7 intercalados, no por columnas), cada campo como varint zigzag:
+ *   - tiempo: delta de delta (con muestreo regular casi siempre 0 => 1 byte)
+ *   - valores: delta contra el mismo campo de la fila anterior
+ * Por filas el bloque en RAM se llena de a una fila sin buffers por columna,
+ * y la cola sin grabar se decodifica igual que un bloque de la SD.
+ * La cabecera de cada bloque guarda su rango de tiempo, así una consulta
+ * busca por bisección y lee solo los bloques del nivel que necesita.
+ *
+ * ~13 bytes por fila a 1 s => ~1.2 MB/día; el nivel 1 s rota a los 32 MB
+ * (~4 semanas, más otras tantas en .old).
+ *
+ * La bisección exige tiempos crecientes: no se graba nada hasta que el reloj
+ * es válido (NTP, año >= 2024), y al arrancar cada nivel retoma desde el
+ * último t_last en la SD; una fila que no avanza (reloj hacia atrás) se descarta.
+ */
+class TimeSeries {
+public:
+    static constexpr int COLS = 8;          // mA CH1..CH4, mWh de sesión CH1..CH4
+    static constexpr int LEVELS = 3;
+    static constexpr size_t BLOCK_SIZE = 512;
+    static constexpr uint32_t MIN_VALID_EPOCH = 1704067200; // 2024-01-01 00:00:00 UTC
+
+    struct Row {
+        uint32_t t;
+        int32_t v[COLS];
+    };
+    // Devuelve false para cortar la consulta
+    using RowCallback = bool (*)(const Row& row, void* ctx);
+
+    static bool start(const char* base_path);
+    static void append(const Row& row);     // Nivel 1 s; los niveles superiores se derivan
+
+    static uint32_t step_s(int level);
+    // Nivel más fino que entrega como mucho max_rows filas para [from, to]
+    static int pick_level(uint32_t from, uint32_t to, uint32_t max_rows);
+    static size_t query(int level, uint32_t from, uint32_t to, RowCallback cb, void* ctx);
+    static std::string status();
+
+private:
+    struct __attribute__((packed)) BlockHeader {
+        uint16_t magic;
+        uint8_t level;
+        uint8_t cols;
+        uint16_t rows;
+        uint16_t bytes;     // Bytes de payload usados
+        uint32_t t_first;
+        uint32_t t_last;
+        uint32_t crc;       // CRC32 de cabecera (sin crc) + payload
+    };
+    static_assert(sizeof(BlockHeader) == 20, "block_crc() asume cabecera de 20 bytes");
+    static constexpr size_t PAYLOAD = BLOCK_SIZE - sizeof(BlockHeader);
+    static constexpr size_t MAX_ROW_BYTES = 5 * (COLS + 1);
+
+    struct Block {
+        BlockHeader hdr;
+        uint8_t payload[PAYLOAD];
+    };
+    static_assert(sizeof(Block) == BLOCK_SIZE, "Bloque de serie debe medir 512 bytes");
+
+    // Codificador de un bloque en RAM
+    struct Encoder {
+        Block blk;
+        uint32_t prev_t;
+        int32_t prev_dt;
+        int32_t prev_v[COLS];
+    };
+
+    // Acumulador de reducción hacia el nivel siguiente
+    struct Rollup {
+        uint32_t bucket;
+        uint32_t count;
+        int64_t sum[COLS];
+        int32_t last[COLS];
+    };
+
+    static std::string _base;
+    static std::mutex _mutex;
+    static Encoder _enc[LEVELS];
+    static Rollup _roll[LEVELS - 1];
+    static uint32_t _blocks_written[LEVELS];
+    static uint32_t _write_errors;
+    static uint32_t _last_t[LEVELS];        // Última fila aceptada por nivel (incluye la SD)
+    static uint32_t _waiting_clock;         // Segundos sin grabar por reloj sin sincronizar
+    static uint32_t _backwards;             // Filas descartadas por tiempo que no avanza
+    static bool _started;
+    static FILE* _file[LEVELS];
+    static long _file_size[LEVELS];
+
+    static std::string path(int level, bool old);
+    static void encoder_reset(Encoder& e, int level);
+    static bool encoder_push(Encoder& e, const Row& row);
+    static bool flush(int level);
+    static uint32_t last_time_on_disk(int level);
+    static void append_level(int level, const Row& row);
+    static bool decode_block(const Block& b, uint32_t from, uint32_t to, RowCallback cb, void* ctx, size_t& emitted);
+    static size_t query_file(const std::string& file, uint32_t from, uint32_t to, RowCallback cb, void* ctx, bool& stop);
+    static void writer_task(void* pv);
+};
@@ -0,0 +1,477 @@
+#include "Uplink.hpp"
+#include "Metering.hpp"
+#include "ChargeControl.hpp"
+#include "WifiManager.hpp"
+#include "esp_http_client.h"
+#include "esp_crt_bundle.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_mac.h"
+#include "esp_system.h"
+#include "esp_rom_crc.h"
+#include "nvs_flash.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "TaskConfig.hpp"
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <time.h>
+#include <algorithm>
+
+static const char* TAG = "UPLINK";
+
+extern LoggerFS g_logger;
+
+static constexpr uint32_t SPOOL_MAGIC = 0x51555556; // "VUUQ"
+static constexpr uint32_t POS_MAGIC = 0x50555556;   // "VUUP"
+
+std::mutex Uplink::_mutex;
+Uplink::Batch Uplink::_cur = {};
+Uplink::Batch Uplink::_ready = {};
+Uplink::Stats Uplink::_stats = {};
+char Uplink::_url[128] = {};
+uint16_t Uplink::_tele_s = DEFAULT_TELE_S;
+uint16_t Uplink::_batch_s = DEFAULT_BATCH_S;
+bool Uplink::_flush_req = false;
+volatile bool Uplink::_url_changed = false;
+uint8_t Uplink::_mac[6] = {};
+uint32_t Uplink::_next_seq = 0;
+uint32_t Uplink::_seq_limit = 0;
+std::string Uplink::_spool;
+std::string Uplink::_spool_pos;
+long Uplink::_spool_size = 0;
+long Uplink::_read_off = 0;
+uint32_t Uplink::_backoff_s = 0;
+int64_t Uplink::_retry_at_us = 0;
+void* Uplink::_client = nullptr;
+
+// --- Varints zigzag (mismo formato que TimeSeries) ---
+static inline uint32_t zz_enc(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+
+static inline size_t put_varint(uint8_t* p, uint32_t v) {
+    size_t n = 0;
+    while (v >= 0x80) { p[n++] = (uint8_t)(v | 0x80); v >>= 7; }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+static uint32_t now_epoch() {
+    time_t now = time(NULL);
+    return now < 1704067200 ? 0 : (uint32_t)now; // Sin NTP no hay hora absoluta
+}
+
+// --- CONFIGURACIÓN (NVS "uplink") ---
+
+void Uplink::load_config() {
+    nvs_handle_t handle;
+    if (nvs_open("uplink", NVS_READONLY, &handle) != ESP_OK) return;
+    size_t len = sizeof(_url);
+    if (nvs_get_str(handle, "url", _url, &len) != ESP_OK) _url[0] = 0;
+    nvs_get_u16(handle, "tele_s", &_tele_s);
+    nvs_get_u16(handle, "batch_s", &_batch_s);
+    nvs_get_u32(handle, "seq", &_seq_limit);
+    nvs_close(handle);
+    if (_tele_s == 0) _tele_s = DEFAULT_TELE_S;
+    if (_batch_s == 0) _batch_s = DEFAULT_BATCH_S;
+    // Lo reservado antes del reinicio pudo haberse usado: se arranca desde el tope
+    _next_seq = _seq_limit;
+}
+
+uint32_t Uplink::take_seq() {
+    if (_next_seq >= _seq_limit) {
+        _seq_limit = _next_seq + SEQ_RESERVE;
+        nvs_handle_t handle;
+        if (nvs_open("uplink", NVS_READWRITE, &handle) == ESP_OK) {
+            nvs_set_u32(handle, "seq", _seq_limit);
+            nvs_commit(handle);
+            nvs_close(handle);
+        }
+    }
+    return _next_seq++;
+}
+
+bool Uplink::set_url(const char* url) {
+    if (!url || strlen(url) >= sizeof(_url)) return false;
+    if (url[0] && strncmp(url, "http://", 7) != 0 && strncmp(url, "https://", 8) != 0) return false;
+    nvs_handle_t handle;
+    if (nvs_open("uplink", NVS_READWRITE, &handle) != ESP_OK) return false;
+    nvs_set_str(handle, "url", url);
+    nvs_commit(handle);
+    nvs_close(handle);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    strncpy(_url, url, sizeof(_url) - 1);
+    _url[sizeof(_url) - 1] = 0;
+    _url_changed = true; // uplink_task cierra la conexión vieja entre envíos
+    return true;
+}
+
+bool Uplink::set_periods(uint16_t tele_s, uint16_t batch_s) {
+    if (tele_s < 5 || batch_s < tele_s) return false;
+    nvs_handle_t handle;
+    if (nvs_open("uplink", NVS_READWRITE, &handle) != ESP_OK) return false;
+    nvs_set_u16(handle, "tele_s", tele_s);
+    nvs_set_u16(handle, "batch_s", batch_s);
+    nvs_commit(handle);
+    nvs_close(handle);
+    _tele_s = tele_s;
+    _batch_s = batch_s;
+    return true;
+}
+
+void Uplink::flush_now() {
+    _flush_req = true;
+}
+
+// --- LOTES ---
+
+void Uplink::open_batch(Batch& b) {
+    BatchHeader hdr = {};
+    hdr.magic[0] = 'V';
+    hdr.magic[1] = 'U';
+    hdr.version = 1;
+    hdr.t0 = now_epoch();
+    memcpy(hdr.mac, _mac, sizeof(hdr.mac));
+    memcpy(b.data, &hdr, sizeof(hdr));
+    b.len = sizeof(hdr);
+    b.seq = 0;
+    b.opened_us = esp_timer_get_time();
+    memset(b.prev, 0, sizeof(b.prev));
+}
+
+// Con _mutex tomado: deja lugar en _cur para una fila de len bytes
+bool Uplink::reserve(size_t len) {
+    if (_cur.len == 0) open_batch(_cur);
+    if (_cur.len + ROW_HEAD_MAX + len <= BATCH_MAX) return true;
+    // Lote lleno: se cierra si el anterior ya salió; si no, la fila se pierde
+    if (!seal()) {
+        _stats.dropped_rows++;
+        return false;
+    }
+    open_batch(_cur);
+    return true;
+}
+
+// Con _mutex tomado y reserve() hecho
+void Uplink::push_row(RowType type, const uint8_t* payload, size_t len) {
+    uint8_t* p = _cur.data + _cur.len;
+    size_t n = 0;
+    p[n++] = type;
+    n += put_varint(p + n, (uint32_t)((esp_timer_get_time() - _cur.opened_us) / 1000000));
+    memcpy(p + n, payload, len);
+    _cur.len += n + len;
+    ((BatchHeader*)_cur.data)->rows++;
+}
+
+void Uplink::on_event(RectEvent evento, std::string_view valor, std::string_view nota) {
+    if (!_url[0]) return;
+    uint8_t buf[4 + 48 + 4 + 112];
+    size_t n = put_varint(buf, static_cast<uint16_t>(evento));
+    size_t vlen = std::min(valor.size(), (size_t)48);
+    size_t nlen = std::min(nota.size(), (size_t)112);
+    n += put_varint(buf + n, (uint32_t)vlen);
+    memcpy(buf + n, valor.data(), vlen);
+    n += vlen;
+    n += put_varint(buf + n, (uint32_t)nlen);
+    memcpy(buf + n, nota.data(), nlen);
+    n += nlen;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (reserve(n)) push_row(ROW_EVENT, buf, n);
+}
+
+void Uplink::add_telemetry() {
+    MeterSnapshot s;
+    Metering::snapshot(s);
+    int32_t v[TELE_FIELDS];
+    uint32_t mask = 0;
+    for (int i = 0; i < 4; i++) {
+        v[i] = s.ma[i];
+        v[4 + i] = (int32_t)s.session_mwh[i];
+        if (ChargeControl::get(i).conducting) mask |= 1u << i;
+    }
+    v[8] = (int32_t)s.lifetime_mwh;   // Los deltas de 32 bits cubren el desborde
+    v[9] = (int32_t)mask;
+    v[10] = (int32_t)(esp_get_free_heap_size() / 1024);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    uint8_t buf[TELE_FIELDS * 5];
+    if (!reserve(sizeof(buf))) return;
+    // Deltas contra la fila anterior del mismo lote (un lote nuevo parte de cero)
+    size_t n = 0;
+    for (int i = 0; i < TELE_FIELDS; i++) n += put_varint(buf + n, zz_enc((int32_t)((uint32_t)v[i] - (uint32_t)_cur.prev[i])));
+    push_row(ROW_TELEMETRY, buf, n);
+    memcpy(_cur.prev, v, sizeof(v));
+}
+
+// Con _mutex tomado: pasa _cur a _ready si está libre
+bool Uplink::seal() {
+    if (_ready.len) return false;
+    if (_cur.len <= sizeof(BatchHeader)) {
+        _cur.len = 0;
+        return true;
+    }
+    _cur.seq = take_seq();
+    ((BatchHeader*)_cur.data)->seq = _cur.seq;
+    memcpy(&_ready, &_cur, sizeof(Batch));
+    _cur.len = 0;
+    return true;
+}
+
+void Uplink::release_ready() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _ready.len = 0;
+}
+
+// --- TRANSPORTE ---
+
+void Uplink::drop_client() {
+    if (_client) {
+        esp_http_client_cleanup((esp_http_client_handle_t)_client);
+        _client = nullptr;
+    }
+}
+
+bool Uplink::post(const uint8_t* data, size_t len, uint32_t seq) {
+    if (!_client) {
+        esp_http_client_config_t config = {};
+        config.url = _url;
+        config.method = HTTP_METHOD_POST;
+        config.user_agent = "ESP32-S3-Rectificador-v1";
+        if (strncmp(_url, "https", 5) == 0) config.crt_bundle_attach = esp_crt_bundle_attach;
+        config.timeout_ms = 10000;
+        config.keep_alive_enable = true; // Una conexión (y un handshake TLS) para todo el reenvío
+        _client = esp_http_client_init(&config);
+        if (!_client) return false;
+    }
+    esp_http_client_handle_t client = (esp_http_client_handle_t)_client;
+
+    char mac[13], seq_str[12];
+    snprintf(mac, sizeof(mac), "%02x%02x%02x%02x%02x%02x", _mac[0], _mac[1], _mac[2], _mac[3], _mac[4], _mac[5]);
+    snprintf(seq_str, sizeof(seq_str), "%u", (unsigned)seq);
+    esp_http_client_set_header(client, "Content-Type", "application/octet-stream");
+    esp_http_client_set_header(client, "X-Device", mac);
+    esp_http_client_set_header(client, "X-Seq", seq_str);
+    esp_http_client_set_post_field(client, (const char*)data, (int)len);
+
+    esp_err_t err = esp_http_client_perform(client);
+    _stats.last_status = err == ESP_OK ? esp_http_client_get_status_code(client) : -1;
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Lote %u: %s", (unsigned)seq, esp_err_to_name(err));
+        drop_client();
+        return false;
+    }
+    int st = _stats.last_status;
+    if (st >= 400 && st < 500 && st != 408 && st != 429) {
+        // El colector lo rechaza por contenido: reintentarlo trabaría toda la cola
+        ESP_LOGE(TAG, "Lote %u rechazado (HTTP %d), se descarta", (unsigned)seq, st);
+        _stats.dropped_batches++;
+        return true;
+    }
+    if (st < 200 || st >= 300) {
+        ESP_LOGW(TAG, "Lote %u: HTTP %d", (unsigned)seq, st);
+        return false;
+    }
+    _stats.bytes_sent += len;
+    _stats.last_ok_us = esp_timer_get_time();
+    _backoff_s = 0;
+    return true;
+}
+
+void Uplink::on_failure() {
+    _stats.failures++;
+    _backoff_s = _backoff_s ? std::min<uint32_t>(_backoff_s * 2, 300) : 5;
+    _retry_at_us = esp_timer_get_time() + (int64_t)_backoff_s * 1000000;
+}
+
+// --- SPOOL EN SD ---
+// uplink.q: [SpoolHeader][lote] en orden; uplink.pos guarda hasta dónde se envió.
+
+void Uplink::spool_load() {
+    FILE* f = fopen(_spool.c_str(), "rb");
+    if (f) {
+        fseek(f, 0, SEEK_END);
+        _spool_size = ftell(f);
+        fclose(f);
+    }
+    f = fopen(_spool_pos.c_str(), "rb");
+    if (f) {
+        uint32_t pos[2] = {};
+        if (fread(pos, sizeof(pos), 1, f) == 1 && pos[0] == POS_MAGIC && (long)pos[1] <= _spool_size) {
+            _read_off = (long)pos[1];
+        }
+        fclose(f);
+    }
+    if (_spool_size > _read_off) {
+        ESP_LOGI(TAG, "Spool con %ld bytes pendientes", _spool_size - _read_off);
+    }
+}
+
+void Uplink::spool_save_pos() {
+    if (_read_off >= _spool_size) {
+        // Todo enviado: se descarta el archivo para que no crezca
+        remove(_spool.c_str());
+        remove(_spool_pos.c_str());
+        _spool_size = 0;
+        _read_off = 0;
+        return;
+    }
+    FILE* f = fopen(_spool_pos.c_str(), "wb");
+    if (!f) return;
+    uint32_t pos[2] = {POS_MAGIC, (uint32_t)_read_off};
+    fwrite(pos, sizeof(pos), 1, f);
+    fclose(f);
+}
+
+bool Uplink::spool_append(const Batch& b) {
+    if (_spool.empty() || _spool_size + (long)(sizeof(SpoolHeader) + b.len) > SPOOL_MAX) return false;
+    FILE* f = fopen(_spool.c_str(), "ab");
+    if (!f) return false;
+    SpoolHeader hdr = {SPOOL_MAGIC, b.seq, (uint32_t)b.len, esp_rom_crc32_le(0, b.data, b.len)};
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 && fwrite(b.data, 1, b.len, f) == b.len;
+    fflush(f);
+    fsync(fileno(f));
+    fclose(f);
+    if (ok) {
+        _spool_size += sizeof(hdr) + b.len;
+        _stats.spooled++;
+    }
+    return ok;
+}
+
+bool Uplink::spool_replay_one() {
+    FILE* f = fopen(_spool.c_str(), "rb");
+    if (!f) {
+        _spool_size = _read_off = 0;
+        return false;
+    }
+    static uint8_t s_buf[BATCH_MAX]; // Solo la usa uplink_task
+    SpoolHeader hdr;
+    bool valid = fseek(f, _read_off, SEEK_SET) == 0 && fread(&hdr, sizeof(hdr), 1, f) == 1 &&
+                 hdr.magic == SPOOL_MAGIC && hdr.len <= BATCH_MAX && fread(s_buf, 1, hdr.len, f) == hdr.len &&
+                 esp_rom_crc32_le(0, s_buf, hdr.len) == hdr.crc;
+    fclose(f);
+
+    if (!valid) {
+        // Cola cortada por un corte de energía durante la escritura: se descarta lo que sigue
+        ESP_LOGW(TAG, "Spool corrupto en %ld; se descartan %ld bytes", _read_off, _spool_size - _read_off);
+        _stats.dropped_batches++;
+        _read_off = _spool_size;
+        spool_save_pos();
+        return false;
+    }
+    if (!post(s_buf, hdr.len, hdr.seq)) return false;
+    _read_off += sizeof(hdr) + hdr.len;
+    _stats.replayed++;
+    spool_save_pos();
+    return true;
+}
+
+// --- TAREA ---
+
+void Uplink::uplink_task(void* pv) {
+    int64_t next_tele_us = esp_timer_get_time();
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(1000));
+        if (_url_changed) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _url_changed = false;
+            drop_client(); // La próxima petición abre la conexión hacia la URL nueva
+            _backoff_s = 0;
+            _retry_at_us = 0;
+        }
+        if (!_url[0]) continue;
+        int64_t now = esp_timer_get_time();
+
+        if (now >= next_tele_us) {
+            add_telemetry();
+            next_tele_us = now + (int64_t)_tele_s * 1000000;
+        }
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            bool due = _cur.len && (now - _cur.opened_us) >= (int64_t)_batch_s * 1000000;
+            if (due || _flush_req) {
+                if (seal()) _flush_req = false;
+            }
+        }
+
+        bool online = WifiManager::is_connected() && now >= _retry_at_us;
+
+        // Lote nuevo: directo si no hay atrasos; si no, a la cola para respetar el orden
+        if (_ready.len) {
+            bool backlog = _spool_size > _read_off;
+            if (!backlog && online) {
+                if (post(_ready.data, _ready.len, _ready.seq)) {
+                    _stats.sent++;
+                    release_ready();
+                } else {
+                    on_failure();
+                    online = false;
+                }
+            }
+            if (_ready.len && !_spool.empty()) {
+                if (!spool_append(_ready)) {
+                    _stats.dropped_batches++;
+                    ESP_LOGW(TAG, "Spool lleno: lote %u descartado", (unsigned)_ready.seq);
+                }
+                release_ready();
+            }
+            // Sin SD el lote queda en RAM y se reintenta (los eventos nuevos esperan en _cur)
+        }
+
+        // Reenvío en orden, de a uno y con un tope por ciclo para no acaparar la red
+        for (int i = 0; online && i < REPLAY_PER_CYCLE && _spool_size > _read_off; i++) {
+            if (!spool_replay_one()) {
+                if (_spool_size > _read_off) on_failure();
+                break;
+            }
+            vTaskDelay(pdMS_TO_TICKS(50));
+        }
+    }
+}
+
+bool Uplink::start(const char* spool_dir) {
+    static bool s_started = false;
+    if (s_started) return true;
+    s_started = true;
+
+    esp_read_mac(_mac, ESP_MAC_WIFI_STA);
+    load_config();
+    if (spool_dir) {
+        _spool = std::string(spool_dir) + "/uplink.q";
+        _spool_pos = std::string(spool_dir) + "/uplink.pos";
+        spool_load();
+    }
+    g_logger.set_tap(on_event);
+    TaskPlan::create(TaskPlan::UPLINK, uplink_task, NULL);
+    ESP_LOGI(TAG, "Uplink %s (telemetría %u s, lote %u s, spool %s)", _url[0] ? _url : "apagado",
+             (unsigned)_tele_s, (unsigned)_batch_s, _spool.empty() ? "no" : "SD");
+    return true;
+}
+
+// --- ESTADO ---
+
+std::string Uplink::status() {
+    char buf[320];
+    int64_t now = esp_timer_get_time();
+    snprintf(buf, sizeof(buf),
+             "URL: %s\nTelemetría %u s | lote %u s | próximo lote %u\n"
+             "Enviados %u (+%u reenviados) | %llu bytes | fallos %u | último HTTP %d | último OK hace %lld s\n"
+             "Spool: %ld bytes pendientes | encolados %u | descartados %u lotes, %u filas\n",
+             _url[0] ? _url : "(apagado)", (unsigned)_tele_s, (unsigned)_batch_s, (unsigned)_next_seq,
+             (unsigned)_stats.sent, (unsigned)_stats.replayed, (unsigned long long)_stats.bytes_sent,
+             (unsigned)_stats.failures, _stats.last_status,
+             _stats.last_ok_us ? (long long)((now - _stats.last_ok_us) / 1000000) : -1LL,
+             _spool_size - _read_off, (unsigned)_stats.spooled, (unsigned)_stats.dropped_batches,
+             (unsigned)_stats.dropped_rows);
+    return buf;
+}
+
+void Uplink::metrics(TextBuffer& out) {
+    out.appendf("uplink_batches_sent %u\nuplink_batches_replayed %u\nuplink_bytes_sent %llu\nuplink_failures %u\n",
+                (unsigned)_stats.sent, (unsigned)_stats.replayed, (unsigned long long)_stats.bytes_sent,
+                (unsigned)_stats.failures);
+    out.appendf("uplink_spool_pending_bytes %ld\nuplink_dropped_batches %u\nuplink_dropped_rows %u\n",
+                _spool_size - _read_off, (unsigned)_stats.dropped_batches, (unsigned)_stats.dropped_rows);
+}
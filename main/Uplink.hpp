@@ -0,0 +1,126 @@
+#pragma once
+#include "LoggerFS.hpp"
+#include "TextBuffer.hpp"
+#include <string>
+#include <string_view>
+#include <mutex>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Envío de eventos y telemetría a un colector central (HTTP POST).
+ *
+ * Los eventos del log (vía LoggerFS::set_tap) y una instantánea periódica de
+ * medición se acumulan en lotes binarios de hasta BATCH_MAX bytes:
+ *   - cabecera con id del equipo (MAC), número de lote y hora de apertura
+ *   - filas con tipo, segundos desde la apertura (varint) y carga útil
+ *   - telemetría como deltas zigzag contra la fila anterior: con el equipo
+ *     quieto cada instantánea ocupa ~14 bytes
+ *
+ * Sin red (o si el colector falla) los lotes van a un spool en la SD y se
+ * reenvían en orden, de a uno, con espera exponencial entre fallos. El
+ * número de lote es monótono entre reinicios; el colector descarta
+ * duplicados por (equipo, lote).
+ *
+ * Configuración en NVS "uplink": url (vacía = apagado), periodos de
+ * telemetría y de lote.
+ */
+class Uplink {
+public:
+    static constexpr size_t BATCH_MAX = 1536;
+    static constexpr long SPOOL_MAX = 8L * 1024 * 1024;     // Varias semanas de telemetría
+    static constexpr uint16_t DEFAULT_TELE_S = 60;
+    static constexpr uint16_t DEFAULT_BATCH_S = 300;
+
+    static bool start(const char* spool_dir);   // nullptr sin SD: solo reintento en RAM
+    static void on_event(RectEvent evento, std::string_view valor, std::string_view nota);
+
+    static bool set_url(const char* url);       // "" apaga el envío
+    static bool set_periods(uint16_t tele_s, uint16_t batch_s);
+    static void flush_now();                    // Cierra el lote actual en el próximo ciclo
+
+    static std::string status();                // Comando "uplink"
+    static void metrics(TextBuffer& out);
+
+private:
+    enum RowType : uint8_t { ROW_TELEMETRY = 1, ROW_EVENT = 2 };
+    static constexpr int TELE_FIELDS = 11;      // mA x4, mWh de sesión x4, mWh total, puntos conduciendo, heap KB
+    static constexpr uint32_t SEQ_RESERVE = 64; // Números de lote reservados por escritura en NVS
+    static constexpr int REPLAY_PER_CYCLE = 16;
+    static constexpr size_t ROW_HEAD_MAX = 6;   // Tipo + varint de segundos
+
+    struct __attribute__((packed)) BatchHeader {
+        uint8_t magic[2];       // 'V','U'
+        uint8_t version;
+        uint8_t flags;
+        uint32_t seq;
+        uint32_t t0;            // Epoch de apertura (0 sin hora)
+        uint8_t mac[6];
+        uint16_t rows;
+    };
+    static_assert(sizeof(BatchHeader) == 20, "Cabecera de lote de 20 bytes");
+
+    struct __attribute__((packed)) SpoolHeader {
+        uint32_t magic;
+        uint32_t seq;
+        uint32_t len;
+        uint32_t crc;           // CRC32 del lote
+    };
+
+    struct Batch {
+        uint8_t data[BATCH_MAX];
+        size_t len;             // 0 = vacío
+        uint32_t seq;
+        int64_t opened_us;
+        int32_t prev[TELE_FIELDS];
+    };
+
+    struct Stats {
+        uint32_t sent;
+        uint32_t spooled;
+        uint32_t replayed;
+        uint32_t failures;
+        uint32_t dropped_rows;  // Lote lleno con el anterior aún sin salir
+        uint32_t dropped_batches; // Spool lleno o sin SD
+        uint64_t bytes_sent;
+        int64_t last_ok_us;
+        int last_status;
+    };
+
+    static std::mutex _mutex;           // _cur, _ready y la configuración
+    static Batch _cur;
+    static Batch _ready;
+    static Stats _stats;
+    static char _url[128];
+    static uint16_t _tele_s;
+    static uint16_t _batch_s;
+    static bool _flush_req;
+    static volatile bool _url_changed;
+    static uint8_t _mac[6];
+    static uint32_t _next_seq;
+    static uint32_t _seq_limit;
+    static std::string _spool;          // Vacío sin SD
+    static std::string _spool_pos;
+    static long _spool_size;
+    static long _read_off;
+    static uint32_t _backoff_s;
+    static int64_t _retry_at_us;
+    static void* _client;               // esp_http_client_handle_t reutilizado (keep-alive)
+
+    static void load_config();
+    static uint32_t take_seq();
+    static void open_batch(Batch& b);
+    static bool reserve(size_t len);
+    static void push_row(RowType type, const uint8_t* payload, size_t len);
+    static void add_telemetry();
+    static bool seal();
+    static void release_ready();
+    static bool post(const uint8_t* data, size_t len, uint32_t seq);
+    static void drop_client();
+    static bool spool_append(const Batch& b);
+    static bool spool_replay_one();
+    static void spool_save_pos();
+    static void spool_load();
+    static void on_failure();
+    static void uplink_task(void* pv);
+};
@@ -139,6 +139,38 @@ bool ADS1115::readContinuous(int16_t& raw){
     return readConversion(raw);
 }
 
+bool ADS1115::readAndStart(Mux next_mux, PGA pga, DataRate dr, int16_t& raw){
+    Lock L(mtx_);
+    uint16_t cfg = makeConfig(next_mux,pga,dr,Mode::SINGLE_SHOT,true);
+    uint8_t wr[3] = { REG_CONFIG, (uint8_t)(cfg>>8), (uint8_t)(cfg&0xFF) };
+    uint8_t d[2] = {0,0};
+    i2c_cmd_handle_t c = i2c_cmd_link_create();
+    // Puntero a conversión + lectura
+    i2c_master_start(c);
+    i2c_master_write_byte(c, (addr_<<1)|I2C_MASTER_WRITE, true);
+    i2c_master_write_byte(c, REG_CONVERSION, true);
+    i2c_master_start(c);
+    i2c_master_write_byte(c, (addr_<<1)|I2C_MASTER_READ, true);
+    i2c_master_read(c, d, 2, I2C_MASTER_LAST_NACK);
+    // Repeated start: config del próximo canal con OS=1
+    i2c_master_start(c);
+    i2c_master_write_byte(c, (addr_<<1)|I2C_MASTER_WRITE, true);
+    i2c_master_write(c, wr, 3, true);
+    i2c_master_stop(c);
+    esp_err_t ret = i2c_master_cmd_begin(port_, c, pdMS_TO_TICKS(10));
+    i2c_cmd_link_delete(c);
+    if(ret != ESP_OK) return false;
+    raw = int16_t((d[0]<<8) | d[1]);
+    return true;
+}
+
+bool ADS1115::conversionReady(bool& ready){
+    uint16_t cfg=0;
+    if(!readConfig(cfg)) return false;
+    ready = (cfg & 0x8000) != 0;
+    return true;
+}
+
 bool ADS1115::stopContinuous(){
     // Pasar a single-shot sin iniciar conversión
     uint16_t cfg = makeConfig(Mux::AIN0_GND, PGA::FS_6V144, DataRate::SPS_128, Mode::SINGLE_SHOT, false);
@@ -37,6 +37,13 @@ public:
     bool readContinuous(int16_t& raw);                                            // lee último valor
     bool stopContinuous();                                                        // cambia a single-shot inerte
 
+    // Modo encadenado: en UNA transacción I2C lee la conversión anterior y
+    // dispara la siguiente (single-shot) en otro canal. Sin polling de OS:
+    // quien llama garantiza que pasó el tiempo de conversión.
+    bool readAndStart(Mux next_mux, PGA pga, DataRate dr, int16_t& raw);
+    // Bit OS del registro de config: ready=true si no hay conversión en curso
+    bool conversionReady(bool& ready);
+
     // Conversión helper
     static float lsb_uV(PGA pga);     // tamaño de LSB en microvoltios
     static float fsr_mV(PGA pga);     // FSR en mV
@@ -5,15 +5,26 @@
 #include "freertos/semphr.h"
 #include "esp_log.h"
 #include "esp_timer.h"
+#include "nvs_flash.h"
 
 // Librerías del Proyecto
 #include "ads1115.hpp"
 #include "mcp23017.hpp"
 #include "wifiManager.hpp"
 #include "PortalWeb.hpp"
+#include "Uplink.hpp"
 #include "LoggerFS.hpp"
-#include "CommandManager.hpp"
+#include "CommandGateway.hpp"
 #include "GitHubClient.hpp"
+#include "OtaPipeline.hpp"
+#include "BootSequencer.hpp"
+#include "ChargeControl.hpp"
+#include "Metering.hpp"
+#include "Protection.hpp"
+#include "TimeSeries.hpp"
+#include "Supervisor.hpp"
+#include "TaskConfig.hpp"
+#include "esp_task_wdt.h"
 
 static const char* TAG = "MOTO_CHARGER_MAIN";
 
@@ -33,7 +44,6 @@ LoggerFS g_logger("/sd"); //
 float g_corriente_actual = 0.0f;
 int g_potenciometro_mv = 0;
 volatile bool g_scr_enabled = false;
-volatile bool g_is_wifi_scanning = false; // Bloquea I2C durante escaneo
 
 // --- CONFIGURACIÓN DE PINES (MCP23017 Relays) ---
 #define RELAY_CH1 0
@@ -42,51 +52,31 @@ volatile bool g_is_wifi_scanning = false; // Bloquea I2C durante escaneo
 #define RELAY_CH4 3
 
 
-struct ChargePoint {
-    int relay_pin;
-    uint32_t seconds_left;
-    bool active;
-};
-
-// Estado de los 4 puntos de carga para motos
-ChargePoint moto_points[4] = {
-    {0, 0, false}, // Relay CH1
-    {1, 0, false}, // Relay CH2
-    {2, 0, false}, // Relay CH3
-    {3, 0, false}  // Relay CH4
-};
 /**
  * @brief Tarea de Control de Carga y Temporizadores
  */
 void task_charging_control(void* pvParameters) {
+    TickType_t last_wake = xTaskGetTickCount();
+    esp_task_wdt_add(NULL);
+    Supervisor::watch(Supervisor::Watch::CHARGE, 5000, 30000);
     while (1) {
-        for (int i = 0; i < 4; i++) {
-            if (moto_points[i].active) {
-                if (moto_points[i].seconds_left > 0) {
-                    moto_points[i].seconds_left--;
-                    
-                    // Cada 60 segundos registrar en el log
-                    if (moto_points[i].seconds_left % 60 == 0) {
-                        g_logger.registrarEstructurado(RectEvent::PROCESS_START, 
-                            "CH" + std::to_string(i+1), 
-                            "Tiempo restante: " + std::to_string(moto_points[i].seconds_left/60) + " min");
-                    }
-                } else {
-                    // Tiempo agotado: Apagar relay
-                    moto_points[i].active = false;
-                    g_mcp_1->digital_write(moto_points[i].relay_pin, false); // Apagar
-                    g_logger.registrarEstructurado(RectEvent::PROCESS_STOP, "CH" + std::to_string(i+1), "Carga finalizada");
-                }
-            }
-        }
-        vTaskDelay(pdMS_TO_TICKS(1000)); // Tick de 1 segundo
+        Supervisor::busy(Supervisor::Watch::CHARGE, "tick");
+        ChargeControl::tick();
+        Supervisor::busy(Supervisor::Watch::CHARGE, nullptr);
+        Supervisor::checkin(Supervisor::Watch::CHARGE);
+        esp_task_wdt_reset();
+        // Periodo fijo de 1 s (sin arrastrar la duración del tick); el desvío va a /metrics
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(1000));
     }
 }
 
+// --- ETAPAS DE ARRANQUE (ver BootSequencer) ---
+static bool s_sd_ok = false;
+
 /**
- * @brief Inicialización de Buses y Dispositivos
+ * @brief Bus I2C y dispositivos (ADS1115 + ambos MCP23017)
  */
-void setup_hardware() {
+static void stage_i2c() {
     g_i2c_mutex = xSemaphoreCreateMutex();
 
     // Configuración I2C Master
@@ -103,64 +93,107 @@ void setup_hardware() {
 
     // Inicializar ADS1115
     g_ads = new ADS1115(I2C_NUM_0, 0x48, g_i2c_mutex);
-    
-    // Inicializar MCP23017 para Relays
-    g_mcp_1 = new MCP23017(I2C_NUM_0, 0x20);
-    if (g_mcp_1->begin()) {
-        for(int i=0; i<4; i++) g_mcp_1->pin_mode(i, 0); // Salidas
-    }
 
-    // Inicializar MCP23017 para SD (CS/CD)
+    // MCP23017 para Relays y para SD (CS/CD)
+    g_mcp_1 = new MCP23017(I2C_NUM_0, 0x20);
     g_mcp_2 = new MCP23017(I2C_NUM_0, 0x25);
-    g_mcp_2->begin();
-
-    // Montar Tarjeta SD y Logger
-    if (g_logger.begin()) {
-        g_logger.registrarEstructurado(RectEvent::BOOT, "v1.0.0", "Sistema Iniciado");
-    }
 }
 
-void task_serial_reader(void* pvParameters) {
-    char incoming_data[128];
-    while (1) {
-        // Leer desde el monitor serial (stdin)
-        if (fgets(incoming_data, sizeof(incoming_data), stdin)) {
-            std::string command(incoming_data);
-            // Procesar el comando (ej: "start.ch1")
-            std::string response = CommandManager::execute(command);
-            printf("Respuesta: %s\n", response.c_str());
+/**
+ * @brief Relés en estado seguro y control de carga: lo primero en quedar operativo
+ */
+static void stage_relays() {
+    if (g_mcp_1->begin()) {
+        for(int i=0; i<4; i++) {
+            g_mcp_1->digital_write(i, false); // Apagado antes de pasar a salida
+            g_mcp_1->pin_mode(i, 0);          // Salidas
         }
-        vTaskDelay(pdMS_TO_TICKS(100));
     }
+    // Reanuda las sesiones pagadas que un corte o un reset dejaron abiertas
+    ChargeControl::begin();
+    TaskPlan::create(TaskPlan::CHARGE, task_charging_control, NULL);
 }
 
-extern "C" void app_main(void) {
-    ESP_LOGI(TAG, "Iniciando Cargador de Motas VoltaEnergy...");
+/**
+ * @brief Montar Tarjeta SD y Logger (el CS pasa por el MCP de 0x25)
+ */
+static void stage_sd() {
+    g_mcp_2->begin();
+    s_sd_ok = g_logger.begin();
+    if (s_sd_ok) TimeSeries::start("/sd");
+}
 
-    // 1. Hardware y Almacenamiento
-    setup_hardware();
+/**
+ * @brief Protección y medición de energía (ADS1115)
+ */
+static void stage_meter() {
+    Protection::start();
+    Metering::start();
+}
 
-    // 2. Conectividad WiFi
+static void stage_wifi() {
     WifiManager::init();
 
-    WifiManager::connect_saved();
-
-    // Espera activa para verificar conexión real
-    ESP_LOGI(TAG, "Esperando conexión WiFi...");
-    vTaskDelay(pdMS_TO_TICKS(10000)); // Aumentamos a 10s para dar margen a los reintentos
-
-    if (!WifiManager::is_connected()) { 
-        ESP_LOGW(TAG, "Fallo de conexión detectado. Iniciando Modo AP...");
+    // Sin espera fija: la reconexión (y el AP de respaldo) avanzan por eventos
+    if (!WifiManager::connect_saved()) {
+        ESP_LOGW(TAG, "Sin credenciales guardadas. Iniciando Modo AP...");
         WifiManager::start_ap();
-    } else {
-        ESP_LOGI(TAG, "Conexión confirmada. IP: %s", WifiManager::get_ip().c_str());
     }
-    // 3. Servidor Web y Portal
+}
+
+static void stage_portal() {
     PortalWeb* portal = new PortalWeb();
     portal->start();
+}
 
-    // 4. Tareas de Sistema
-    xTaskCreatePinnedToCore(task_charging_control, "charge_task", 4096, NULL, 5, NULL, 1);
+static void stage_services() {
+    CommandGateway::start(); // UART + WS + POST /api/cmd
+    GitHubClient::start_release_cache(); // /list-releases responde desde caché
+    OtaPipeline::resume_pending();       // Continúa una OTA cortada por un reinicio
+}
+
+/**
+ * @brief NVS antes de cualquier etapa: relés (tope del sitio), SD (secuencia del log),
+ * WiFi y medición lo leen desde tareas paralelas.
+ */
+static void init_nvs() {
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(ret);
+}
+
+extern "C" void app_main(void) {
+    ESP_LOGI(TAG, "Iniciando Cargador de Motas VoltaEnergy...");
+    init_nvs();
+    g_logger.start_deferred(); // El control de carga registra por cola desde el core 1
+
+    // Grafo de arranque: SD y WiFi avanzan en paralelo; los relés quedan
+    // en estado seguro y el control de carga corre apenas hay bus I2C.
+    // La protección tampoco espera al WiFi: solo necesita el bus.
+    static const BootStage stages[] = {
+        /* 0 */ { "i2c",      stage_i2c,      0,                6 },
+        /* 1 */ { "relays",   stage_relays,   BOOT_STAGE(0),    6 },
+        /* 2 */ { "sd",       stage_sd,       BOOT_STAGE(0),    3 },
+        /* 3 */ { "wifi",     stage_wifi,     0,                4 },
+        /* 4 */ { "portal",   stage_portal,   BOOT_STAGE(3),    3 },
+        /* 5 */ { "services", stage_services, BOOT_STAGE(3),    3 },
+        /* 6 */ { "meter",    stage_meter,    BOOT_STAGE(0),    5 },
+    };
+    bool boot_ok = BootSequencer::run(stages, sizeof(stages) / sizeof(stages[0]), pdMS_TO_TICKS(30000));
+    Uplink::start(s_sd_ok ? "/sd" : nullptr); // Antes del evento de arranque para que también suba
+    Supervisor::start();
+
+    // BOOT / BOOT_WDT / BOOT_SOFT según la causa del reinicio
+    char reason[64];
+    RectEvent boot_ev = Supervisor::boot_event(reason, sizeof(reason));
+    ESP_LOGI(TAG, "Causa del arranque: %s", reason);
+    // Sin SD el evento igual llega al colector (el logger descarta solo la escritura)
+    g_logger.registrarf(boot_ok ? boot_ev : RectEvent::ERR_SYSTEM, GitHubClient::get_current_version(),
+                        "Sistema Iniciado en %u ms (%s) | %s", (unsigned)BootSequencer::total_ms(),
+                        BootSequencer::summary().c_str(), reason);
 
     ESP_LOGI(TAG, "Sistema listo. Versión: %s", GitHubClient::get_current_version().c_str());
 }
\ No newline at end of file
@@ -7,6 +7,8 @@ MCP23017::MCP23017(i2c_port_t port, uint8_t addr)
 }
 
 MCP23017::~MCP23017() {
+    if (m_trip_cmd) i2c_cmd_link_delete_static(m_trip_cmd);
+    if (m_out_mtx) vSemaphoreDelete(m_out_mtx);
 }
 
 bool MCP23017::begin() {
@@ -18,6 +20,19 @@ bool MCP23017::begin() {
     iocon_value &= ~(1 << 6); // MIRROR = 0 (INTA/INTB separados)
     
     if (!write_register(IOCONA, iocon_value)) return false;
+
+    // Estado inicial de los latches de salida
+    read_register(OLATA, m_olat[0]);
+    read_register(OLATB, m_olat[1]);
+    if (!m_out_mtx) m_out_mtx = xSemaphoreCreateMutex();
+
+    if (!m_trip_cmd) {
+        m_trip_cmd = i2c_cmd_link_create_static(m_trip_link, sizeof(m_trip_link));
+        i2c_master_start(m_trip_cmd);
+        i2c_master_write_byte(m_trip_cmd, (m_addr << 1) | I2C_MASTER_WRITE, true);
+        i2c_master_write(m_trip_cmd, m_trip_data, sizeof(m_trip_data), true); // Se lee m_trip_data al ejecutar
+        i2c_master_stop(m_trip_cmd);
+    }
     
     ESP_LOGI(TAG, "MCP23017 inicializado en addr 0x%02X", m_addr);
     return true;
@@ -93,20 +108,41 @@ bool MCP23017::pin_pullup(uint8_t pin, bool enable) {
     return write_register(reg, current);
 }
 
+bool MCP23017::write_latch(uint8_t port, uint8_t set_mask, uint8_t clear_mask) {
+    if (m_out_mtx) xSemaphoreTake(m_out_mtx, portMAX_DELAY);
+    uint8_t value = (uint8_t)((m_olat[port] | set_mask) & ~clear_mask & ~m_force_low[port]);
+    bool ok = write_register(port ? OLATB : OLATA, value);
+    if (ok) m_olat[port] = value;
+    if (m_out_mtx) xSemaphoreGive(m_out_mtx);
+    return ok;
+}
+
 bool MCP23017::digital_write(uint8_t pin, bool level) {
-    uint8_t reg = (pin < 8) ? GPIOA : GPIOB;
-    uint8_t bit = pin % 8;
-    
-    uint8_t current;
-    if (!read_register(reg, current)) return false;
-    
-    if (level) {
-        current |= (1 << bit);
-    } else {
-        current &= ~(1 << bit);
-    }
-    
-    return write_register(reg, current);
+    uint8_t port = (pin < 8) ? 0 : 1;
+    uint8_t bit = (uint8_t)(1 << (pin % 8));
+    return level ? write_latch(port, bit, 0) : write_latch(port, 0, bit);
+}
+
+bool MCP23017::trip_port_a(uint8_t mask) {
+    if (!m_trip_cmd) return write_latch(0, 0, mask);
+    if (m_out_mtx) xSemaphoreTake(m_out_mtx, portMAX_DELAY);
+    m_force_low[0] |= mask;
+    m_trip_data[1] = (uint8_t)(m_olat[0] & ~m_force_low[0]);
+    bool ok = i2c_master_cmd_begin(m_port, m_trip_cmd, pdMS_TO_TICKS(10)) == ESP_OK;
+    if (ok) m_olat[0] = m_trip_data[1];
+    if (m_out_mtx) xSemaphoreGive(m_out_mtx);
+    return ok;
+}
+
+void MCP23017::release_port_a(uint8_t mask) {
+    if (m_out_mtx) xSemaphoreTake(m_out_mtx, portMAX_DELAY);
+    m_force_low[0] &= ~mask;
+    if (m_out_mtx) xSemaphoreGive(m_out_mtx);
+}
+
+bool MCP23017::port_a_low(uint8_t mask) {
+    uint8_t olat;
+    return read_register(OLATA, olat) && (olat & mask) == 0;
 }
 
 bool MCP23017::digital_read(uint8_t pin, bool& level) {
@@ -120,11 +156,11 @@ bool MCP23017::digital_read(uint8_t pin, bool& level) {
 }
 
 bool MCP23017::write_port_a(uint8_t value) {
-    return write_register(GPIOA, value);
+    return write_latch(0, value, (uint8_t)~value);
 }
 
 bool MCP23017::write_port_b(uint8_t value) {
-    return write_register(GPIOB, value);
+    return write_latch(1, value, (uint8_t)~value);
 }
 
 bool MCP23017::read_port_a(uint8_t& value) {
@@ -1,6 +1,8 @@
 #pragma once
 #include "driver/i2c.h"
 #include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 
 class MCP23017 {
 private:
@@ -26,6 +28,18 @@ private:
     bool write_register(uint8_t reg, uint8_t value);
     bool read_register(uint8_t reg, uint8_t& value);
 
+    // Sombra de OLATA/OLATB: las escrituras no necesitan leer antes el puerto.
+    // El mutex cubre cálculo + escritura, así dos tareas no se pisan el latch.
+    uint8_t m_olat[2] = {0, 0};
+    uint8_t m_force_low[2] = {0, 0};  // Bits bloqueados en 0 (protección)
+    SemaphoreHandle_t m_out_mtx = nullptr;
+    bool write_latch(uint8_t port, uint8_t set_mask, uint8_t clear_mask);
+
+    // Escritura de disparo armada de antemano (sin malloc en el camino crítico)
+    uint8_t m_trip_data[2] = {OLATA, 0};
+    uint8_t m_trip_link[I2C_LINK_RECOMMENDED_SIZE(2)] = {};
+    i2c_cmd_handle_t m_trip_cmd = nullptr;
+
 public:
     MCP23017(i2c_port_t port, uint8_t addr = 0x20);
     ~MCP23017();
@@ -45,6 +59,13 @@ public:
     bool write_port_b(uint8_t value);
     bool read_port_a(uint8_t& value);
     bool read_port_b(uint8_t& value);
+
+    // Protección: fuerza a 0 los bits del puerto A con la transacción pre-armada
+    // y los mantiene así hasta release_port_a(), aunque otro los pida en 1.
+    bool trip_port_a(uint8_t mask);
+    void release_port_a(uint8_t mask);
+    // Lee OLATA del chip: true si todos los bits de mask quedaron en 0 (confirma el disparo)
+    bool port_a_low(uint8_t mask);
     
     // Utilidades
     bool test_connection();
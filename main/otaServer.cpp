@@ -1,7 +1,7 @@
-#include "ota_server.hpp"
+#include "otaServer.hpp"
+#include "OtaPipeline.hpp"
 
 static const char *TAG = "WEB_OTA";
-extern volatile bool g_scr_enabled; // Referencia a tu variable de main.cpp
 
 // HTML simple embebido en la Flash
 static const char* index_html = R"(
@@ -16,11 +16,18 @@ static const char* index_html = R"(
 <body><div class='card'>
     <h2>Actualización de Firmware</h2>
     <p>Seleccione el archivo .bin del proyecto compilado</p>
-    <form method='POST' action='/update' enctype='multipart/form-data'>
-        <input type='file' name='update' accept='.bin'><br><br>
-        <input type='submit' class='btn' value='Iniciar Actualización'>
-    </form>
-</div></body></html>
+    <input type='file' id='fw' accept='.bin'><br><br>
+    <button class='btn' onclick="up()">Iniciar Actualización</button>
+    <p id='st'></p>
+</div>
+<script>
+// Se envía el .bin crudo (sin multipart) para que se grabe tal cual
+function up(){
+    const f=document.getElementById('fw').files[0]; if(!f) return;
+    document.getElementById('st').innerText='Subiendo...';
+    fetch('/update',{method:'POST',body:f}).then(r=>r.text()).then(t=>document.getElementById('st').innerHTML=t);
+}
+</script></body></html>
 )";
 
 WebOtaServer::WebOtaServer() {}
@@ -48,44 +55,6 @@ esp_err_t WebOtaServer::index_get_handler(httpd_req_t *req) {
 }
 
 esp_err_t WebOtaServer::update_post_handler(httpd_req_t *req) {
-    if (g_scr_enabled) {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "ERROR: SCR ACTIVOS - Detenga el equipo.");
-        return ESP_FAIL;
-    }
-
-    // Buffer de 32KB -> Irá a PSRAM automáticamente
-    char *buf = (char *)malloc(32768); 
-    if (!buf) {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Sin memoria PSRAM disponible");
-        return ESP_FAIL;
-    }
-
-    esp_ota_handle_t update_handle = 0;
-    const esp_partition_t *update_partition = esp_ota_get_next_update_partition(NULL);
-    
-    ESP_LOGI(TAG, "Iniciando escritura en partición: %s", update_partition->label);
-    esp_ota_begin(update_partition, OTA_SIZE_UNKNOWN, &update_handle);
-
-    int remaining = req->content_len;
-    while (remaining > 0) {
-        int received = httpd_req_recv(req, buf, std::min(remaining, 32768));
-        if (received <= 0) {
-            free(buf);
-            esp_ota_abort(update_handle);
-            return ESP_FAIL;
-        }
-        esp_ota_write(update_handle, buf, received);
-        remaining -= received;
-    }
-
-    esp_ota_end(update_handle);
-    esp_ota_set_boot_partition(update_partition);
-    
-    ESP_LOGI(TAG, "OTA Completo. Reiniciando...");
-    httpd_resp_sendstr(req, "<html><body><h1>Exito. Reiniciando equipo...</h1></body></html>");
-    
-    free(buf);
-    vTaskDelay(pdMS_TO_TICKS(2000));
-    esp_restart();
-    return ESP_OK;
-}
\ No newline at end of file
+    // Recepción y grabación en paralelo con verificación SHA-256 (ver OtaPipeline)
+    return OtaPipeline::receive_upload(req);
+}
@@ -4,125 +4,345 @@
 #include "esp_log.h"
 #include "nvs_flash.h"
 #include <string.h>
+#include <mutex>
+#include <algorithm>
+#include "esp_timer.h"
+#include "esp_netif_sntp.h"
+#include "freertos/event_groups.h"
+#include "JsonWriter.hpp"
 
 
 static const char* TAG = "WIFI_MGR";
 static int s_retry_num = 0;
-#define MAX_RETRIES 5
+#define FALLBACK_AFTER_RETRIES 3     // Tras estos fallos se levanta el AP en paralelo
+#define BACKOFF_BASE_MS        500
+#define BACKOFF_MAX_MS         30000
 
 // Banderas de estado
 bool s_connected = false;
-bool s_must_fallback = false;
-// Cambia esto al principio de wifiManager.cpp
-extern volatile bool g_is_wifi_scanning;
+bool s_must_fallback = false;        // AP de respaldo activo (APSTA)
+static bool s_wifi_started = false;
+static bool s_fast_connect = false;  // Intento con BSSID/canal en caché
+static bool s_static_lease = false;  // IP fija tomada del lease en caché (DHCP detenido)
+static esp_timer_handle_t s_retry_timer = nullptr;
+static esp_netif_t* s_sta_netif = nullptr;
+
+// Estado del escaneo asíncrono
+static std::mutex s_scan_mutex;
+static std::vector<WifiManager::ScanEntry> s_scan_cache;
+static int64_t s_scan_time_us = 0;
+static uint32_t s_scan_id = 0;          // Último escaneo lanzado
+static uint32_t s_scan_done_id = 0;     // Último escaneo con resultados en caché
+static bool s_scan_running = false;
+static EventGroupHandle_t s_scan_events = nullptr;
+static WifiManager::ScanListener s_scan_listener = nullptr;
+#define SCAN_DONE_BIT BIT0
+#define SCAN_CACHE_TTL_US (30LL * 1000 * 1000)
+
+static void scan_done_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
+
+// --- CACHÉ DE RECONEXIÓN RÁPIDA (NVS "wifi_fast") ---
+// BSSID + canal evitan el escaneo completo; el lease permite IP estática opcional.
+struct FastConnectCache {
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint32_t ip, gw, mask;
+};
+
+static bool load_fast_cache(FastConnectCache& c) {
+    nvs_handle_t handle;
+    if (nvs_open("wifi_fast", NVS_READONLY, &handle) != ESP_OK) return false;
+    size_t len = sizeof(c);
+    esp_err_t res = nvs_get_blob(handle, "cache", &c, &len);
+    nvs_close(handle);
+    return res == ESP_OK && len == sizeof(c) && c.channel != 0;
+}
+
+static void save_fast_cache(const FastConnectCache& c) {
+    FastConnectCache old = {};
+    if (load_fast_cache(old) && memcmp(&old, &c, sizeof(c)) == 0) return; // No desgastar NVS
+    nvs_handle_t handle;
+    if (nvs_open("wifi_fast", NVS_READWRITE, &handle) != ESP_OK) return;
+    nvs_set_blob(handle, "cache", &c, sizeof(c));
+    nvs_commit(handle);
+    nvs_close(handle);
+}
+
+static bool static_ip_enabled() {
+    nvs_handle_t handle;
+    uint8_t enabled = 0;
+    if (nvs_open("storage", NVS_READONLY, &handle) == ESP_OK) {
+        nvs_get_u8(handle, "wifi_static", &enabled);
+        nvs_close(handle);
+    }
+    return enabled != 0;
+}
+
+// Quita BSSID/canal fijos: el siguiente intento hace escaneo completo
+static void drop_fast_connect() {
+    if (!s_fast_connect) return;
+    s_fast_connect = false;
+    wifi_config_t conf;
+    if (esp_wifi_get_config(WIFI_IF_STA, &conf) == ESP_OK) {
+        conf.sta.bssid_set = false;
+        conf.sta.channel = 0;
+        conf.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+        esp_wifi_set_config(WIFI_IF_STA, &conf);
+    }
+    ESP_LOGW(TAG, "BSSID en caché no respondió, se usará escaneo completo");
+}
+
+// El lease en caché no sirvió (o la red cambió): vuelve el DHCP y se olvida la IP
+static void drop_static_lease() {
+    if (!s_static_lease) return;
+    s_static_lease = false;
+    if (s_sta_netif) esp_netif_dhcpc_start(s_sta_netif);
+    FastConnectCache c;
+    if (load_fast_cache(c) && c.ip) {
+        c.ip = c.gw = c.mask = 0;
+        save_fast_cache(c);
+    }
+    ESP_LOGW(TAG, "IP estática en caché descartada, se vuelve a DHCP");
+}
+
+static void retry_timer_cb(void* arg) {
+    esp_wifi_connect();
+}
+
 // Manejador de eventos de WiFi (Conexión, Desconexión e IP)
 static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
         s_connected = false;
-        if (s_retry_num < MAX_RETRIES) {
-            esp_wifi_connect();
-            s_retry_num++;
-            ESP_LOGW(TAG, "Reintentando conectar al AP... (%d/%d)", s_retry_num, MAX_RETRIES);
-        } else {
-            ESP_LOGE(TAG, "Fallo de conexión tras %d intentos. Solicitando portal...", MAX_RETRIES);
-            s_must_fallback = true;
+        drop_fast_connect();
+        drop_static_lease();
+        s_retry_num++;
+
+        // Backoff exponencial: 0.5 s, 1 s, 2 s ... hasta 30 s. Nunca se deja de reintentar.
+        uint32_t delay_ms = BACKOFF_BASE_MS << std::min(s_retry_num - 1, 6);
+        delay_ms = std::min<uint32_t>(delay_ms, BACKOFF_MAX_MS);
+        ESP_LOGW(TAG, "Desconectado. Reintento %d en %u ms", s_retry_num, (unsigned)delay_ms);
+        esp_timer_stop(s_retry_timer);
+        esp_timer_start_once(s_retry_timer, (uint64_t)delay_ms * 1000);
+
+        if (s_retry_num == FALLBACK_AFTER_RETRIES && !s_must_fallback) {
+            ESP_LOGE(TAG, "Fallo de conexión tras %d intentos. Levantando AP de respaldo...", s_retry_num);
+            WifiManager::start_ap();
         }
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
-        ESP_LOGI(TAG, "IP Obtenida: " IPSTR, IP2STR(&event->ip_info.ip));
+        ESP_LOGI(TAG, "IP Obtenida: " IPSTR " (intentos: %d)", IP2STR(&event->ip_info.ip), s_retry_num);
         s_retry_num = 0;
         s_connected = true;
-        s_must_fallback = false;
+
+        FastConnectCache c = {};
+        wifi_ap_record_t ap;
+        if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+            memcpy(c.bssid, ap.bssid, 6);
+            c.channel = ap.primary;
+            c.ip = event->ip_info.ip.addr;
+            c.gw = event->ip_info.gw.addr;
+            c.mask = event->ip_info.netmask.addr;
+            save_fast_cache(c);
+        }
+
+        // El AP de respaldo se retira si nadie lo está usando
+        wifi_sta_list_t sta_list;
+        if (s_must_fallback && esp_wifi_ap_get_sta_list(&sta_list) == ESP_OK && sta_list.num == 0) {
+            esp_wifi_set_mode(WIFI_MODE_STA);
+            s_must_fallback = false;
+            ESP_LOGI(TAG, "STA conectada, AP de respaldo detenido");
+        }
     }
 }
 
+static void sntp_sync_cb(struct timeval* tv) {
+    ESP_LOGI(TAG, "Reloj sincronizado por NTP (%lld)", (long long)tv->tv_sec);
+}
+
 void WifiManager::init() {
-    esp_err_t ret = nvs_flash_init();
-    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        ret = nvs_flash_init();
-    }
-    ESP_ERROR_CHECK(ret);
+    // NVS lo inicializa app_main antes del arranque: varias etapas lo leen en paralelo
     ESP_ERROR_CHECK(esp_netif_init());
+
+    // SNTP queda esperando red: sincroniza en cuanto la STA obtiene IP (y cada hora)
+    esp_sntp_config_t sntp_cfg = ESP_NETIF_SNTP_DEFAULT_CONFIG("pool.ntp.org");
+    sntp_cfg.sync_cb = sntp_sync_cb;
+    if (esp_netif_sntp_init(&sntp_cfg) != ESP_OK) ESP_LOGW(TAG, "No se pudo iniciar SNTP");
     // Se asume que el event loop ya existe o se crea aquí
     esp_err_t err = esp_event_loop_create_default();
     if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
         ESP_ERROR_CHECK(err);
     }
+
+    // Ambas interfaces se crean una sola vez: STA y AP pueden convivir (APSTA)
+    s_sta_netif = esp_netif_create_default_wifi_sta();
+    esp_netif_create_default_wifi_ap();
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+
+    esp_event_handler_instance_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &event_handler, NULL, NULL);
+    esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &event_handler, NULL, NULL);
+
+    esp_timer_create_args_t timer_args = {};
+    timer_args.callback = &retry_timer_cb;
+    timer_args.name = "wifi_retry";
+    esp_timer_create(&timer_args, &s_retry_timer);
+
+    s_scan_events = xEventGroupCreate();
+    esp_event_handler_instance_register(WIFI_EVENT, WIFI_EVENT_SCAN_DONE, &scan_done_handler, NULL, NULL);
 }
 
 bool WifiManager::is_connected() { return s_connected; }
 bool WifiManager::should_fallback() { return s_must_fallback; }
 
-// --- MÉTODO DE ESCANEO PROFESIONAL ---
-std::string WifiManager::scan_to_json() {
-    g_is_wifi_scanning = true; // Pausamos lecturas del ADS1115 en el loop principal
-    ESP_LOGI(TAG, "Iniciando escaneo en modo APSTA para estabilidad...");
+// --- ESCANEO ASÍNCRONO CON CACHÉ ---
+// El escaneo se lanza sin bloquear; WIFI_EVENT_SCAN_DONE llena la caché
+// (deduplicada por SSID y ordenada por RSSI). Dentro del TTL no se vuelve a escanear.
+
+static void scan_done_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
+    wifi_event_sta_scan_done_t* done = (wifi_event_sta_scan_done_t*)event_data;
+    if (done && done->status != 0) {
+        // Escaneo fallido o cancelado: se conserva la caché anterior
+        esp_wifi_clear_ap_list();
+        {
+            std::lock_guard<std::mutex> lock(s_scan_mutex);
+            s_scan_running = false;
+        }
+        xEventGroupSetBits(s_scan_events, SCAN_DONE_BIT);
+        ESP_LOGW(TAG, "Escaneo #%u fallido", (unsigned)s_scan_id);
+        if (s_scan_listener) s_scan_listener(s_scan_id, false);
+        return;
+    }
 
-    // 1. Cambiamos modo a APSTA (Permite escanear mientras el Portal sigue vivo)
-    esp_wifi_set_mode(WIFI_MODE_APSTA);
-    vTaskDelay(pdMS_TO_TICKS(100)); // Delay para estabilizar radio
+    uint16_t ap_count = 0;
+    esp_wifi_scan_get_ap_num(&ap_count);
+
+    std::vector<WifiManager::ScanEntry> found;
+    wifi_ap_record_t *ap_info = ap_count ? (wifi_ap_record_t *)malloc(sizeof(wifi_ap_record_t) * ap_count) : nullptr;
+    if (ap_info && esp_wifi_scan_get_ap_records(&ap_count, ap_info) == ESP_OK) {
+        found.reserve(ap_count);
+        for (int i = 0; i < ap_count; i++) {
+            const char* ssid = (const char*)ap_info[i].ssid;
+            if (ssid[0] == 0) continue; // Redes ocultas no sirven para el portal
+            auto it = std::find_if(found.begin(), found.end(),
+                                   [&](const WifiManager::ScanEntry& e) { return strcmp(e.ssid, ssid) == 0; });
+            if (it == found.end()) {
+                WifiManager::ScanEntry e = {};
+                strncpy(e.ssid, ssid, sizeof(e.ssid) - 1);
+                e.rssi = ap_info[i].rssi;
+                found.push_back(e);
+            } else if (ap_info[i].rssi > it->rssi) {
+                it->rssi = ap_info[i].rssi; // Mismo SSID en varios AP: nos quedamos con el mejor
+            }
+        }
+        std::sort(found.begin(), found.end(),
+                  [](const WifiManager::ScanEntry& a, const WifiManager::ScanEntry& b) { return a.rssi > b.rssi; });
+    } else {
+        esp_wifi_clear_ap_list(); // Libera la lista interna aunque no la leamos
+    }
+    free(ap_info);
+
+    WifiManager::store_scan(found);
+    ESP_LOGI(TAG, "Escaneo terminado: %d redes únicas", (int)found.size());
+}
+
+void WifiManager::store_scan(std::vector<ScanEntry>& entries) {
+    {
+        std::lock_guard<std::mutex> lock(s_scan_mutex);
+        s_scan_cache.swap(entries);
+        s_scan_time_us = esp_timer_get_time();
+        s_scan_done_id = s_scan_id;
+        s_scan_running = false;
+    }
+    if (s_scan_events) xEventGroupSetBits(s_scan_events, SCAN_DONE_BIT);
+    if (s_scan_listener) s_scan_listener(s_scan_done_id, true);
+}
+
+void WifiManager::set_scan_listener(ScanListener cb) {
+    s_scan_listener = cb;
+}
+
+uint32_t WifiManager::start_scan(bool force) {
+    std::lock_guard<std::mutex> lock(s_scan_mutex);
+    if (s_scan_running) return s_scan_id;
+
+    bool fresh = s_scan_done_id != 0 && (esp_timer_get_time() - s_scan_time_us) < SCAN_CACHE_TTL_US;
+    if (fresh && !force) return s_scan_done_id; // Repetir dentro del TTL es gratis
+
+    // En modo AP puro no se puede escanear: APSTA mantiene vivo el portal
+    wifi_mode_t mode;
+    if (esp_wifi_get_mode(&mode) == ESP_OK && mode == WIFI_MODE_AP) {
+        esp_wifi_set_mode(WIFI_MODE_APSTA);
+    }
 
     wifi_scan_config_t scan_config = {};
-    scan_config.show_hidden = true;
+    scan_config.show_hidden = false;
     scan_config.scan_type = WIFI_SCAN_TYPE_ACTIVE;
     scan_config.scan_time.active.min = 100;
     scan_config.scan_time.active.max = 200;
 
-    // 2. Iniciamos escaneo bloqueante (true) ahora que estamos en modo seguro
-    esp_err_t res = esp_wifi_scan_start(&scan_config, true);
-    
+    if (s_scan_events) xEventGroupClearBits(s_scan_events, SCAN_DONE_BIT);
+    esp_err_t res = esp_wifi_scan_start(&scan_config, false); // No bloqueante
     if (res != ESP_OK) {
         ESP_LOGE(TAG, "Fallo al iniciar escaneo: %s", esp_err_to_name(res));
-        g_is_wifi_scanning = false;
-        return "[]";
-    }
-
-    uint16_t ap_count = 0;
-    esp_wifi_scan_get_ap_num(&ap_count);
-    ESP_LOGI(TAG, "Redes encontradas: %d", ap_count);
-
-    if (ap_count == 0) {
-        g_is_wifi_scanning = false;
-        return "[]";
+        return s_scan_done_id;
     }
+    s_scan_running = true;
+    ESP_LOGI(TAG, "Escaneo #%u iniciado", (unsigned)(s_scan_id + 1));
+    return ++s_scan_id;
+}
 
-    // 3. Obtener registros usando PSRAM (Ideal para ESP32-S3)
-    wifi_ap_record_t *ap_info = (wifi_ap_record_t *)heap_caps_malloc(sizeof(wifi_ap_record_t) * ap_count, MALLOC_CAP_SPIRAM);
-    if (!ap_info) {
-        ESP_LOGE(TAG, "Error: Sin memoria PSRAM para escaneo");
-        g_is_wifi_scanning = false;
-        return "[]";
+bool WifiManager::wait_scan(uint32_t scan_id, TickType_t timeout) {
+    TickType_t t0 = xTaskGetTickCount();
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(s_scan_mutex);
+            if (s_scan_done_id >= scan_id) return true;
+            if (!s_scan_running) return false;
+        }
+        TickType_t waited = xTaskGetTickCount() - t0;
+        if (!s_scan_events || waited >= timeout) return false;
+        xEventGroupWaitBits(s_scan_events, SCAN_DONE_BIT, pdFALSE, pdFALSE, timeout - waited);
     }
+}
 
-    ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&ap_count, ap_info));
+uint32_t WifiManager::scan_result_id() {
+    std::lock_guard<std::mutex> lock(s_scan_mutex);
+    return s_scan_done_id;
+}
 
-    // 4. Construir el JSON
-    std::string json = "[";
-    for (int i = 0; i < ap_count; i++) {
-        json += "{\"s\":\"" + std::string((char*)ap_info[i].ssid) + "\",\"r\":" + std::to_string(ap_info[i].rssi) + "}";
-        if (i < ap_count - 1) json += ",";
+void WifiManager::scan_to_json(TextBuffer& out) {
+    std::lock_guard<std::mutex> lock(s_scan_mutex);
+    JsonWriter j(out);
+    j.begin_array();
+    for (const auto& e : s_scan_cache) {
+        j.begin_object().field("s", e.ssid).field("r", e.rssi).end_object();
     }
-    json += "]";
-
-    heap_caps_free(ap_info);
-    g_is_wifi_scanning = false; // Reanudamos ADS1115
-    return json;
+    j.end_array();
 }
 
-void WifiManager::save_and_reconnect(std::string ssid, std::string pass) {
+void WifiManager::save_and_reconnect(const char* ssid, const char* pass) {
     nvs_handle_t handle;
     if (nvs_open("storage", NVS_READWRITE, &handle) == ESP_OK) {
-        nvs_set_str(handle, "wifi_ssid", ssid.c_str());
-        nvs_set_str(handle, "wifi_pass", pass.c_str());
+        nvs_set_str(handle, "wifi_ssid", ssid);
+        nvs_set_str(handle, "wifi_pass", pass);
         nvs_commit(handle);
         nvs_close(handle);
         ESP_LOGI(TAG, "Credenciales guardadas en NVS (storage)");
     }
     ESP_LOGW(TAG, "Credenciales guardadas. Reiniciando en 3 segundos...");
-    // Damos tiempo al PortalWeb para terminar la petición HTTP
-    vTaskDelay(pdMS_TO_TICKS(3000));
-    esp_restart();
+    // El reinicio lo dispara un timer: el handler HTTP responde y el httpd sigue atendiendo
+    static esp_timer_handle_t s_restart_timer = nullptr;
+    if (!s_restart_timer) {
+        esp_timer_create_args_t args = {};
+        args.callback = [](void*) { esp_restart(); };
+        args.name = "wifi_restart";
+        if (esp_timer_create(&args, &s_restart_timer) != ESP_OK) {
+            esp_restart();
+            return;
+        }
+    }
+    esp_timer_stop(s_restart_timer); // Un segundo envío reinicia la cuenta
+    esp_timer_start_once(s_restart_timer, 3000 * 1000);
 }
 
 bool WifiManager::connect_saved() {
@@ -144,22 +364,40 @@ bool WifiManager::connect_saved() {
         return false;
     }
 
-    ESP_LOGI(TAG, "Conectando a red guardada: %s", ssid);
-
-    esp_netif_create_default_wifi_sta();
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    esp_wifi_init(&cfg);
-
-    esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL, NULL);
-    esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &event_handler, NULL, NULL);
-
     wifi_config_t wifi_config = {};
     strncpy((char*)wifi_config.sta.ssid, ssid, 32);
     strncpy((char*)wifi_config.sta.password, pass, 64);
 
-    esp_wifi_set_mode(WIFI_MODE_STA);
+    // Reconexión rápida: BSSID y canal conocidos saltan el escaneo de todos los canales
+    FastConnectCache cache;
+    bool have_cache = load_fast_cache(cache);
+    if (have_cache) {
+        memcpy(wifi_config.sta.bssid, cache.bssid, 6);
+        wifi_config.sta.bssid_set = true;
+        wifi_config.sta.channel = cache.channel;
+        wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+        s_fast_connect = true;
+    }
+
+    // IP estática opcional con el último lease: evita esperar al DHCP
+    if (have_cache && cache.ip && static_ip_enabled() && s_sta_netif) {
+        esp_netif_ip_info_t ip = {};
+        ip.ip.addr = cache.ip;
+        ip.gw.addr = cache.gw;
+        ip.netmask.addr = cache.mask;
+        esp_netif_dhcpc_stop(s_sta_netif);
+        esp_netif_set_ip_info(s_sta_netif, &ip);
+        s_static_lease = true;  // Hasta la primera desconexión: ahí vuelve el DHCP
+    }
+
+    ESP_LOGI(TAG, "Conectando a red guardada: %s (%s)", ssid, have_cache ? "rápida" : "escaneo completo");
+
+    esp_wifi_set_mode(s_must_fallback ? WIFI_MODE_APSTA : WIFI_MODE_STA);
     esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
-    esp_wifi_start();
+    if (!s_wifi_started) {
+        esp_wifi_start();
+        s_wifi_started = true;
+    }
     esp_wifi_set_ps(WIFI_PS_NONE);
     esp_wifi_connect();
     
@@ -168,9 +406,6 @@ bool WifiManager::connect_saved() {
 
 void WifiManager::start_ap() {
     ESP_LOGI(TAG, "Iniciando SoftAP de configuracion...");
-    esp_netif_create_default_wifi_ap();
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    esp_wifi_init(&cfg);
 
     wifi_config_t ap_config = {};
     strcpy((char*)ap_config.ap.ssid, "Volta Energy Charger");
@@ -178,9 +413,18 @@ void WifiManager::start_ap() {
     ap_config.ap.max_connection = 4;
     ap_config.ap.authmode = WIFI_AUTH_OPEN;
 
-    esp_wifi_set_mode(WIFI_MODE_AP);
+    // Si la STA ya está configurada seguimos reintentando en paralelo (APSTA)
+    wifi_mode_t mode = WIFI_MODE_NULL;
+    esp_wifi_get_mode(&mode);
+    bool sta_active = s_wifi_started && (mode == WIFI_MODE_STA || mode == WIFI_MODE_APSTA);
+
+    esp_wifi_set_mode(sta_active ? WIFI_MODE_APSTA : WIFI_MODE_AP);
     esp_wifi_set_config(WIFI_IF_AP, &ap_config);
-    esp_wifi_start();
+    if (!s_wifi_started) {
+        esp_wifi_start();
+        s_wifi_started = true;
+    }
+    s_must_fallback = true;
     ESP_LOGI(TAG, "Portal AP listo en 192.168.4.1");
 }
 
@@ -1,24 +1,38 @@
 #pragma once
 #include <string>
 #include <vector>
+#include "TextBuffer.hpp"
 #include "esp_wifi.h"
 #include "esp_netif.h"
 #include "nvs_flash.h"
-
-extern volatile bool g_is_wifi_scanning;
+#include "freertos/FreeRTOS.h"
 
 class WifiManager {
 public:
     static void init();
     static bool connect_saved();
     static void start_ap();
-    static std::string scan_to_json();
-    static void save_and_reconnect(std::string ssid, std::string pass);
+
+    // Escaneo no bloqueante: devuelve el id del escaneo (o el de la caché si sigue vigente)
+    struct ScanEntry {
+        char ssid[33];
+        int8_t rssi;
+    };
+    static uint32_t start_scan(bool force = false);
+    static bool wait_scan(uint32_t scan_id, TickType_t timeout);
+    static uint32_t scan_result_id();
+    static void scan_to_json(TextBuffer& out);   // Resultado en caché (deduplicado, por RSSI)
+    static void store_scan(std::vector<ScanEntry>& entries);
+    // Aviso al terminar cada escaneo (ok o fallido); corre en la tarea de eventos
+    using ScanListener = void (*)(uint32_t scan_id, bool ok);
+    static void set_scan_listener(ScanListener cb);
+    // Guarda en NVS y programa el reinicio; vuelve enseguida para que el handler responda
+    static void save_and_reconnect(const char* ssid, const char* pass);
     static void save_last_time(long timestamp);
     static long get_last_time();
 
     static bool is_connected();
-    static bool should_fallback();
+    static bool should_fallback();   // true mientras el AP de respaldo está activo
     
     // --- NUEVOS MÉTODOS PARA EL LOGGER ---
     static std::string get_ssid();
@@ -0,0 +1,488 @@
+#!/usr/bin/env python3
+"""Generador de carga para el portal del rectificador (HTTP + WebSocket).
+
+Reproduce una mezcla de tráfico de tablero contra el equipo (o un sustituto
+local) y arma un informe de capacidad para comparar entre versiones:
+
+  - latencia p50/p90/p99 y caudal por ruta, medidos del lado del cliente;
+  - ida y vuelta de comandos por WebSocket ("id:stats" -> {"type":"cmd","id":..});
+  - jitter del tick de carga (charge_tick_jitter_us) y contadores de sesiones
+    y workers leídos de /metrics antes y después;
+  - el texto de load.report del propio equipo.
+
+Con --ramp se simulan decenas de clientes a la vez: cada escalón (p. ej.
+8,16,32,48) corre con esa cantidad de conexiones keep-alive concurrentes,
+más --idle sockets abiertos sin pedir nada (pestañas olvidadas), y la tabla
+final muestra si la latencia se mantiene estable al crecer la concurrencia
+junto con los rechazos y reciclados de HttpSessions en cada escalón.
+
+Antes de cargar se envía load.reset para que los histogramas del equipo
+cubran solo esta corrida. Solo usa la biblioteca estándar.
+
+Ejemplos:
+  python3 tools/portal_load.py --host 192.168.4.1 --clients 6 --ws 4 \\
+      --duration 60 --json capacidad-v1.4.json
+  python3 tools/portal_load.py --host 192.168.4.1 --ramp 4,8,16,32,48 \\
+      --idle 8 --step 20 --json conexiones-v1.4.json
+"""
+
+import argparse
+import base64
+import json
+import os
+import random
+import re
+import socket
+import struct
+import sys
+import threading
+import time
+import http.client
+
+# Mezcla por defecto: peso relativo de cada petición de un cliente HTTP
+DEFAULT_MIX = "root=40,metrics=15,cmd=25,scan=10,logs=5,series=5"
+
+ROUTES = {
+    "root":    ("GET", "/", None),
+    "metrics": ("GET", "/metrics", None),
+    "cmd":     ("POST", "/api/cmd", b"stats"),
+    "scan":    ("GET", "/scan?async=1", None),
+    "logs":    ("GET", "/get-logs", None),
+    "series":  ("GET", "/api/series?max=60", None),
+}
+
+
+def percentile(sorted_ms, q):
+    if not sorted_ms:
+        return 0.0
+    k = min(len(sorted_ms) - 1, max(0, int(round(q * (len(sorted_ms) - 1)))))
+    return sorted_ms[k]
+
+
+class Stats:
+    """Latencias y códigos por ruta, compartidas entre hilos."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.lat = {}
+        self.codes = {}
+        self.errors = {}
+
+    def record(self, route, ms, code):
+        with self.lock:
+            self.lat.setdefault(route, []).append(ms)
+            key = str(code)
+            self.codes.setdefault(route, {}).setdefault(key, 0)
+            self.codes[route][key] += 1
+
+    def error(self, route, what):
+        with self.lock:
+            self.errors.setdefault(route, {}).setdefault(what, 0)
+            self.errors[route][what] += 1
+
+    def summary(self, elapsed_s):
+        out = {}
+        with self.lock:
+            for route in sorted(set(self.lat) | set(self.errors)):
+                ms = sorted(self.lat.get(route, []))
+                out[route] = {
+                    "n": len(ms),
+                    "rps": round(len(ms) / elapsed_s, 2) if elapsed_s else 0.0,
+                    "p50_ms": round(percentile(ms, 0.50), 1),
+                    "p90_ms": round(percentile(ms, 0.90), 1),
+                    "p99_ms": round(percentile(ms, 0.99), 1),
+                    "max_ms": round(ms[-1], 1) if ms else 0.0,
+                    "codes": self.codes.get(route, {}),
+                    "errors": self.errors.get(route, {}),
+                }
+        return out
+
+    def merged(self, skip=("ws",)):
+        """Latencias de todas las rutas HTTP juntas, ordenadas."""
+        with self.lock:
+            ms = [v for route, lat in self.lat.items() if route not in skip for v in lat]
+            errors = sum(n for route, e in self.errors.items() if route not in skip for n in e.values())
+        return sorted(ms), errors
+
+
+def http_request(host, port, method, path, body=None, timeout=10.0, conn=None):
+    """Una petición; reutiliza conn (keep-alive) si se pasa. Devuelve (código, cuerpo, conn)."""
+    if conn is None:
+        conn = http.client.HTTPConnection(host, port, timeout=timeout)
+    headers = {"Content-Type": "text/plain"} if body is not None else {}
+    conn.request(method, path, body=body, headers=headers)
+    resp = conn.getresponse()
+    data = resp.read()
+    if resp.getheader("Connection", "").lower() == "close":
+        conn.close()
+        conn = None
+    return resp.status, data, conn
+
+
+def run_cmd(host, port, cmd, timeout=10.0):
+    code, data, conn = http_request(host, port, "POST", "/api/cmd", cmd.encode(), timeout)
+    if conn:
+        conn.close()
+    if code != 200:
+        raise RuntimeError("%s -> HTTP %d" % (cmd, code))
+    return json.loads(data.decode("utf-8", "replace")).get("resp", "")
+
+
+METRIC_RE = re.compile(r'^([A-Za-z_][A-Za-z0-9_]*)(\{[^}]*\})?\s+(-?\d+(?:\.\d+)?)$')
+
+
+def read_metrics(host, port):
+    code, data, conn = http_request(host, port, "GET", "/metrics")
+    if conn:
+        conn.close()
+    metrics = {}
+    for line in data.decode("utf-8", "replace").splitlines():
+        m = METRIC_RE.match(line.strip())
+        if m:
+            metrics[m.group(1) + (m.group(2) or "")] = float(m.group(3))
+    return metrics
+
+
+def http_client(args, mix, stats, stop, rng):
+    """Cliente de tablero: elige rutas según la mezcla, con pausa de pensar."""
+    conn = None
+    names = [n for n, _ in mix]
+    weights = [w for _, w in mix]
+    while not stop.is_set():
+        route = rng.choices(names, weights)[0]
+        method, path, body = ROUTES[route]
+        t0 = time.monotonic()
+        try:
+            code, _, conn = http_request(args.host, args.port, method, path, body, args.timeout, conn)
+            stats.record(route, (time.monotonic() - t0) * 1000.0, code)
+        except (OSError, http.client.HTTPException) as e:
+            stats.error(route, type(e).__name__)
+            if conn:
+                conn.close()
+            conn = None
+        if not args.keepalive and conn:
+            conn.close()
+            conn = None
+        if args.think_ms:
+            stop.wait(rng.uniform(0.5, 1.5) * args.think_ms / 1000.0)
+    if conn:
+        conn.close()
+
+
+class WsClient:
+    """Cliente WebSocket mínimo (texto, sin extensiones) sobre un socket."""
+
+    def __init__(self, host, port, path="/ws", timeout=10.0):
+        self.sock = socket.create_connection((host, port), timeout=timeout)
+        key = base64.b64encode(os.urandom(16)).decode()
+        req = ("GET %s HTTP/1.1\r\nHost: %s:%d\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+               "Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n\r\n") % (path, host, port, key)
+        self.sock.sendall(req.encode())
+        head = b""
+        while b"\r\n\r\n" not in head:
+            chunk = self.sock.recv(1024)
+            if not chunk:
+                raise ConnectionError("handshake cortado")
+            head += chunk
+        status = head.split(b"\r\n", 1)[0]
+        if b" 101 " not in status + b" ":
+            raise ConnectionError(status.decode("latin-1"))
+        self.buf = head.split(b"\r\n\r\n", 1)[1]
+
+    def send_text(self, text):
+        payload = text.encode()
+        mask = os.urandom(4)
+        n = len(payload)
+        if n < 126:
+            hdr = struct.pack("!BB", 0x81, 0x80 | n)
+        else:
+            hdr = struct.pack("!BBH", 0x81, 0x80 | 126, n)
+        masked = bytes(b ^ mask[i % 4] for i, b in enumerate(payload))
+        self.sock.sendall(hdr + mask + masked)
+
+    def _read(self, n):
+        while len(self.buf) < n:
+            chunk = self.sock.recv(4096)
+            if not chunk:
+                raise ConnectionError("WebSocket cerrado")
+            self.buf += chunk
+        out, self.buf = self.buf[:n], self.buf[n:]
+        return out
+
+    def recv_text(self):
+        """Un mensaje completo (junta fragmentos); None si llega un cierre."""
+        parts = []
+        while True:
+            b0, b1 = self._read(2)
+            n = b1 & 0x7F
+            if n == 126:
+                n = struct.unpack("!H", self._read(2))[0]
+            elif n == 127:
+                n = struct.unpack("!Q", self._read(8))[0]
+            data = self._read(n)
+            opcode = b0 & 0x0F
+            if opcode == 0x8:
+                return None
+            if opcode in (0x9, 0xA):
+                continue
+            parts.append(data)
+            if b0 & 0x80:
+                return b"".join(parts).decode("utf-8", "replace")
+
+    def close(self):
+        try:
+            self.sock.close()
+        except OSError:
+            pass
+
+
+def ws_client(args, stats, stop, index):
+    """Suscriptor del tablero: mantiene el WS y manda un comando cada ws_period_ms."""
+    try:
+        ws = WsClient(args.host, args.port, timeout=args.timeout)
+    except (OSError, ConnectionError) as e:
+        stats.error("ws", "conexión: %s" % e)
+        return
+    next_id = index * 1000000 + 1
+    try:
+        while not stop.is_set():
+            cmd_id = next_id
+            next_id += 1
+            t0 = time.monotonic()
+            ws.send_text("%d:stats" % cmd_id)
+            # Puede haber avisos intercalados ({"type":"scan"}, telemetría): se esperan el id propio
+            while True:
+                msg = ws.recv_text()
+                if msg is None:
+                    raise ConnectionError("cierre del servidor")
+                try:
+                    obj = json.loads(msg)
+                except ValueError:
+                    continue
+                if obj.get("type") == "cmd" and obj.get("id") == cmd_id:
+                    break
+            stats.record("ws", (time.monotonic() - t0) * 1000.0, "ok")
+            stop.wait(args.ws_period_ms / 1000.0)
+    except (OSError, ConnectionError) as e:
+        stats.error("ws", type(e).__name__)
+    finally:
+        ws.close()
+
+
+def idle_client(args, stop, closed):
+    """Conexión abierta que no pide nada: cuenta si el servidor la cierra antes del final."""
+    try:
+        sock = socket.create_connection((args.host, args.port), timeout=args.timeout)
+    except OSError:
+        closed.append("refused")
+        return
+    sock.settimeout(0.5)
+    try:
+        while not stop.is_set():
+            try:
+                if not sock.recv(1):
+                    closed.append("reaped")
+                    return
+            except socket.timeout:
+                continue
+    except OSError:
+        closed.append("reset")
+    finally:
+        sock.close()
+
+
+def parse_mix(text):
+    mix = []
+    for item in text.split(","):
+        name, _, weight = item.partition("=")
+        name = name.strip()
+        if name not in ROUTES:
+            raise SystemExit("Ruta desconocida en --mix: %s (opciones: %s)" % (name, ", ".join(ROUTES)))
+        mix.append((name, float(weight or 1)))
+    return mix
+
+
+def device_snapshot(args, label):
+    try:
+        return read_metrics(args.host, args.port)
+    except (OSError, http.client.HTTPException) as e:
+        print("AVISO: /metrics %s no disponible: %s" % (label, e), file=sys.stderr)
+        return {}
+
+
+def jitter_of(metrics, name="charge_tick_jitter_us"):
+    keys = {"p50": '{q="0.5"}', "p90": '{q="0.9"}', "p99": '{q="0.99"}', "max": "_max{}", "n": "_count{}"}
+    out = {}
+    for k, suffix in keys.items():
+        if name + suffix in metrics:
+            out[k] = int(metrics[name + suffix])
+    return out
+
+
+def delta(before, after, prefixes):
+    return {k: int(after[k] - before.get(k, 0)) for k in sorted(after)
+            if any(k.startswith(p) for p in prefixes) and "{" not in k}
+
+
+def run_load(args, clients, ws_clients, duration_s, idle=0, closed=None):
+    """Una corrida: devuelve las estadísticas y los segundos efectivos."""
+    stats = Stats()
+    stop = threading.Event()
+    mix = parse_mix(args.mix)
+    rng_seed = random.Random(args.seed)
+    threads = []
+    for i in range(clients):
+        rng = random.Random(rng_seed.random())
+        threads.append(threading.Thread(target=http_client, args=(args, mix, stats, stop, rng), daemon=True))
+    for i in range(ws_clients):
+        threads.append(threading.Thread(target=ws_client, args=(args, stats, stop, i + 1), daemon=True))
+    for i in range(idle):
+        threads.append(threading.Thread(target=idle_client, args=(args, stop, closed), daemon=True))
+    t0 = time.monotonic()
+    for t in threads:
+        t.start()
+    stop.wait(duration_s)
+    stop.set()
+    for t in threads:
+        t.join(args.timeout + 1)
+    return stats, time.monotonic() - t0
+
+
+def print_routes(summary):
+    print("%-8s %7s %7s %8s %8s %8s %8s  códigos / errores" % ("ruta", "n", "req/s", "p50 ms", "p90 ms",
+                                                             "p99 ms", "max ms"))
+    for route, s in summary.items():
+        extra = " ".join("%s:%d" % kv for kv in sorted(s["codes"].items()))
+        if s["errors"]:
+            extra += " | " + " ".join("%s:%d" % kv for kv in sorted(s["errors"].items()))
+        print("%-8s %7d %7.2f %8.1f %8.1f %8.1f %8.1f  %s" % (route, s["n"], s["rps"], s["p50_ms"], s["p90_ms"],
+                                                              s["p99_ms"], s["max_ms"], extra))
+
+
+def reset_device(args):
+    if not args.reset:
+        return
+    try:
+        run_cmd(args.host, args.port, "load.reset", args.timeout)
+    except (OSError, RuntimeError, ValueError, http.client.HTTPException) as e:
+        print("AVISO: load.reset falló: %s" % e, file=sys.stderr)
+
+
+def run_ramp(args):
+    """Escalones de concurrencia: latencia HTTP global y contadores del equipo en cada uno."""
+    levels = [int(x) for x in args.ramp.split(",") if x.strip()]
+    print("Rampa %s conexiones (+%d inactivas, %d WS), %.0f s por escalón contra %s:%d" % (
+        ",".join(map(str, levels)), args.idle, args.ws, args.step, args.host, args.port))
+    print("%6s %7s %7s %8s %8s %8s %6s %7s %7s %7s %9s" % ("conex", "n", "req/s", "p50 ms", "p99 ms", "max ms",
+                                                           "error", "rechaz", "recicl", "barrid", "tick p99"))
+    steps = []
+    for level in levels:
+        reset_device(args)
+        before = device_snapshot(args, "inicial")
+        closed = []
+        stats, elapsed = run_load(args, level, args.ws, args.step, args.idle, closed)
+        after = device_snapshot(args, "final")
+        ms, errors = stats.merged()
+        counters = delta(before, after, ("http_sessions_", "http_ws_"))
+        step = {
+            "connections": level,
+            "n": len(ms),
+            "rps": round(len(ms) / elapsed, 2) if elapsed else 0.0,
+            "p50_ms": round(percentile(ms, 0.50), 1),
+            "p99_ms": round(percentile(ms, 0.99), 1),
+            "max_ms": round(ms[-1], 1) if ms else 0.0,
+            "errors": errors,
+            "idle_closed": {k: closed.count(k) for k in set(closed)},
+            "ws": stats.summary(elapsed).get("ws", {}),
+            "device_counters": counters,
+            "charge_tick_jitter_us": jitter_of(after),
+        }
+        steps.append(step)
+        print("%6d %7d %7.2f %8.1f %8.1f %8.1f %6d %7d %7d %7d %9s" % (
+            level, step["n"], step["rps"], step["p50_ms"], step["p99_ms"], step["max_ms"], errors,
+            counters.get("http_sessions_refused", 0), counters.get("http_sessions_recycled", 0),
+            counters.get("http_sessions_reaped", 0), step["charge_tick_jitter_us"].get("p99", "-")))
+
+    # Estable: el p99 del escalón más alto comparado con el del primero
+    ratio = steps[-1]["p99_ms"] / steps[0]["p99_ms"] if steps and steps[0]["p99_ms"] else 0.0
+    print("p99 a %d conexiones = %.1fx el de %d" % (levels[-1], ratio, levels[0]) if steps else "")
+    return {"ramp": steps, "p99_growth": round(ratio, 2)}
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    ap.add_argument("--host", default="192.168.4.1")
+    ap.add_argument("--port", type=int, default=80)
+    ap.add_argument("--clients", type=int, default=4, help="clientes HTTP concurrentes")
+    ap.add_argument("--ws", type=int, default=2, help="suscriptores WebSocket")
+    ap.add_argument("--duration", type=float, default=30.0, help="segundos de carga")
+    ap.add_argument("--mix", default=DEFAULT_MIX, help="pesos por ruta, p. ej. root=40,cmd=25,logs=5")
+    ap.add_argument("--think-ms", type=float, default=250.0, help="pausa media entre peticiones de un cliente")
+    ap.add_argument("--ws-period-ms", type=float, default=1000.0, help="un comando WS cada tanto por suscriptor")
+    ap.add_argument("--no-keepalive", dest="keepalive", action="store_false", help="una conexión por petición")
+    ap.add_argument("--timeout", type=float, default=10.0)
+    ap.add_argument("--seed", type=int, default=1, help="semilla de la mezcla (corridas reproducibles)")
+    ap.add_argument("--no-reset", dest="reset", action="store_false", help="no enviar load.reset antes")
+    ap.add_argument("--ramp", help="escalones de conexiones concurrentes, p. ej. 8,16,32,48")
+    ap.add_argument("--step", type=float, default=20.0, help="segundos por escalón de la rampa")
+    ap.add_argument("--idle", type=int, default=0, help="conexiones abiertas sin peticiones (rampa)")
+    ap.add_argument("--json", help="guardar el informe en este archivo")
+    args = ap.parse_args()
+
+    if args.ramp:
+        report = {"time": time.strftime("%Y-%m-%dT%H:%M:%S"), "target": "%s:%d" % (args.host, args.port),
+                  "load": {"ws": args.ws, "idle": args.idle, "step_s": args.step, "mix": args.mix,
+                           "think_ms": args.think_ms, "keepalive": args.keepalive, "seed": args.seed}}
+        report.update(run_ramp(args))
+        if args.json:
+            with open(args.json, "w") as f:
+                json.dump(report, f, indent=2, ensure_ascii=False)
+            print("Informe guardado en %s" % args.json)
+        return
+
+    reset_device(args)
+    before = device_snapshot(args, "inicial")
+
+    print("Carga: %d HTTP + %d WS durante %.0f s contra %s:%d" % (args.clients, args.ws, args.duration,
+                                                                args.host, args.port))
+    stats, elapsed = run_load(args, args.clients, args.ws, args.duration)
+    summary = stats.summary(elapsed)
+
+    after = device_snapshot(args, "final")
+    try:
+        device_report = run_cmd(args.host, args.port, "load.report", args.timeout)
+    except (OSError, RuntimeError, ValueError, http.client.HTTPException) as e:
+        device_report = "(load.report no disponible: %s)" % e
+
+    total = sum(s["n"] for s in summary.values())
+    print()
+    print_routes(summary)
+    print("Total %d respuestas en %.1f s (%.2f/s)" % (total, elapsed, total / elapsed if elapsed else 0))
+    jitter = jitter_of(after)
+    if jitter:
+        print("Tick de carga: desvío p50 %s | p99 %s | max %s us (n=%s)" % (jitter.get("p50"), jitter.get("p99"),
+                                                                         jitter.get("max"), jitter.get("n")))
+    print()
+    print(device_report)
+
+    report = {
+        "time": time.strftime("%Y-%m-%dT%H:%M:%S"),
+        "target": "%s:%d" % (args.host, args.port),
+        "firmware": device_report.split("|")[0].replace("--- CAPACIDAD", "").strip() if device_report else "",
+        "load": {"clients": args.clients, "ws": args.ws, "duration_s": args.duration, "mix": args.mix,
+                 "think_ms": args.think_ms, "keepalive": args.keepalive, "seed": args.seed},
+        "routes": summary,
+        "charge_tick_jitter_us": jitter,
+        "charge_tick_jitter_loaded_us": jitter_of(after, "charge_tick_jitter_loaded_us"),
+        "device_counters": delta(before, after, ("http_sessions_", "http_workers_", "http_ws_")),
+        "heap_min_free": int(after.get("heap_min_free", 0)),
+        "device_report": device_report,
+    }
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(report, f, indent=2, ensure_ascii=False)
+        print("Informe guardado en %s" % args.json)
+
+
+if __name__ == "__main__":
+    main()